@@ -0,0 +1,172 @@
+/// \file
+/// \brief compare the terminal and headless backends on tall and wide files
+///
+/// Usage: bench_backend [lines [columns]]
+///
+/// Two C source files are generated: a tall one of the given number of short
+/// lines (default 20000), and a wide one of 50 comments of the given number of
+/// columns (default 8000). Each is rendered with `vimcat_read` using each
+/// backend. The headless result is checked against the terminal result, except
+/// for lines beyond the 10000 columns Vim will draw in a terminal.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vimcat/vimcat.h>
+
+/// summary of a rendered file, for comparing one render to another
+typedef struct {
+  uint64_t hash;
+  size_t lines;
+} digest_t;
+
+static int accumulate(void *state, char *line) {
+  digest_t *d = state;
+
+  // FNV-1a
+  for (const char *p = line; *p != '\0'; ++p) {
+    d->hash ^= (uint8_t)*p;
+    d->hash *= UINT64_C(0x100000001b3);
+  }
+  d->hash ^= '\n';
+  d->hash *= UINT64_C(0x100000001b3);
+  ++d->lines;
+
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// write some source with a mix of syntax groups in short lines
+static void write_tall(FILE *f, unsigned long lines, unsigned long columns) {
+  (void)columns;
+  for (unsigned long i = 0; i < lines; ++i) {
+    switch (i % 3) {
+    case 0:
+      fprintf(f, "/* comment %lu */\n", i);
+      break;
+    case 1:
+      fprintf(f, "static int x%lu = %lu;\n", i, i);
+      break;
+    default:
+      fprintf(f, "static const char *s%lu = \"string %lu\";\n", i, i);
+      break;
+    }
+  }
+}
+
+/// write a few lines, each a long comment
+///
+/// Comments begin in the first column, as text that opens a syntax region
+/// beyond 'synmaxcol' is highlighted differently by each backend.
+static void write_wide(FILE *f, unsigned long lines, unsigned long columns) {
+  (void)lines;
+  for (unsigned long i = 0; i < 50; ++i) {
+    fputs(i % 2 == 0 ? "//" : "/*", f);
+    for (unsigned long j = 0; j < columns; ++j)
+      fputc(j % 8 == 0 ? ' ' : 'a' + (int)(j % 26), f);
+    fputs(i % 2 == 0 ? "\n" : " */\n", f);
+  }
+}
+
+/// render a file with the given backend
+static int render(const char *path, vimcat_backend_t backend, digest_t *d,
+                  double *elapsed) {
+  int rc = vimcat_set_backend(backend);
+  if (rc != 0)
+    return rc;
+  *d = (digest_t){.hash = UINT64_C(0xcbf29ce484222325)};
+  const double start = now();
+  rc = vimcat_read(path, accumulate, d);
+  *elapsed = now() - start;
+  return rc;
+}
+
+int main(int argc, char **argv) {
+
+  unsigned long lines = 20000;
+  if (argc > 1)
+    lines = strtoul(argv[1], NULL, 10);
+
+  unsigned long columns = 8000;
+  if (argc > 2)
+    columns = strtoul(argv[2], NULL, 10);
+
+  if (!vimcat_have_vim()) {
+    fprintf(stderr, "vim not found\n");
+    return EXIT_FAILURE;
+  }
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  static const struct {
+    const char *name;
+    void (*write)(FILE *f, unsigned long lines, unsigned long columns);
+  } SAMPLES[] = {{"tall", write_tall}, {"wide", write_wide}};
+
+  int rc = EXIT_SUCCESS;
+
+  printf("%-10s %10s %10s %10s\n", "file", "terminal", "headless", "speedup");
+
+  for (size_t i = 0; i < sizeof(SAMPLES) / sizeof(SAMPLES[0]); ++i) {
+    char path[4096];
+    (void)snprintf(path, sizeof(path), "%s/bench_backend.XXXXXX.c", TMPDIR);
+    const int fd = mkstemps(path, strlen(".c"));
+    if (fd < 0) {
+      fprintf(stderr, "mkstemps failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    FILE *f = fdopen(fd, "w");
+    if (f == NULL) {
+      fprintf(stderr, "fdopen failed: %s\n", strerror(errno));
+      (void)close(fd);
+      (void)unlink(path);
+      return EXIT_FAILURE;
+    }
+    SAMPLES[i].write(f, lines, columns);
+    (void)fclose(f);
+
+    digest_t terminal = {0};
+    double terminal_time = 0;
+    int r = render(path, VIMCAT_BACKEND_TERMINAL, &terminal, &terminal_time);
+    if (r != 0) {
+      fprintf(stderr, "terminal render failed: %s\n", strerror(r));
+      (void)unlink(path);
+      return EXIT_FAILURE;
+    }
+
+    digest_t headless = {0};
+    double headless_time = 0;
+    r = render(path, VIMCAT_BACKEND_HEADLESS, &headless, &headless_time);
+    (void)unlink(path);
+    if (r != 0) {
+      fprintf(stderr, "headless render failed: %s\n", strerror(r));
+      return EXIT_FAILURE;
+    }
+
+    const bool truncated = columns > 10000 && SAMPLES[i].write == write_wide;
+    if (headless.lines != terminal.lines ||
+        (!truncated && headless.hash != terminal.hash)) {
+      fprintf(stderr, "%s file rendered differently by each backend\n",
+              SAMPLES[i].name);
+      rc = EXIT_FAILURE;
+    }
+
+    printf("%-10s %10.3f %10.3f %10.2f\n", SAMPLES[i].name, terminal_time,
+           headless_time, terminal_time / headless_time);
+  }
+
+  return rc;
+}
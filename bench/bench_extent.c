@@ -0,0 +1,197 @@
+/// \file
+/// \brief measure the throughput of text extent scanning
+///
+/// Usage: bench_extent [megabytes]
+///
+/// Source-like text of the given size (default 256MB) is generated and then
+/// measured by each available implementation of `extent_feed`, by
+/// `get_extent`, and by the byte-at-a-time `getc` algorithm it replaced.
+
+#include "extent.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// the original, byte-at-a-time, measurement algorithm
+static void baseline(FILE *f, size_t *rows, size_t *columns) {
+
+  size_t lines = 1;
+  size_t width = 0;
+  size_t max_width = 0;
+  int last = EOF;
+
+  while (true) {
+    int c = getc(f);
+    if (c == EOF)
+      break;
+    last = c;
+
+    if (c == '\n') {
+      ++lines;
+      if (max_width < width)
+        max_width = width;
+      width = 0;
+      continue;
+    }
+
+    if (c == '\r') {
+      int n = getc(f);
+      if (n == '\n') {
+        ++lines;
+        if (max_width < width)
+          max_width = width;
+        width = 0;
+        continue;
+      }
+      if (n != EOF)
+        (void)ungetc(n, f);
+    }
+
+    if (c == '\t') {
+      width += 8;
+      continue;
+    }
+
+    ++width;
+  }
+
+  if (max_width < width)
+    max_width = width;
+  if (last == '\n')
+    --lines;
+
+  *rows = lines;
+  *columns = max_width;
+}
+
+static void report(const char *name, double seconds, size_t size, size_t rows,
+                   size_t columns) {
+  printf("%-16s %10.3f %10.1f %12zu %8zu\n", name, seconds,
+         (double)size / seconds / 1e6, rows, columns);
+}
+
+int main(int argc, char **argv) {
+
+  size_t megabytes = 256;
+  if (argc > 1)
+    megabytes = strtoul(argv[1], NULL, 10);
+  const size_t size = megabytes * 1000 * 1000;
+
+  char *text = malloc(size);
+  if (text == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  // generate lines of varying length, with some indentation
+  {
+    static const char *const LINES[] = {
+        "\tif (x == NULL) {\n",
+        "\t\treturn EINVAL;\n",
+        "\t}\n",
+        "\n",
+        "  // a comment of moderate length that spans a good part of a line\n",
+        "int foo(const char *bar, size_t baz, struct qux *quux);\r\n",
+    };
+    size_t offset = 0;
+    for (size_t i = 0; offset < size; ++i) {
+      const char *line = LINES[i % (sizeof(LINES) / sizeof(LINES[0]))];
+      const size_t length = strlen(line);
+      const size_t n = size - offset < length ? size - offset : length;
+      memcpy(&text[offset], line, n);
+      offset += n;
+    }
+  }
+
+  // write it to a file
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+  char path[4096];
+  (void)snprintf(path, sizeof(path), "%s/bench_extent.XXXXXX", TMPDIR);
+  {
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+      fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+      free(text);
+      return EXIT_FAILURE;
+    }
+    for (size_t offset = 0; offset < size;) {
+      const ssize_t w = write(fd, &text[offset], size - offset);
+      if (w < 0) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        (void)close(fd);
+        (void)unlink(path);
+        free(text);
+        return EXIT_FAILURE;
+      }
+      offset += (size_t)w;
+    }
+    (void)close(fd);
+  }
+
+  printf("%zuMB\n", megabytes);
+  printf("%-16s %10s %10s %12s %8s\n", "implementation", "seconds", "MB/s",
+         "rows", "columns");
+
+  // the original algorithm, reading from a file
+  {
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+      size_t rows = 0;
+      size_t columns = 0;
+      const double start = now();
+      baseline(f, &rows, &columns);
+      report("getc (file)", now() - start, size, rows, columns);
+      (void)fclose(f);
+    }
+  }
+
+  // the current algorithm, reading from a file
+  {
+    size_t rows = 0;
+    size_t columns = 0;
+    const double start = now();
+    const int rc = get_extent(path, 0, &rows, &columns);
+    const double elapsed = now() - start;
+    if (rc == 0)
+      report("get_extent", elapsed, size, rows, columns);
+  }
+
+  // each implementation, scanning memory
+  static const struct {
+    extent_impl_t impl;
+    const char *name;
+  } IMPLS[] = {
+      {EXTENT_SCALAR, "scalar"},
+      {EXTENT_SSE2, "SSE2"},
+      {EXTENT_AVX2, "AVX2"},
+  };
+  for (size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); ++i) {
+    if (!extent_use(IMPLS[i].impl))
+      continue;
+    extent_t e;
+    extent_init(&e, 0);
+    const double start = now();
+    (void)extent_feed(&e, text, size);
+    size_t rows = 0;
+    size_t columns = 0;
+    extent_finish(&e, &rows, &columns);
+    report(IMPLS[i].name, now() - start, size, rows, columns);
+  }
+
+  (void)unlink(path);
+  free(text);
+
+  return EXIT_SUCCESS;
+}
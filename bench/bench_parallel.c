@@ -0,0 +1,147 @@
+/// \file
+/// \brief compare serial and parallel rendering of a large file
+///
+/// Usage: bench_parallel [lines [max jobs]]
+///
+/// A C source file of the given number of lines (default 100000) is generated
+/// and then rendered with `vimcat_read` and with `vimcat_read_parallel` at
+/// increasing job counts up to the given maximum (default: the number of online
+/// processors). Each parallel result is checked against the serial result.
+///
+/// Each Vim but the first parses the file up to where it begins, so expect the
+/// speedup to level off at around two, and at four jobs, beyond which a single
+/// file is not divided further.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vimcat/vimcat.h>
+
+/// summary of a rendered file, for comparing one render to another
+typedef struct {
+  uint64_t hash;
+  size_t lines;
+} digest_t;
+
+static int accumulate(void *state, char *line) {
+  digest_t *d = state;
+
+  // FNV-1a
+  for (const char *p = line; *p != '\0'; ++p) {
+    d->hash ^= (uint8_t)*p;
+    d->hash *= UINT64_C(0x100000001b3);
+  }
+  d->hash ^= '\n';
+  d->hash *= UINT64_C(0x100000001b3);
+  ++d->lines;
+
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+
+  unsigned long lines = 100000;
+  if (argc > 1)
+    lines = strtoul(argv[1], NULL, 10);
+
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc > 2)
+    jobs = strtol(argv[2], NULL, 10);
+  if (jobs < 1)
+    jobs = 1;
+
+  if (!vimcat_have_vim()) {
+    fprintf(stderr, "vim not found\n");
+    return EXIT_FAILURE;
+  }
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  char path[4096];
+  (void)snprintf(path, sizeof(path), "%s/bench_parallel.XXXXXX.c", TMPDIR);
+  const int fd = mkstemps(path, strlen(".c"));
+  if (fd < 0) {
+    fprintf(stderr, "mkstemps failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  FILE *f = fdopen(fd, "w");
+  if (f == NULL) {
+    fprintf(stderr, "fdopen failed: %s\n", strerror(errno));
+    (void)close(fd);
+    (void)unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  // write some source with a mix of syntax groups
+  for (unsigned long i = 0; i < lines; ++i) {
+    switch (i % 4) {
+    case 0:
+      fprintf(f, "/* comment %lu */\n", i);
+      break;
+    case 1:
+      fprintf(f, "static int x%lu = %lu;\n", i, i);
+      break;
+    case 2:
+      fprintf(f, "static const char *s%lu = \"string %lu\";\n", i, i);
+      break;
+    default:
+      fprintf(f, "\n");
+      break;
+    }
+  }
+  (void)fclose(f);
+
+  int rc = EXIT_SUCCESS;
+
+  printf("%lu lines\n", lines);
+  printf("%-10s %10s %10s\n", "jobs", "seconds", "speedup");
+
+  digest_t reference = {.hash = UINT64_C(0xcbf29ce484222325)};
+  double serial = 0;
+  {
+    const double start = now();
+    const int r = vimcat_read(path, accumulate, &reference);
+    serial = now() - start;
+    if (r != 0) {
+      fprintf(stderr, "vimcat_read failed: %s\n", strerror(r));
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+    printf("%-10s %10.3f %10.2f\n", "serial", serial, 1.0);
+  }
+
+  for (long j = 1; j <= jobs; j = j * 2 > jobs && j < jobs ? jobs : j * 2) {
+    digest_t d = {.hash = UINT64_C(0xcbf29ce484222325)};
+    const double start = now();
+    const int r = vimcat_read_parallel(path, (size_t)j, accumulate, &d);
+    const double elapsed = now() - start;
+    if (r != 0) {
+      fprintf(stderr, "vimcat_read_parallel failed: %s\n", strerror(r));
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+    if (d.lines != reference.lines || d.hash != reference.hash) {
+      fprintf(stderr, "%ld jobs produced different output\n", j);
+      rc = EXIT_FAILURE;
+    }
+    printf("%-10ld %10.3f %10.2f\n", j, elapsed, serial / elapsed);
+  }
+
+done:
+  (void)unlink(path);
+
+  return rc;
+}
@@ -0,0 +1,382 @@
+/// \file
+/// \brief measure the throughput of interpreting Vim’s terminal output
+///
+/// Usage: bench_term [megabytes]
+///
+/// Vim’s drawing of a generated C file is recorded, with syntax highlighting on
+/// and then off, and the drawing in each recording is repeated to form input of
+/// the given size (default 64MB). This is interpreted by `term_send` from a
+/// file, as it would be from Vim’s output pipe, using each implementation of
+/// its scan for plain text. The contents of the resulting screen are summarised
+/// so runs can be checked against each other, and the time to read the screen
+/// back with `term_readline` is measured. Finally the size of the screen as
+/// read back is compared with its size with each change of style written in
+/// full and each line resetting its style, as vimcat once did.
+
+#include "colour.h"
+#include "term.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/// dimensions of the screen Vim draws
+enum { COLUMNS = 120, ROWS = 1000 };
+
+/// escape sequence for Erase in Display
+static const char ERASE[] = "\033[2J";
+
+/// number of times to read the final screen
+enum { READS = 100 };
+
+static double now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// write some source with a mix of syntax groups
+static void write_source(FILE *f) {
+  for (unsigned long i = 0; i < ROWS; ++i) {
+    switch (i % 5) {
+    case 0:
+      fprintf(f, "/* comment %lu */\n", i);
+      break;
+    case 1:
+      fprintf(f, "static int x%lu = %lu;\n", i, i);
+      break;
+    case 2:
+      fprintf(f, "\tif (x%lu > 0x%lx) return \"s\\t%lu\";\n", i - 1, i, i);
+      break;
+    case 3:
+      fprintf(f, "#define M%lu(a, b) ((a) + (b) * %lu.5f) // é ü ∑\n", i, i);
+      break;
+    default:
+      fputc('\n', f);
+      break;
+    }
+  }
+}
+
+/// run Vim on a file, capturing what it draws
+static int record(const char *path, const char *syntax, char **recording,
+                  size_t *size) {
+  char *command = NULL;
+  if (asprintf(&command,
+               "vim -R --not-a-term -X -u NONE -i NONE '+syntax %s'"
+               " '+set t_Co=256 lines=%d columns=%d nonumber laststatus=0"
+               " noruler nowrap' '+redraw' '+qa!' -- '%s'",
+               syntax, ROWS, COLUMNS, path) < 0)
+    return ENOMEM;
+
+  FILE *vim = popen(command, "r");
+  free(command);
+  if (vim == NULL)
+    return errno;
+
+  FILE *out = open_memstream(recording, size);
+  if (out == NULL) {
+    const int rc = errno;
+    (void)pclose(vim);
+    return rc;
+  }
+
+  char block[BUFSIZ];
+  for (size_t r; (r = fread(block, 1, sizeof(block), vim)) > 0;)
+    (void)fwrite(block, 1, r, out);
+
+  (void)fclose(out);
+  if (pclose(vim) != 0)
+    return ECHILD;
+  return 0;
+}
+
+/// number of bytes a colour took when styles were written in full
+static size_t colour_size(long colour, unsigned base) {
+  if (colour == VIMCAT_COLOUR_DEFAULT)
+    return strlen("39;");
+  const colour_t c = {.r = (uint8_t)(colour >> 16),
+                      .g = (uint8_t)(colour >> 8),
+                      .b = (uint8_t)colour};
+  const unsigned colour8 = colour_24_to_8(c);
+  if (colour8 <= 7)
+    return strlen("39;");
+  if (colour8 <= 15)
+    return (size_t)snprintf(NULL, 0, "%u;", base + 60 + colour8 - 8);
+  if (colour8 <= 255)
+    return (size_t)snprintf(NULL, 0, "%u;5;%um\033[", base + 8, colour8);
+  return (size_t)snprintf(NULL, 0, "%u;2;%u;%u;%um\033[", base + 8, c.r, c.g,
+                          c.b);
+}
+
+/// number of bytes a style took when written in full
+static size_t style_size(const vimcat_span_t *span) {
+  return strlen("\033[") + colour_size(span->fg, 30) +
+         colour_size(span->bg, 40) + strlen(span->bold ? "1;" : "22;") +
+         strlen(span->underline ? "4" : "24") + strlen("m");
+}
+
+/// bytes a screen is read back as
+typedef struct {
+  size_t full;    ///< writing each style in full and resetting each line
+  size_t minimal; ///< with `term_readline`
+  size_t carried; ///< with `term_readline`, carrying style across lines
+} sizes_t;
+
+/// measure the size of the screen as read and as written in full
+static int measure_sizes(term_t *term, sizes_t *sizes) {
+
+  // size of the screen as styles were once written
+  size_t full = 0;
+  for (size_t y = 1; y <= ROWS; ++y) {
+    char *text = NULL;
+    const vimcat_span_t *spans = NULL;
+    size_t n_spans = 0;
+    if (term_readspans(term, y, &text, &spans, &n_spans) != 0) {
+      fprintf(stderr, "term_readspans failed\n");
+      return EXIT_FAILURE;
+    }
+    full += strlen(text) + strlen("\n");
+    for (size_t i = 0; i < n_spans; ++i)
+      full += style_size(&spans[i]);
+    // the first span of default style, and the reset at the end of the line,
+    // were only written for a styled line
+    if (n_spans > 0) {
+      const vimcat_span_t *first = &spans[0];
+      const vimcat_span_t *last = &spans[n_spans - 1];
+      if (first->fg == VIMCAT_COLOUR_DEFAULT &&
+          first->bg == VIMCAT_COLOUR_DEFAULT && !first->bold &&
+          !first->underline)
+        full -= style_size(first);
+      if (last->fg != VIMCAT_COLOUR_DEFAULT ||
+          last->bg != VIMCAT_COLOUR_DEFAULT || last->bold || last->underline)
+        full += strlen("\033[0m");
+    }
+  }
+
+  // size of the screen as read, with and without style carried across lines
+  size_t read[2] = {0};
+  for (size_t carry = 0; carry < 2; ++carry) {
+    term_set_carry(term, carry != 0);
+    for (size_t y = 1; y <= ROWS; ++y) {
+      char *line = NULL;
+      if (term_readline(term, y, &line) != 0) {
+        fprintf(stderr, "term_readline failed\n");
+        return EXIT_FAILURE;
+      }
+      read[carry] += strlen(line) + strlen("\n");
+    }
+    if (carry) {
+      char *end = NULL;
+      if (term_readline_end(term, &end) != 0) {
+        fprintf(stderr, "term_readline_end failed\n");
+        return EXIT_FAILURE;
+      }
+      read[carry] += strlen(end);
+    }
+  }
+  term_set_carry(term, false);
+
+  *sizes = (sizes_t){.full = full, .minimal = read[0], .carried = read[1]};
+  return EXIT_SUCCESS;
+}
+
+/// interpret a file of terminal input with each implementation
+static int measure(const char *name, term_t *term, int fd, size_t size,
+                   sizes_t *sizes) {
+
+  static const struct {
+    term_impl_t impl;
+    const char *name;
+  } IMPLS[] = {
+      {TERM_SCALAR, "scalar"},
+      {TERM_SSE2, "SSE2"},
+      {TERM_AVX2, "AVX2"},
+  };
+
+  uint64_t reference = 0;
+  for (size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); ++i) {
+    if (!term_use(IMPLS[i].impl))
+      continue;
+
+    term_reset(term);
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+      fprintf(stderr, "lseek failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    bool framed = false;
+    const double start = now();
+    const int r = term_send(term, fd, &framed);
+    const double elapsed = now() - start;
+    if (r != 0) {
+      fprintf(stderr, "term_send failed: %s\n", strerror(r));
+      return EXIT_FAILURE;
+    }
+
+    // summarise the final screen, reading it repeatedly for timing
+    uint64_t digest = UINT64_C(0xcbf29ce484222325);
+    const double read_start = now();
+    for (size_t j = 0; j < READS; ++j) {
+      for (size_t y = 1; y <= ROWS; ++y) {
+        char *line = NULL;
+        if (term_readline(term, y, &line) != 0) {
+          fprintf(stderr, "term_readline failed\n");
+          return EXIT_FAILURE;
+        }
+        if (j > 0)
+          continue;
+        // FNV-1a
+        for (const char *p = line; *p != '\0'; ++p) {
+          digest ^= (uint8_t)*p;
+          digest *= UINT64_C(0x100000001b3);
+        }
+        digest ^= '\n';
+        digest *= UINT64_C(0x100000001b3);
+      }
+    }
+    const double read_elapsed = (now() - read_start) / READS;
+
+    printf("%-12s %-8s %10.3f %10.1f %10.3f %18" PRIx64 "\n", name,
+           IMPLS[i].name, elapsed, (double)size / elapsed / 1e6,
+           read_elapsed * 1e3, digest);
+
+    if (reference == 0) {
+      reference = digest;
+    } else if (digest != reference) {
+      fprintf(stderr, "%s screen differs from scalar\n", IMPLS[i].name);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return measure_sizes(term, sizes);
+}
+
+int main(int argc, char **argv) {
+
+  size_t megabytes = 64;
+  if (argc > 1)
+    megabytes = strtoul(argv[1], NULL, 10);
+  const size_t size = megabytes * 1000 * 1000;
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  // write some source for Vim to draw
+  char source[4096];
+  (void)snprintf(source, sizeof(source), "%s/bench_term.XXXXXX.c", TMPDIR);
+  {
+    const int fd = mkstemps(source, strlen(".c"));
+    if (fd < 0) {
+      fprintf(stderr, "mkstemps failed: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    FILE *f = fdopen(fd, "w");
+    if (f == NULL) {
+      fprintf(stderr, "fdopen failed: %s\n", strerror(errno));
+      (void)close(fd);
+      (void)unlink(source);
+      return EXIT_FAILURE;
+    }
+    write_source(f);
+    (void)fclose(f);
+  }
+
+  term_t *term = NULL;
+  if (term_new(&term, COLUMNS, ROWS) != 0) {
+    fprintf(stderr, "term_new failed\n");
+    (void)unlink(source);
+    return EXIT_FAILURE;
+  }
+
+  static const struct {
+    const char *name;
+    const char *syntax;
+  } SAMPLES[] = {{"highlighted", "on"}, {"plain", "off"}};
+
+  printf("%-12s %-8s %10s %10s %10s %18s\n", "output", "scan", "seconds",
+         "MB/s", "read ms", "screen digest");
+
+  sizes_t sizes[sizeof(SAMPLES) / sizeof(SAMPLES[0])] = {0};
+
+  int rc = EXIT_SUCCESS;
+  for (size_t i = 0; rc == EXIT_SUCCESS && i < sizeof(SAMPLES) /
+                                                   sizeof(SAMPLES[0]); ++i) {
+
+    // record Vim drawing the source
+    char *recording = NULL;
+    size_t recording_size = 0;
+    {
+      const int r =
+          record(source, SAMPLES[i].syntax, &recording, &recording_size);
+      if (r != 0 || recording_size == 0) {
+        fprintf(stderr, "recording Vim failed: %s\n", strerror(r));
+        free(recording);
+        rc = EXIT_FAILURE;
+        break;
+      }
+    }
+
+    // repeat the recording to form the input
+    char path[4096];
+    (void)snprintf(path, sizeof(path), "%s/bench_term.XXXXXX", TMPDIR);
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+      fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+      free(recording);
+      rc = EXIT_FAILURE;
+      break;
+    }
+    // repeat only what Vim draws after it last erases the screen, so the
+    // input is not dominated by erasing
+    size_t start = 0;
+    for (const char *p = recording;
+         (p = memmem(p, recording_size - (size_t)(p - recording), ERASE,
+                     strlen(ERASE))) != NULL;
+         p += strlen(ERASE))
+      start = (size_t)(p - recording) + strlen(ERASE);
+    size_t total = 0;
+    for (size_t from = 0; rc == EXIT_SUCCESS && total < size; from = start) {
+      for (size_t offset = from; offset < recording_size;) {
+        const ssize_t w =
+            write(fd, &recording[offset], recording_size - offset);
+        if (w < 0) {
+          fprintf(stderr, "write failed: %s\n", strerror(errno));
+          rc = EXIT_FAILURE;
+          break;
+        }
+        offset += (size_t)w;
+      }
+      total += recording_size - from;
+    }
+    free(recording);
+
+    if (rc == EXIT_SUCCESS)
+      rc = measure(SAMPLES[i].name, term, fd, total, &sizes[i]);
+
+    (void)close(fd);
+    (void)unlink(path);
+  }
+
+  if (rc == EXIT_SUCCESS) {
+    printf("\n%-12s %10s %10s %8s %10s %8s\n", "output", "full bytes",
+           "bytes", "of full", "carried", "of full");
+    for (size_t i = 0; i < sizeof(SAMPLES) / sizeof(SAMPLES[0]); ++i)
+      printf("%-12s %10zu %10zu %7.1f%% %10zu %7.1f%%\n", SAMPLES[i].name,
+             sizes[i].full, sizes[i].minimal,
+             100.0 * (double)sizes[i].minimal / (double)sizes[i].full,
+             sizes[i].carried,
+             100.0 * (double)sizes[i].carried / (double)sizes[i].full);
+  }
+
+  term_free(&term);
+  (void)unlink(source);
+
+  return rc;
+}
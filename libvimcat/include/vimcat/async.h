@@ -0,0 +1,98 @@
+/// \file
+/// \brief non-blocking highlighting for event loops
+///
+/// The `vimcat_read*` functions block until Vim has rendered the whole file.
+/// Applications built around an event loop (`poll`, `epoll`, …) can instead
+/// start a render, wait for its file descriptor to become readable alongside
+/// their other work, and then call `vimcat_async_step` to process whatever Vim
+/// has produced so far. A typical loop looks like:
+///
+///   vimcat_async_t *a = NULL;
+///   int rc = vimcat_async_start(filename, callback, state, &a);
+///   while (rc == 0 && (rc = vimcat_async_step(a)) == EAGAIN) {
+///     // wait for vimcat_async_fd(a) to be readable, e.g. with poll()
+///   }
+///   vimcat_async_close(&a);
+///
+/// Asynchronous renders always use the terminal backend, and do not consult
+/// the render cache.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// an in-progress render
+typedef struct vimcat_async vimcat_async_t;
+
+/** begin Vim-highlighting the given file
+ *
+ * This measures the file and starts Vim, but does not wait for any output.
+ * Lines are passed to the callback from within `vimcat_async_step`.
+ *
+ * \param filename Source file to read
+ * \param callback Handler for highlighted lines, as for `vimcat_read`
+ * \param state State to pass as first parameter to the callback
+ * \param async [out] The started render on success
+ * \return 0 on success or an errno on failure
+ */
+VIMCAT_API int vimcat_async_start(const char *filename,
+                                  int (*callback)(void *state, char *line),
+                                  void *state, vimcat_async_t **async);
+
+/** file descriptor to wait on before calling `vimcat_async_step`
+ *
+ * The descriptor becomes readable when a step can make progress. It remains
+ * the same for the life of the render, so it can be registered with an event
+ * loop once. It is owned by the render and must not be closed by the caller.
+ *
+ * \param async Render to query
+ * \return A pollable file descriptor, or -1 if the render has finished
+ */
+VIMCAT_API int vimcat_async_fd(const vimcat_async_t *async);
+
+/** process any output Vim has produced, without blocking
+ *
+ * Each highlighted line that has become available is passed to the render’s
+ * callback, in order. If the callback returns non-zero, the render is
+ * cancelled. Once the render has finished, further calls return the same
+ * result.
+ *
+ * A callback that returns EAGAIN cancels the render like any other non-zero
+ * return, and this is returned as the result. To tell this apart from a render
+ * still in progress, check whether `vimcat_async_fd` now returns -1.
+ *
+ * \param async Render to advance
+ * \return EAGAIN if the render is still in progress, 0 if it has completed
+ *   successfully, ENOTSUP if the available Vim is too old to render
+ *   asynchronously, another errno on failure, or the non-zero return from the
+ *   caller’s callback
+ */
+VIMCAT_API int vimcat_async_step(vimcat_async_t *async);
+
+/** release a render, cancelling it if it has not finished
+ *
+ * Cancelling kills Vim and waits for it to exit, so no child process remains
+ * afterwards. No further lines are passed to the callback.
+ *
+ * \param async [inout] Render to release, which is set to `NULL`
+ */
+VIMCAT_API void vimcat_async_close(vimcat_async_t **async);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+/// \file
+/// \brief selection of how highlighting is extracted from Vim
+///
+/// By default, libvimcat runs Vim in a virtual terminal and reads back what Vim
+/// draws. This reproduces exactly what Vim would display, but is subject to
+/// Vim’s limits on terminal dimensions (10000 columns and 1000 rows), so very
+/// wide lines are truncated and tall files are drawn a screen at a time.
+///
+/// The headless backend instead runs a script within Vim that reports the
+/// syntax highlighting of every character of the file, which is then converted
+/// into the same output the terminal backend produces. It has no limit on line
+/// width and needs no screen redraws. However it only reproduces syntax
+/// highlighting, not other features of Vim’s display, e.g. 'list' characters,
+/// concealed text, or matches added by plugins. Control characters are passed
+/// through rather than shown as Vim would (e.g. "^A"). Where a line is longer
+/// than 'synmaxcol', Vim’s screen drawing and its reporting of syntax disagree
+/// on whether a region opened beyond that column continues onto the next line,
+/// so highlighting of the lines that follow may differ. If the available Vim
+/// cannot run the script, the terminal backend is used instead.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// means of extracting highlighting from Vim
+typedef enum {
+  VIMCAT_BACKEND_TERMINAL = 0, ///< read Vim’s drawing of a virtual terminal
+  VIMCAT_BACKEND_HEADLESS = 1, ///< ask Vim for syntax attributes directly
+} vimcat_backend_t;
+
+/** select the backend used by subsequent renders
+ *
+ * On startup, the terminal backend is used.
+ *
+ * \param backend Backend to use
+ * \return 0 on success or EINVAL if \p backend is unrecognised
+ */
+VIMCAT_API int vimcat_set_backend(vimcat_backend_t backend);
+
+/** retrieve the backend used for renders
+ *
+ * \return The selected backend
+ */
+VIMCAT_API vimcat_backend_t vimcat_get_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+/// \file
+/// \brief render cache configuration
+///
+/// libvimcat can keep the result of highlighting a file on disk so that a later
+/// request to highlight the same content is answered without running Vim.
+/// Entries are named by a hash of the file’s content together with everything
+/// else known to affect the result: the file’s name (which drives filetype
+/// detection), any filetype hint, the user’s vimrc files, the Vim executable,
+/// the terminal type, and the version of libvimcat. Changes to other files Vim
+/// reads, such as plugins or syntax files, are not detected. Clear the cache
+/// directory after changing these.
+///
+/// Only whole files are cached. Requests for a range or selection of lines are
+/// always rendered afresh.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// a reasonable default for the size limit of a render cache, in bytes
+#define VIMCAT_CACHE_SIZE_DEFAULT ((size_t)256 * 1024 * 1024)
+
+/** set a directory in which to cache rendered files
+ *
+ * On startup, no rendered files are cached. When the total size of the entries
+ * in the directory exceeds \p max_size, the least recently used are removed.
+ * The directory must already exist, and should not be used for anything else.
+ *
+ * \param path Directory to use, or `NULL` to stop caching
+ * \param max_size Maximum total size of cached entries in bytes, or 0 for no
+ *   limit
+ * \return 0 on success or an errno on failure
+ */
+VIMCAT_API int vimcat_set_cache_dir(const char *path, size_t max_size);
+
+/** retrieve the number of render cache lookups made by this process
+ *
+ * \param hits [out] Number of lookups answered from the cache
+ * \param misses [out] Number of lookups that needed a fresh render
+ */
+VIMCAT_API void vimcat_cache_stats(unsigned long *hits, unsigned long *misses);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,126 @@
+/// \file
+/// \brief reusable rendering contexts
+///
+/// The `vimcat_read*` functions allocate the state they need for each call and
+/// take their settings from process-wide defaults. Applications that perform
+/// many renders can instead create a context, which holds its own settings and
+/// keeps its working memory (e.g. the virtual terminal Vim draws into) from one
+/// call to the next.
+///
+/// A context must only be used by one thread at a time, but separate contexts
+/// can be used from different threads concurrently. Settings made on a context
+/// affect only calls made through it.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#include <stdio.h>
+#include <vimcat/backend.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// settings and working memory for a series of renders
+typedef struct vimcat_ctx vimcat_ctx_t;
+
+/** create a context
+ *
+ * A new context uses the terminal backend, runs the first `vim` found in
+ * `$PATH`, lets Vim detect filetypes, and emits no debug messages, regardless
+ * of any process-wide settings.
+ *
+ * \param ctx [out] The new context on success
+ * \return 0 on success or an errno on failure
+ */
+VIMCAT_API int vimcat_ctx_new(vimcat_ctx_t **ctx);
+
+/** set where debug messages from calls on this context are written
+ *
+ * \param ctx Context to configure
+ * \param stream Destination for debug messages, or `NULL` to suppress them
+ */
+VIMCAT_API void vimcat_ctx_set_debug(vimcat_ctx_t *ctx, FILE *stream);
+
+/** select the backend used by calls on this context
+ *
+ * \param ctx Context to configure
+ * \param backend Backend to use
+ * \return 0 on success or EINVAL if \p backend is not a known backend
+ */
+VIMCAT_API int vimcat_ctx_set_backend(vimcat_ctx_t *ctx,
+                                      vimcat_backend_t backend);
+
+/** select the Vim executable run by calls on this context
+ *
+ * \param ctx Context to configure
+ * \param vim Path to Vim, or `NULL` to search `$PATH` for `vim`
+ * \return 0 on success or an errno on failure
+ */
+VIMCAT_API int vimcat_ctx_set_vim(vimcat_ctx_t *ctx, const char *vim);
+
+/** set the filetype Vim gives files rendered through this context
+ *
+ * \param ctx Context to configure
+ * \param filetype Vim filetype (e.g. "c"), or `NULL` to let Vim detect it
+ * \return 0 on success, EINVAL if \p filetype is not a plausible Vim filetype,
+ *   or another errno on failure
+ */
+VIMCAT_API int vimcat_ctx_set_filetype(vimcat_ctx_t *ctx,
+                                       const char *filetype);
+
+/** Vim-highlight the given file using a context
+ *
+ * This behaves as `vimcat_read`, but with the settings of \p ctx.
+ *
+ * \param ctx Context to use
+ * \param filename Source file to read
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_ctx_read(vimcat_ctx_t *ctx, const char *filename,
+                               int (*callback)(void *state, char *line),
+                               void *state);
+
+/** Vim-highlight a range of lines of the given file using a context
+ *
+ * This behaves as `vimcat_read_range`, but with the settings of \p ctx.
+ *
+ * \param ctx Context to use
+ * \param filename Source file to read
+ * \param first 1-indexed first line to highlight
+ * \param last Last line to highlight, or 0 to highlight through to the end of
+ *   the file
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_ctx_read_range(vimcat_ctx_t *ctx, const char *filename,
+                                     unsigned long first, unsigned long last,
+                                     int (*callback)(void *state, char *line),
+                                     void *state);
+
+/** release a context
+ *
+ * \param ctx [inout] Context to release, which is set to `NULL`
+ */
+VIMCAT_API void vimcat_ctx_free(vimcat_ctx_t **ctx);
+
+#ifdef __cplusplus
+}
+#endif
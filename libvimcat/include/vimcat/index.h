@@ -0,0 +1,42 @@
+/// \file
+/// \brief line index configuration
+///
+/// To highlight individual lines quickly, libvimcat indexes the byte offset and
+/// width of every line of a file the first time one of its lines is requested,
+/// and keeps a number of these indices in memory. Indices can optionally be
+/// persisted to disk so they can be reused by later processes.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/** set a directory in which to persist line indices
+ *
+ * On startup, line indices are only kept in memory. Indices written to this
+ * directory are named after the device and inode of the file they describe,
+ * and are validated against the file’s size and modification time before being
+ * used. The directory must already exist.
+ *
+ * \param path Directory to use, or `NULL` to stop persisting indices
+ * \return 0 on success or an errno on failure
+ */
+VIMCAT_API int vimcat_set_index_dir(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
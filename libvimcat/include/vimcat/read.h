@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,6 +36,199 @@ VIMCAT_API int vimcat_read(const char *filename,
                            int (*callback)(void *state, char *line),
                            void *state);
 
+/** Vim-highlight the content of stdin
+ *
+ * This behaves as `vimcat_read`, but highlights whatever can be read from
+ * stdin until EOF. It is a shorthand for `vimcat_read_fd(STDIN_FILENO, NULL,
+ * callback, state)`. The input is captured in memory (or in a temporary file on
+ * platforms without anonymous in-memory files) so that Vim can read it. As Vim
+ * does not learn a filename, filetype detection relies on the input’s content.
+ *
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_stdin(int (*callback)(void *state, char *line),
+                                 void *state);
+
+/** Vim-highlight the content of a file descriptor
+ *
+ * This behaves as `vimcat_read_stdin`, but reads from \p fd, which can be a
+ * pipe, socket, or anything else that can be read until EOF. \p fd is not
+ * closed.
+ *
+ * If \p filetype is given, Vim uses it for the input instead of trying to
+ * detect the filetype itself. It must be the name of a Vim filetype, like
+ * "c" or "python".
+ *
+ * \param fd Descriptor to read
+ * \param filetype Vim filetype of the input, or `NULL` to let Vim detect it
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_fd(int fd, const char *filetype,
+                              int (*callback)(void *state, char *line),
+                              void *state);
+
+/** Vim-highlight text held in memory
+ *
+ * This behaves as `vimcat_read_fd`, but highlights the \p length bytes at
+ * \p data. These are passed to Vim through an anonymous in-memory file where
+ * the platform supports it, so they are never written to disk and are measured
+ * without being read back.
+ *
+ * \param data Text to highlight
+ * \param length Number of bytes in \p data
+ * \param filetype Vim filetype of the text, or `NULL` to let Vim detect it
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_buffer(const char *data, size_t length,
+                                  const char *filetype,
+                                  int (*callback)(void *state, char *line),
+                                  void *state);
+
+/** Vim-highlight the given file using several Vim instances at once
+ *
+ * This behaves as `vimcat_read`, but files taller than a single Vim screen are
+ * divided among up to \p jobs concurrently running Vim instances. Lines are
+ * still passed to the callback in order and on the calling thread. The
+ * callback does not need to be thread-safe.
+ *
+ * Each Vim instance that begins rendering part way through the file first
+ * parses it from the start, so the result is identical to `vimcat_read`. This
+ * parsing costs roughly half as much as drawing the same lines, so the speedup
+ * is limited to around twice as fast however many jobs are given, and total
+ * processor time grows with each Vim. A file is divided among at most four Vim
+ * instances for this reason.
+ *
+ * \param filename Source file to read
+ * \param jobs Maximum number of Vim instances to run at once, or 0 to use one
+ *   per online processor
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_parallel(const char *filename, size_t jobs,
+                                    int (*callback)(void *state, char *line),
+                                    void *state);
+
+/** Vim-highlight several files, returning lines through the callback function
+ *
+ * This is equivalent to calling `vimcat_read` on each file in turn, but a
+ * single Vim instance is used to render all the files. When highlighting many
+ * files, this avoids paying Vim’s startup cost once per file.
+ *
+ * Lines are passed to the callback in order, file by file. If a file cannot be
+ * read, all files preceding it are highlighted before the failure is returned.
+ * The same lifetime rules as `vimcat_read` apply to \p line.
+ *
+ * \param filenames Source files to read
+ * \param n Number of entries in \p filenames
+ * \param callback Handler for highlighted lines, receiving the index within
+ *   \p filenames of the file \p line came from
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_files(const char *const *filenames, size_t n,
+                                 int (*callback)(void *state, size_t index,
+                                                 char *line),
+                                 void *state);
+
+/** Vim-highlight several files using several Vim instances at once
+ *
+ * This behaves as `vimcat_read_files`, but the files are divided among up to
+ * \p jobs concurrently running Vim instances. Files taller than a single Vim
+ * screen may themselves be divided, as for `vimcat_read_parallel`. Lines are
+ * still passed to the callback in order, file by file, and on the calling
+ * thread. Neither callback needs to be thread-safe.
+ *
+ * The outcome for each file is reported through \p finished, in order: after
+ * the last of its lines has been passed to \p callback, or in place of its
+ * lines if it could not be read. A file that cannot be read does not stop
+ * those after it from being highlighted, unless \p finished returns non-zero.
+ * If \p finished is `NULL`, the first file that cannot be read stops the
+ * render, as for `vimcat_read_files`.
+ *
+ * \param filenames Source files to read
+ * \param n Number of entries in \p filenames
+ * \param jobs Maximum number of Vim instances to run at once, or 0 to use one
+ *   per online processor
+ * \param callback Handler for highlighted lines, receiving the index within
+ *   \p filenames of the file \p line came from
+ * \param finished Optional handler for the outcome of each file, receiving its
+ *   index within \p filenames and 0 or the errno that prevented highlighting it
+ * \param state State to pass as first parameter to the callbacks
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   one of the caller’s callbacks if there was one
+ */
+VIMCAT_API int vimcat_read_files_parallel(
+    const char *const *filenames, size_t n, size_t jobs,
+    int (*callback)(void *state, size_t index, char *line),
+    int (*finished)(void *state, size_t index, int rc), void *state);
+
+/** Vim-highlight a range of lines in the given file
+ *
+ * This behaves as `vimcat_read`, but only lines \p first through \p last
+ * (inclusive) are passed to the callback. Only the requested lines are rendered
+ * and the file is not scanned beyond \p last, so the cost of this is
+ * proportional to the size of the range rather than the size of the file.
+ *
+ * Requested lines after the end of the file are silently omitted, but it is an
+ * error for \p first to be after the end of the file.
+ *
+ * \param filename Source file to read
+ * \param first 1-indexed first line to highlight
+ * \param last Last line to highlight, or 0 to highlight through to the end of
+ *   the file
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, ERANGE if \p first is after the end of the file, another
+ *   errno on failure, or the last non-zero return from the caller’s callback if
+ *   there was one
+ */
+VIMCAT_API int vimcat_read_range(const char *filename, unsigned long first,
+                                 unsigned long last,
+                                 int (*callback)(void *state, char *line),
+                                 void *state);
+
+/** Vim-highlight a range of lines in the given file within a time limit
+ *
+ * This behaves as `vimcat_read_range`, but gives up on Vim if it has not
+ * rendered the range within \p timeout milliseconds. Any Vim still running
+ * is killed, and lines that had not yet been passed to the callback are passed
+ * on as they appear in the file (without the trailing newline, and with control
+ * characters other than tab shown as Vim shows them, e.g. "^A"). Highlighted
+ * lines always precede unhighlighted ones, so the result can be described by
+ * the number of lines that were highlighted.
+ *
+ * A render that runs out of time is not stored in the render cache.
+ *
+ * \param filename Source file to read
+ * \param first 1-indexed first line to highlight
+ * \param last Last line to highlight, or 0 to highlight through to the end of
+ *   the file
+ * \param timeout Milliseconds to allow Vim
+ * \param callback Handler for lines
+ * \param state State to pass as first parameter to the callback
+ * \param highlighted [out] Optional; on success, the number of lines from
+ *   \p first onwards that were passed to the callback highlighted
+ * \return 0 on success, including when lines were passed on unhighlighted,
+ *   ERANGE if \p first is after the end of the file, another errno on failure,
+ *   or the last non-zero return from the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_timeout(const char *filename, unsigned long first,
+                                   unsigned long last, unsigned long timeout,
+                                   int (*callback)(void *state, char *line),
+                                   void *state, unsigned long *highlighted);
+
 /** Vim-highlight a single line in the given file
  *
  * This function provides a convenience one-shot version of `vimcat_read` for
@@ -47,6 +242,32 @@ VIMCAT_API int vimcat_read(const char *filename,
 VIMCAT_API int vimcat_read_line(const char *filename, unsigned long lineno,
                                 char **line);
 
+/** Vim-highlight a selection of lines in the given file
+ *
+ * This is equivalent to calling `vimcat_read_line` for each of \p linenos, but
+ * a single Vim instance is used to render all of them. Lines are passed to the
+ * callback in ascending order, and a line requested more than once is only
+ * passed once. If any requested line is beyond the end of the file, ERANGE is
+ * returned before any lines are passed to the callback.
+ *
+ * The same lifetime rules as `vimcat_read` apply to \p line.
+ *
+ * \param filename Source file to read
+ * \param linenos Line numbers of the lines to highlight, in any order
+ * \param n Number of entries in \p linenos
+ * \param callback Handler for highlighted lines, receiving the line number of
+ *   \p line
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_lines(const char *filename,
+                                 const unsigned long *linenos, size_t n,
+                                 int (*callback)(void *state,
+                                                 unsigned long lineno,
+                                                 char *line),
+                                 void *state);
+
 #ifdef __cplusplus
 }
 #endif
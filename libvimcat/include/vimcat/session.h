@@ -0,0 +1,155 @@
+/// \file
+/// \brief incremental re-highlighting of a changing file
+///
+/// Applications that display a file while it is being edited would otherwise
+/// need to re-highlight the whole file after every change. A session keeps the
+/// most recent render of a file, and on request works out which lines have
+/// changed since and asks Vim to render only those. As a change can alter the
+/// highlighting of lines after it (e.g. opening a comment), rendering continues
+/// past the changed text until the output settles back into agreement with the
+/// previous render.
+///
+/// Vim begins each re-render part way through the file, so highlighting that
+/// depends on text many lines earlier is subject to the same limits as Vim’s
+/// own syntax synchronisation when jumping into a file.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// a highlighted file, kept for incremental updates
+typedef struct vimcat_session vimcat_session_t;
+
+/// a description of how a render changed
+///
+/// Lines `first` through `first + removed - 1` of the previous render were
+/// replaced by lines `first` through `first + added - 1` of the new one. All
+/// other lines are unchanged, though those after the change are renumbered if
+/// `added` and `removed` differ. If nothing changed, `added` and `removed` are
+/// both 0.
+typedef struct {
+  unsigned long first;   ///< 1-indexed first line that changed
+  unsigned long removed; ///< number of lines of the previous render replaced
+  unsigned long added;   ///< number of lines replacing them
+} vimcat_change_t;
+
+/** Vim-highlight the given file and keep the result for later updates
+ *
+ * Each line of the file is passed to the callback, as with `vimcat_read`.
+ *
+ * \param filename Source file to read
+ * \param callback Handler for highlighted lines, receiving the line number of
+ *   \p line
+ * \param state State to pass as first parameter to the callback
+ * \param session [out] The new session on success
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_session_open(const char *filename,
+                                   int (*callback)(void *state,
+                                                   unsigned long lineno,
+                                                   char *line),
+                                   void *state, vimcat_session_t **session);
+
+/** re-highlight a session’s file after it has changed on disk
+ *
+ * The file is compared line by line with the version previously highlighted to
+ * find the changed text. Only the changed lines, and those whose highlighting
+ * the change affects, are rendered. Lines whose rendering differs from before
+ * are passed to the callback, numbered as in the new version of the file.
+ *
+ * Finding the changed text means reading and hashing the whole file, so an
+ * update costs time in proportion to the file’s size however small the change.
+ * This is skipped if the file’s identity, size and modification time show it to
+ * be unchanged since the last update. Callers who know where the file was
+ * edited should use `vimcat_session_edit` instead.
+ *
+ * If rendering fails, the session is left describing the previous version of
+ * the file. The session is updated before any lines are passed to the callback,
+ * so it reflects the new version even if the callback returns non-zero.
+ *
+ * \param session Session to update
+ * \param change [out] Description of what changed, on success
+ * \param callback Handler for changed lines, or `NULL` if the caller will
+ *   retrieve them with `vimcat_session_line`
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, ESTALE if the file changed again while being read,
+ *   another errno on failure, or the last non-zero return from the caller’s
+ *   callback if there was one
+ */
+VIMCAT_API int vimcat_session_update(vimcat_session_t *session,
+                                     vimcat_change_t *change,
+                                     int (*callback)(void *state,
+                                                     unsigned long lineno,
+                                                     char *line),
+                                     void *state);
+
+/** re-highlight a session’s file after a known edit
+ *
+ * This behaves as `vimcat_session_update`, but the caller states which text
+ * changed instead of having the whole file compared: lines \p first through
+ * \p last of the new version of the file replace some number of lines starting
+ * at \p first in the previous version, and all other lines are unchanged. A
+ * deletion is described by \p last being `first - 1`. How many lines were
+ * replaced is deduced from the change in the file’s length.
+ *
+ * \param session Session to update
+ * \param first 1-indexed first line of the edit
+ * \param last Last line of the edit in the new version of the file
+ * \param change [out] Description of how the render changed, on success
+ * \param callback Handler for changed lines, or `NULL`
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, EINVAL if the edit is inconsistent with the file’s new
+ *   length, ESTALE if the file changed again while being read, another errno
+ *   on failure, or the last non-zero return from the caller’s callback if there
+ *   was one
+ */
+VIMCAT_API int vimcat_session_edit(vimcat_session_t *session,
+                                   unsigned long first, unsigned long last,
+                                   vimcat_change_t *change,
+                                   int (*callback)(void *state,
+                                                   unsigned long lineno,
+                                                   char *line),
+                                   void *state);
+
+/** number of lines in a session’s current render
+ *
+ * \param session Session to query
+ * \return Number of lines
+ */
+VIMCAT_API unsigned long vimcat_session_rows(const vimcat_session_t *session);
+
+/** retrieve a line of a session’s current render
+ *
+ * \param session Session to query
+ * \param lineno 1-indexed line number
+ * \return The highlighted line, valid until the session is next updated or
+ *   closed, or `NULL` if \p lineno is out of range
+ */
+VIMCAT_API const char *vimcat_session_line(const vimcat_session_t *session,
+                                           unsigned long lineno);
+
+/** release a session
+ *
+ * \param session [inout] Session to release, which is set to `NULL`
+ */
+VIMCAT_API void vimcat_session_close(vimcat_session_t **session);
+
+#ifdef __cplusplus
+}
+#endif
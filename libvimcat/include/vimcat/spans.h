@@ -0,0 +1,70 @@
+/// \file
+/// \brief highlighting as structured style spans
+///
+/// The `vimcat_read*` functions describe highlighting with ANSI terminal escape
+/// sequences, which suits display in a terminal. Consumers that present text in
+/// some other way (e.g. as HTML or in an editor) would need to parse these
+/// sequences again. The function here instead describes each line as plain text
+/// and a list of spans giving the style of each part of it.
+///
+/// Applications should include the general API header, vimcat.h, in preference
+/// to selectively including this.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIMCAT_API
+#ifdef __GNUC__
+#define VIMCAT_API __attribute__((visibility("default")))
+#elif defined(_MSC_VER)
+#define VIMCAT_API __declspec(dllexport)
+#else
+#define VIMCAT_API /* nothing */
+#endif
+#endif
+
+/// value of `vimcat_span_t.fg` or `vimcat_span_t.bg` for the terminal’s default
+/// colour
+#define VIMCAT_COLOUR_DEFAULT (-1L)
+
+/// a run of uniformly styled text within a line
+typedef struct {
+  size_t offset;  ///< byte offset of the run’s first character in the line
+  size_t length;  ///< number of bytes in the run
+  long fg;        ///< foreground as 0xRRGGBB, or `VIMCAT_COLOUR_DEFAULT`
+  long bg;        ///< background as 0xRRGGBB, or `VIMCAT_COLOUR_DEFAULT`
+  bool bold;      ///< is the run bold?
+  bool underline; ///< is the run underlined?
+} vimcat_span_t;
+
+/** Vim-highlight the given file, returning lines as text and style spans
+ *
+ * This behaves as `vimcat_read`, but each line is passed to the callback as
+ * plain UTF-8 text without escape sequences, along with the spans that style
+ * it. The spans are in order, do not overlap, and together cover the whole of
+ * \p text. Adjacent spans differ in style. An empty line has no spans.
+ *
+ * The callback should not free \p text or \p spans, but it is free to modify the
+ * pointed to data. Both are only valid until \p callback returns.
+ *
+ * \param filename Source file to read
+ * \param callback Handler for highlighted lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+VIMCAT_API int vimcat_read_spans(const char *filename,
+                                 int (*callback)(void *state, char *text,
+                                                 const vimcat_span_t *spans,
+                                                 size_t n_spans),
+                                 void *state);
+
+#ifdef __cplusplus
+}
+#endif
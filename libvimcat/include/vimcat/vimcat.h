@@ -10,7 +10,14 @@
 #endif
 #endif
 
+#include <vimcat/async.h>
+#include <vimcat/backend.h>
+#include <vimcat/cache.h>
+#include <vimcat/ctx.h>
 #include <vimcat/debug.h>
 #include <vimcat/have_vim.h>
+#include <vimcat/index.h>
 #include <vimcat/read.h>
+#include <vimcat/session.h>
+#include <vimcat/spans.h>
 #include <vimcat/version.h>
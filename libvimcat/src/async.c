@@ -0,0 +1,361 @@
+#include "compiler.h"
+#include "debug.h"
+#include "line_index.h"
+#include "read_core.h"
+#include "spool.h"
+#include "term.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vimcat/async.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+// An asynchronous render drives the same Vim session `read_session` does, but
+// with Vim’s output pipe made non-blocking so `term_send` returns EAGAIN rather
+// than waiting, retaining any partially received escape sequence until the next
+// step.
+//
+// Once Vim closes its output it still needs to be reaped. On Linux, we hold a
+// pidfd for Vim that becomes readable when it exits. The caller is given an
+// epoll instance watching both this and the pipe, so they have a single
+// descriptor to wait on throughout. Elsewhere (or on kernels without pidfds),
+// the caller waits on the pipe itself and Vim is reaped with a blocking wait
+// after it closes the pipe, which it does only as it exits.
+
+struct vimcat_async {
+  int (*callback)(void *state, char *line);
+  void *state;
+
+  window_t *windows;
+  size_t n_windows;
+  size_t next; ///< index of the next window expected from Vim
+
+  term_t *term;
+  spool_t script; ///< script Vim is running, to be kept until it exits
+  int out;        ///< Vim’s output, or -1 once closed
+  pid_t vim;      ///< Vim’s PID, or 0 once reaped
+  int pidfd;      ///< descriptor referring to Vim, or -1 if unavailable
+  int epoll;      ///< epoll instance given to the caller, or -1 if unavailable
+
+  bool refused;  ///< did the caller’s callback return non-zero?
+  bool finished; ///< has the render completed or failed?
+  int rc;        ///< result of the render, once finished
+};
+
+/// get a descriptor that becomes readable when Vim exits
+static int open_pidfd(pid_t vim) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  const long fd = syscall(SYS_pidfd_open, vim, 0);
+  if (fd < 0) {
+    DEBUG("pidfd_open failed: %s", strerror(errno));
+    return -1;
+  }
+  (void)fcntl((int)fd, F_SETFD, FD_CLOEXEC);
+  return (int)fd;
+#else
+  (void)vim;
+  return -1;
+#endif
+}
+
+/// create an epoll instance watching Vim’s output and, if we have it, its pidfd
+static int open_epoll(int out, int pidfd) {
+#ifdef __linux__
+  const int fd = epoll_create1(EPOLL_CLOEXEC);
+  if (ERROR(fd < 0))
+    return -1;
+
+  struct epoll_event event = {.events = EPOLLIN, .data = {.fd = out}};
+  if (ERROR(epoll_ctl(fd, EPOLL_CTL_ADD, out, &event) < 0)) {
+    (void)close(fd);
+    return -1;
+  }
+
+  if (pidfd >= 0) {
+    event = (struct epoll_event){.events = EPOLLIN, .data = {.fd = pidfd}};
+    if (ERROR(epoll_ctl(fd, EPOLL_CTL_ADD, pidfd, &event) < 0)) {
+      (void)close(fd);
+      return -1;
+    }
+  }
+
+  return fd;
+#else
+  (void)out;
+  (void)pidfd;
+  return -1;
+#endif
+}
+
+/// close Vim’s output, once it is exhausted or no longer wanted
+static void close_output(vimcat_async_t *a) {
+  assert(a != NULL);
+  assert(a->out >= 0);
+
+  // stop watching the pipe, which would otherwise keep reporting EOF
+#ifdef __linux__
+  if (a->epoll >= 0)
+    (void)epoll_ctl(a->epoll, EPOLL_CTL_DEL, a->out, NULL);
+#endif
+
+  (void)close(a->out);
+  a->out = -1;
+}
+
+/// kill Vim and wait for it to exit
+static void kill_vim(vimcat_async_t *a) {
+  assert(a != NULL);
+  assert(a->vim > 0);
+
+  // signal via the pidfd if we have one, as this cannot race with Vim being
+  // reaped and its PID reused
+  bool signalled = false;
+#if defined(__linux__) && defined(SYS_pidfd_send_signal)
+  if (a->pidfd >= 0)
+    signalled =
+        syscall(SYS_pidfd_send_signal, a->pidfd, SIGKILL, NULL, 0) == 0;
+#endif
+  if (!signalled)
+    (void)kill(a->vim, SIGKILL);
+
+  (void)wait_vim(a->vim);
+  a->vim = 0;
+}
+
+/// finish the render, cleaning up after Vim if it is still running
+static void finish(vimcat_async_t *a, int rc) {
+  assert(a != NULL);
+  assert(!a->finished);
+
+  if (a->out >= 0)
+    close_output(a);
+  if (a->vim > 0)
+    kill_vim(a);
+  if (a->pidfd >= 0) {
+    (void)close(a->pidfd);
+    a->pidfd = -1;
+  }
+
+  a->finished = true;
+  a->rc = rc;
+}
+
+/// make as much progress as possible without blocking
+static int step(vimcat_async_t *a) {
+  assert(a != NULL);
+
+  int rc = 0;
+
+  // receive whatever windows Vim has drawn
+  while (a->out >= 0) {
+    bool framed = false;
+    rc = term_send(a->term, a->out, &framed);
+    if (rc == EAGAIN)
+      return EAGAIN;
+    if (ERROR(rc != 0))
+      return rc;
+
+    // did Vim close its output?
+    if (!framed) {
+      if (ERROR(a->next < a->n_windows)) {
+        // if we saw no frames at all, assume this Vim cannot run our loop
+        return a->next == 0 ? ENOTSUP : EBADMSG;
+      }
+      close_output(a);
+      break;
+    }
+
+    if (ERROR(a->next == a->n_windows))
+      return EBADMSG;
+
+    // pass terminal lines back to the caller
+    const window_t *w = &a->windows[a->next];
+    for (size_t y = 1; y <= w->rows; ++y) {
+      char *line = NULL;
+      if (ERROR((rc = term_readline(a->term, y, &line))))
+        return rc;
+      if (UNLIKELY((rc = a->callback(a->state, line)))) {
+        DEBUG("callback refused line %zu with %d", w->top + y - 1, rc);
+        a->refused = true;
+        return rc;
+      }
+    }
+    ++a->next;
+  }
+
+  // without a pidfd to tell us when Vim has exited, it is closing its output
+  // that tells us it is exiting
+  if (a->pidfd < 0) {
+    rc = wait_vim(a->vim);
+    a->vim = 0;
+    return rc;
+  }
+
+  bool exited = false;
+  rc = try_wait_vim(a->vim, &exited);
+  if (!exited && rc == 0)
+    return EAGAIN;
+  a->vim = 0;
+  return rc;
+}
+
+/// start Vim rendering the whole of a file
+static int launch(vimcat_async_t *a, const char *filename, size_t rows,
+                  size_t columns) {
+  assert(a != NULL);
+  assert(filename != NULL);
+  assert(rows > 0);
+
+  int rc = 0;
+
+  // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
+  // page through the file in screens of 999 rows if it is taller than this
+  a->n_windows = (rows + 998) / 999;
+  a->windows = calloc(a->n_windows, sizeof(a->windows[0]));
+  if (ERROR(a->windows == NULL))
+    return ENOMEM;
+  for (size_t i = 0; i < a->n_windows; ++i) {
+    a->windows[i].top = 1 + i * 999;
+    a->windows[i].rows =
+        rows - a->windows[i].top + 1 > 999 ? 999 : rows - a->windows[i].top + 1;
+  }
+
+  if (ERROR((rc = start_session(1, &filename, a->n_windows, a->windows,
+                                columns, NULL, &a->term, &a->out, &a->vim,
+                                &a->script))))
+    return rc;
+
+  const int flags = fcntl(a->out, F_GETFL);
+  if (ERROR(flags < 0 || fcntl(a->out, F_SETFL, flags | O_NONBLOCK) < 0))
+    return errno;
+
+  a->pidfd = open_pidfd(a->vim);
+  a->epoll = open_epoll(a->out, a->pidfd);
+
+  // without an epoll instance, the caller can only wait on the pipe
+  if (a->epoll < 0 && a->pidfd >= 0) {
+    (void)close(a->pidfd);
+    a->pidfd = -1;
+  }
+
+  DEBUG("started asynchronous render of %s, waiting on %s", filename,
+        a->epoll < 0    ? "Vim’s output"
+        : a->pidfd < 0 ? "Vim’s output via epoll"
+                       : "Vim’s output and pidfd");
+
+  return 0;
+}
+
+int vimcat_async_start(const char *filename,
+                       int (*callback)(void *state, char *line), void *state,
+                       vimcat_async_t **async) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  if (ERROR(async == NULL))
+    return EINVAL;
+
+  int rc = 0;
+
+  vimcat_async_t *a = calloc(1, sizeof(*a));
+  if (ERROR(a == NULL))
+    return ENOMEM;
+  a->callback = callback;
+  a->state = state;
+  a->script = (spool_t){.fd = -1};
+  a->out = -1;
+  a->pidfd = -1;
+  a->epoll = -1;
+
+  size_t rows = 0;
+  size_t columns = 0;
+  if (ERROR((rc = line_index_extent(filename, &rows, &columns))))
+    goto done;
+
+  DEBUG("%s has %zu rows and %zu columns", filename, rows, columns);
+
+  // an empty file needs no Vim
+  if (rows == 0) {
+    a->finished = true;
+  } else if (ERROR((rc = launch(a, filename, rows, columns)))) {
+    goto done;
+  }
+
+  // success
+  *async = a;
+  a = NULL;
+
+done:
+  vimcat_async_close(&a);
+
+  return rc;
+}
+
+int vimcat_async_fd(const vimcat_async_t *async) {
+
+  if (ERROR(async == NULL))
+    return -1;
+
+  if (async->finished)
+    return -1;
+
+  return async->epoll >= 0 ? async->epoll : async->out;
+}
+
+int vimcat_async_step(vimcat_async_t *async) {
+
+  if (ERROR(async == NULL))
+    return EINVAL;
+
+  if (async->finished)
+    return async->rc;
+
+  // the callback may return EAGAIN itself, which ends the render like any
+  // other refusal rather than meaning Vim has more to send
+  const int rc = step(async);
+  if (rc == EAGAIN && !async->refused)
+    return EAGAIN;
+
+  finish(async, rc);
+  return rc;
+}
+
+void vimcat_async_close(vimcat_async_t **async) {
+
+  if (async == NULL)
+    return;
+
+  if (*async == NULL)
+    return;
+
+  vimcat_async_t *a = *async;
+
+  if (!a->finished) {
+    DEBUG("cancelling asynchronous render");
+    finish(a, ECANCELED);
+  }
+
+  if (a->epoll >= 0)
+    (void)close(a->epoll);
+  term_free(&a->term);
+  spool_close(&a->script);
+  free(a->windows);
+  free(a);
+
+  *async = NULL;
+}
@@ -1,6 +1,8 @@
 /// \file
 /// \brief abstraction for an in-memory buffer
 
+#pragma once
+
 #include "compiler.h"
 #include <stddef.h>
 #include <stdio.h>
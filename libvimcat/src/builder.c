@@ -0,0 +1,53 @@
+#include "builder.h"
+#include "debug.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int builder_grow(builder_t *b, size_t n) {
+  assert(b != NULL);
+
+  if (ERROR(n > SIZE_MAX - b->size))
+    return EOVERFLOW;
+  const size_t needed = b->size + n;
+  if (needed <= b->capacity)
+    return 0;
+
+  // grow geometrically, so a series of appends costs amortised linear time
+  size_t c = b->capacity < 64 ? 64 : b->capacity;
+  while (c < needed)
+    c = c > SIZE_MAX / 2 ? needed : c * 2;
+
+  char *base = realloc(b->base, c);
+  if (ERROR(base == NULL))
+    return ENOMEM;
+  b->base = base;
+  b->capacity = c;
+
+  return 0;
+}
+
+int builder_str(builder_t *b, char **str) {
+  assert(b != NULL);
+  assert(str != NULL);
+
+  const int rc = builder_reserve(b, 1);
+  if (ERROR(rc != 0))
+    return rc;
+  b->base[b->size] = '\0';
+  *str = b->base;
+
+  return 0;
+}
+
+void builder_free(builder_t *b) {
+
+  if (b == NULL)
+    return;
+
+  free(b->base);
+
+  *b = (builder_t){0};
+}
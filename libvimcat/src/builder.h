@@ -0,0 +1,109 @@
+/// \file
+/// \brief a growable string, built up a piece at a time
+///
+/// Unlike a `buffer_t`, a builder is written to directly rather than through a
+/// stream, and is emptied by forgetting its contents rather than erasing them.
+/// So building a string costs in proportion to its length, and once a builder
+/// has grown to fit the strings it is used for, building needs no allocation.
+
+#pragma once
+
+#include "compiler.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+/// a string under construction
+typedef struct {
+  char *base;      ///< content, NUL terminated only by `builder_str`
+  size_t size;     ///< number of bytes of content
+  size_t capacity; ///< number of bytes allocated in `base`
+} builder_t;
+
+/** enlarge a builder’s allocation
+ *
+ * This is the slow path of `builder_reserve`, which should be called instead.
+ *
+ * \param b Builder to grow
+ * \param n Number of bytes to make room for beyond its content
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int builder_grow(builder_t *b, size_t n);
+
+/** ensure there is room to add some bytes to a builder
+ *
+ * On success, the caller may write up to \p n bytes from `base + size` and
+ * then increase `size` by the number written.
+ *
+ * \param b Builder to prepare
+ * \param n Number of bytes to make room for beyond its content
+ * \return 0 on success or an errno on failure
+ */
+static inline int builder_reserve(builder_t *b, size_t n) {
+  assert(b != NULL);
+  if (LIKELY(b->capacity - b->size >= n))
+    return 0;
+  return builder_grow(b, n);
+}
+
+/** append bytes to a builder
+ *
+ * \param b Builder to append to
+ * \param data Bytes to append
+ * \param n Number of bytes in \p data
+ * \return 0 on success or an errno on failure
+ */
+static inline int builder_append(builder_t *b, const char *data, size_t n) {
+  assert(data != NULL || n == 0);
+
+  const int rc = builder_reserve(b, n);
+  if (UNLIKELY(rc != 0))
+    return rc;
+  if (n > 0)
+    memcpy(&b->base[b->size], data, n);
+  b->size += n;
+  return 0;
+}
+
+/** append repetitions of a byte to a builder
+ *
+ * \param b Builder to append to
+ * \param c Byte to append
+ * \param n Number of times to append \p c
+ * \return 0 on success or an errno on failure
+ */
+static inline int builder_fill(builder_t *b, char c, size_t n) {
+  const int rc = builder_reserve(b, n);
+  if (UNLIKELY(rc != 0))
+    return rc;
+  if (n > 0)
+    memset(&b->base[b->size], c, n);
+  b->size += n;
+  return 0;
+}
+
+/** discard a builder’s content, retaining its allocation for reuse
+ *
+ * \param b Builder to clear
+ */
+static inline void builder_clear(builder_t *b) {
+  assert(b != NULL);
+  b->size = 0;
+}
+
+/** NUL terminate a builder’s content
+ *
+ * The terminator is not counted in `size`, so more can be appended afterwards.
+ * The returned string is valid until the builder is next modified.
+ *
+ * \param b Builder to terminate
+ * \param str [out] The content as a string on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int builder_str(builder_t *b, char **str);
+
+/** release a builder’s allocation
+ *
+ * \param b Builder to free, which is left empty
+ */
+INTERNAL void builder_free(builder_t *b);
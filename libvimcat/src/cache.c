@@ -0,0 +1,693 @@
+#include "cache.h"
+#include "buffer.h"
+#include "ctx.h"
+#include "debug.h"
+#include "extent.h"
+#include "hash.h"
+#include "io.h"
+#include "vim.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <vimcat/cache.h>
+#include <vimcat/version.h>
+
+/// protects all state below
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// directory in which to cache renders, or `NULL` not to
+static char *cache_dir;
+
+/// maximum total size of entries in `cache_dir`, or 0 for no limit
+static size_t cache_max;
+
+/// lookup statistics
+static unsigned long hits;
+static unsigned long misses;
+
+/// magic number at the start of a cache entry
+static const char MAGIC[8] = "vimcatrc";
+
+/// version of the cache entry format
+enum { VERSION = 1 };
+
+/// suffix of cache entry filenames
+#define SUFFIX ".render"
+
+/// name of the file recording the approximate total size of entries
+#define SIZE_FILE "size"
+
+/// age in seconds beyond which a temporary file is assumed to be abandoned
+enum { STALE_AGE = 60 * 60 };
+
+/// header of a cache entry, followed by its lines
+typedef struct {
+  char magic[sizeof(MAGIC)];
+  uint64_t version;
+  unsigned char key[sizeof(((digest_t *)0)->bytes)];
+  uint64_t lines; ///< number of lines that follow
+  uint64_t size;  ///< total bytes of the lines that follow
+} header_t;
+
+struct cache_entry {
+  void *base;   ///< mapping of the entry file
+  size_t size;  ///< size of the mapping
+  size_t lines; ///< number of lines following the header
+};
+
+bool cache_enabled(void) {
+  (void)pthread_mutex_lock(&lock);
+  const bool enabled = cache_dir != NULL;
+  (void)pthread_mutex_unlock(&lock);
+  return enabled;
+}
+
+/// modification time of a file
+static struct timespec mtime_of(const struct stat *st) {
+  assert(st != NULL);
+#ifdef __APPLE__
+  return st->st_mtimespec;
+#else
+  return st->st_mtim;
+#endif
+}
+
+/// capture the state of a file
+static cache_stamp_t stamp_of(const struct stat *st) {
+  assert(st != NULL);
+  return (cache_stamp_t){.dev = st->st_dev,
+                         .ino = st->st_ino,
+                         .size = st->st_size,
+                         .mtime = mtime_of(st)};
+}
+
+/// state for measuring and hashing a file in one pass
+typedef struct {
+  extent_t extent;
+  hash_t hash;
+} scan_t;
+
+/// `read_blocks` handler for `cache_scan`
+static bool on_block(void *state, const char *block, size_t size) {
+  scan_t *s = state;
+  (void)extent_feed(&s->extent, block, size);
+  hash_feed(&s->hash, block, size);
+  return true;
+}
+
+int cache_scan(const char *filename, digest_t *content, cache_stamp_t *stamp,
+               size_t *rows, size_t *columns) {
+  assert(filename != NULL);
+  assert(content != NULL);
+  assert(stamp != NULL);
+  assert(rows != NULL);
+  assert(columns != NULL);
+
+  int rc = 0;
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+
+  // note the file’s state before reading it, so a change during or after our
+  // reading can be detected
+  {
+    struct stat st;
+    if (ERROR(fstat(fd, &st) != 0)) {
+      rc = errno;
+      goto done;
+    }
+    *stamp = stamp_of(&st);
+  }
+
+  scan_t s;
+  extent_init(&s.extent, 0);
+  hash_init(&s.hash);
+
+  if (ERROR((rc = read_blocks(fd, filename, on_block, &s, NULL))))
+    goto done;
+
+  extent_finish(&s.extent, rows, columns);
+  *content = hash_finish(&s.hash);
+
+done:
+  (void)close(fd);
+
+  return rc;
+}
+
+/// hash the content of a file, or its absence
+static void hash_file(hash_t *h, const char *path) {
+  assert(h != NULL);
+  assert(path != NULL);
+
+  hash_str(h, path);
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    hash_str(h, NULL);
+    return;
+  }
+
+  char block[4096];
+  while (true) {
+    const ssize_t r = read(fd, block, sizeof(block));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    hash_feed(h, block, (size_t)r);
+  }
+  hash_str(h, "");
+
+  (void)close(fd);
+}
+
+/// hash a file under the user’s home directory
+static void hash_home_file(hash_t *h, const char *home, const char *path) {
+  assert(h != NULL);
+  assert(path != NULL);
+
+  if (home == NULL)
+    return;
+
+  char *full = NULL;
+  if (ERROR(asprintf(&full, "%s/%s", home, path) < 0))
+    return;
+  hash_file(h, full);
+  free(full);
+}
+
+digest_t cache_key(const digest_t *content, const char *filename,
+                   const char *filetype, const vimcat_ctx_t *ctx) {
+  assert(content != NULL);
+
+  hash_t h;
+  hash_init(&h);
+
+  hash_feed(&h, MAGIC, sizeof(MAGIC));
+  hash_str(&h, vimcat_version());
+
+  // what is being rendered, and how
+  hash_feed(&h, content->bytes, sizeof(content->bytes));
+  hash_str(&h, filename);
+  hash_str(&h, filetype);
+  const uint64_t backend = (uint64_t)ctx_backend(ctx);
+  hash_feed(&h, &backend, sizeof(backend));
+
+  // environment that affects Vim’s configuration and colouring
+  static const char *const VARS[] = {"VIMINIT",     "VIM",  "VIMRUNTIME",
+                                     "MYVIMRC",     "TERM", "COLORTERM",
+                                     "XDG_CONFIG_HOME"};
+  for (size_t i = 0; i < sizeof(VARS) / sizeof(VARS[0]); ++i)
+    hash_str(&h, getenv(VARS[i]));
+
+  // the vimrc files Vim may read
+  const char *home = getenv("HOME");
+  hash_home_file(&h, home, ".vimrc");
+  hash_home_file(&h, home, ".vim/vimrc");
+  hash_home_file(&h, home, ".config/vim/vimrc");
+  const char *xdg = getenv("XDG_CONFIG_HOME");
+  hash_home_file(&h, xdg, "vim/vimrc");
+  hash_file(&h, "/etc/vimrc");
+  hash_file(&h, "/etc/vim/vimrc");
+
+  // the Vim executable that will be run
+  const vim_t *vim = NULL;
+  if (vim_find(ctx_vim(ctx), &vim) == 0) {
+    vim_hash(&h, vim);
+  } else {
+    hash_str(&h, NULL);
+  }
+
+  return hash_finish(&h);
+}
+
+char *cache_path(const char *name) {
+  assert(name != NULL);
+
+  char *path = NULL;
+
+  (void)pthread_mutex_lock(&lock);
+  if (cache_dir != NULL) {
+    if (ERROR(asprintf(&path, "%s/%s", cache_dir, name) < 0))
+      path = NULL;
+  }
+  (void)pthread_mutex_unlock(&lock);
+
+  return path;
+}
+
+/// construct the path at which an entry would be stored
+///
+/// \return A path to be freed by the caller, or `NULL` if caching is disabled
+static char *entry_path(const digest_t *key) {
+  assert(key != NULL);
+
+  char name[sizeof(key->bytes) * 2 + sizeof(SUFFIX)];
+  for (size_t i = 0; i < sizeof(key->bytes); ++i)
+    (void)snprintf(&name[i * 2], 3, "%02x", (unsigned)key->bytes[i]);
+  (void)strcpy(&name[sizeof(key->bytes) * 2], SUFFIX);
+
+  return cache_path(name);
+}
+
+static void count(bool hit) {
+  (void)pthread_mutex_lock(&lock);
+  if (hit) {
+    ++hits;
+  } else {
+    ++misses;
+  }
+  (void)pthread_mutex_unlock(&lock);
+}
+
+cache_entry_t *cache_lookup(const digest_t *key) {
+  assert(key != NULL);
+
+  char *path = entry_path(key);
+  if (path == NULL)
+    return NULL;
+
+  cache_entry_t *entry = NULL;
+  void *base = MAP_FAILED;
+  size_t size = 0;
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    goto done;
+
+  struct stat st;
+  if (ERROR(fstat(fd, &st) != 0))
+    goto done;
+  if (st.st_size < (off_t)sizeof(header_t) + 1 ||
+      (uintmax_t)st.st_size > SIZE_MAX)
+    goto done;
+  size = (size_t)st.st_size;
+
+  // map the entry privately and writable, so callers can modify the lines we
+  // give them without affecting the entry
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (ERROR(base == MAP_FAILED))
+    goto done;
+
+  header_t h;
+  memcpy(&h, base, sizeof(h));
+  const char *data = (const char *)base + sizeof(h);
+  if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+      memcmp(h.key, key->bytes, sizeof(h.key)) != 0 ||
+      h.size != size - sizeof(h) || h.lines == 0 || h.lines > h.size ||
+      data[h.size - 1] != '\0') {
+    DEBUG("ignoring corrupt or foreign cache entry %s", path);
+    goto done;
+  }
+
+  entry = calloc(1, sizeof(*entry));
+  if (ERROR(entry == NULL))
+    goto done;
+  entry->base = base;
+  entry->size = size;
+  entry->lines = (size_t)h.lines;
+  base = MAP_FAILED;
+
+  // mark this entry as recently used
+  (void)futimens(fd, NULL);
+
+  DEBUG("cache hit %s", path);
+
+done:
+  count(entry != NULL);
+  if (entry == NULL)
+    DEBUG("cache miss %s", path);
+  if (base != MAP_FAILED)
+    (void)munmap(base, size);
+  if (fd >= 0)
+    (void)close(fd);
+  free(path);
+
+  return entry;
+}
+
+int cache_replay(cache_entry_t *entry,
+                 int (*callback)(void *state, char *line), void *state) {
+  assert(entry != NULL);
+  assert(callback != NULL);
+
+  char *line = (char *)entry->base + sizeof(header_t);
+  const char *end = (const char *)entry->base + entry->size;
+
+  for (size_t i = 0; i < entry->lines; ++i) {
+    char *nul = memchr(line, '\0', (size_t)(end - line));
+    if (ERROR(nul == NULL))
+      return EBADMSG;
+
+    const int rc = callback(state, line);
+    if (UNLIKELY(rc != 0))
+      return rc;
+
+    line = nul + 1;
+  }
+
+  return 0;
+}
+
+void cache_release(cache_entry_t **entry) {
+  assert(entry != NULL);
+
+  if (*entry == NULL)
+    return;
+
+  (void)munmap((*entry)->base, (*entry)->size);
+  free(*entry);
+  *entry = NULL;
+}
+
+int cache_record_open(cache_record_t *r) {
+  assert(r != NULL);
+
+  *r = (cache_record_t){0};
+  return buffer_open(&r->lines);
+}
+
+int cache_record(cache_record_t *r, const char *line) {
+  assert(r != NULL);
+  assert(line != NULL);
+
+  if (ERROR(fputs(line, r->lines.f) < 0))
+    return errno;
+  if (ERROR(fputc('\0', r->lines.f) == EOF))
+    return errno;
+  ++r->count;
+
+  return 0;
+}
+
+/// a file in the cache directory, considered for eviction
+typedef struct {
+  char *name;
+  off_t size;
+  struct timespec mtime;
+} victim_t;
+
+static int cmp_victim(const void *a, const void *b) {
+  const victim_t *x = a;
+  const victim_t *y = b;
+  if (x->mtime.tv_sec != y->mtime.tv_sec)
+    return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+  if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+    return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/// is this the name of a temporary file, as created by `cache_commit` or
+/// `vim_has_echoraw`?
+static bool is_temporary(const char *name) {
+  assert(name != NULL);
+
+  // `mkostemp` replaces the trailing “XXXXXX” of “<entry>.XXXXXX”
+  const size_t len = strlen(name);
+  const size_t random = strlen("XXXXXX");
+  if (len < random || strchr(&name[len - random], '.') != NULL)
+    return false;
+
+  static const char *const SUFFIXES[] = {SUFFIX ".", ".vim."};
+  for (size_t i = 0; i < sizeof(SUFFIXES) / sizeof(SUFFIXES[0]); ++i) {
+    const size_t n = strlen(SUFFIXES[i]);
+    if (len - random > n &&
+        strncmp(&name[len - random - n], SUFFIXES[i], n) == 0)
+      return true;
+  }
+  return false;
+}
+
+/** remove least recently used entries until the cache is within its limit
+ *
+ * Temporary files abandoned by other processes are also removed.
+ *
+ * \param dir Cache directory
+ * \param max Limit on the total size of entries
+ * \param total [out] Total size of the remaining entries on success
+ * \return True on success
+ */
+static bool evict(const char *dir, size_t max, uintmax_t *total) {
+  assert(dir != NULL);
+  assert(total != NULL);
+
+  DIR *d = opendir(dir);
+  if (ERROR(d == NULL))
+    return false;
+
+  bool ok = false;
+  victim_t *victims = NULL;
+  size_t n_victims = 0;
+  *total = 0;
+  const time_t now = time(NULL);
+
+  for (struct dirent *de; (de = readdir(d)) != NULL;) {
+    const size_t len = strlen(de->d_name);
+    const bool temporary = is_temporary(de->d_name);
+    if (!temporary && (len <= strlen(SUFFIX) ||
+                       strcmp(de->d_name + len - strlen(SUFFIX), SUFFIX) != 0))
+      continue;
+
+    struct stat st;
+    if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+
+    // remove temporary files whose writers have long since stopped
+    if (temporary) {
+      if (now - mtime_of(&st).tv_sec > STALE_AGE &&
+          unlinkat(dirfd(d), de->d_name, 0) == 0)
+        DEBUG("removed stale temporary file %s", de->d_name);
+      continue;
+    }
+
+    victim_t *v = realloc(victims, sizeof(victims[0]) * (n_victims + 1));
+    if (ERROR(v == NULL))
+      goto done;
+    victims = v;
+    victims[n_victims].name = strdup(de->d_name);
+    if (ERROR(victims[n_victims].name == NULL))
+      goto done;
+    victims[n_victims].size = st.st_size;
+    victims[n_victims].mtime = mtime_of(&st);
+    ++n_victims;
+    *total += (uintmax_t)st.st_size;
+  }
+
+  if (*total > max) {
+    qsort(victims, n_victims, sizeof(victims[0]), cmp_victim);
+    for (size_t i = 0; i < n_victims && *total > max; ++i) {
+      if (unlinkat(dirfd(d), victims[i].name, 0) == 0) {
+        DEBUG("evicted cache entry %s", victims[i].name);
+        *total -= (uintmax_t)victims[i].size;
+      }
+    }
+  }
+  ok = true;
+
+done:
+  for (size_t i = 0; i < n_victims; ++i)
+    free(victims[i].name);
+  free(victims);
+  (void)closedir(d);
+
+  return ok;
+}
+
+/** add to the recorded total size of entries, evicting entries if this takes
+ * it over the limit
+ *
+ * \param dir Cache directory
+ * \param max Limit on the total size of entries
+ * \param added Size of an entry just inserted
+ */
+static void account(const char *dir, size_t max, uintmax_t added) {
+  assert(dir != NULL);
+
+  char *path = NULL;
+  if (ERROR(asprintf(&path, "%s/" SIZE_FILE, dir) < 0))
+    return;
+
+  // learn the recorded total, if there is one
+  bool known = false;
+  uintmax_t total = 0;
+  {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      char text[32] = {0};
+      const ssize_t r = read(fd, text, sizeof(text) - 1);
+      (void)close(fd);
+      char *end = NULL;
+      if (r > 0) {
+        total = strtoumax(text, &end, 10);
+        known = end != text && *end == '\n';
+      }
+    }
+  }
+
+  // scan the directory if we do not know its size or it is over the limit
+  if (known)
+    total += added;
+  if (!known || total > max) {
+    DEBUG("scanning cache directory %s", dir);
+    if (!evict(dir, max, &total))
+      goto done;
+  }
+
+  {
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (ERROR(fd < 0))
+      goto done;
+    char text[32];
+    const int len = snprintf(text, sizeof(text), "%ju\n", total);
+    (void)write_all(fd, text, (size_t)len);
+    (void)close(fd);
+  }
+
+done:
+  free(path);
+}
+
+void cache_commit(cache_record_t *r, const digest_t *key, const char *source,
+                  const cache_stamp_t *stamp) {
+  assert(r != NULL);
+  assert(key != NULL);
+  assert(source == NULL || stamp != NULL);
+
+  if (r->count == 0)
+    return;
+
+  // if the file has changed since it was hashed, Vim may have rendered content
+  // other than what the key describes
+  if (source != NULL) {
+    struct stat st;
+    const cache_stamp_t now = stat(source, &st) == 0 ? stamp_of(&st)
+                                                     : (cache_stamp_t){0};
+    if (now.dev != stamp->dev || now.ino != stamp->ino ||
+        now.size != stamp->size || now.mtime.tv_sec != stamp->mtime.tv_sec ||
+        now.mtime.tv_nsec != stamp->mtime.tv_nsec) {
+      DEBUG("%s changed while being rendered; not caching it", source);
+      return;
+    }
+  }
+
+  char *path = entry_path(key);
+  if (path == NULL)
+    return;
+
+  char *dir = NULL;
+  size_t max = 0;
+  char *tmp = NULL;
+  int fd = -1;
+
+  // write to a temporary file and then move it into place, so concurrent
+  // readers never see a partial entry
+  if (ERROR(asprintf(&tmp, "%s.XXXXXX", path) < 0)) {
+    tmp = NULL;
+    goto done;
+  }
+  fd = mkostemp(tmp, O_CLOEXEC);
+  if (ERROR(fd < 0))
+    goto done;
+
+  buffer_sync(&r->lines);
+  header_t h = {.version = VERSION,
+                .lines = r->count,
+                .size = r->lines.size};
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  memcpy(h.key, key->bytes, sizeof(h.key));
+
+  int rc = 0;
+  if (ERROR((rc = write_all(fd, &h, sizeof(h)))))
+    goto done;
+  if (ERROR((rc = write_all(fd, r->lines.base, r->lines.size))))
+    goto done;
+
+  {
+    const int c = close(fd);
+    fd = -1;
+    if (ERROR(c != 0) || ERROR(rename(tmp, path) != 0))
+      goto done;
+  }
+  free(tmp);
+  tmp = NULL;
+  DEBUG("saved cache entry %s", path);
+
+  // take a copy of the configuration, so we can scan without holding the lock
+  (void)pthread_mutex_lock(&lock);
+  if (cache_dir != NULL)
+    dir = strdup(cache_dir);
+  max = cache_max;
+  (void)pthread_mutex_unlock(&lock);
+
+  if (dir != NULL && max != 0)
+    account(dir, max, sizeof(h) + r->lines.size);
+
+done:
+  if (fd >= 0)
+    (void)close(fd);
+  if (tmp != NULL)
+    (void)unlink(tmp);
+  free(tmp);
+  free(dir);
+  free(path);
+}
+
+void cache_record_close(cache_record_t *r) {
+  assert(r != NULL);
+
+  buffer_close(&r->lines);
+  *r = (cache_record_t){0};
+}
+
+int vimcat_set_cache_dir(const char *path, size_t max_size) {
+
+  char *copy = NULL;
+  if (path != NULL) {
+    struct stat st;
+    if (ERROR(stat(path, &st) < 0))
+      return errno;
+    if (ERROR(!S_ISDIR(st.st_mode)))
+      return ENOTDIR;
+
+    copy = strdup(path);
+    if (ERROR(copy == NULL))
+      return ENOMEM;
+  }
+
+  (void)pthread_mutex_lock(&lock);
+  char *old = cache_dir;
+  cache_dir = copy;
+  cache_max = max_size;
+  (void)pthread_mutex_unlock(&lock);
+
+  free(old);
+
+  return 0;
+}
+
+void vimcat_cache_stats(unsigned long *hits_out, unsigned long *misses_out) {
+  (void)pthread_mutex_lock(&lock);
+  if (hits_out != NULL)
+    *hits_out = hits;
+  if (misses_out != NULL)
+    *misses_out = misses;
+  (void)pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,139 @@
+/// \file
+/// \brief on-disk cache of rendered files
+///
+/// An entry is a header followed by the rendered lines of a file, each NUL
+/// terminated. Entries are mapped into memory when read, so replaying one
+/// passes pointers straight into the mapping to the caller. Entries are written
+/// under a temporary name and renamed into place, so concurrent readers never
+/// see a partial entry. An entry’s modification time is refreshed each time it
+/// is used, which is what eviction orders entries by.
+///
+/// The approximate total size of the entries is kept in a file alongside them,
+/// and added to as entries are inserted, so the directory need only be scanned
+/// when this exceeds the limit. Concurrent updates to it may be lost, which
+/// each scan corrects. A scan also removes temporary files left behind by
+/// processes that died while writing them.
+///
+/// See vimcat/cache.h for what the key of an entry covers.
+
+#pragma once
+
+#include "buffer.h"
+#include "compiler.h"
+#include "hash.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <vimcat/ctx.h>
+
+/// is a cache directory configured?
+INTERNAL bool cache_enabled(void);
+
+/** construct the path of a file within the cache directory
+ *
+ * \param name Filename within the directory
+ * \return A path to be freed by the caller, or `NULL` if caching is disabled
+ */
+INTERNAL char *cache_path(const char *name);
+
+/// identity and state of a file, to tell whether it has changed
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+} cache_stamp_t;
+
+/** measure a file and hash its content in a single pass
+ *
+ * \param filename File to scan
+ * \param content [out] Digest of the file’s content on success
+ * \param stamp [out] State of the file before it was read, on success
+ * \param rows [out] Number of lines on success
+ * \param columns [out] Width of the widest line on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int cache_scan(const char *filename, digest_t *content,
+                        cache_stamp_t *stamp, size_t *rows, size_t *columns);
+
+/** derive the key under which a render is cached
+ *
+ * \param content Digest of the text being rendered
+ * \param filename Name by which Vim will see the text, or `NULL` if it is
+ *   anonymous
+ * \param filetype Filetype Vim is told to use, or `NULL` if it will detect it
+ * \param ctx Context the render is performed through, or `NULL`
+ * \return A key covering these and the environment Vim will run in
+ */
+INTERNAL digest_t cache_key(const digest_t *content, const char *filename,
+                            const char *filetype, const vimcat_ctx_t *ctx);
+
+/// a cached render
+typedef struct cache_entry cache_entry_t;
+
+/** find a cached render
+ *
+ * \param key Key of the render
+ * \return The cached entry, or `NULL` if there was none
+ */
+INTERNAL cache_entry_t *cache_lookup(const digest_t *key);
+
+/** pass the lines of a cached render to a callback
+ *
+ * \param entry Entry to replay
+ * \param callback Handler for each line
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success or the last non-zero return from the callback
+ */
+INTERNAL int cache_replay(cache_entry_t *entry,
+                          int (*callback)(void *state, char *line),
+                          void *state);
+
+/** release a cached render
+ *
+ * \param entry [inout] Entry to release, which is set to `NULL`
+ */
+INTERNAL void cache_release(cache_entry_t **entry);
+
+/// a render being recorded for later insertion in the cache
+typedef struct {
+  buffer_t lines; ///< rendered lines, each NUL terminated
+  size_t count;   ///< number of lines in `lines`
+} cache_record_t;
+
+/** start recording a render
+ *
+ * \param r Recording to initialise
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int cache_record_open(cache_record_t *r);
+
+/** add a line to a recording
+ *
+ * \param r Recording to extend
+ * \param line Rendered line
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int cache_record(cache_record_t *r, const char *line);
+
+/** insert a completed recording into the cache
+ *
+ * Failure to do so is not an error, as the cache is only an optimisation. The
+ * key covers the content of the file as it was hashed, while Vim read the file
+ * later. So if the file has changed since it was hashed, the recording is not
+ * inserted, as it may be of different content.
+ *
+ * \param r Recording to insert
+ * \param key Key to insert it under
+ * \param source File that was rendered, or `NULL` if it cannot have changed
+ * \param stamp State of \p source when it was hashed, if \p source is given
+ */
+INTERNAL void cache_commit(cache_record_t *r, const digest_t *key,
+                           const char *source, const cache_stamp_t *stamp);
+
+/** discard a recording
+ *
+ * \param r Recording to discard
+ */
+INTERNAL void cache_record_close(cache_record_t *r);
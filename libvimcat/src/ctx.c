@@ -0,0 +1,201 @@
+#include "ctx.h"
+#include "buffer.h"
+#include "debug.h"
+#include "read_core.h"
+#include "term.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/backend.h>
+#include <vimcat/ctx.h>
+
+vimcat_backend_t ctx_backend(const vimcat_ctx_t *ctx) {
+  if (ctx == NULL)
+    return vimcat_get_backend();
+  return ctx->backend;
+}
+
+const char *ctx_vim(const vimcat_ctx_t *ctx) {
+  if (ctx == NULL || ctx->vim == NULL)
+    return "vim";
+  return ctx->vim;
+}
+
+int ctx_term(vimcat_ctx_t *ctx, term_t **t, size_t columns, size_t rows) {
+  assert(t != NULL);
+
+  if (ctx == NULL || ctx->term == NULL)
+    return term_new(t, columns, rows);
+
+  int rc = 0;
+  if (ERROR((rc = term_resize(&ctx->term, columns, rows))))
+    return rc;
+
+  *t = ctx->term;
+  ctx->term = NULL;
+
+  return 0;
+}
+
+void ctx_term_release(vimcat_ctx_t *ctx, term_t **t) {
+  assert(t != NULL);
+
+  if (*t == NULL)
+    return;
+
+  // keep the terminal for the next render, unless we already have one
+  if (ctx != NULL && ctx->term == NULL) {
+    ctx->term = *t;
+    *t = NULL;
+    return;
+  }
+
+  term_free(t);
+}
+
+int vimcat_ctx_new(vimcat_ctx_t **ctx) {
+
+  if (ERROR(ctx == NULL))
+    return EINVAL;
+
+  vimcat_ctx_t *c = calloc(1, sizeof(*c));
+  if (ERROR(c == NULL))
+    return ENOMEM;
+
+  c->backend = VIMCAT_BACKEND_TERMINAL;
+
+  int rc = 0;
+  if (ERROR((rc = buffer_open(&c->script)))) {
+    free(c);
+    return rc;
+  }
+
+  *ctx = c;
+  return 0;
+}
+
+void vimcat_ctx_set_debug(vimcat_ctx_t *ctx, FILE *stream) {
+
+  if (ERROR(ctx == NULL))
+    return;
+
+  ctx->debug = stream;
+}
+
+int vimcat_ctx_set_backend(vimcat_ctx_t *ctx, vimcat_backend_t backend) {
+
+  if (ERROR(ctx == NULL))
+    return EINVAL;
+
+  if (ERROR(backend != VIMCAT_BACKEND_TERMINAL &&
+            backend != VIMCAT_BACKEND_HEADLESS))
+    return EINVAL;
+
+  ctx->backend = backend;
+  return 0;
+}
+
+/// replace a string setting of a context
+static int set_string(char **setting, const char *value) {
+  assert(setting != NULL);
+
+  char *copy = NULL;
+  if (value != NULL) {
+    copy = strdup(value);
+    if (ERROR(copy == NULL))
+      return ENOMEM;
+  }
+
+  free(*setting);
+  *setting = copy;
+  return 0;
+}
+
+int vimcat_ctx_set_vim(vimcat_ctx_t *ctx, const char *vim) {
+
+  if (ERROR(ctx == NULL))
+    return EINVAL;
+
+  if (ERROR(vim != NULL && vim[0] == '\0'))
+    return EINVAL;
+
+  return set_string(&ctx->vim, vim);
+}
+
+int vimcat_ctx_set_filetype(vimcat_ctx_t *ctx, const char *filetype) {
+
+  if (ERROR(ctx == NULL))
+    return EINVAL;
+
+  if (ERROR(filetype != NULL && !is_filetype(filetype)))
+    return EINVAL;
+
+  return set_string(&ctx->filetype, filetype);
+}
+
+/// `vimcat_ctx_read_range`, once debug messages are routed to the context
+static int read_range(vimcat_ctx_t *ctx, const char *filename,
+                      unsigned long first, unsigned long last,
+                      int (*callback)(void *state, char *line), void *state) {
+  assert(ctx != NULL);
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(first == 0))
+    return EINVAL;
+
+  if (ERROR(last != 0 && first > last))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  const render_opts_t opts = {.filetype = ctx->filetype, .ctx = ctx};
+  return read_core(filename, (size_t)first, (size_t)last, 1, &opts, callback,
+                   state);
+}
+
+int vimcat_ctx_read_range(vimcat_ctx_t *ctx, const char *filename,
+                          unsigned long first, unsigned long last,
+                          int (*callback)(void *state, char *line),
+                          void *state) {
+
+  if (ERROR(ctx == NULL))
+    return EINVAL;
+
+  // route this thread’s debug messages to the context for the duration
+  FILE *const *const outer = debug_sink;
+  debug_sink = &ctx->debug;
+
+  const int rc = read_range(ctx, filename, first, last, callback, state);
+
+  debug_sink = outer;
+
+  return rc;
+}
+
+int vimcat_ctx_read(vimcat_ctx_t *ctx, const char *filename,
+                    int (*callback)(void *state, char *line), void *state) {
+  return vimcat_ctx_read_range(ctx, filename, 1, 0, callback, state);
+}
+
+void vimcat_ctx_free(vimcat_ctx_t **ctx) {
+
+  if (ctx == NULL)
+    return;
+
+  if (*ctx == NULL)
+    return;
+
+  term_free(&(*ctx)->term);
+  buffer_close(&(*ctx)->script);
+  free((*ctx)->filetype);
+  free((*ctx)->vim);
+  free(*ctx);
+
+  *ctx = NULL;
+}
@@ -0,0 +1,52 @@
+/// \file
+/// \brief internals of rendering contexts
+///
+/// Internal functions take a context that may be `NULL`, meaning the
+/// process-wide defaults and no reuse of working memory, as the `vimcat_read*`
+/// functions have always behaved.
+
+#pragma once
+
+#include "buffer.h"
+#include "compiler.h"
+#include "term.h"
+#include <stdio.h>
+#include <vimcat/backend.h>
+#include <vimcat/ctx.h>
+
+struct vimcat_ctx {
+  FILE *debug;              ///< destination for debug messages
+  vimcat_backend_t backend; ///< backend to render with
+  char *vim;                ///< Vim to run, or `NULL` to search `$PATH`
+  char *filetype;           ///< filetype to give files, or `NULL` to detect
+
+  term_t *term;    ///< terminal kept between renders, if any
+  buffer_t script; ///< scratch space for constructing Vim commands
+};
+
+/// which backend should a render use?
+INTERNAL vimcat_backend_t ctx_backend(const vimcat_ctx_t *ctx);
+
+/// name or path of the Vim to run
+INTERNAL const char *ctx_vim(const vimcat_ctx_t *ctx);
+
+/** obtain a terminal of the given dimensions
+ *
+ * If the context holds a terminal from a previous render, this is resized and
+ * handed out instead of allocating a new one.
+ *
+ * \param ctx Context to take a terminal from, or `NULL`
+ * \param t [out] A reset terminal on success
+ * \param columns Width of the terminal
+ * \param rows Height of the terminal
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int ctx_term(vimcat_ctx_t *ctx, term_t **t, size_t columns,
+                      size_t rows);
+
+/** return a terminal obtained from `ctx_term`
+ *
+ * \param ctx Context the terminal was taken from, or `NULL`
+ * \param t [inout] Terminal to return, which is set to `NULL`
+ */
+INTERNAL void ctx_term_release(vimcat_ctx_t *ctx, term_t **t);
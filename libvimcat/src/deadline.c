@@ -0,0 +1,44 @@
+#include "deadline.h"
+#include "debug.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// current time on the monotonic clock in milliseconds
+static uint64_t now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+deadline_t deadline_after(unsigned long timeout) {
+  // avoid producing 0, which means no deadline
+  return now() + timeout + 1;
+}
+
+bool deadline_passed(deadline_t deadline) {
+  return deadline != 0 && now() >= deadline;
+}
+
+int deadline_poll(deadline_t deadline, int fd) {
+  while (true) {
+    int timeout = -1;
+    if (deadline != 0) {
+      const uint64_t t = now();
+      if (t >= deadline)
+        return ETIMEDOUT;
+      timeout = deadline - t > INT32_MAX ? INT32_MAX : (int)(deadline - t);
+    }
+
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    const int r = poll(&p, 1, timeout);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (ERROR(r < 0))
+      return errno;
+    if (r > 0)
+      return 0;
+  }
+}
@@ -0,0 +1,30 @@
+/// \file
+/// \brief bounding how long a render may wait on Vim
+
+#pragma once
+
+#include "compiler.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// a time on the monotonic clock in milliseconds, or 0 for no deadline
+typedef uint64_t deadline_t;
+
+/** compute the deadline a given time from now
+ *
+ * \param timeout Milliseconds from now
+ * \return A deadline, which is never 0
+ */
+INTERNAL deadline_t deadline_after(unsigned long timeout);
+
+/// has the given deadline passed?
+INTERNAL bool deadline_passed(deadline_t deadline);
+
+/** wait for a descriptor to become readable
+ *
+ * \param deadline Time at which to stop waiting, or 0 to wait indefinitely
+ * \param fd Descriptor to wait on
+ * \return 0 if \p fd is readable, ETIMEDOUT if \p deadline passed first, or
+ *   another errno on failure
+ */
+INTERNAL int deadline_poll(deadline_t deadline, int fd);
@@ -5,6 +5,8 @@
 
 FILE *vimcat_debug;
 
+_Thread_local FILE *const *debug_sink;
+
 FILE *vimcat_set_debug(FILE *stream) {
   FILE *old = vimcat_debug;
   vimcat_debug = stream;
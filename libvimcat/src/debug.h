@@ -9,16 +9,27 @@
 
 extern FILE *vimcat_debug INTERNAL;
 
+/// While a thread is making a call on a `vimcat_ctx_t`, its debug messages go
+/// to the context’s stream instead of `vimcat_debug`. This points at that
+/// stream, or is `NULL` when the thread is not within such a call.
+extern _Thread_local FILE *const *debug_sink INTERNAL;
+
+/// where should this thread’s debug messages go?
+static inline FILE *debug_stream(void) {
+  return debug_sink != NULL ? *debug_sink : vimcat_debug;
+}
+
 /// emit a debug message
 #define DEBUG(...)                                                             \
   do {                                                                         \
-    if (UNLIKELY(vimcat_debug != NULL)) {                                      \
+    FILE *const stream_ = debug_stream();                                      \
+    if (UNLIKELY(stream_ != NULL)) {                                           \
       const char *name_ = strrchr(__FILE__, '/');                              \
-      flockfile(vimcat_debug);                                                 \
-      fprintf(vimcat_debug, "[VIMCAT] libvimcat/src%s:%d: ", name_, __LINE__); \
-      fprintf(vimcat_debug, __VA_ARGS__);                                      \
-      fprintf(vimcat_debug, "\n");                                             \
-      funlockfile(vimcat_debug);                                               \
+      flockfile(stream_);                                                      \
+      fprintf(stream_, "[VIMCAT] libvimcat/src%s:%d: ", name_, __LINE__);      \
+      fprintf(stream_, __VA_ARGS__);                                           \
+      fprintf(stream_, "\n");                                                  \
+      funlockfile(stream_);                                                    \
     }                                                                          \
   } while (0)
 
@@ -0,0 +1,377 @@
+#include "extent.h"
+#include "compiler.h"
+#include "debug.h"
+#include "io.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#else
+#define HAVE_X86 0
+#endif
+
+void extent_init(extent_t *e, size_t limit) {
+  assert(e != NULL);
+
+  *e = (extent_t){.limit = limit, .lines = 1};
+}
+
+/// account for a line ending
+///
+/// \param e Measurement state
+/// \param cr Was the "\n" preceded by a "\r"?
+/// \param next Byte offset at which the following line starts
+static void end_line(extent_t *e, bool cr, size_t next) {
+  assert(e != NULL);
+
+  // the "\r" of a Windows line ending was counted as a character, so uncount it
+  if (cr) {
+    assert(e->width > 0);
+    --e->width;
+  }
+
+  if (e->on_line != NULL)
+    e->on_line(e->on_line_state, e->line_start, e->width);
+  e->line_start = next;
+
+  ++e->lines;
+  if (e->max_width < e->width)
+    e->max_width = e->width;
+  e->width = 0;
+  e->last = '\n';
+  e->bare_lf = !cr;
+
+  // have we scanned as far as the caller requested?
+  if (e->limit != 0 && e->lines > e->limit)
+    e->done = true;
+}
+
+/// measure `data[from]` to `data[length - 1]` a byte at a time
+///
+/// \return Offset within \p data up to which bytes were consumed
+static size_t feed_scalar(extent_t *e, const char *data, size_t from,
+                          size_t length) {
+  assert(e != NULL);
+  assert(data != NULL || length == 0);
+  assert(from <= length);
+
+  for (size_t i = from; i < length; ++i) {
+    const char c = data[i];
+
+    if (c == '\n') {
+      end_line(e, e->last == '\r', e->offset + i + 1);
+      if (e->done)
+        return i + 1;
+      continue;
+    }
+
+    // assume a tab stop is ≤ 8 characters and anything else is a single
+    // character
+    e->width += c == '\t' ? 8 : 1;
+    e->last = c;
+    e->bare_lf = false;
+  }
+
+  return length;
+}
+
+#if HAVE_X86
+
+/// bits [from, to) of a 64-bit mask
+static uint64_t bits(unsigned from, unsigned to) {
+  assert(from <= to);
+  assert(to <= 64);
+  const uint64_t upto = to == 64 ? UINT64_MAX : (UINT64_C(1) << to) - 1;
+  const uint64_t below = from == 64 ? UINT64_MAX : (UINT64_C(1) << from) - 1;
+  return upto & ~below;
+}
+
+/** measure a 64-byte block, given masks of where its newlines and tabs are
+ *
+ * \param e Measurement state
+ * \param block Start of the block
+ * \param at Byte offset of the block within the current feed
+ * \param lf Bit i is set if `block[i]` is a "\n"
+ * \param tab Bit i is set if `block[i]` is a "\t"
+ * \return Number of bytes consumed
+ */
+static size_t feed_block(extent_t *e, const char *block, size_t at,
+                         uint64_t lf, uint64_t tab) {
+  assert(e != NULL);
+  assert(block != NULL);
+
+  // fast path for the common case of a block within a line
+  if (LIKELY(lf == 0)) {
+    e->width += 64 + 7 * (size_t)__builtin_popcountll(tab);
+    e->last = block[63];
+    e->bare_lf = false;
+    return 64;
+  }
+
+  unsigned start = 0;
+  for (; lf != 0; lf &= lf - 1) {
+    const unsigned end = (unsigned)__builtin_ctzll(lf);
+    e->width += end - start +
+                7 * (size_t)__builtin_popcountll(tab & bits(start, end));
+    const char prior = end > 0 ? block[end - 1] : e->last;
+    end_line(e, prior == '\r', e->offset + at + end + 1);
+    start = end + 1;
+    if (e->done)
+      return start;
+  }
+
+  if (start < 64) {
+    e->width +=
+        64 - start + 7 * (size_t)__builtin_popcountll(tab & bits(start, 64));
+    e->last = block[63];
+    e->bare_lf = false;
+  }
+
+  return 64;
+}
+
+#ifdef __SSE2__
+static size_t feed_sse2(extent_t *e, const char *data, size_t length) {
+  assert(e != NULL);
+  assert(data != NULL || length == 0);
+
+  const __m128i LF = _mm_set1_epi8('\n');
+  const __m128i TAB = _mm_set1_epi8('\t');
+
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    uint64_t lf = 0;
+    uint64_t tab = 0;
+    for (unsigned j = 0; j < 64; j += 16) {
+      const __m128i v = _mm_loadu_si128((const void *)&data[i + j]);
+      lf |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, LF)) << j;
+      tab |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, TAB))
+             << j;
+    }
+    const size_t consumed = feed_block(e, &data[i], i, lf, tab);
+    if (e->done)
+      return i + consumed;
+  }
+
+  return feed_scalar(e, data, i, length);
+}
+#endif
+
+__attribute__((target("avx2"))) static size_t
+feed_avx2(extent_t *e, const char *data, size_t length) {
+  assert(e != NULL);
+  assert(data != NULL || length == 0);
+
+  const __m256i LF = _mm256_set1_epi8('\n');
+  const __m256i TAB = _mm256_set1_epi8('\t');
+
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    const __m256i lo = _mm256_loadu_si256((const void *)&data[i]);
+    const __m256i hi = _mm256_loadu_si256((const void *)&data[i + 32]);
+    const uint64_t lf =
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, LF)) |
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, LF))
+            << 32;
+    const uint64_t tab =
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, TAB)) |
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, TAB))
+            << 32;
+    const size_t consumed = feed_block(e, &data[i], i, lf, tab);
+    if (e->done)
+      return i + consumed;
+  }
+
+  return feed_scalar(e, data, i, length);
+}
+
+#endif
+
+/// implementation selected by `extent_use`
+static extent_impl_t selected = EXTENT_AUTO;
+
+bool extent_use(extent_impl_t impl) {
+  switch (impl) {
+  case EXTENT_AUTO:
+  case EXTENT_SCALAR:
+    break;
+  case EXTENT_SSE2:
+#if HAVE_X86 && defined(__SSE2__)
+    break;
+#else
+    return false;
+#endif
+  case EXTENT_AVX2:
+#if HAVE_X86
+    if (!__builtin_cpu_supports("avx2"))
+      return false;
+    break;
+#else
+    return false;
+#endif
+  }
+  selected = impl;
+  return true;
+}
+
+/// dispatch to the selected implementation
+static size_t feed(extent_t *e, const char *data, size_t length) {
+  assert(e != NULL);
+  assert(data != NULL || length == 0);
+
+  switch (selected) {
+  case EXTENT_AUTO:
+#if HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+      return feed_avx2(e, data, length);
+#endif
+#if HAVE_X86 && defined(__SSE2__)
+    return feed_sse2(e, data, length);
+#else
+    return feed_scalar(e, data, 0, length);
+#endif
+  case EXTENT_SCALAR:
+    return feed_scalar(e, data, 0, length);
+#if HAVE_X86 && defined(__SSE2__)
+  case EXTENT_SSE2:
+    return feed_sse2(e, data, length);
+#endif
+#if HAVE_X86
+  case EXTENT_AVX2:
+    return feed_avx2(e, data, length);
+#endif
+  default:
+    UNREACHABLE();
+  }
+
+  return feed_scalar(e, data, 0, length);
+}
+
+size_t extent_feed(extent_t *e, const char *data, size_t length) {
+  assert(e != NULL);
+  assert(data != NULL || length == 0);
+
+  if (e->done)
+    return 0;
+
+  const size_t consumed = feed(e, data, length);
+  e->offset += consumed;
+
+  return consumed;
+}
+
+void extent_finish(const extent_t *e, size_t *rows, size_t *columns) {
+  assert(e != NULL);
+  assert(rows != NULL);
+  assert(columns != NULL);
+
+  *columns = e->max_width < e->width ? e->width : e->max_width;
+
+  // if the text ended with a newline, we do not count the next (empty) line
+  *rows = e->lines;
+  if (e->bare_lf) {
+    assert(*rows > 1);
+    --*rows;
+  }
+}
+
+/// `read_blocks` handler for measuring a file
+static bool on_block(void *state, const char *block, size_t size) {
+  extent_t *e = state;
+  (void)extent_feed(e, block, size);
+  return !e->done;
+}
+
+/// measure a file with a prepared measurement state
+static int scan(const char *filename, extent_t *e) {
+  assert(filename != NULL);
+  assert(e != NULL);
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+
+  const int rc = read_blocks(fd, filename, on_block, e, NULL);
+  (void)close(fd);
+
+  return rc;
+}
+
+int get_extent(const char *filename, size_t limit, size_t *rows,
+               size_t *columns) {
+  assert(filename != NULL);
+  assert(rows != NULL);
+  assert(columns != NULL);
+
+  extent_t e;
+  extent_init(&e, limit);
+
+  const int rc = scan(filename, &e);
+  if (ERROR(rc != 0))
+    return rc;
+
+  extent_finish(&e, rows, columns);
+
+  return 0;
+}
+
+/// state for measuring the widest line within a range
+typedef struct {
+  size_t first;  ///< 1-indexed first line of interest
+  size_t lineno; ///< 1-indexed number of the next line to complete
+  size_t width;  ///< width of the widest line of interest so far
+} range_t;
+
+static void on_range_line(void *state, size_t start, size_t width) {
+  assert(state != NULL);
+
+  (void)start;
+
+  range_t *r = state;
+  if (r->lineno >= r->first && r->width < width)
+    r->width = width;
+  ++r->lineno;
+}
+
+int get_extent_range(const char *filename, size_t first, size_t last,
+                     size_t *rows, size_t *columns) {
+  assert(filename != NULL);
+  assert(first > 0);
+  assert(last == 0 || first <= last);
+  assert(rows != NULL);
+  assert(columns != NULL);
+
+  // if we want every line from the start, there is nothing to exclude
+  if (first == 1)
+    return get_extent(filename, last, rows, columns);
+
+  extent_t e;
+  extent_init(&e, last);
+  range_t r = {.first = first, .lineno = 1};
+  e.on_line = on_range_line;
+  e.on_line_state = &r;
+
+  const int rc = scan(filename, &e);
+  if (ERROR(rc != 0))
+    return rc;
+
+  size_t ignored;
+  extent_finish(&e, rows, &ignored);
+
+  // account for the final line, which has no line ending to trigger
+  // `on_range_line`
+  if (*rows == r.lineno)
+    on_range_line(&r, e.line_start, e.width);
+
+  *columns = r.width;
+
+  return 0;
+}
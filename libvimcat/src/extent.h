@@ -0,0 +1,107 @@
+/// \file
+/// \brief measuring the dimensions of text
+///
+/// Text can be measured all at once from a file with `get_extent` or
+/// incrementally, as it becomes available, through an `extent_t`. Either way,
+/// a line ends at "\n" or "\r\n", a tab is assumed to occupy 8 columns, and
+/// every other byte is assumed to occupy 1 column. This over-counts the width
+/// required for UTF-8 characters, but that is fine for sizing a terminal.
+
+#pragma once
+
+#include "compiler.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// state of an in-progress measurement
+typedef struct {
+  size_t limit;      ///< number of lines after which to stop, or 0 for no limit
+  size_t lines;      ///< number of lines begun so far
+  size_t width;      ///< width of the current line so far
+  size_t max_width;  ///< width of the widest completed line
+  size_t offset;     ///< number of bytes consumed prior to the current feed
+  size_t line_start; ///< byte offset at which the current line began
+  char last;         ///< last byte consumed
+  bool bare_lf;      ///< was the last byte consumed a "\n" without a "\r"?
+  bool done;         ///< has the limit been reached?
+
+  /// optional handler to be told of each completed line
+  void (*on_line)(void *state, size_t start, size_t width);
+  void *on_line_state; ///< state to pass as first parameter to `on_line`
+} extent_t;
+
+/** prepare to measure some text
+ *
+ * The caller can set `on_line` and `on_line_state` after this call if they
+ * need to know the position and width of each line. Note that `on_line` is not
+ * called for the final line, which the caller can find in `line_start` and
+ * `width` after the last feed.
+ *
+ * \param e Measurement state to initialise
+ * \param limit Number of lines after which to stop, or 0 for no limit
+ */
+INTERNAL void extent_init(extent_t *e, size_t limit);
+
+/** measure the next piece of some text
+ *
+ * \param e Measurement state
+ * \param data Text to measure
+ * \param length Number of bytes in \p data
+ * \return Number of bytes consumed, which is less than \p length only if the
+ *   limit was reached
+ */
+INTERNAL size_t extent_feed(extent_t *e, const char *data, size_t length);
+
+/** retrieve the result of a measurement
+ *
+ * \param e Measurement state
+ * \param rows [out] Number of lines seen
+ * \param columns [out] Width of the widest line seen
+ */
+INTERNAL void extent_finish(const extent_t *e, size_t *rows, size_t *columns);
+
+/** learn the number of lines and maximum line width of a text file
+ *
+ * \param filename File to scan
+ * \param limit Number of lines after which to stop scanning, or 0 for no limit
+ * \param rows [out] Number of lines on success
+ * \param columns [out] Width of the widest line on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int get_extent(const char *filename, size_t limit, size_t *rows,
+                        size_t *columns);
+
+/** learn the number of lines of a text file and the maximum width of a range
+ *   of them
+ *
+ * This is equivalent to `get_extent` with a limit of \p last, except that
+ * lines prior to \p first do not contribute to \p columns.
+ *
+ * \param filename File to scan
+ * \param first 1-indexed first line whose width is of interest
+ * \param last Last line whose width is of interest and after which to stop
+ *   scanning, or 0 for no limit
+ * \param rows [out] Number of lines on success
+ * \param columns [out] Width of the widest line in [\p first, \p last] on
+ *   success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int get_extent_range(const char *filename, size_t first, size_t last,
+                              size_t *rows, size_t *columns);
+
+/// implementations of `extent_feed`
+typedef enum {
+  EXTENT_AUTO,   ///< the fastest this machine supports
+  EXTENT_SCALAR, ///< byte-at-a-time
+  EXTENT_SSE2,   ///< 64 bytes at a time using SSE2
+  EXTENT_AVX2,   ///< 64 bytes at a time using AVX2
+} extent_impl_t;
+
+/** select which implementation `extent_feed` uses
+ *
+ * This is only intended for testing and benchmarking. It is not thread-safe.
+ *
+ * \param impl Implementation to use
+ * \return True if the implementation is supported on this machine
+ */
+INTERNAL bool extent_use(extent_impl_t impl);
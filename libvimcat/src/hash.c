@@ -0,0 +1,149 @@
+#include "hash.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t C1 = UINT64_C(0x87c37b91114253d5);
+static const uint64_t C2 = UINT64_C(0x4cf5ad432745937f);
+
+static uint64_t rotl(uint64_t x, unsigned r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix(uint64_t k) {
+  k ^= k >> 33;
+  k *= UINT64_C(0xff51afd7ed558ccd);
+  k ^= k >> 33;
+  k *= UINT64_C(0xc4ceb9fe1a85ec53);
+  k ^= k >> 33;
+  return k;
+}
+
+/// read a little-endian 64-bit value
+static uint64_t get64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+/// mix in a complete 16-byte block
+static void block(hash_t *h, const unsigned char *p) {
+  assert(h != NULL);
+  assert(p != NULL);
+
+  uint64_t k1 = get64(p);
+  uint64_t k2 = get64(p + 8);
+
+  k1 *= C1;
+  k1 = rotl(k1, 31);
+  k1 *= C2;
+  h->h1 ^= k1;
+
+  h->h1 = rotl(h->h1, 27);
+  h->h1 += h->h2;
+  h->h1 = h->h1 * 5 + 0x52dce729;
+
+  k2 *= C2;
+  k2 = rotl(k2, 33);
+  k2 *= C1;
+  h->h2 ^= k2;
+
+  h->h2 = rotl(h->h2, 31);
+  h->h2 += h->h1;
+  h->h2 = h->h2 * 5 + 0x38495ab5;
+}
+
+void hash_init(hash_t *h) {
+  assert(h != NULL);
+
+  *h = (hash_t){0};
+}
+
+void hash_feed(hash_t *h, const void *data, size_t length) {
+  assert(h != NULL);
+  assert(data != NULL || length == 0);
+
+  const unsigned char *p = data;
+  h->length += length;
+
+  // complete any partial block left over from the last feed
+  if (h->tail_length > 0) {
+    const size_t want = sizeof(h->tail) - h->tail_length;
+    const size_t take = length < want ? length : want;
+    memcpy(&h->tail[h->tail_length], p, take);
+    h->tail_length += take;
+    p += take;
+    length -= take;
+    if (h->tail_length < sizeof(h->tail))
+      return;
+    block(h, h->tail);
+    h->tail_length = 0;
+  }
+
+  for (; length >= 16; p += 16, length -= 16)
+    block(h, p);
+
+  memcpy(h->tail, p, length);
+  h->tail_length = length;
+}
+
+void hash_str(hash_t *h, const char *s) {
+  assert(h != NULL);
+
+  if (s == NULL) {
+    // no string contains a NUL, so this cannot collide with one
+    static const char NONE[2] = {'\0', '\0'};
+    hash_feed(h, NONE, sizeof(NONE));
+    return;
+  }
+
+  hash_feed(h, s, strlen(s) + 1);
+}
+
+digest_t hash_finish(const hash_t *h) {
+  assert(h != NULL);
+
+  uint64_t h1 = h->h1;
+  uint64_t h2 = h->h2;
+
+  // mix in the trailing partial block
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  for (size_t i = h->tail_length; i > 8; --i)
+    k2 |= (uint64_t)h->tail[i - 1] << (8 * (i - 9));
+  for (size_t i = h->tail_length < 8 ? h->tail_length : 8; i > 0; --i)
+    k1 |= (uint64_t)h->tail[i - 1] << (8 * (i - 1));
+  if (h->tail_length > 8) {
+    k2 *= C2;
+    k2 = rotl(k2, 33);
+    k2 *= C1;
+    h2 ^= k2;
+  }
+  if (h->tail_length > 0) {
+    k1 *= C1;
+    k1 = rotl(k1, 31);
+    k1 *= C2;
+    h1 ^= k1;
+  }
+
+  h1 ^= h->length;
+  h2 ^= h->length;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix(h1);
+  h2 = fmix(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  digest_t d;
+  for (unsigned i = 0; i < 8; ++i) {
+    d.bytes[i] = (unsigned char)(h1 >> (8 * i));
+    d.bytes[8 + i] = (unsigned char)(h2 >> (8 * i));
+  }
+  return d;
+}
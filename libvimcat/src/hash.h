@@ -0,0 +1,59 @@
+/// \file
+/// \brief incremental 128-bit hashing
+///
+/// This is MurmurHash3 (the x64, 128-bit variant) restructured so data can be
+/// fed to it in pieces. It is not a cryptographic hash. It is used to name
+/// cached renders by their content, where a collision would show stale output
+/// but not compromise anything.
+
+#pragma once
+
+#include "compiler.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// state of an in-progress hash
+typedef struct {
+  uint64_t h1;
+  uint64_t h2;
+  uint64_t length;        ///< total bytes fed so far
+  unsigned char tail[16]; ///< bytes not yet forming a complete block
+  size_t tail_length;     ///< number of valid bytes in `tail`
+} hash_t;
+
+/// a finished hash
+typedef struct {
+  unsigned char bytes[16];
+} digest_t;
+
+/** prepare to hash some data
+ *
+ * \param h Hash state to initialise
+ */
+INTERNAL void hash_init(hash_t *h);
+
+/** hash the next piece of some data
+ *
+ * \param h Hash state
+ * \param data Data to hash
+ * \param length Number of bytes in \p data
+ */
+INTERNAL void hash_feed(hash_t *h, const void *data, size_t length);
+
+/** hash a NUL-terminated string, including its terminator
+ *
+ * Including the terminator means a sequence of strings hashes differently to
+ * their concatenation.
+ *
+ * \param h Hash state
+ * \param s String to hash, or `NULL` which is treated as distinct from any
+ *   string
+ */
+INTERNAL void hash_str(hash_t *h, const char *s);
+
+/** retrieve the result of a hash
+ *
+ * \param h Hash state
+ * \return Digest of all data fed so far
+ */
+INTERNAL digest_t hash_finish(const hash_t *h);
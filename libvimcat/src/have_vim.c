@@ -1,7 +1,8 @@
+#include "vim.h"
 #include <stdbool.h>
-#include <stdlib.h>
 #include <vimcat/have_vim.h>
 
 bool vimcat_have_vim(void) {
-  return system("which vim >/dev/null 2>/dev/null") == EXIT_SUCCESS;
+  const vim_t *vim = NULL;
+  return vim_find("vim", &vim) == 0;
 }
@@ -0,0 +1,78 @@
+#include "io.h"
+#include "debug.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+int read_all(int fd, void *buffer, size_t size) {
+  assert(fd >= 0);
+  assert(buffer != NULL || size == 0);
+
+  char *p = buffer;
+  while (size > 0) {
+    const ssize_t r = read(fd, p, size);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      return errno;
+    if (r == 0)
+      return EIO;
+    p += r;
+    size -= (size_t)r;
+  }
+  return 0;
+}
+
+int write_all(int fd, const void *buffer, size_t size) {
+  assert(fd >= 0);
+  assert(buffer != NULL || size == 0);
+
+  const char *p = buffer;
+  while (size > 0) {
+    const ssize_t w = write(fd, p, size);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return errno;
+    p += w;
+    size -= (size_t)w;
+  }
+  return 0;
+}
+
+int read_blocks(int fd, const char *filename,
+                bool (*feed)(void *state, const char *block, size_t size),
+                void *state, bool *complete) {
+  assert(fd >= 0);
+  assert(filename != NULL);
+  assert(feed != NULL);
+
+  char *block = malloc(IO_BLOCK_SIZE);
+  if (ERROR(block == NULL))
+    return ENOMEM;
+
+  bool ok = true;
+  while (true) {
+    const ssize_t r = read(fd, block, IO_BLOCK_SIZE);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      DEBUG("read of %s failed: %s", filename, strerror(errno));
+      ok = false;
+      break;
+    }
+    if (r == 0 || !feed(state, block, (size_t)r))
+      break;
+  }
+
+  free(block);
+  if (complete != NULL)
+    *complete = ok;
+
+  return 0;
+}
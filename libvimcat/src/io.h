@@ -0,0 +1,50 @@
+/// \file
+/// \brief reading and writing file descriptors
+///
+/// These retry interrupted and short transfers, which a single `read` or
+/// `write` leaves to its caller.
+
+#pragma once
+
+#include "compiler.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// size of the blocks files are read in
+enum { IO_BLOCK_SIZE = 128 * 1024 };
+
+/** read exactly the given number of bytes
+ *
+ * \param fd File descriptor to read from
+ * \param buffer [out] Destination for the bytes read
+ * \param size Number of bytes to read
+ * \return 0 on success, `EIO` if the file ended first, or an errno on failure
+ */
+INTERNAL int read_all(int fd, void *buffer, size_t size);
+
+/** write exactly the given number of bytes
+ *
+ * \param fd File descriptor to write to
+ * \param buffer Bytes to write
+ * \param size Number of bytes in \p buffer
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int write_all(int fd, const void *buffer, size_t size);
+
+/** read a file to its end, a block at a time
+ *
+ * A failure to read, e.g. because the file is a directory, is treated as the
+ * file ending there, leaving Vim to decide how to display it.
+ *
+ * \param fd File descriptor to read from
+ * \param filename Name of the file, for diagnostics
+ * \param feed Handler for each block, returning false to stop reading early
+ * \param state State to pass as first parameter to the handler
+ * \param complete [out] If not `NULL`, whether the file was read without
+ *   failure on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int read_blocks(int fd, const char *filename,
+                         bool (*feed)(void *state, const char *block,
+                                      size_t size),
+                         void *state, bool *complete);
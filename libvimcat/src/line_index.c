@@ -0,0 +1,580 @@
+#include "line_index.h"
+#include "debug.h"
+#include "extent.h"
+#include "io.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vimcat/index.h>
+
+struct line_index {
+  // identity of the indexed file, for checking the index is still valid
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  size_t rows;       ///< number of lines
+  size_t columns;    ///< width of the widest line
+  uint64_t *offsets; ///< byte offset of the start of each line
+  uint32_t *widths;  ///< width of each line, saturating at UINT32_MAX
+
+  size_t capacity; ///< allocated length of `offsets` and `widths`
+  bool oom;        ///< did we fail to grow the arrays during construction?
+
+  size_t refs; ///< number of references, protected by `lock`
+};
+
+/// maximum number of indices to keep in memory
+enum { CACHE_SIZE = 32 };
+
+/// protects all state below and the `refs` field of any index
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// cached indices, most recently used first
+static line_index_t *cache[CACHE_SIZE];
+static size_t cache_len;
+
+/// directory in which to persist indices, or `NULL` not to
+static char *index_dir;
+
+/// magic number at the start of a persisted index
+static const char MAGIC[8] = "vimcatix";
+
+/// version of the persisted index format
+enum { VERSION = 1 };
+
+/// header of a persisted index, followed by the offsets and then the widths
+typedef struct {
+  char magic[sizeof(MAGIC)];
+  uint64_t version;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t rows;
+  uint64_t columns;
+} header_t;
+
+static struct timespec get_mtime(const struct stat *st) {
+  assert(st != NULL);
+#ifdef __APPLE__
+  return st->st_mtimespec;
+#else
+  return st->st_mtim;
+#endif
+}
+
+/// does this index describe the current state of the given file?
+static bool is_valid(const line_index_t *index, const struct stat *st) {
+  assert(index != NULL);
+  assert(st != NULL);
+
+  const struct timespec mtime = get_mtime(st);
+  return index->dev == st->st_dev && index->ino == st->st_ino &&
+         index->size == st->st_size && index->mtime.tv_sec == mtime.tv_sec &&
+         index->mtime.tv_nsec == mtime.tv_nsec;
+}
+
+static void destroy(line_index_t *index) {
+  if (index == NULL)
+    return;
+  free(index->widths);
+  free(index->offsets);
+  free(index);
+}
+
+/// drop a reference, with `lock` held
+///
+/// \return The index if this was the last reference, for the caller to destroy
+///   once they have released `lock`
+static line_index_t *unref(line_index_t *index) {
+  assert(index != NULL);
+  assert(index->refs > 0);
+
+  --index->refs;
+  return index->refs == 0 ? index : NULL;
+}
+
+/// find a valid cached index for a file, acquiring a reference to it
+static line_index_t *lookup(const struct stat *st) {
+  assert(st != NULL);
+
+  line_index_t *found = NULL;
+  line_index_t *stale = NULL;
+
+  (void)pthread_mutex_lock(&lock);
+
+  for (size_t i = 0; i < cache_len; ++i) {
+    line_index_t *index = cache[i];
+    if (index->dev != st->st_dev || index->ino != st->st_ino)
+      continue;
+
+    // remove this entry, so we can either move it to the front or discard it
+    memmove(&cache[i], &cache[i + 1], (cache_len - i - 1) * sizeof(cache[0]));
+    --cache_len;
+
+    if (is_valid(index, st)) {
+      memmove(&cache[1], &cache[0], cache_len * sizeof(cache[0]));
+      cache[0] = index;
+      ++cache_len;
+      ++index->refs;
+      found = index;
+    } else {
+      stale = unref(index);
+    }
+    break;
+  }
+
+  (void)pthread_mutex_unlock(&lock);
+
+  destroy(stale);
+
+  return found;
+}
+
+/// add an index to the cache, replacing any prior index for the same file
+static void insert(line_index_t *index) {
+  assert(index != NULL);
+
+  line_index_t *dropped[2] = {NULL};
+
+  (void)pthread_mutex_lock(&lock);
+
+  for (size_t i = 0; i < cache_len; ++i) {
+    if (cache[i]->dev != index->dev || cache[i]->ino != index->ino)
+      continue;
+    dropped[0] = unref(cache[i]);
+    memmove(&cache[i], &cache[i + 1], (cache_len - i - 1) * sizeof(cache[0]));
+    --cache_len;
+    break;
+  }
+
+  // evict the least recently used entry if we are full
+  if (cache_len == CACHE_SIZE) {
+    dropped[1] = unref(cache[cache_len - 1]);
+    --cache_len;
+  }
+
+  memmove(&cache[1], &cache[0], cache_len * sizeof(cache[0]));
+  cache[0] = index;
+  ++cache_len;
+  ++index->refs;
+
+  (void)pthread_mutex_unlock(&lock);
+
+  destroy(dropped[0]);
+  destroy(dropped[1]);
+}
+
+/// construct the path at which an index for the given file would be persisted
+///
+/// \return True if persistence is enabled and the path fit in the buffer
+static bool sidecar_path(const struct stat *st, char *path, size_t size) {
+  assert(st != NULL);
+  assert(path != NULL);
+
+  bool ok = false;
+
+  (void)pthread_mutex_lock(&lock);
+
+  if (index_dir != NULL) {
+    const int r = snprintf(path, size, "%s/%jx-%jx.idx", index_dir,
+                           (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+    ok = r >= 0 && (size_t)r < size;
+  }
+
+  (void)pthread_mutex_unlock(&lock);
+
+  return ok;
+}
+
+/// try to read a persisted index for a file
+///
+/// \return A valid index with a single reference, or `NULL` if there was none
+static line_index_t *load(const struct stat *st) {
+  assert(st != NULL);
+
+  char path[PATH_MAX];
+  if (!sidecar_path(st, path, sizeof(path)))
+    return NULL;
+
+  line_index_t *index = NULL;
+  line_index_t *ok = NULL;
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  header_t h;
+  if (read_all(fd, &h, sizeof(h)) != 0)
+    goto done;
+
+  const struct timespec mtime = get_mtime(st);
+  if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+      h.dev != (uint64_t)st->st_dev || h.ino != (uint64_t)st->st_ino ||
+      h.size != (uint64_t)st->st_size || h.mtime_sec != mtime.tv_sec ||
+      h.mtime_nsec != mtime.tv_nsec) {
+    DEBUG("ignoring stale or foreign index %s", path);
+    goto done;
+  }
+
+  // a file of n bytes cannot have more than n + 1 lines
+  if (h.rows == 0 || h.rows > h.size + 1 || h.rows > SIZE_MAX / 8)
+    goto done;
+
+  index = calloc(1, sizeof(*index));
+  if (ERROR(index == NULL))
+    goto done;
+
+  index->rows = (size_t)h.rows;
+  index->columns = (size_t)h.columns;
+  index->offsets = malloc(index->rows * sizeof(index->offsets[0]));
+  index->widths = malloc(index->rows * sizeof(index->widths[0]));
+  if (ERROR(index->offsets == NULL || index->widths == NULL))
+    goto done;
+
+  if (read_all(fd, index->offsets, index->rows * sizeof(index->offsets[0])))
+    goto done;
+  if (read_all(fd, index->widths, index->rows * sizeof(index->widths[0])))
+    goto done;
+
+  index->dev = st->st_dev;
+  index->ino = st->st_ino;
+  index->size = st->st_size;
+  index->mtime = mtime;
+  index->capacity = index->rows;
+  index->refs = 1;
+
+  DEBUG("loaded index %s", path);
+  ok = index;
+  index = NULL;
+
+done:
+  destroy(index);
+  (void)close(fd);
+
+  return ok;
+}
+
+/// try to persist an index, ignoring any failure
+static void save(const line_index_t *index, const struct stat *st) {
+  assert(index != NULL);
+  assert(st != NULL);
+
+  char path[PATH_MAX];
+  if (!sidecar_path(st, path, sizeof(path)))
+    return;
+
+  // write to a temporary file and then move it into place, so concurrent
+  // readers never see a partial index
+  char tmp[PATH_MAX];
+  {
+    const int r = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if (r < 0 || (size_t)r >= sizeof(tmp))
+      return;
+  }
+  const int fd = mkstemp(tmp);
+  if (ERROR(fd < 0))
+    return;
+
+  header_t h = {.version = VERSION,
+                .dev = (uint64_t)index->dev,
+                .ino = (uint64_t)index->ino,
+                .size = (uint64_t)index->size,
+                .mtime_sec = index->mtime.tv_sec,
+                .mtime_nsec = index->mtime.tv_nsec,
+                .rows = index->rows,
+                .columns = index->columns};
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+
+  int rc = 0;
+  if (ERROR((rc = write_all(fd, &h, sizeof(h)))))
+    goto done;
+  if (ERROR((rc = write_all(fd, index->offsets,
+                            index->rows * sizeof(index->offsets[0])))))
+    goto done;
+  if (ERROR((rc = write_all(fd, index->widths,
+                            index->rows * sizeof(index->widths[0])))))
+    goto done;
+
+done:
+  if (close(fd) != 0 && rc == 0)
+    rc = errno;
+  if (rc != 0 || ERROR(rename(tmp, path) != 0)) {
+    (void)unlink(tmp);
+    return;
+  }
+  DEBUG("saved index %s", path);
+}
+
+/// record a line in an index under construction
+static void append(line_index_t *index, size_t start, size_t width) {
+  assert(index != NULL);
+
+  if (index->oom)
+    return;
+
+  if (index->rows == index->capacity) {
+    const size_t c = index->capacity == 0 ? 1024 : index->capacity * 2;
+    uint64_t *o = realloc(index->offsets, c * sizeof(o[0]));
+    if (ERROR(o == NULL)) {
+      index->oom = true;
+      return;
+    }
+    index->offsets = o;
+    uint32_t *w = realloc(index->widths, c * sizeof(w[0]));
+    if (ERROR(w == NULL)) {
+      index->oom = true;
+      return;
+    }
+    index->widths = w;
+    index->capacity = c;
+  }
+
+  index->offsets[index->rows] = start;
+  index->widths[index->rows] =
+      width > UINT32_MAX ? UINT32_MAX : (uint32_t)width;
+  ++index->rows;
+}
+
+static void on_line(void *state, size_t start, size_t width) {
+  append(state, start, width);
+}
+
+/// `read_blocks` handler for indexing a file
+static bool on_block(void *state, const char *block, size_t size) {
+  (void)extent_feed(state, block, size);
+  return true;
+}
+
+/** scan a file to construct its index
+ *
+ * \param filename Name of the file, for debugging
+ * \param fd Open handle to the file
+ * \param st Status of the file prior to the scan
+ * \param index [out] Constructed index on success
+ * \param cacheable [out] Whether the file was read successfully and unchanged
+ *   by the time the scan finished
+ * \return 0 on success or an errno on failure
+ */
+static int scan(const char *filename, int fd, const struct stat *st,
+                 line_index_t **index, bool *cacheable) {
+  assert(filename != NULL);
+  assert(st != NULL);
+  assert(index != NULL);
+  assert(cacheable != NULL);
+
+  int rc = 0;
+  line_index_t *ix = NULL;
+
+  ix = calloc(1, sizeof(*ix));
+  if (ERROR(ix == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  ix->dev = st->st_dev;
+  ix->ino = st->st_ino;
+  ix->size = st->st_size;
+  ix->mtime = get_mtime(st);
+  ix->refs = 1;
+
+  extent_t e;
+  extent_init(&e, 0);
+  e.on_line = on_line;
+  e.on_line_state = ix;
+
+  // an unreadable file (e.g. a directory) is indexed up to where reading
+  // failed, but the result is not remembered
+  if (ERROR((rc = read_blocks(fd, filename, on_block, &e, cacheable))))
+    goto done;
+
+  size_t rows = 0;
+  extent_finish(&e, &rows, &ix->columns);
+
+  // the final line has no line ending to trigger `on_line`
+  if (rows == ix->rows + 1)
+    append(ix, e.line_start, e.width);
+
+  if (ERROR(ix->oom)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  assert(ix->rows == rows);
+
+  // if the file changed while we were reading it, our index may be a mix of
+  // old and new content
+  struct stat after;
+  if (ERROR(fstat(fd, &after) != 0) || !is_valid(ix, &after)) {
+    DEBUG("%s changed while being indexed", filename);
+    *cacheable = false;
+  }
+
+  *index = ix;
+  ix = NULL;
+
+done:
+  destroy(ix);
+
+  return rc;
+}
+
+int line_index_open(const char *filename, bool build, line_index_t **index) {
+  assert(filename != NULL);
+  assert(index != NULL);
+
+  *index = NULL;
+
+  int rc = 0;
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+
+  struct stat st;
+  if (ERROR(fstat(fd, &st) != 0)) {
+    rc = errno;
+    goto done;
+  }
+
+  if ((*index = lookup(&st)) != NULL) {
+    DEBUG("using cached index for %s", filename);
+    goto done;
+  }
+
+  if ((*index = load(&st)) != NULL) {
+    insert(*index);
+    goto done;
+  }
+
+  if (!build)
+    goto done;
+
+  DEBUG("indexing %s", filename);
+  bool cacheable = false;
+  if (ERROR((rc = scan(filename, fd, &st, index, &cacheable))))
+    goto done;
+
+  if (cacheable) {
+    insert(*index);
+    save(*index, &st);
+  }
+
+done:
+  (void)close(fd);
+
+  return rc;
+}
+
+void line_index_close(line_index_t **index) {
+  assert(index != NULL);
+
+  if (*index == NULL)
+    return;
+
+  (void)pthread_mutex_lock(&lock);
+  line_index_t *last = unref(*index);
+  (void)pthread_mutex_unlock(&lock);
+
+  destroy(last);
+  *index = NULL;
+}
+
+bool line_index_current(const line_index_t *index, const char *filename) {
+  assert(index != NULL);
+  assert(filename != NULL);
+
+  struct stat st;
+  if (stat(filename, &st) != 0)
+    return false;
+
+  return is_valid(index, &st);
+}
+
+size_t line_index_rows(const line_index_t *index) {
+  assert(index != NULL);
+  return index->rows;
+}
+
+size_t line_index_columns(const line_index_t *index) {
+  assert(index != NULL);
+  return index->columns;
+}
+
+uint64_t line_index_offset(const line_index_t *index, size_t lineno) {
+  assert(index != NULL);
+  assert(lineno > 0);
+  assert(lineno <= index->rows);
+  return index->offsets[lineno - 1];
+}
+
+size_t line_index_width(const line_index_t *index, size_t lineno) {
+  assert(index != NULL);
+  assert(lineno > 0);
+  assert(lineno <= index->rows);
+  return index->widths[lineno - 1];
+}
+
+int line_index_extent(const char *filename, size_t *rows, size_t *columns) {
+  assert(filename != NULL);
+  assert(rows != NULL);
+  assert(columns != NULL);
+
+  line_index_t *index = NULL;
+  int rc = line_index_open(filename, false, &index);
+  if (ERROR(rc != 0))
+    return rc;
+
+  if (index == NULL)
+    return get_extent(filename, 0, rows, columns);
+
+  *rows = index->rows;
+  *columns = index->columns;
+  line_index_close(&index);
+
+  return 0;
+}
+
+void line_index_flush(void) {
+  line_index_t *dropped[CACHE_SIZE] = {NULL};
+
+  (void)pthread_mutex_lock(&lock);
+  for (size_t i = 0; i < cache_len; ++i)
+    dropped[i] = unref(cache[i]);
+  cache_len = 0;
+  (void)pthread_mutex_unlock(&lock);
+
+  for (size_t i = 0; i < CACHE_SIZE; ++i)
+    destroy(dropped[i]);
+}
+
+int vimcat_set_index_dir(const char *path) {
+
+  char *copy = NULL;
+  if (path != NULL) {
+    copy = strdup(path);
+    if (ERROR(copy == NULL))
+      return ENOMEM;
+  }
+
+  (void)pthread_mutex_lock(&lock);
+  char *old = index_dir;
+  index_dir = copy;
+  (void)pthread_mutex_unlock(&lock);
+
+  free(old);
+
+  return 0;
+}
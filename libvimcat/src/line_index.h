@@ -0,0 +1,106 @@
+/// \file
+/// \brief cached per-file indices of line positions and widths
+///
+/// Rendering a single line of a file needs to know whether the line exists and
+/// how wide it is. Scanning for this is proportional to the line number, which
+/// adds up when a caller asks for many lines of the same file. A line index
+/// records the byte offset and display width of every line in a file so these
+/// questions can be answered in constant time.
+///
+/// Indices are cached in memory, keyed by device and inode, and are discarded
+/// when the file’s size or modification time changes. If a directory has been
+/// configured with `vimcat_set_index_dir`, indices are also persisted there so
+/// they survive across processes.
+
+#pragma once
+
+#include "compiler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// an index of the lines of a file
+typedef struct line_index line_index_t;
+
+/** find or build the line index for a file
+ *
+ * The returned index is immutable and remains valid until released with
+ * `line_index_close`, even if it is evicted from the cache or the file is
+ * modified in the meantime.
+ *
+ * \param filename File to index
+ * \param build Build a new index if none is cached? If false and no valid
+ *   index is cached, `*index` is set to `NULL` and 0 is returned.
+ * \param index [out] The line index on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int line_index_open(const char *filename, bool build,
+                             line_index_t **index);
+
+/** release a line index
+ *
+ * \param index [inout] Index to release, which is set to `NULL`
+ */
+INTERNAL void line_index_close(line_index_t **index);
+
+/** is an index still valid for a file?
+ *
+ * \param index Index to check
+ * \param filename File \p index was opened for
+ * \return True if the file’s identity, size and modification time are those it
+ *   had when it was indexed
+ */
+INTERNAL bool line_index_current(const line_index_t *index,
+                                 const char *filename);
+
+/** number of lines in the indexed file
+ *
+ * This matches the number of rows `get_extent` reports with no limit.
+ *
+ * \param index Index to query
+ * \return Number of lines
+ */
+INTERNAL size_t line_index_rows(const line_index_t *index);
+
+/** width of the widest line in the indexed file
+ *
+ * \param index Index to query
+ * \return Maximum line width
+ */
+INTERNAL size_t line_index_columns(const line_index_t *index);
+
+/** byte offset at which a line starts
+ *
+ * \param index Index to query
+ * \param lineno 1-indexed line number, at most `line_index_rows(index)`
+ * \return Offset of the first byte of the line
+ */
+INTERNAL uint64_t line_index_offset(const line_index_t *index, size_t lineno);
+
+/** display width of a line
+ *
+ * \param index Index to query
+ * \param lineno 1-indexed line number, at most `line_index_rows(index)`
+ * \return Width of the line, excluding its line ending
+ */
+INTERNAL size_t line_index_width(const line_index_t *index, size_t lineno);
+
+/** learn the number of lines and maximum line width of a text file
+ *
+ * This is equivalent to `get_extent` with no limit, but answers from the
+ * file’s index if one is cached instead of scanning the file. It does not build
+ * an index if there is none, as the caller is presumably about to read the
+ * whole file anyway.
+ *
+ * \param filename File to measure
+ * \param rows [out] Number of lines on success
+ * \param columns [out] Width of the widest line on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int line_index_extent(const char *filename, size_t *rows,
+                               size_t *columns);
+
+/// discard all in-memory cached indices
+///
+/// This is only intended for testing.
+INTERNAL void line_index_flush(void);
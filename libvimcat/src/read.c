@@ -1,17 +1,31 @@
+#include "buffer.h"
+#include "builder.h"
+#include "cache.h"
 #include "compiler.h"
+#include "ctx.h"
+#include "deadline.h"
 #include "debug.h"
+#include "extent.h"
 #include "get_environ.h"
+#include "line_index.h"
 #include "read_core.h"
+#include "spool.h"
 #include "term.h"
+#include "vim.h"
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <vimcat/backend.h>
 #include <vimcat/read.h>
 
 // To understand the code that follows, it is useful to know several
@@ -41,117 +55,14 @@
 //
 //   6. Trailing blank lines in the file are not emitted by Vim at all, as they
 //      do not need display.
+//
+//   7. When asked to render several screens in one run, Vim has no natural way
+//      of signalling where one screen ends and the next begins. So after each
+//      redraw we ask it to emit an Operating System Command of our own
+//      invention, "\033]vimcat;frame\007", that the virtual terminal treats as
+//      a frame delimiter.
 
-/// open a file for reading, setting close-on-exec
-static FILE *fopen_cloexec(const char *filename) {
-  assert(filename != NULL);
-
-#ifdef __APPLE__
-  // macOS does not support 'e' to `fopen`, so work around this
-  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
-  if (ERROR(fd < 0))
-    return NULL;
-
-  FILE *f = fdopen(fd, "r");
-  if (ERROR(f == NULL)) {
-    const int err = errno;
-    (void)close(fd);
-    errno = err;
-  }
-
-  return f;
-#else
-  return fopen(filename, "re");
-#endif
-}
-/// learn the number of lines and maximum line width of a text file
-static int get_extent(const char *filename, size_t limit, size_t *rows,
-                      size_t *columns) {
-  assert(filename != NULL);
-
-  FILE *f = fopen_cloexec(filename);
-  if (ERROR(f == NULL))
-    return errno;
-
-  size_t lines = 1;
-  size_t width = 0;
-  size_t max_width = 0;
-  int last = EOF;
-
-  int rc = 0;
-
-  while (true) {
-
-    // have we scanned as far as the caller requested?
-    if (limit != 0 && lines > limit)
-      break;
-
-    int c = getc(f);
-    if (c == EOF)
-      break;
-    last = c;
-
-    // is this a Unix end of line?
-    if (c == '\n') {
-      ++lines;
-      if (max_width < width)
-        max_width = width;
-      width = 0;
-      continue;
-    }
-
-    // is this a Windows end of line?
-    if (c == '\r') {
-      int n = getc(f);
-      if (n == '\n') {
-        ++lines;
-        if (max_width < width)
-          max_width = width;
-        width = 0;
-        continue;
-      }
-
-      if (n != EOF) {
-        if (ERROR(ungetc(n, f) == EOF)) {
-          rc = EIO;
-          goto done;
-        }
-      }
-    }
-
-    // assume a tab stop is ≤ 8 characters
-    if (c == '\t') {
-      width += 8;
-      continue;
-    }
-
-    // Anything else counts as a single character. This over-counts the width
-    // required for UTF-8 characters, but that is fine.
-    ++width;
-  }
-
-  if (max_width < width)
-    max_width = width;
-
-  // if the file ended with a newline, we do not count the next (empty) line
-  if (last == '\n') {
-    assert(lines > 1);
-    --lines;
-  }
-
-done:
-  (void)fclose(f);
-
-  if (LIKELY(rc == 0)) {
-    *rows = lines;
-    *columns = max_width;
-  }
-
-  return rc;
-}
-
-/// `pipe` that also sets close-on-exec
-static int pipe_(int pipefd[2]) {
+int pipe_(int pipefd[2]) {
   assert(pipefd != NULL);
 
 #ifdef __APPLE__
@@ -183,25 +94,39 @@ static int pipe_(int pipefd[2]) {
   return 0;
 }
 
-/// start Vim, reading and displaying the given file at the given dimensions
-static int run_vim(FILE **out, pid_t *pid, const char *filename, size_t rows,
-                   size_t columns, size_t top_row) {
+int run_vim(int *out, pid_t *pid, size_t n_files,
+            const char *const *filenames, size_t rows, size_t columns,
+            const render_opts_t *opts, const char *const *commands) {
 
   assert(out != NULL);
   assert(pid != NULL);
-  assert(filename != NULL);
+  assert(n_files > 0);
+  assert(filenames != NULL);
   assert(columns >= 80 && "missing min clamping in vimcat_read?");
   assert(columns <= 10000 && "Vim will not render this many columns");
   assert(rows >= 1 && "missing min clamping in vimcat_read?");
   assert(rows <= 1000 && "Vim will not render this many rows");
-
-  // clamp the top row to a legal value
-  if (top_row == 0)
-    top_row = 1;
+  assert(opts == NULL || opts->filetype == NULL ||
+         is_filetype(opts->filetype));
+  assert(commands != NULL);
+
+  // do not start a Vim we would have no time to wait for
+  const deadline_t deadline = opts == NULL ? 0 : opts->deadline;
+  if (UNLIKELY(deadline_passed(deadline))) {
+    DEBUG("deadline passed before starting Vim");
+    return ETIMEDOUT;
+  }
 
   int rc = 0;
-  FILE *output = NULL;
   int devnull = -1;
+  char const **argv = NULL;
+  char *set_filetype = NULL;
+
+  // find Vim, once per process, so we can spawn it without searching `$PATH`
+  const char *name = ctx_vim(opts_ctx(opts));
+  const vim_t *vim = NULL;
+  if (ERROR((rc = vim_find(name, &vim))))
+    return rc;
 
   posix_spawn_file_actions_t actions;
   if (ERROR((rc = posix_spawn_file_actions_init(&actions))))
@@ -212,13 +137,14 @@ static int run_vim(FILE **out, pid_t *pid, const char *filename, size_t rows,
   if (ERROR((rc = pipe_(fd))))
     goto done;
 
-  // turn the read end of the pipe into a file handle
-  output = fdopen(fd[0], "r");
-  if (ERROR(output == NULL)) {
-    rc = errno;
-    goto done;
+  // if we need to stop waiting at a deadline, do not let reads block
+  if (deadline != 0) {
+    const int flags = fcntl(fd[0], F_GETFL);
+    if (ERROR(flags < 0 || fcntl(fd[0], F_SETFL, flags | O_NONBLOCK) < 0)) {
+      rc = errno;
+      goto done;
+    }
   }
-  fd[0] = -1;
 
   // dup the write end of the pipe over Vim’s stdout
   if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, fd[1],
@@ -234,7 +160,7 @@ static int run_vim(FILE **out, pid_t *pid, const char *filename, size_t rows,
   if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, devnull,
                                                    STDIN_FILENO))))
     goto done;
-  if (vimcat_debug == NULL) {
+  if (debug_stream() == NULL) {
     if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, devnull,
                                                      STDERR_FILENO))))
       goto done;
@@ -251,9 +177,7 @@ static int run_vim(FILE **out, pid_t *pid, const char *filename, size_t rows,
   (void)snprintf(set_columns, sizeof(set_columns), "+set columns=%zu", columns);
 
   // prefix of the command we will run
-  enum { ARGS = 13 };
-  char const *argv[ARGS] = {
-      "vim",
+  static const char *const PREFIX[] = {
       "-R",           // read-only mode
       "--not-a-term", // do not check whether std* is a TTY
       "-X",           // do not connect to X server
@@ -263,77 +187,94 @@ static int run_vim(FILE **out, pid_t *pid, const char *filename, size_t rows,
       " nowrap"       // disable text wrapping in case we have long rows
       " scrolloff=0"  // make `z<CR>` scroll cursor row to the top
       " nohlsearch",  // turn off highlighting from prior searches
-      set_rows,
-      set_columns,
   };
-  size_t arg_index = 0;
-  while (argv[arg_index] != NULL) {
-    ++arg_index;
-    assert(arg_index < ARGS);
+  enum { PREFIX_LENGTH = sizeof(PREFIX) / sizeof(PREFIX[0]) };
+
+  // If we were told the filetype, set it as each file is read. This runs before
+  // any detection autocommands the user’s vimrc installs, and `setf` prevents
+  // those from overriding it, so Vim skips inspecting the file’s content.
+  const char *filetype = opts == NULL ? NULL : opts->filetype;
+  if (filetype != NULL) {
+    if (ERROR(asprintf(&set_filetype, "au BufRead * setf %s", filetype) < 0)) {
+      set_filetype = NULL;
+      rc = ENOMEM;
+      goto done;
+    }
+  }
+
+  size_t n_commands = 0;
+  while (commands[n_commands] != NULL)
+    ++n_commands;
+
+  // Vim accepts at most 10 commands, of which the prefix uses 3 (including
+  // lines and columns) and we need 1 to exit
+  assert(n_commands <= 6 && "too many commands for Vim to handle");
+
+  // allocate space for Vim, the prefix, lines, columns, filetype, commands,
+  // "+qa!", "--", files, and a `NULL` terminator
+  const size_t args = 1 + PREFIX_LENGTH + 2 + 2 + n_commands + 2 + n_files + 1;
+  argv = calloc(args, sizeof(argv[0]));
+  if (ERROR(argv == NULL)) {
+    rc = ENOMEM;
+    goto done;
   }
+  size_t arg_index = 0;
 
 #define APPEND(str)                                                            \
   do {                                                                         \
     assert(argv[arg_index] == NULL && "overwriting existing argument");        \
     argv[arg_index] = (str);                                                   \
     ++arg_index;                                                               \
-    assert(arg_index < ARGS && "exceeding allocated Vim arguments");           \
+    assert(arg_index < args && "exceeding allocated Vim arguments");           \
   } while (0)
 
-  // if we need to jump to a later row, construct Vim parameters to move there
-  // and scroll the window such that this line is at the top
-  char jump[sizeof("+normal! Gz\r") + 20];
-  if (top_row > 1) {
-    (void)snprintf(jump, sizeof(jump), "+normal! %zuGz\r", top_row);
-
-    APPEND(jump);
-
-    DEBUG("running Vim with '+set lines=%zu', '+set columns=%zu', '+normal! "
-          "%zuGz<CR>' on %s",
-          rows, columns, top_row, filename);
-  } else {
-    DEBUG("running Vim with '+set lines=%zu', '+set columns=%zu' on %s", rows,
-          columns, filename);
+  APPEND(name);
+  for (size_t i = 0; i < PREFIX_LENGTH; ++i)
+    APPEND(PREFIX[i]);
+  APPEND(set_rows);
+  APPEND(set_columns);
+  if (set_filetype != NULL) {
+    APPEND("--cmd");
+    APPEND(set_filetype);
   }
 
-  APPEND("+redraw"); // force a screen render to happen before exiting
-  APPEND("+qa!");    // exit with prejudice
+  for (size_t i = 0; i < n_commands; ++i)
+    APPEND(commands[i]);
+
+  APPEND("+qa!"); // exit with prejudice
   APPEND("--");
-  APPEND(filename);
+  for (size_t i = 0; i < n_files; ++i)
+    APPEND(filenames[i]);
 
 #undef APPEND
 
-#ifndef NDEBUG
-  {
-    size_t commands = 0;
-    for (size_t i = 0; i < sizeof(argv) / sizeof(argv[0]); ++i) {
-      assert(argv[i] != NULL);
-      if (argv[i][0] == '+')
-        ++commands;
-      if (strcmp(argv[i], "--") == 0)
-        break;
-    }
-    assert(commands <= 10 && "too many commands for Vim to handle");
+  if (UNLIKELY(debug_stream() != NULL)) {
+    DEBUG("running Vim with '+set lines=%zu', '+set columns=%zu' on %zu "
+          "file(s), starting with %s",
+          rows, columns, n_files, filenames[0]);
+    if (set_filetype != NULL)
+      DEBUG("  and --cmd '%s'", set_filetype);
+    for (size_t i = 0; i < n_commands; ++i)
+      DEBUG("  and '%s'", commands[i]);
   }
-#endif
 
   // spawn Vim
   pid_t p = 0;
-  if (ERROR(((rc = posix_spawnp(&p, argv[0], &actions, NULL,
-                                (char *const *)argv, get_environ())))))
+  if (ERROR(((rc = posix_spawn(&p, vim_path(vim), &actions, NULL,
+                               (char *const *)argv, get_environ())))))
     goto done;
   DEBUG("vim is PID %ld", (long)p);
 
   // success
-  *out = output;
-  output = NULL;
+  *out = fd[0];
+  fd[0] = -1;
   *pid = p;
 
 done:
+  free(argv);
+  free(set_filetype);
   if (devnull >= 0)
     (void)close(devnull);
-  if (output != NULL)
-    (void)fclose(output);
   if (fd[0] >= 0)
     (void)close(fd[0]);
   if (fd[1] >= 0)
@@ -343,149 +284,915 @@ done:
   return rc;
 }
 
-int read_core(const char *filename, unsigned long lineno,
-              int (*callback)(void *state, char *line), void *state) {
+int put_vim_string(const char *s, FILE *f) {
+  assert(s != NULL);
+  assert(f != NULL);
 
-  assert(filename != NULL);
-  assert(callback != NULL);
+  if (ERROR(fputc('\'', f) == EOF))
+    return errno;
+  for (const char *p = s; *p != '\0'; ++p) {
+    if (*p == '\'') {
+      if (ERROR(fputc('\'', f) == EOF))
+        return errno;
+    }
+    if (ERROR(fputc(*p, f) == EOF))
+      return errno;
+  }
+  if (ERROR(fputc('\'', f) == EOF))
+    return errno;
 
-  int rc = 0;
-  term_t *term = NULL;
+  return 0;
+}
 
-  // learn the extent (character width and height) of this file so we can lie to
-  // Vim and claim we have a terminal of these dimensions to prevent it
-  // line-wrapping and/or truncating
-  size_t rows = 0;
-  size_t columns = 0;
-  if (ERROR((rc = get_extent(filename, (size_t)lineno, &rows, &columns))))
-    goto done;
+int put_source(const char *path, FILE *f) {
+  assert(path != NULL);
+  assert(f != NULL);
 
-  DEBUG("%s has %zu rows and %zu columns", filename, rows, columns);
+  if (ERROR(fputs("+exe 'source' fnameescape(", f) < 0))
+    return errno;
+  const int rc = put_vim_string(path, f);
+  if (ERROR(rc != 0))
+    return rc;
+  if (ERROR(fputc(')', f) == EOF))
+    return errno;
 
-  // was the requested line beyond the extent of the file?
-  if (ERROR(lineno != 0 && (size_t)lineno > rows)) {
-    rc = ERANGE;
-    goto done;
+  return 0;
+}
+
+size_t arg_budget(void) {
+
+  // the limit covers both arguments and environment, counting the pointer to
+  // each string as well as the string itself
+  long max = sysconf(_SC_ARG_MAX);
+  if (max <= 0)
+    max = _POSIX_ARG_MAX;
+
+  size_t used = 0;
+  for (char **e = get_environ(); *e != NULL; ++e)
+    used += strlen(*e) + 1 + sizeof(*e);
+
+  // leave room for the arguments `run_vim` adds, all of which are short
+  enum { RESERVE = 16 * 1024 };
+  used += RESERVE;
+
+  return (size_t)max > used ? (size_t)max - used : 0;
+}
+
+/// translate a wait status of Vim into an errno
+static int exit_status(int status) {
+  if (WIFEXITED(status)) {
+    const int rc = WEXITSTATUS(status);
+    if (UNLIKELY(rc != 0))
+      DEBUG("Vim exited with failure: %d", rc);
+    return rc;
+  }
+
+  DEBUG("Vim exited abnormally: %d", status);
+  return status;
+}
+
+int wait_vim(pid_t vim) {
+  assert(vim > 0);
+
+  DEBUG("waiting for Vim to exit...");
+  int status;
+  if (ERROR(waitpid(vim, &status, 0) < 0)) {
+    const int rc = errno;
+    DEBUG("waitpid failed: %s", strerror(rc));
+    return rc;
+  }
+
+  return exit_status(status);
+}
+
+int try_wait_vim(pid_t vim, bool *exited) {
+  assert(vim > 0);
+  assert(exited != NULL);
+
+  int status;
+  const pid_t r = waitpid(vim, &status, WNOHANG);
+  if (ERROR(r < 0)) {
+    const int rc = errno;
+    DEBUG("waitpid failed: %s", strerror(rc));
+    return rc;
+  }
+
+  *exited = r != 0;
+  if (r == 0)
+    return 0;
+  return exit_status(status);
+}
+
+int drain_vim(int vim_stdout, const render_opts_t *opts) {
+  assert(vim_stdout >= 0);
+
+  const deadline_t deadline = opts == NULL ? 0 : opts->deadline;
+
+  char discard[BUFSIZ];
+  for (;;) {
+    const ssize_t r = read(vim_stdout, discard, sizeof(discard));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && errno == EAGAIN) {
+      const int rc = deadline_poll(deadline, vim_stdout);
+      if (rc == ETIMEDOUT)
+        DEBUG("deadline passed waiting for Vim to exit");
+      if (rc != 0)
+        return rc;
+      continue;
+    }
+    if (r < 0)
+      return errno;
+    if (r == 0)
+      return 0;
   }
+}
+
+int recv_vim(term_t *term, int vim_stdout, const render_opts_t *opts,
+             bool *framed) {
+  assert(term != NULL);
+  assert(vim_stdout >= 0);
+  assert(framed != NULL);
+
+  const deadline_t deadline = opts == NULL ? 0 : opts->deadline;
+
+  for (;;) {
+    const int rc = term_send(term, vim_stdout, framed);
+    if (rc != EAGAIN)
+      return rc;
+
+    // Vim has not drawn a full screen yet, so wait until it has more for us
+    const int r = deadline_poll(deadline, vim_stdout);
+    if (r == ETIMEDOUT)
+      DEBUG("deadline passed waiting for Vim to draw");
+    if (r != 0)
+      return r;
+  }
+}
 
-  size_t term_rows = rows;
-  size_t term_columns = columns;
+void abandon_vim(int vim_stdout, pid_t vim) {
+  assert(vim_stdout >= 0);
+  assert(vim > 0);
 
-  // we only need a single row if we are highlighting one line
-  if (lineno > 0) {
-    rows = (size_t)lineno;
-    term_rows = 1;
+  (void)close(vim_stdout);
+  (void)kill(vim, SIGKILL);
+  (void)wait_vim(vim);
+}
+
+bool is_filetype(const char *filetype) {
+  assert(filetype != NULL);
+
+  if (filetype[0] == '\0')
+    return false;
+
+  for (const char *p = filetype; *p != '\0'; ++p) {
+    if (!isalnum((unsigned char)*p) && *p != '_' && *p != '-' && *p != '.')
+      return false;
   }
 
-  // we need one extra row for the Vim statusline
-  ++term_rows;
+  return true;
+}
+
+/// clamp terminal dimensions to values that will not confuse or impede Vim
+static void clamp_extent(size_t *rows, size_t *columns) {
+  assert(rows != NULL);
+  assert(columns != NULL);
 
-  // bump the terminal dimensions if they are likely to confuse or impede Vim
-  if (term_rows < 2) {
-    DEBUG("clamping terminal rows from %zu to 2", term_rows);
-    term_rows = 2;
+  if (*rows < 2) {
+    DEBUG("clamping terminal rows from %zu to 2", *rows);
+    *rows = 2;
   }
-  if (term_columns < 80) {
-    DEBUG("clamping terminal columns from %zu to 80", term_columns);
-    term_columns = 80;
+  if (*columns < 80) {
+    DEBUG("clamping terminal columns from %zu to 80", *columns);
+    *columns = 80;
   }
 
   // Vim has a hard limit of 10000 columns, so if the file is wider than that we
   // just let anything beyond this be invisible
-  if (UNLIKELY(term_columns > 10000)) {
-    DEBUG("clamping terminal columns from %zu to 10000", term_columns);
-    term_columns = 10000;
+  if (UNLIKELY(*columns > 10000)) {
+    DEBUG("clamping terminal columns from %zu to 10000", *columns);
+    *columns = 10000;
   }
 
-  // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
-  // move in chunks of 999 rows if we have a file taller than this
-  if (term_rows > 1000) {
-    DEBUG("clamping terminal rows from %zu to 1000", term_rows);
-    term_rows = 1000;
+  // Vim has a hard limit of 1000 rows
+  if (*rows > 1000) {
+    DEBUG("clamping terminal rows from %zu to 1000", *rows);
+    *rows = 1000;
   }
+}
 
-  // create a virtual terminal
-  if (ERROR((rc = term_new(&term, term_columns, term_rows))))
-    goto done;
+int emit(term_t *term, size_t row, const render_opts_t *opts,
+         int (*callback)(void *state, size_t window, unsigned long lineno,
+                         char *line),
+         void *state, size_t window, unsigned long lineno) {
+  assert(term != NULL);
+  assert(callback != NULL || (opts != NULL && opts->spans != NULL));
+
+  int rc = 0;
+
+  if (opts != NULL && opts->spans != NULL) {
+    char *text = NULL;
+    const vimcat_span_t *spans = NULL;
+    size_t n_spans = 0;
+    if (ERROR((rc = term_readspans(term, row, &text, &spans, &n_spans))))
+      return rc;
+    return opts->spans(state, window, lineno, text, spans, n_spans);
+  }
 
-  for (size_t row = lineno == 0 ? 1 : (size_t)lineno; row <= rows;) {
+  char *line = NULL;
+  if (ERROR((rc = term_readline(term, row, &line))))
+    return rc;
+  return callback(state, window, lineno, line);
+}
 
-    // if we are beyond the first iteration of this loop, clear terminal
-    // contents from the last iteration
-    if (lineno == 0 && row > 1)
-      term_reset(term);
+/// render each window with its own Vim, for Vims that cannot run a session
+static int read_windows(term_t *term, const char *const *filenames,
+                        size_t n_windows, const window_t *windows,
+                        const render_opts_t *opts,
+                        int (*callback)(void *state, size_t window,
+                                        unsigned long lineno, char *line),
+                        void *state) {
+  assert(term != NULL);
+  assert(filenames != NULL);
+  assert(windows != NULL || n_windows == 0);
+  assert(callback != NULL || (opts != NULL && opts->spans != NULL));
 
-    // how many rows can we render in this pass?
-    size_t vim_rows = rows - row + 1;
-    if (vim_rows > 999)
-      vim_rows = 999;
+  int rc = 0;
+
+  for (size_t i = 0; i < n_windows; ++i) {
+    const window_t *w = &windows[i];
+
+    // clear terminal contents from the last iteration
+    term_reset(term);
+
+    // if we need to jump to a later row, construct Vim parameters to move there
+    // and scroll the window such that this line is at the top
+    char jump[sizeof("+normal! Gz\r") + 20];
+    (void)snprintf(jump, sizeof(jump), "+normal! %zuGz\r", w->top);
+    const char *commands[4] = {0};
+    size_t n_commands = 0;
+    if (w->sync)
+      commands[n_commands++] = "+syntax sync fromstart";
+    if (w->top > 1)
+      commands[n_commands++] = jump;
+    commands[n_commands] = "+redraw";
 
     // ask Vim to render the file
-    FILE *vim_stdout = NULL;
+    int vim_stdout = -1;
     pid_t vim = 0;
-    if (ERROR((rc = run_vim(&vim_stdout, &vim, filename, term_rows,
-                            term_columns, row))))
-      goto done;
+    if (ERROR((rc = run_vim(&vim_stdout, &vim, 1, &filenames[w->file],
+                            term_rows(term), term_columns(term), opts,
+                            commands))))
+      return rc;
 
-    assert(vim_stdout != NULL && "invalid stream for Vim’s output");
+    assert(vim_stdout >= 0 && "invalid stream for Vim’s output");
     assert(vim > 0 && "invalid PID for Vim");
 
     // drain Vim’s output into the virtual terminal
-    rc = term_send(term, vim_stdout);
-
-    // if we failed to drain the entire output, discard the rest now
-    if (ERROR(rc != 0)) {
-      while (getc(vim_stdout) != EOF)
-        ;
+    bool framed = false;
+    rc = recv_vim(term, vim_stdout, opts, &framed);
+
+    // if we failed to drain the entire output, discard the rest now, unless
+    // we are out of time to wait for it
+    if (ERROR(rc != 0) || ERROR(framed)) {
+      if (rc == 0)
+        rc = EBADMSG;
+      if (rc == ETIMEDOUT || drain_vim(vim_stdout, opts) == ETIMEDOUT) {
+        abandon_vim(vim_stdout, vim);
+        return rc;
+      }
     }
 
     // clean up after Vim
+    (void)close(vim_stdout);
     {
-      (void)fclose(vim_stdout);
-      vim_stdout = NULL;
+      const int r = wait_vim(vim);
+      if (rc == 0)
+        rc = r;
+    }
+    if (UNLIKELY(rc != 0))
+      return rc;
 
-      DEBUG("waiting for Vim to exit...");
-      int status;
-      if (ERROR(waitpid(vim, &status, 0) < 0)) {
-        if (rc == 0) {
-          rc = errno;
-          DEBUG("waitpid failed: %s", strerror(rc));
-        }
-      } else if (rc == 0) {
-        if (WIFEXITED(status)) {
-          rc = WEXITSTATUS(status);
-          if (UNLIKELY(rc != 0))
-            DEBUG("Vim exited with failure: %d", rc);
-        } else {
-          rc = status;
-          DEBUG("Vim exited abnormally: %d", rc);
-        }
-      }
+    // pass terminal lines back to the caller
+    term_set_width(term, w->columns);
+    for (size_t y = 1; y <= w->rows; ++y) {
+      if (UNLIKELY((rc = emit(term, y, opts, callback, state, i,
+                              w->top + y - 1))))
+        return rc;
+    }
+  }
+
+  return 0;
+}
+
+/// create a virtual terminal large enough for any of a series of windows
+static int session_term(size_t n_files, size_t n_windows,
+                        const window_t *windows, size_t columns,
+                        const render_opts_t *opts, term_t **term) {
+  assert(windows != NULL);
+  assert(n_windows > 0);
+  assert(term != NULL);
+
+  (void)n_files;
+
+  // size the terminal to fit the tallest window, plus one extra row for the Vim
+  // statusline
+  size_t height = 0;
+  for (size_t i = 0; i < n_windows; ++i) {
+    assert(windows[i].file < n_files);
+    assert(windows[i].top > 0);
+    assert(windows[i].rows > 0);
+    assert(windows[i].rows <= 999 && "window exceeds Vim’s row limit");
+    if (height < windows[i].rows)
+      height = windows[i].rows;
+  }
+  ++height;
+  size_t width = columns;
+  clamp_extent(&height, &width);
+
+  return ctx_term(opts_ctx(opts), term, width, height);
+}
+
+/// Vim script that renders each of a list of windows, `s:windows`, whose
+/// entries are `[file, top, sync]`
+static const char SESSION[] =
+    "for [s:file, s:top, s:sync] in s:windows\n"
+    "  if argidx() + 1 != s:file\n"
+    "    exe 'silent! argument' s:file\n"
+    "  endif\n"
+    "  if s:sync\n"
+    "    syntax sync fromstart\n"
+    "    let s:redrawtime = &redrawtime\n"
+    "    set redrawtime=0\n"
+    "  endif\n"
+    "  exe 'normal!' s:top . \"Gz\\r\"\n"
+    "  redraw!\n"
+    "  if s:sync\n"
+    "    let &redrawtime = s:redrawtime\n"
+    "  endif\n"
+    "  call echoraw(\"\\e]" TERM_FRAME "\\x07\")\n"
+    "endfor\n";
+
+int start_session(size_t n_files, const char *const *filenames,
+                  size_t n_windows, const window_t *windows, size_t columns,
+                  const render_opts_t *opts, term_t **term, int *out,
+                  pid_t *pid, spool_t *spool) {
+
+  assert(n_files > 0);
+  assert(filenames != NULL);
+  assert(windows != NULL);
+  assert(n_windows > 0);
+  assert(term != NULL);
+  assert(out != NULL);
+  assert(pid != NULL);
+  assert(spool != NULL);
+
+  int rc = 0;
+  vimcat_ctx_t *const ctx = opts_ctx(opts);
+  term_t *t = NULL;
+  spool_t s = {.fd = -1};
+  buffer_t local = {0};
+  buffer_t *script = ctx == NULL ? &local : &ctx->script;
+
+  // create a virtual terminal
+  if (ERROR((rc = session_term(n_files, n_windows, windows, columns, opts,
+                               &t))))
+    goto done;
+
+  // Construct a script for Vim to run that visits each window in turn, redraws
+  // the screen, and then emits a frame marker so we know the terminal contents
+  // are ready to read. `echoraw` is only available in Vim ≥ 8.2.0065. Changing
+  // how a file is synced discards what Vim has parsed of it, so this is only
+  // done where asked, which is for a file’s first window. Parsing a large file
+  // up to such a window can take longer than 'redrawtime', after which Vim
+  // would stop highlighting the file, so the limit is lifted while drawing it.
+  if (ctx == NULL) {
+    if (ERROR((rc = buffer_open(script))))
+      goto done;
+  } else {
+    buffer_clear(script);
+  }
+  if (ERROR(fputs("let s:windows = [", script->f) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  for (size_t i = 0; i < n_windows; ++i) {
+    if (ERROR(fprintf(script->f, "%s[%zu,%zu,%d]", i == 0 ? "" : ",",
+                      windows[i].file + 1, windows[i].top,
+                      windows[i].sync ? 1 : 0) < 0)) {
+      rc = errno;
+      goto done;
+    }
+  }
+  if (ERROR(fprintf(script->f, "]\n%s", SESSION) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  buffer_sync(script);
+  if (ERROR((rc = spool_buffer(&s, script->base, script->size))))
+    goto done;
+
+  // reuse the buffer for the command that runs the script
+  buffer_clear(script);
+  if (ERROR((rc = put_source(s.path, script->f))))
+    goto done;
+  buffer_sync(script);
+
+  // ask Vim to render the windows
+  {
+    const char *commands[] = {"+if !exists('*echoraw') | cquit | endif",
+                              script->base, NULL};
+    if (ERROR((rc = run_vim(out, pid, n_files, filenames, term_rows(t),
+                            term_columns(t), opts, commands))))
+      goto done;
+  }
+
+  assert(*out >= 0 && "invalid stream for Vim’s output");
+  assert(*pid > 0 && "invalid PID for Vim");
+
+  // success
+  *term = t;
+  t = NULL;
+  *spool = s;
+  s = (spool_t){.fd = -1};
+
+done:
+  spool_close(&s);
+  buffer_close(&local);
+  ctx_term_release(ctx, &t);
+
+  return rc;
+}
+
+int read_session(size_t n_files, const char *const *filenames,
+                 size_t n_windows, const window_t *windows, size_t columns,
+                 const render_opts_t *opts,
+                 int (*callback)(void *state, size_t window,
+                                 unsigned long lineno, char *line),
+                 void *state) {
+
+  assert(n_files > 0);
+  assert(filenames != NULL);
+  assert(windows != NULL || n_windows == 0);
+  assert(callback != NULL || (opts != NULL && opts->spans != NULL));
+
+  if (n_windows == 0)
+    return 0;
+
+  if (ctx_backend(opts_ctx(opts)) == VIMCAT_BACKEND_HEADLESS) {
+    const int r = read_headless(n_files, filenames, n_windows, windows, opts,
+                                callback, state);
+    if (r != ENOTSUP)
+      return r;
+    DEBUG("headless backend unavailable; falling back to terminal backend");
+  }
+
+  int rc = 0;
+  term_t *term = NULL;
+  int vim_stdout = -1;
+  pid_t vim = 0;
+  spool_t script = {.fd = -1};
+
+  // Skip straight to a Vim per window if its version or an earlier render
+  // tells us this Vim cannot run our loop. Otherwise the loop’s own check will
+  // tell us, by Vim exiting without drawing anything.
+  const vim_t *v = NULL;
+  if (vim_find(ctx_vim(opts_ctx(opts)), &v) != 0)
+    v = NULL;
+  if (v != NULL && !vim_has_echoraw(v)) {
+    DEBUG("Vim lacks echoraw; using a Vim per window");
+    if (ERROR((rc = session_term(n_files, n_windows, windows, columns, opts,
+                                 &term))))
+      goto done;
+    rc = read_windows(term, filenames, n_windows, windows, opts, callback,
+                      state);
+    goto done;
+  }
+
+  if (ERROR((rc = start_session(n_files, filenames, n_windows, windows, columns,
+                                opts, &term, &vim_stdout, &vim, &script))))
+    goto done;
+
+  for (size_t i = 0; i < n_windows; ++i) {
+    const window_t *w = &windows[i];
+
+    // drain Vim’s output into the virtual terminal until it has redrawn
+    bool framed = false;
+    if (ERROR((rc = recv_vim(term, vim_stdout, opts, &framed))))
+      goto done;
+
+    // did Vim exit without completing this window?
+    if (ERROR(!framed)) {
+      (void)close(vim_stdout);
+      vim_stdout = -1;
+      const int status = wait_vim(vim);
       vim = 0;
-      if (UNLIKELY(rc != 0))
+
+      // If we saw no frames at all, assume this Vim cannot run our loop. If it
+      // exited through the loop’s check for `echoraw`, whose `:cquit` exits
+      // with 1, remember this so later renders need not try.
+      if (i == 0) {
+        DEBUG("no frames received; falling back to a Vim per window");
+        if (status == 1 && v != NULL)
+          vim_lacks_echoraw(v);
+        rc = read_windows(term, filenames, n_windows, windows, opts, callback,
+                          state);
         goto done;
+      }
+
+      rc = EBADMSG;
+      goto done;
     }
 
     // pass terminal lines back to the caller
-    for (size_t y = 1; y <= vim_rows; ++y) {
-
-      char *line = NULL;
-      if (ERROR((rc = term_readline(term, y, &line))))
+    term_set_width(term, w->columns);
+    for (size_t y = 1; y <= w->rows; ++y) {
+      if (UNLIKELY((rc = emit(term, y, opts, callback, state, i,
+                              w->top + y - 1))))
         goto done;
+    }
+  }
+
+  // drain anything Vim emits on exit
+  {
+    bool framed = false;
+    if (ERROR((rc = recv_vim(term, vim_stdout, opts, &framed))))
+      goto done;
+    if (ERROR(framed)) {
+      rc = EBADMSG;
+      goto done;
+    }
+  }
+
+  // clean up after Vim
+  (void)close(vim_stdout);
+  vim_stdout = -1;
+  rc = wait_vim(vim);
+  vim = 0;
+
+done:
+  if (vim_stdout >= 0)
+    abandon_vim(vim_stdout, vim);
+  spool_close(&script);
+  ctx_term_release(opts_ctx(opts), &term);
+
+  return rc;
+}
+
+/// state for translating session callbacks into caller callbacks
+typedef struct {
+  int (*callback)(void *state, char *line);
+  void *state;
+  cache_record_t *record; ///< optional recording of lines passed on
+  size_t passed;          ///< number of lines passed on
+  bool refused;           ///< did the caller’s callback return non-zero?
+} forward_t;
+
+static int forward(void *state, size_t window, unsigned long lineno,
+                   char *line) {
+
+  assert(state != NULL);
+  assert(line != NULL);
+
+  (void)window;
+  (void)lineno;
+
+  forward_t *f = state;
+
+  // record the line before the caller has a chance to modify it
+  if (f->record != NULL) {
+    const int rc = cache_record(f->record, line);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+
+  ++f->passed;
+  const int rc = f->callback(f->state, line);
+  f->refused = rc != 0;
+  return rc;
+}
+
+/// 'tabstop' Vim uses unless told otherwise
+enum { TABSTOP = 8 };
+
+/** does every line of a file end in CR LF?
+ *
+ * This is how Vim decides a file is in DOS format, in which case it strips the
+ * CRs rather than displaying them.
+ *
+ * \param f File to scan, which is left at its start
+ * \param line [inout] Buffer for `getline`
+ * \param size [inout] Size of \p line
+ * \param dos [out] Whether the file is in DOS format, on success
+ * \return 0 on success or an errno on failure
+ */
+static int is_dos(FILE *f, char **line, size_t *size, bool *dos) {
+  assert(f != NULL);
+  assert(line != NULL);
+  assert(size != NULL);
+  assert(dos != NULL);
+
+  bool crlf = false;
+  while (true) {
+    errno = 0;
+    const ssize_t length = getline(line, size, f);
+    if (length < 0) {
+      if (ERROR(errno != 0))
+        return errno;
+      break;
+    }
+    if ((*line)[length - 1] != '\n')
+      break;
+    if (length < 2 || (*line)[length - 2] != '\r') {
+      crlf = false;
+      break;
+    }
+    crlf = true;
+  }
+
+  if (ERROR(fseeko(f, 0, SEEK_SET) != 0))
+    return errno;
+
+  *dos = crlf;
+  return 0;
+}
+
+/** pass lines of a file on without highlighting, for when Vim ran out of time
+ *
+ * Lines are shown as Vim would show them with its default settings. Control
+ * characters other than tab are shown as Vim shows them (e.g. "^A"), so the
+ * file’s content cannot drive the caller’s terminal. Tabs are expanded to
+ * Vim’s default 'tabstop', as the file’s own is unknown without Vim. The CRs
+ * of a file whose lines all end in CR LF are dropped. Lines beyond the end of
+ * the file are passed on empty, as Vim would render them.
+ *
+ * \param filename Source file to read
+ * \param first 1-indexed first line to pass on
+ * \param last Last line to pass on
+ * \param callback Handler for lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the non-zero return from the
+ *   caller’s callback
+ */
+static int read_plain(const char *filename, size_t first, size_t last,
+                      int (*callback)(void *state, char *line), void *state) {
+  assert(filename != NULL);
+  assert(first > 0);
+  assert(callback != NULL);
 
-      if (UNLIKELY((rc = callback(state, line))))
+  int rc = 0;
+  char *line = NULL;
+  size_t size = 0;
+  builder_t plain = {0};
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+  FILE *f = fdopen(fd, "r");
+  if (ERROR(f == NULL)) {
+    rc = errno;
+    (void)close(fd);
+    return rc;
+  }
+
+  bool dos = false;
+  if (ERROR((rc = is_dos(f, &line, &size, &dos))))
+    goto done;
+
+  for (size_t lineno = 1; lineno <= last; ++lineno) {
+    ssize_t length = 0;
+    if (f != NULL) {
+      errno = 0;
+      length = getline(&line, &size, f);
+      if (length < 0) {
+        if (ERROR(errno != 0)) {
+          rc = errno;
+          goto done;
+        }
+        (void)fclose(f);
+        f = NULL;
+        length = 0;
+      }
+    }
+    if (lineno < first)
+      continue;
+
+    // drop the line ending
+    if (length > 0 && line[length - 1] == '\n') {
+      --length;
+      if (dos && length > 0 && line[length - 1] == '\r')
+        --length;
+    }
+
+    builder_clear(&plain);
+    size_t column = 0;
+    for (ssize_t i = 0; i < length; ++i) {
+      const unsigned char c = (unsigned char)line[i];
+      if (c == '\t') {
+        const size_t spaces = TABSTOP - column % TABSTOP;
+        rc = builder_fill(&plain, ' ', spaces);
+        column += spaces;
+      } else if (c < 0x20 || c == 0x7f) {
+        const char caret[] = {'^', c == 0x7f ? '?' : (char)(c + '@')};
+        rc = builder_append(&plain, caret, sizeof(caret));
+        column += sizeof(caret);
+      } else {
+        rc = builder_append(&plain, &line[i], 1);
+        // count only the first byte of each UTF-8 character
+        if ((c & 0xc0) != 0x80)
+          ++column;
+      }
+      if (ERROR(rc != 0))
         goto done;
     }
+    char *text = NULL;
+    if (ERROR((rc = builder_str(&plain, &text))))
+      goto done;
+
+    if (UNLIKELY((rc = callback(state, text))))
+      goto done;
+  }
+
+done:
+  builder_free(&plain);
+  free(line);
+  if (f != NULL)
+    (void)fclose(f);
+
+  return rc;
+}
+
+int read_extent(const char *filename, size_t first, size_t last,
+                size_t columns, size_t jobs, const render_opts_t *opts,
+                const digest_t *record, const cache_stamp_t *stamp,
+                int (*callback)(void *state, char *line), void *state) {
+
+  assert(filename != NULL);
+  assert(first > 0);
+  assert(first <= last);
+  assert(jobs > 0);
+  assert(record == NULL || first == 1);
+  assert(callback != NULL);
+
+  int rc = 0;
+  cache_record_t recording = {0};
+  if (record != NULL) {
+    if (ERROR((rc = cache_record_open(&recording))))
+      return rc;
+  }
+
+  // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
+  // page through the file in screens of 999 rows if it is taller than this
+  const size_t n_windows = (last - first + 1 + 998) / 999;
+  window_t *windows = calloc(n_windows, sizeof(windows[0]));
+  if (ERROR(windows == NULL)) {
+    cache_record_close(&recording);
+    return ENOMEM;
+  }
+  for (size_t i = 0; i < n_windows; ++i) {
+    windows[i].top = first + i * 999;
+    windows[i].rows =
+        last - windows[i].top + 1 > 999 ? 999 : last - windows[i].top + 1;
+  }
+
+  // render all pages within a single Vim per job
+  forward_t f = {.callback = callback,
+                .state = state,
+                .record = record == NULL ? NULL : &recording};
+  rc = read_parallel(1, &filename, n_windows, windows, columns, jobs, opts,
+                     forward, &f);
+  const size_t highlighted = f.passed;
+
+  // if Vim ran out of time, pass on the remaining lines as they are
+  if (rc == ETIMEDOUT && opts != NULL && opts->deadline != 0 && !f.refused) {
+    DEBUG("deadline passed after %zu lines; passing on lines [%zu, %zu] "
+          "unhighlighted",
+          highlighted, first + highlighted, last);
+    rc = read_plain(filename, first + highlighted, last, callback, state);
+  } else if (rc == 0 && record != NULL) {
+    cache_commit(&recording, record, stamp == NULL ? NULL : filename, stamp);
+  }
+
+  if (opts != NULL && opts->highlighted != NULL)
+    *opts->highlighted = highlighted;
+
+  free(windows);
+  if (record != NULL)
+    cache_record_close(&recording);
+
+  return rc;
+}
+
+int read_core(const char *filename, size_t first, size_t last, size_t jobs,
+              const render_opts_t *opts,
+              int (*callback)(void *state, char *line), void *state) {
+
+  assert(filename != NULL);
+  assert(first > 0);
+  assert(last == 0 || first <= last);
+  assert(jobs > 0);
+  assert(callback != NULL);
+
+  int rc = 0;
+  line_index_t *index = NULL;
+
+  // whole files go through the render cache, if there is one
+  if (first == 1 && last == 0 && cache_enabled()) {
+    size_t rows = 0;
+    size_t columns = 0;
+    digest_t content;
+    cache_stamp_t stamp;
+    if (ERROR((rc = cache_scan(filename, &content, &stamp, &rows, &columns))))
+      return rc;
+
+    // the name of the file influences how Vim highlights it
+    char *path = realpath(filename, NULL);
+    const digest_t key =
+        cache_key(&content, path == NULL ? filename : path,
+                  opts == NULL ? NULL : opts->filetype, opts_ctx(opts));
+    free(path);
+
+    cache_entry_t *entry = cache_lookup(&key);
+    if (entry != NULL) {
+      rc = cache_replay(entry, callback, state);
+      cache_release(&entry);
+      if (opts != NULL && opts->highlighted != NULL)
+        *opts->highlighted = rows;
+      return rc;
+    }
+
+    return read_extent(filename, 1, rows, columns, jobs, opts, &key, &stamp,
+                       callback, state);
+  }
+
+  // Learn the extent (character width and height) of the lines we need so we
+  // can lie to Vim and claim we have a terminal of these dimensions to prevent
+  // it line-wrapping and/or truncating. Callers highlighting single lines tend
+  // to ask for many lines of the same file, so index the file in this case
+  // rather than scanning up to the line each time.
+  size_t rows = 0;
+  size_t columns = 0;
+  if (ERROR((rc = line_index_open(filename, first == last, &index))))
+    goto done;
+  if (index != NULL) {
+    rows = line_index_rows(index);
+    if (first == 1 && (last == 0 || last >= rows)) {
+      columns = line_index_columns(index);
+    } else {
+      for (size_t i = first; i <= rows && (last == 0 || i <= last); ++i) {
+        const size_t width = line_index_width(index, i);
+        if (columns < width)
+          columns = width;
+      }
+    }
+  } else {
+    if (ERROR((rc = get_extent_range(filename, first, last, &rows, &columns))))
+      goto done;
+  }
+
+  DEBUG("%s has %s%zu rows and lines [%zu, %zu] have %zu columns", filename,
+        index == NULL && last != 0 ? "at least " : "", rows, first, last,
+        columns);
 
-    row += vim_rows;
+  // was the first requested line beyond the extent of the file?
+  if (ERROR(first > rows)) {
+    rc = ERANGE;
+    goto done;
   }
 
+  // do not render beyond the requested range
+  if (last != 0 && last < rows)
+    rows = last;
+
+  rc = read_extent(filename, first, rows, columns, jobs, opts, NULL, NULL,
+                   callback, state);
+
 done:
-  term_free(&term);
+  line_index_close(&index);
 
   return rc;
 }
 
+int vimcat_read_range(const char *filename, unsigned long first,
+                      unsigned long last,
+                      int (*callback)(void *state, char *line), void *state) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(first == 0))
+    return EINVAL;
+
+  if (ERROR(last != 0 && first > last))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  return read_core(filename, (size_t)first, (size_t)last, 1, NULL, callback,
+                   state);
+}
+
 int vimcat_read(const char *filename, int (*callback)(void *state, char *line),
                 void *state) {
 
@@ -495,5 +1202,5 @@ int vimcat_read(const char *filename, int (*callback)(void *state, char *line),
   if (ERROR(callback == NULL))
     return EINVAL;
 
-  return read_core(filename, 0, callback, state);
+  return read_core(filename, 1, 0, 1, NULL, callback, state);
 }
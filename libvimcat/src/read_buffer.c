@@ -0,0 +1,53 @@
+#include "cache.h"
+#include "debug.h"
+#include "hash.h"
+#include "read_core.h"
+#include "spool.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <vimcat/read.h>
+
+int vimcat_read_buffer(const char *data, size_t length, const char *filetype,
+                       int (*callback)(void *state, char *line), void *state) {
+
+  if (ERROR(data == NULL && length > 0))
+    return EINVAL;
+
+  if (ERROR(filetype != NULL && !is_filetype(filetype)))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  // if we have rendered this before, we need not even copy the data
+  const bool cached = cache_enabled();
+  digest_t key;
+  if (cached) {
+    hash_t hash;
+    hash_init(&hash);
+    hash_feed(&hash, data, length);
+    const digest_t content = hash_finish(&hash);
+    key = cache_key(&content, NULL, filetype, NULL);
+    cache_entry_t *entry = cache_lookup(&key);
+    if (entry != NULL) {
+      const int rc = cache_replay(entry, callback, state);
+      cache_release(&entry);
+      return rc;
+    }
+  }
+
+  // copy the data somewhere Vim can open it
+  spool_t spool;
+  int rc = spool_buffer(&spool, data, length);
+  if (ERROR(rc != 0))
+    return rc;
+
+  const render_opts_t opts = {.filetype = filetype};
+  rc = read_extent(spool.path, 1, spool.rows, spool.columns, 1, &opts,
+                   cached ? &key : NULL, NULL, callback, state);
+
+  spool_close(&spool);
+
+  return rc;
+}
@@ -1,15 +1,346 @@
 #pragma once
 
+#include "cache.h"
 #include "compiler.h"
+#include "deadline.h"
+#include "hash.h"
+#include "spool.h"
+#include "term.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <vimcat/ctx.h>
+#include <vimcat/spans.h>
 
-/** common logic of `vimcat_read` and `vimcat_read_line`
+/// settings that apply to every Vim started for a render
+typedef struct {
+  /// filetype to give each file, or `NULL` to let Vim detect it
+  const char *filetype;
+
+  /// If set, rendered rows are passed to this as text and style spans, instead
+  /// of to the render’s line callback as ANSI strings. It receives the same
+  /// state as the line callback would. This is not supported by
+  /// `read_parallel` with more than one job.
+  int (*spans)(void *state, size_t window, unsigned long lineno, char *text,
+               const vimcat_span_t *spans, size_t n_spans);
+
+  /// context supplying settings and working memory, or `NULL` for the
+  /// process-wide defaults
+  vimcat_ctx_t *ctx;
+
+  /// Time by which Vim must have finished, or 0 for no limit. Vims still
+  /// running at this point are killed and the render fails with ETIMEDOUT,
+  /// except in `read_extent`, which passes the remaining lines on without
+  /// highlighting.
+  deadline_t deadline;
+
+  /// if set, `read_core` and `read_extent` store here how many leading lines
+  /// they passed on highlighted
+  size_t *highlighted;
+} render_opts_t;
+
+/// context of a render, if any
+static inline vimcat_ctx_t *opts_ctx(const render_opts_t *opts) {
+  return opts == NULL ? NULL : opts->ctx;
+}
+
+/** is this a plausible Vim filetype name?
+ *
+ * Filetypes are passed to Vim within an Ex command, so this rejects anything
+ * other than the alphanumerics, '_', '-', and '.' that Vim’s own filetypes use.
+ *
+ * \param filetype Name to check
+ * \return True if \p filetype is safe to pass to Vim
+ */
+INTERNAL bool is_filetype(const char *filetype);
+
+/// `pipe` that also sets close-on-exec
+INTERNAL int pipe_(int pipefd[2]);
+
+/** write a string as a single-quoted Vim string literal
+ *
+ * \param s String to write
+ * \param f Stream to write to
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int put_vim_string(const char *s, FILE *f);
+
+/** write a command for `run_vim` that sources a Vim script
+ *
+ * Scripts are given to Vim by name, rather than as commands, when they may be
+ * too long for a single argument. The name is quoted, so may contain anything.
+ *
+ * \param path Path of the script
+ * \param f Stream to write to
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int put_source(const char *path, FILE *f);
+
+/** how many bytes of filenames can be passed to `run_vim` at once?
+ *
+ * Each filename costs its length, plus one for its terminator, plus the size of
+ * a pointer. Exceeding this would have Vim fail to start with E2BIG.
+ *
+ * \return Bytes available for filenames after the environment and `run_vim`’s
+ *   own arguments
+ */
+INTERNAL size_t arg_budget(void);
+
+/** start Vim, reading and displaying the given files at the given dimensions
+ *
+ * If the render has a deadline, the returned pipe is non-blocking and should be
+ * read through `recv_vim` or `drain_vim`. A render whose deadline has already
+ * passed fails with ETIMEDOUT without starting Vim.
+ *
+ * \param out [out] Read end of a pipe carrying Vim’s terminal output on
+ *   success
+ * \param pid [out] PID of the started Vim on success
+ * \param n_files Number of entries in \p filenames
+ * \param filenames Files to load into Vim’s argument list
+ * \param rows Terminal height to give Vim
+ * \param columns Terminal width to give Vim
+ * \param opts Settings for Vim, or `NULL` for the defaults
+ * \param commands `NULL`-terminated list of commands to run after loading
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int run_vim(int *out, pid_t *pid, size_t n_files,
+                     const char *const *filenames, size_t rows, size_t columns,
+                     const render_opts_t *opts, const char *const *commands);
+
+/// wait for Vim to exit, translating its exit status into an errno
+INTERNAL int wait_vim(pid_t vim);
+
+/** check whether Vim has exited, without waiting for it
+ *
+ * \param vim PID of Vim
+ * \param exited [out] Whether Vim has exited and been reaped
+ * \return 0 if Vim has not exited, otherwise as for `wait_vim`
+ */
+INTERNAL int try_wait_vim(pid_t vim, bool *exited);
+
+/** read and discard Vim’s output until it closes its end of the pipe
+ *
+ * \param vim_stdout Vim’s output, as returned by `run_vim`
+ * \param opts Settings of the render, or `NULL` for the defaults
+ * \return 0 on success, ETIMEDOUT if the render’s deadline passed first, or
+ *   another errno on failure
+ */
+INTERNAL int drain_vim(int vim_stdout, const render_opts_t *opts);
+
+/** drain Vim’s output into a terminal until a frame marker or EOF
+ *
+ * This is `term_send`, but giving up if the render’s deadline passes.
+ *
+ * \param term Terminal to write to
+ * \param vim_stdout Vim’s output, as returned by `run_vim`
+ * \param opts Settings of the render, or `NULL` for the defaults
+ * \param framed [out] As for `term_send`
+ * \return 0 on success, ETIMEDOUT if the render’s deadline passed first, or
+ *   another errno on failure
+ */
+INTERNAL int recv_vim(term_t *term, int vim_stdout, const render_opts_t *opts,
+                      bool *framed);
+
+/// terminate a Vim whose output we no longer need
+INTERNAL void abandon_vim(int vim_stdout, pid_t vim);
+
+/** pass a row of a terminal to the caller in the form they asked for
+ *
+ * \param term Terminal to read from
+ * \param row 1-indexed row to read
+ * \param opts Settings of the render, or `NULL` for the defaults
+ * \param callback Handler for the row as an ANSI string, if `opts->spans` is
+ *   not set
+ * \param state State to pass as first parameter to the callback
+ * \param window Index of the window the row belongs to
+ * \param lineno Line number of the row within the window’s file
+ * \return 0 on success, an errno on failure, or the non-zero return from the
+ *   caller’s callback
+ */
+INTERNAL int emit(term_t *term, size_t row, const render_opts_t *opts,
+                  int (*callback)(void *state, size_t window,
+                                  unsigned long lineno, char *line),
+                  void *state, size_t window, unsigned long lineno);
+
+/** common logic of `vimcat_read`, `vimcat_read_line`, `vimcat_read_range`,
+ * and `vimcat_read_parallel`
+ *
+ * Lines after the end of the file are silently omitted, but it is an error
+ * (ERANGE) for \p first to be after the end of the file.
  *
  * \param filename Source file to read
- * \param lineno Line number to highlight, or 0 to highlight all lines
+ * \param first 1-indexed first line to highlight
+ * \param last Last line to highlight, or 0 to highlight through to the end of
+ *   the file
+ * \param jobs Maximum number of Vim instances to run concurrently
+ * \param opts Settings for Vim, or `NULL` for the defaults
  * \param callback Handler for highlighted line(s)
  * \param state State to pass as first parameter to the callback
  * \return 0 on success, an errno on failure, or the last non-zero return from
  *   the caller’s callback if there was one
  */
-INTERNAL int read_core(const char *filename, unsigned long lineno,
+INTERNAL int read_core(const char *filename, size_t first, size_t last,
+                       size_t jobs, const render_opts_t *opts,
                        int (*callback)(void *state, char *line), void *state);
+
+/** render a range of lines whose extent is already known
+ *
+ * This is the latter half of `read_core`, for callers who have measured the
+ * file by other means. If \p record is given, the rendered lines are inserted
+ * into the render cache under this key once all of them have been accepted by
+ * the callback.
+ *
+ * If the render’s deadline passes, the lines not yet passed to the callback are
+ * passed on unhighlighted instead, and the result is not cached.
+ *
+ * \param filename Source file to read
+ * \param first 1-indexed first line to highlight
+ * \param last Last line to highlight, which must exist in the file
+ * \param columns Widest line within [\p first, \p last]
+ * \param jobs Maximum number of Vim instances to run concurrently
+ * \param opts Settings for Vim, or `NULL` for the defaults
+ * \param record Render cache key to store the result under, or `NULL`
+ * \param stamp State of the file when \p record was computed, or `NULL` if
+ *   the file cannot have changed since
+ * \param callback Handler for highlighted line(s)
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+INTERNAL int read_extent(const char *filename, size_t first, size_t last,
+                         size_t columns, size_t jobs,
+                         const render_opts_t *opts, const digest_t *record,
+                         const cache_stamp_t *stamp,
+                         int (*callback)(void *state, char *line),
+                         void *state);
+
+/// a range of rows from one file to be rendered in a single screen
+typedef struct {
+  size_t file; ///< index of the file this window is within
+  size_t top;  ///< 1-indexed first row of the window
+  size_t rows; ///< number of rows in the window, at most 999
+
+  /// Must Vim parse the file from its start to draw this window? This is set
+  /// for a window that continues, in a fresh Vim, a render of its file that
+  /// began at the file’s first line. Without it, Vim would guess the syntax
+  /// state at the window’s top from nearby lines, and might highlight it
+  /// differently to a Vim that had drawn the preceding windows.
+  bool sync;
+
+  /// Width of the terminal the window’s file would be rendered in alone, or 0
+  /// for the width of the terminal it is rendered in. Lines are cut to this,
+  /// so a file rendered alongside wider files still matches its own render.
+  size_t columns;
+} window_t;
+
+/** start a Vim that renders a series of windows
+ *
+ * This is the first half of `read_session`, for callers who want to consume
+ * Vim’s output themselves. Vim redraws each window in turn, following each
+ * with a frame marker that `term_send` stops at. The loop doing so is written
+ * to a script, as a list of many windows would not fit in an argument.
+ *
+ * \param n_files Number of entries in \p filenames
+ * \param filenames Files the windows refer to
+ * \param n_windows Number of entries in \p windows, at least 1
+ * \param windows Windows to render, in the order to render them
+ * \param columns Widest line within any of the windows
+ * \param opts Settings for Vim, or `NULL` for the defaults
+ * \param term [out] A terminal sized to receive Vim’s output on success
+ * \param out [out] Read end of a pipe carrying Vim’s output on success
+ * \param pid [out] PID of the started Vim on success
+ * \param spool [out] Script Vim is running on success, which must remain open
+ *   until Vim exits and then be released with `spool_close`
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int start_session(size_t n_files, const char *const *filenames,
+                           size_t n_windows, const window_t *windows,
+                           size_t columns, const render_opts_t *opts,
+                           term_t **term, int *out, pid_t *pid,
+                           spool_t *spool);
+
+/** render a series of windows within a single Vim instance
+ *
+ * Vim is started once with all \p filenames in its argument list and asked to
+ * move from one window to the next, redrawing the screen for each. If the
+ * available Vim is too old to support this, one Vim per window is used instead.
+ *
+ * \param n_files Number of entries in \p filenames
+ * \param filenames Files the windows refer to
+ * \param n_windows Number of entries in \p windows
+ * \param windows Windows to render, in the order to render them
+ * \param columns Widest line within any of the windows
+ * \param opts Settings for Vim, or `NULL` for the defaults
+ * \param callback Handler for each highlighted line, receiving the index of
+ *   the window it belongs to and its line number within the window’s file,
+ *   which may be `NULL` if `opts->spans` is set
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+INTERNAL int read_session(size_t n_files, const char *const *filenames,
+                          size_t n_windows, const window_t *windows,
+                          size_t columns, const render_opts_t *opts,
+                          int (*callback)(void *state, size_t window,
+                                          unsigned long lineno, char *line),
+                          void *state);
+
+/** render a series of windows by asking Vim for syntax attributes directly
+ *
+ * This is the headless backend, taking the same parameters as `read_session`.
+ * One Vim reports the syntax highlighting of every line in the windows, which
+ * is then drawn into a terminal so lines reach the callback in the same form
+ * the terminal backend produces.
+ *
+ * \return 0 on success, ENOTSUP if the available Vim cannot report syntax
+ *   attributes (in which case no lines have been passed to the callback), an
+ *   errno on failure, or the last non-zero return from the caller’s callback if
+ *   there was one
+ */
+INTERNAL int read_headless(size_t n_files, const char *const *filenames,
+                           size_t n_windows, const window_t *windows,
+                           const render_opts_t *opts,
+                           int (*callback)(void *state, size_t window,
+                                           unsigned long lineno, char *line),
+                           void *state);
+
+/** render a series of windows using several concurrent Vim instances
+ *
+ * The windows are divided into contiguous runs with similar numbers of rows,
+ * each of which is rendered by `read_session` given only the files the run
+ * covers. Up to \p jobs worker threads claim runs in order until none remain.
+ * Windows from several files are divided into more runs than there are
+ * workers, so a worker that finishes early can take on work that would
+ * otherwise wait for a slower one. Lines are still passed to the callback in
+ * order, on the calling thread.
+ *
+ * A run that begins partway through a file has its Vim parse the file from the
+ * start, so the result is identical to rendering every window in a single Vim.
+ * This is only possible for files whose windows begin at their first line, so
+ * if any do not, the windows are rendered serially. The parsing makes later
+ * runs slower, so the windows of any one file are divided into no more than
+ * four runs.
+ *
+ * Runs are also divided wherever needed for the files each covers to fit in a
+ * single Vim’s argument list, even when there is only one job.
+ *
+ * \param n_files Number of entries in \p filenames
+ * \param filenames Files the windows refer to
+ * \param n_windows Number of entries in \p windows
+ * \param windows Windows to render
+ * \param columns Widest line within any of the windows
+ * \param jobs Maximum number of Vim instances to run concurrently
+ * \param opts Settings for Vim, or `NULL` for the defaults
+ * \param callback Handler for each highlighted line, as for `read_session`
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+INTERNAL int read_parallel(size_t n_files, const char *const *filenames,
+                           size_t n_windows, const window_t *windows,
+                           size_t columns, size_t jobs,
+                           const render_opts_t *opts,
+                           int (*callback)(void *state, size_t window,
+                                           unsigned long lineno, char *line),
+                           void *state);
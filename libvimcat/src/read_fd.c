@@ -0,0 +1,54 @@
+#include "cache.h"
+#include "debug.h"
+#include "hash.h"
+#include "read_core.h"
+#include "spool.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <vimcat/read.h>
+
+int vimcat_read_fd(int fd, const char *filetype,
+                   int (*callback)(void *state, char *line), void *state) {
+
+  if (ERROR(fd < 0))
+    return EINVAL;
+
+  if (ERROR(filetype != NULL && !is_filetype(filetype)))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  const bool cached = cache_enabled();
+
+  // capture the input somewhere Vim can open it, measuring and hashing it as we
+  // go
+  spool_t spool;
+  hash_t hash;
+  hash_init(&hash);
+  int rc = spool_open(&spool, fd, cached ? &hash : NULL);
+  if (ERROR(rc != 0))
+    return rc;
+
+  digest_t key;
+  if (cached) {
+    const digest_t content = hash_finish(&hash);
+    key = cache_key(&content, NULL, filetype, NULL);
+    cache_entry_t *entry = cache_lookup(&key);
+    if (entry != NULL) {
+      rc = cache_replay(entry, callback, state);
+      cache_release(&entry);
+      goto done;
+    }
+  }
+
+  const render_opts_t opts = {.filetype = filetype};
+  rc = read_extent(spool.path, 1, spool.rows, spool.columns, 1, &opts,
+                   cached ? &key : NULL, NULL, callback, state);
+
+done:
+  spool_close(&spool);
+
+  return rc;
+}
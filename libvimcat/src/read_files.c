@@ -0,0 +1,360 @@
+#include "cache.h"
+#include "debug.h"
+#include "hash.h"
+#include "line_index.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vimcat/read.h>
+
+/// state for translating session callbacks into caller callbacks
+typedef struct {
+  const window_t *windows;
+  const size_t *index; ///< index within the caller’s files of each session file
+  int (*callback)(void *state, size_t index, char *line);
+  int (*finished)(void *state, size_t index, int rc);
+  void *state;
+
+  /// errors encountered measuring each of the caller’s files
+  const int *errors;
+
+  /// The next of the caller’s files to be passed on, and whether the caller
+  /// has been passed lines of the file before it that it has not yet been
+  /// told the outcome of.
+  size_t next;
+  bool streaming;
+
+  /// If the render cache is in use, these are per-file cache entries (`NULL`
+  /// for files that need rendering), keys and the states of the files when
+  /// their keys were computed, and a recording of the file currently being
+  /// rendered.
+  const char *const *filenames;
+  cache_entry_t **entries;
+  const digest_t *keys;
+  const cache_stamp_t *stamps;
+  cache_record_t record;
+} forward_t;
+
+/// state for replaying a cached file
+typedef struct {
+  const forward_t *f;
+  size_t index;
+} replay_t;
+
+static int replay_line(void *state, char *line) {
+  const replay_t *r = state;
+  return r->f->callback(r->f->state, r->index, line);
+}
+
+/// tell the caller the outcome of one of their files
+static int report(const forward_t *f, size_t index, int rc) {
+  assert(f != NULL);
+
+  // without a handler, the first failure ends the render
+  if (f->finished == NULL)
+    return rc;
+
+  return f->finished(f->state, index, rc);
+}
+
+/// store the recording of the file just rendered, if any, and start afresh
+static int commit(forward_t *f) {
+  assert(f != NULL);
+  assert(f->next > 0);
+
+  if (f->entries == NULL || f->entries[f->next - 1] != NULL)
+    return 0;
+
+  const size_t i = f->next - 1;
+  cache_commit(&f->record, &f->keys[i], f->filenames[i], &f->stamps[i]);
+  cache_record_close(&f->record);
+  return cache_record_open(&f->record);
+}
+
+/** finish the file whose lines are being passed on, and pass on those files
+ * that were not rendered up to but excluding the given file
+ */
+static int advance(forward_t *f, size_t until) {
+  assert(f != NULL);
+
+  int rc = 0;
+
+  if (f->streaming) {
+    f->streaming = false;
+    if (ERROR((rc = commit(f))))
+      return rc;
+    if (UNLIKELY((rc = report(f, f->next - 1, 0))))
+      return rc;
+  }
+
+  for (; f->next < until; ++f->next) {
+    const size_t i = f->next;
+    if (f->errors[i] != 0) {
+      rc = report(f, i, f->errors[i]);
+    } else if (f->entries != NULL && f->entries[i] != NULL) {
+      replay_t r = {.f = f, .index = i};
+      rc = cache_replay(f->entries[i], replay_line, &r);
+      if (rc == 0)
+        rc = report(f, i, 0);
+    } else {
+      // a file with no lines, and hence no windows
+      rc = report(f, i, 0);
+    }
+    if (UNLIKELY(rc != 0))
+      return rc;
+  }
+
+  return 0;
+}
+
+static int forward(void *state, size_t window, unsigned long lineno,
+                   char *line) {
+
+  assert(state != NULL);
+  assert(line != NULL);
+
+  (void)lineno;
+
+  forward_t *f = state;
+  const size_t index = f->index[f->windows[window].file];
+
+  int rc = 0;
+
+  // is this the first line of a new file?
+  if (index >= f->next) {
+    if (UNLIKELY((rc = advance(f, index))))
+      return rc;
+    f->next = index + 1;
+    f->streaming = true;
+  }
+
+  if (f->entries != NULL) {
+    if (ERROR((rc = cache_record(&f->record, line))))
+      return rc;
+  }
+
+  return f->callback(f->state, index, line);
+}
+
+/// common logic of `vimcat_read_files` and `vimcat_read_files_parallel`
+static int read_files(const char *const *filenames, size_t n, size_t jobs,
+                      int (*callback)(void *state, size_t index, char *line),
+                      int (*finished)(void *state, size_t index, int rc),
+                      void *state) {
+
+  assert(filenames != NULL || n == 0);
+  assert(jobs > 0);
+  assert(callback != NULL);
+
+  if (n == 0)
+    return 0;
+
+  int rc = 0;
+  size_t *rows = NULL;
+  size_t *widths = NULL;
+  window_t *windows = NULL;
+  const char **rendered = NULL;
+  size_t *index = NULL;
+  int *errors = NULL;
+  cache_entry_t **entries = NULL;
+  digest_t *keys = NULL;
+  cache_stamp_t *stamps = NULL;
+  forward_t f = {0};
+
+  const bool cached = cache_enabled();
+
+  rows = calloc(n, sizeof(rows[0]));
+  widths = calloc(n, sizeof(widths[0]));
+  rendered = calloc(n, sizeof(rendered[0]));
+  index = calloc(n, sizeof(index[0]));
+  errors = calloc(n, sizeof(errors[0]));
+  if (ERROR(rows == NULL || widths == NULL || rendered == NULL ||
+            index == NULL || errors == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  if (cached) {
+    entries = calloc(n, sizeof(entries[0]));
+    keys = calloc(n, sizeof(keys[0]));
+    stamps = calloc(n, sizeof(stamps[0]));
+    if (ERROR(entries == NULL || keys == NULL || stamps == NULL)) {
+      rc = ENOMEM;
+      goto done;
+    }
+  }
+
+  // Learn the extent of each file. Without a handler for per-file failures,
+  // stop at the first we cannot read, as we will render everything prior to
+  // it and then report the failure.
+  size_t columns = 0;
+  size_t n_files = 0;
+  size_t n_rendered = 0;
+  size_t n_windows = 0;
+  for (; n_files < n; ++n_files) {
+    size_t width = 0;
+
+    if (cached) {
+      // learn the extent and hash in one pass, and skip rendering anything we
+      // have rendered before
+      digest_t content;
+      if (ERROR((errors[n_files] =
+                     cache_scan(filenames[n_files], &content, &stamps[n_files],
+                                &rows[n_files], &width)))) {
+        if (finished == NULL)
+          break;
+        continue;
+      }
+      char *path = realpath(filenames[n_files], NULL);
+      keys[n_files] = cache_key(
+          &content, path == NULL ? filenames[n_files] : path, NULL, NULL);
+      free(path);
+      if ((entries[n_files] = cache_lookup(&keys[n_files])) != NULL)
+        continue;
+    } else {
+      if (ERROR((errors[n_files] = line_index_extent(
+                     filenames[n_files], &rows[n_files], &width)))) {
+        if (finished == NULL)
+          break;
+        continue;
+      }
+    }
+
+    DEBUG("%s has %zu rows and %zu columns", filenames[n_files],
+          rows[n_files], width);
+
+    if (columns < width)
+      columns = width;
+    widths[n_files] = width;
+
+    // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
+    // move in chunks of 999 rows if we have a file taller than this
+    n_windows += (rows[n_files] + 998) / 999;
+
+    rendered[n_rendered] = filenames[n_files];
+    index[n_rendered] = n_files;
+    ++n_rendered;
+  }
+
+  // include the file that stopped us, so its failure is reported
+  if (n_files < n)
+    ++n_files;
+
+  windows = calloc(n_windows, sizeof(windows[0]));
+  if (ERROR(n_windows > 0 && windows == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  // Cut each file’s lines to the width `vimcat_read` would render it at, at
+  // least 80 columns, so lines Vim pads to the terminal’s edge (e.g. the `~`
+  // filler after the end of a file) do not take on the width of a wider file.
+  {
+    size_t w = 0;
+    for (size_t i = 0; i < n_rendered; ++i) {
+      const size_t height = rows[index[i]];
+      const size_t width = widths[index[i]] < 80 ? 80 : widths[index[i]];
+      for (size_t top = 1; top <= height; top += 999) {
+        assert(w < n_windows);
+        windows[w].file = i;
+        windows[w].top = top;
+        windows[w].rows = height - top + 1 > 999 ? 999 : height - top + 1;
+        windows[w].columns = width;
+        ++w;
+      }
+    }
+    assert(w == n_windows);
+  }
+
+  f = (forward_t){.windows = windows,
+                  .index = index,
+                  .callback = callback,
+                  .finished = finished,
+                  .state = state,
+                  .errors = errors,
+                  .filenames = filenames,
+                  .entries = entries,
+                  .keys = keys,
+                  .stamps = stamps};
+  if (cached) {
+    if (ERROR((rc = cache_record_open(&f.record))))
+      goto done;
+  }
+
+  if (n_rendered > 0) {
+    if ((rc = read_parallel(n_rendered, rendered, n_windows, windows, columns,
+                            jobs, NULL, forward, &f)))
+      goto done;
+  }
+
+  // finish the last file rendered and pass on any files after it
+  rc = advance(&f, n_files);
+
+done:
+  if (cached) {
+    cache_record_close(&f.record);
+    for (size_t i = 0; entries != NULL && i < n; ++i)
+      cache_release(&entries[i]);
+  }
+  free(stamps);
+  free(keys);
+  free(entries);
+  free(errors);
+  free(index);
+  free(rendered);
+  free(windows);
+  free(widths);
+  free(rows);
+
+  return rc;
+}
+
+/// check the parameters common to `vimcat_read_files*`
+static bool valid(const char *const *filenames, size_t n) {
+
+  if (ERROR(filenames == NULL && n > 0))
+    return false;
+
+  for (size_t i = 0; i < n; ++i) {
+    if (ERROR(filenames[i] == NULL))
+      return false;
+  }
+
+  return true;
+}
+
+int vimcat_read_files(const char *const *filenames, size_t n,
+                      int (*callback)(void *state, size_t index, char *line),
+                      void *state) {
+
+  if (ERROR(!valid(filenames, n)))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  return read_files(filenames, n, 1, callback, NULL, state);
+}
+
+int vimcat_read_files_parallel(
+    const char *const *filenames, size_t n, size_t jobs,
+    int (*callback)(void *state, size_t index, char *line),
+    int (*finished)(void *state, size_t index, int rc), void *state) {
+
+  if (ERROR(!valid(filenames, n)))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  // default to one worker per processor
+  if (jobs == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  return read_files(filenames, n, jobs, callback, finished, state);
+}
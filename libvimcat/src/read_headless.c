@@ -0,0 +1,579 @@
+#include "buffer.h"
+#include "colour.h"
+#include "compiler.h"
+#include "ctx.h"
+#include "debug.h"
+#include "read_core.h"
+#include "spool.h"
+#include "term.h"
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vimcat/backend.h>
+#include <vimcat/spans.h>
+
+// The headless backend asks Vim to write a report of the highlighting of each
+// line to a file we can read back. The report is a series of lines:
+//
+//   vimcat-headless 1               a header identifying the format
+//   group <id> <fg> <bg> <b> <u>    a highlight group, with its foreground and
+//                                   background as a colour number, "#rrggbb",
+//                                   or "-" for the default, and whether it is
+//                                   bold and underlined
+//   window <tabstop>                the start of a window, and the 'tabstop'
+//                                   of its file
+//   line <id>,<len> <id>,<len> …    the highlight groups of successive runs of
+//                                   bytes of the line that follows
+//   <text>                          the text of a line, exactly as in Vim
+//
+// Every highlight group Vim knows, numbered from 0 (no highlighting) upwards,
+// precedes the first window. Each window has one `line` and text pair per row.
+// Vim does not highlight text beyond 'synmaxcol', so nor do we, reporting it as
+// a single run of group 0.
+//
+// Finding the highlighting of each byte is the expensive part. A Vim9 script
+// does this several times faster than a legacy one, as Vim9 functions are
+// compiled, so we use one when Vim supports it.
+
+/// Vim9 script that finds the runs of each line in a list of windows
+static const char LINES_VIM9[] =
+    "vim9script\n"
+    "def g:VimcatLines(windows: list<list<number>>): list<string>\n"
+    "  var lines: list<string> = []\n"
+    "  for w in windows\n"
+    "    if argidx() + 1 != w[0]\n"
+    "      execute 'silent! argument' w[0]\n"
+    "    endif\n"
+    "    if w[3] != 0\n"
+    "      execute 'syntax sync fromstart'\n"
+    "    endif\n"
+    "    add(lines, 'window ' .. &tabstop)\n"
+    "    for lnum in range(w[1], w[1] + w[2] - 1)\n"
+    "      var text = getline(lnum)\n"
+    "      var width = strlen(text)\n"
+    "      if &synmaxcol > 0 && width > &synmaxcol\n"
+    "        width = &synmaxcol\n"
+    "      endif\n"
+    "      var runs: list<string> = []\n"
+    "      var prev = -1\n"
+    "      var start = 0\n"
+    "      for col in range(width)\n"
+    "        var id = synID(lnum, col + 1, 1)\n"
+    "        if id != prev\n"
+    "          if prev >= 0\n"
+    "            add(runs, prev .. ',' .. (col - start))\n"
+    "          endif\n"
+    "          prev = id\n"
+    "          start = col\n"
+    "        endif\n"
+    "      endfor\n"
+    "      if prev >= 0\n"
+    "        add(runs, prev .. ',' .. (width - start))\n"
+    "      endif\n"
+    "      if width < strlen(text)\n"
+    "        add(runs, '0,' .. (strlen(text) - width))\n"
+    "      endif\n"
+    "      add(lines, 'line ' .. join(runs))\n"
+    "      add(lines, text)\n"
+    "    endfor\n"
+    "  endfor\n"
+    "  return lines\n"
+    "enddef\n";
+
+/// Vim script that writes the report. This is preceded by definitions of
+/// `s:windows`, a list of `[file, top, rows, sync]`, `s:out`, the path to
+/// write the report to, and `s:vim9`, the path of `LINES_VIM9`. Without Vim9,
+/// each byte is reported as a run of its own, as merging them in legacy script
+/// would cost more than it saves.
+static const char SCRIPT[] =
+    "function! s:Lines() abort\n"
+    "  let l:lines = []\n"
+    "  for [l:file, l:top, l:rows, l:sync] in s:windows\n"
+    "    if argidx() + 1 != l:file\n"
+    "      exe 'silent! argument' l:file\n"
+    "    endif\n"
+    "    if l:sync\n"
+    "      exe 'syntax sync fromstart'\n"
+    "    endif\n"
+    "    call add(l:lines, 'window ' . &tabstop)\n"
+    "    for l:lnum in range(l:top, l:top + l:rows - 1)\n"
+    "      let l:text = getline(l:lnum)\n"
+    "      let l:width = strlen(l:text)\n"
+    "      if &synmaxcol > 0 && l:width > &synmaxcol\n"
+    "        let l:width = &synmaxcol\n"
+    "      endif\n"
+    "      let l:runs = map(range(1, l:width),\n"
+    "            \\ 'synID(' . l:lnum . ', v:val, 1) . \",1\"')\n"
+    "      if l:width < strlen(l:text)\n"
+    "        call add(l:runs, '0,' . (strlen(l:text) - l:width))\n"
+    "      endif\n"
+    "      call add(l:lines, 'line ' . join(l:runs))\n"
+    "      call add(l:lines, l:text)\n"
+    "    endfor\n"
+    "  endfor\n"
+    "  return l:lines\n"
+    "endfunction\n"
+    "function! s:Colour(id, what) abort\n"
+    "  if s:gui\n"
+    "    let l:c = synIDattr(a:id, a:what . '#', 'gui')\n"
+    "  else\n"
+    "    let l:c = synIDattr(a:id, a:what, 'cterm')\n"
+    "  endif\n"
+    "  return l:c ==# '' || l:c ==# '-1' ? '-' : l:c\n"
+    "endfunction\n"
+    "if v:version >= 900\n"
+    "  exe 'source' fnameescape(s:vim9)\n"
+    "  let s:lines = VimcatLines(s:windows)\n"
+    "else\n"
+    "  let s:lines = s:Lines()\n"
+    "endif\n"
+    "let s:gui = exists('&termguicolors') && &termguicolors\n"
+    "let s:normal = synIDtrans(hlID('Normal'))\n"
+    "let s:report = ['vimcat-headless 1']\n"
+    "let s:id = 0\n"
+    "while s:id == 0 || synIDattr(s:id, 'name') !=# ''\n"
+    "  let s:t = synIDtrans(s:id)\n"
+    "  let s:fg = s:Colour(s:t, 'fg')\n"
+    "  let s:bg = s:Colour(s:t, 'bg')\n"
+    "  if s:fg ==# '-'\n"
+    "    let s:fg = s:Colour(s:normal, 'fg')\n"
+    "  endif\n"
+    "  if s:bg ==# '-'\n"
+    "    let s:bg = s:Colour(s:normal, 'bg')\n"
+    "  endif\n"
+    "  call add(s:report, join(['group', s:id, s:fg, s:bg,\n"
+    "        \\ synIDattr(s:t, 'bold', 'cterm') ==# '1',\n"
+    "        \\ synIDattr(s:t, 'underline', 'cterm') ==# '1']))\n"
+    "  let s:id += 1\n"
+    "endwhile\n"
+    "call writefile(s:report + s:lines, s:out)\n";
+
+/// header line of the report
+#define HEADER "vimcat-headless 1"
+
+/// backend selected by the caller
+static atomic_int backend = VIMCAT_BACKEND_TERMINAL;
+
+int vimcat_set_backend(vimcat_backend_t b) {
+  if (ERROR(b != VIMCAT_BACKEND_TERMINAL && b != VIMCAT_BACKEND_HEADLESS))
+    return EINVAL;
+  atomic_store(&backend, (int)b);
+  return 0;
+}
+
+vimcat_backend_t vimcat_get_backend(void) {
+  return (vimcat_backend_t)atomic_load(&backend);
+}
+
+/// a line in the report
+typedef struct {
+  size_t window;  ///< index of the window the line belongs to
+  size_t tabstop; ///< 'tabstop' of the line’s file
+  char *runs;     ///< space-separated "<id>,<length>" pairs
+  char *text;     ///< the line itself, which may contain NULs
+  size_t length;  ///< number of bytes in `text`
+} row_t;
+
+/// interpret a colour from the report
+static long parse_colour(const char *s) {
+  assert(s != NULL);
+
+  // a 24-bit colour?
+  if (s[0] == '#' && strlen(s) == 7) {
+    char *end = NULL;
+    const long rgb = strtol(&s[1], &end, 16);
+    if (*end == '\0')
+      return rgb;
+  }
+
+  // an 8-bit colour?
+  if (isdigit((unsigned char)s[0])) {
+    char *end = NULL;
+    const unsigned long n = strtoul(s, &end, 10);
+    if (*end == '\0' && n <= 255) {
+      const colour_t c = colour_8_to_24((uint8_t)n);
+      return (long)c.r << 16 | (long)c.g << 8 | c.b;
+    }
+  }
+
+  // anything else (e.g. "-") leaves the terminal’s default
+  return VIMCAT_COLOUR_DEFAULT;
+}
+
+/// the style of each highlight group, indexed by group ID
+typedef struct {
+  vimcat_span_t *styles;
+  size_t size;
+} groups_t;
+
+/// parse a `group` line of the report
+static int parse_group(char *line, groups_t *groups) {
+  assert(line != NULL);
+  assert(groups != NULL);
+
+  char *fields[6] = {0};
+  char *save = NULL;
+  size_t n = 0;
+  for (char *f = strtok_r(line, " ", &save); f != NULL && n < 6;
+       f = strtok_r(NULL, " ", &save))
+    fields[n++] = f;
+  if (ERROR(n != 6))
+    return EBADMSG;
+
+  // groups are reported in order of their IDs
+  const unsigned long id = strtoul(fields[1], NULL, 10);
+  if (ERROR(id != groups->size))
+    return EBADMSG;
+
+  vimcat_span_t *styles =
+      realloc(groups->styles, (groups->size + 1) * sizeof(styles[0]));
+  if (ERROR(styles == NULL))
+    return ENOMEM;
+  groups->styles = styles;
+
+  groups->styles[groups->size] =
+      (vimcat_span_t){.fg = parse_colour(fields[2]),
+                      .bg = parse_colour(fields[3]),
+                      .bold = strcmp(fields[4], "1") == 0,
+                      .underline = strcmp(fields[5], "1") == 0};
+  ++groups->size;
+
+  return 0;
+}
+
+/// how many terminal cells does a line occupy?
+static size_t row_columns(const row_t *r) {
+  assert(r != NULL);
+
+  size_t column = 0;
+  for (size_t i = 0; i < r->length; ++i) {
+    if (r->text[i] == '\t') {
+      column += r->tabstop - column % r->tabstop;
+    } else if (((unsigned char)r->text[i] & 0xc0) != 0x80) {
+      ++column;
+    }
+  }
+  return column;
+}
+
+/// draw a line of the report into the first row of a terminal
+static int draw(term_t *term, const row_t *r, const groups_t *groups) {
+  assert(term != NULL);
+  assert(r != NULL);
+
+  term_reset(term);
+
+  size_t column = 1;
+  size_t offset = 0;
+  for (const char *p = r->runs; offset < r->length;) {
+
+    // find the style and extent of the next run
+    vimcat_span_t style = {.fg = VIMCAT_COLOUR_DEFAULT,
+                           .bg = VIMCAT_COLOUR_DEFAULT};
+    size_t length = r->length - offset;
+    if (*p != '\0') {
+      char *end = NULL;
+      const unsigned long id = strtoul(p, &end, 10);
+      if (*end == ',') {
+        if (id < groups->size)
+          style = groups->styles[id];
+        const unsigned long l = strtoul(end + 1, &end, 10);
+        if (l < length)
+          length = l;
+      }
+      p = end;
+      while (*p == ' ')
+        ++p;
+    }
+
+    // draw the run, expanding tabs
+    for (size_t i = offset; i < offset + length;) {
+      if (r->text[i] == '\t') {
+        const size_t spaces = r->tabstop - (column - 1) % r->tabstop;
+        for (size_t j = 0; j < spaces; ++j) {
+          const int rc = term_write(term, 1, &column, " ", 1, &style);
+          if (ERROR(rc != 0))
+            return rc;
+        }
+        ++i;
+        continue;
+      }
+      size_t j = i;
+      while (j < offset + length && r->text[j] != '\t')
+        ++j;
+      const int rc = term_write(term, 1, &column, &r->text[i], j - i, &style);
+      if (ERROR(rc != 0))
+        return rc;
+      i = j;
+    }
+
+    offset += length;
+  }
+
+  return 0;
+}
+
+/// read the whole of a spooled report
+static int slurp(const spool_t *s, buffer_t *into) {
+  assert(s != NULL);
+  assert(into != NULL);
+
+  char block[BUFSIZ];
+  for (off_t offset = 0;;) {
+    const ssize_t r = pread(s->fd, block, sizeof(block), offset);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (ERROR(r < 0))
+      return errno;
+    if (r == 0)
+      break;
+    if (ERROR(fwrite(block, 1, (size_t)r, into->f) != (size_t)r))
+      return errno;
+    offset += r;
+  }
+  buffer_sync(into);
+
+  return 0;
+}
+
+int read_headless(size_t n_files, const char *const *filenames,
+                  size_t n_windows, const window_t *windows,
+                  const render_opts_t *opts,
+                  int (*callback)(void *state, size_t window,
+                                  unsigned long lineno, char *line),
+                  void *state) {
+
+  assert(n_files > 0);
+  assert(filenames != NULL);
+  assert(windows != NULL || n_windows == 0);
+  assert(callback != NULL || (opts != NULL && opts->spans != NULL));
+
+  if (n_windows == 0)
+    return 0;
+
+  int rc = 0;
+  spool_t report = {.fd = -1};
+  spool_t script = {.fd = -1};
+  spool_t vim9 = {.fd = -1};
+  buffer_t text = {0};
+  buffer_t output = {0};
+  int vim_stdout = -1;
+  pid_t vim = 0;
+  groups_t groups = {0};
+  row_t *rows = NULL;
+  term_t *term = NULL;
+
+  // somewhere for Vim to write its report
+  if (ERROR((rc = spool_buffer(&report, "", 0))))
+    goto done;
+
+  // construct the scripts for Vim to run
+  if (ERROR((rc = spool_buffer(&vim9, LINES_VIM9, strlen(LINES_VIM9)))))
+    goto done;
+  if (ERROR((rc = buffer_open(&text))))
+    goto done;
+  if (ERROR(fputs("let s:windows = [", text.f) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  for (size_t i = 0; i < n_windows; ++i) {
+    assert(windows[i].file < n_files);
+    if (ERROR(fprintf(text.f, "%s[%zu,%zu,%zu,%d]", i == 0 ? "" : ",",
+                      windows[i].file + 1, windows[i].top, windows[i].rows,
+                      windows[i].sync ? 1 : 0) < 0)) {
+      rc = errno;
+      goto done;
+    }
+  }
+  if (ERROR(fputs("]\nlet s:out = ", text.f) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  if (ERROR((rc = put_vim_string(report.path, text.f))))
+    goto done;
+  if (ERROR(fputs("\nlet s:vim9 = ", text.f) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  if (ERROR((rc = put_vim_string(vim9.path, text.f))))
+    goto done;
+  if (ERROR(fprintf(text.f, "\n%s", SCRIPT) < 0)) {
+    rc = errno;
+    goto done;
+  }
+  buffer_sync(&text);
+  if (ERROR((rc = spool_buffer(&script, text.base, text.size))))
+    goto done;
+
+  // reuse the buffer for the command that runs the script
+  buffer_clear(&text);
+  if (ERROR((rc = put_source(script.path, text.f))))
+    goto done;
+  buffer_sync(&text);
+
+  // Ask Vim to write the report. The screen Vim draws in the meantime is
+  // irrelevant, so give it the smallest terminal it accepts.
+  {
+    const char *commands[] = {"+if !exists('*synIDtrans')"
+                              " || !exists('*writefile') | cquit | endif",
+                              text.base, NULL};
+    if (ERROR((rc = run_vim(&vim_stdout, &vim, n_files, filenames, 2, 80, opts,
+                            commands))))
+      goto done;
+  }
+  if (ERROR((rc = drain_vim(vim_stdout, opts))))
+    goto done;
+  (void)close(vim_stdout);
+  vim_stdout = -1;
+  const int exit_status = wait_vim(vim);
+  vim = 0;
+
+  if (ERROR((rc = buffer_open(&output))))
+    goto done;
+  if (ERROR((rc = slurp(&report, &output))))
+    goto done;
+
+  // if there is no report, assume this Vim could not run the script
+  if (output.size < strlen(HEADER) ||
+      strncmp(output.base, HEADER "\n", strlen(HEADER) + 1) != 0) {
+    DEBUG("no report from Vim (exit status %d)", exit_status);
+    rc = ENOTSUP;
+    goto done;
+  }
+  if (ERROR(exit_status != 0)) {
+    rc = exit_status;
+    goto done;
+  }
+
+  // divide the report into lines and interpret them
+  size_t n_rows = 0;
+  {
+    size_t window = SIZE_MAX;
+    size_t tabstop = 8;
+    size_t seen = 0; // rows seen in the current window
+
+    char *end = output.base + output.size;
+    for (char *p = output.base + strlen(HEADER) + 1; p < end;) {
+      char *eol = memchr(p, '\n', (size_t)(end - p));
+      if (ERROR(eol == NULL)) {
+        rc = EBADMSG;
+        goto done;
+      }
+      *eol = '\0';
+
+      if (strncmp(p, "group ", strlen("group ")) == 0) {
+        if (ERROR((rc = parse_group(p, &groups))))
+          goto done;
+
+      } else if (strncmp(p, "window ", strlen("window ")) == 0) {
+        if (ERROR(window != SIZE_MAX && seen != windows[window].rows)) {
+          rc = EBADMSG;
+          goto done;
+        }
+        window = window == SIZE_MAX ? 0 : window + 1;
+        if (ERROR(window >= n_windows)) {
+          rc = EBADMSG;
+          goto done;
+        }
+        tabstop = strtoul(p + strlen("window "), NULL, 10);
+        if (tabstop == 0)
+          tabstop = 8;
+        seen = 0;
+
+      } else if (strncmp(p, "line", strlen("line")) == 0) {
+        if (ERROR(window == SIZE_MAX || seen == windows[window].rows)) {
+          rc = EBADMSG;
+          goto done;
+        }
+
+        // the text of the line follows
+        char *line = eol + 1;
+        char *line_end = line < end ? memchr(line, '\n', (size_t)(end - line))
+                                    : NULL;
+        if (ERROR(line_end == NULL)) {
+          rc = EBADMSG;
+          goto done;
+        }
+        *line_end = '\0';
+
+        if (rows == NULL) {
+          size_t total = 0;
+          for (size_t i = 0; i < n_windows; ++i)
+            total += windows[i].rows;
+          rows = calloc(total, sizeof(rows[0]));
+          if (ERROR(rows == NULL)) {
+            rc = ENOMEM;
+            goto done;
+          }
+        }
+        char *runs = p + strlen("line");
+        rows[n_rows] = (row_t){.window = window,
+                               .tabstop = tabstop,
+                               .runs = *runs == ' ' ? runs + 1 : runs,
+                               .text = line,
+                               .length = (size_t)(line_end - line)};
+        ++n_rows;
+        ++seen;
+        eol = line_end;
+
+      } else {
+        DEBUG("unrecognised line in Vim’s report: %s", p);
+        rc = EBADMSG;
+        goto done;
+      }
+
+      p = eol + 1;
+    }
+
+    if (ERROR(window + 1 != n_windows || seen != windows[window].rows)) {
+      rc = EBADMSG;
+      goto done;
+    }
+  }
+  DEBUG("Vim reported %zu rows using %zu highlight groups", n_rows,
+        groups.size);
+
+  // draw each line into a terminal wide enough for all of them, so it can be
+  // read back in whatever form the caller wants
+  size_t columns = 1;
+  for (size_t i = 0; i < n_rows; ++i) {
+    const size_t c = row_columns(&rows[i]);
+    if (columns < c)
+      columns = c;
+  }
+  if (ERROR((rc = ctx_term(opts_ctx(opts), &term, columns, 1))))
+    goto done;
+
+  for (size_t i = 0, y = 0; i < n_rows; ++i, ++y) {
+    // reset our row counter at the start of each window
+    if (i > 0 && rows[i - 1].window != rows[i].window)
+      y = 0;
+    if (ERROR((rc = draw(term, &rows[i], &groups))))
+      goto done;
+    if (UNLIKELY((rc = emit(term, 1, opts, callback, state, rows[i].window,
+                            windows[rows[i].window].top + y))))
+      goto done;
+  }
+
+done:
+  ctx_term_release(opts_ctx(opts), &term);
+  free(rows);
+  free(groups.styles);
+  if (vim_stdout >= 0)
+    abandon_vim(vim_stdout, vim);
+  buffer_close(&output);
+  buffer_close(&text);
+  spool_close(&vim9);
+  spool_close(&script);
+  spool_close(&report);
+
+  return rc;
+}
@@ -31,5 +31,6 @@ int vimcat_read_line(const char *filename, unsigned long lineno, char **line) {
     return EINVAL;
 
   // highlight the line in the file
-  return read_core(filename, lineno, accept_line, line);
+  return read_core(filename, (size_t)lineno, (size_t)lineno, 1, NULL,
+                   accept_line, line);
 }
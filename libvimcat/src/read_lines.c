@@ -0,0 +1,141 @@
+#include "debug.h"
+#include "line_index.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/read.h>
+
+/// state for filtering session callbacks down to the requested lines
+typedef struct {
+  const unsigned long *linenos; ///< sorted, unique, requested lines
+  size_t n;                     ///< number of entries in `linenos`
+  size_t next;                  ///< index of the next line to deliver
+  int (*callback)(void *state, unsigned long lineno, char *line);
+  void *state;
+} filter_t;
+
+static int filter(void *state, size_t window, unsigned long lineno,
+                  char *line) {
+
+  assert(state != NULL);
+  assert(line != NULL);
+
+  (void)window;
+
+  filter_t *f = state;
+
+  // skip rows that were only rendered because they lie between requested lines
+  if (f->next == f->n || f->linenos[f->next] != lineno)
+    return 0;
+
+  ++f->next;
+  return f->callback(f->state, lineno, line);
+}
+
+static int cmp_lineno(const void *a, const void *b) {
+  const unsigned long *x = a;
+  const unsigned long *y = b;
+  return *x < *y ? -1 : *x > *y;
+}
+
+int vimcat_read_lines(const char *filename, const unsigned long *linenos,
+                      size_t n,
+                      int (*callback)(void *state, unsigned long lineno,
+                                      char *line),
+                      void *state) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(linenos == NULL && n > 0))
+    return EINVAL;
+
+  for (size_t i = 0; i < n; ++i) {
+    if (ERROR(linenos[i] == 0))
+      return EINVAL;
+  }
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  if (n == 0)
+    return 0;
+
+  int rc = 0;
+  unsigned long *sorted = NULL;
+  window_t *windows = NULL;
+  line_index_t *index = NULL;
+
+  // put the requested lines in order, dropping duplicates
+  sorted = malloc(n * sizeof(sorted[0]));
+  if (ERROR(sorted == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  memcpy(sorted, linenos, n * sizeof(sorted[0]));
+  qsort(sorted, n, sizeof(sorted[0]), cmp_lineno);
+  size_t unique = 1;
+  for (size_t i = 1; i < n; ++i) {
+    if (sorted[i] != sorted[unique - 1])
+      sorted[unique++] = sorted[i];
+  }
+
+  if (ERROR((rc = line_index_open(filename, true, &index))))
+    goto done;
+
+  // were any of the requested lines beyond the extent of the file?
+  const size_t rows = line_index_rows(index);
+  if (ERROR(sorted[unique - 1] > rows)) {
+    rc = ERANGE;
+    goto done;
+  }
+
+  // Cover the lines with as few windows as possible, each starting at a
+  // requested line and spanning at most Vim’s limit of 999 rows. The terminal
+  // only needs to be wide enough for the requested lines, as others are cut off
+  // rather than wrapped.
+  windows = calloc(unique, sizeof(windows[0]));
+  if (ERROR(windows == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  size_t n_windows = 0;
+  size_t columns = 0;
+  for (size_t i = 0; i < unique; ++i) {
+    const size_t lineno = (size_t)sorted[i];
+
+    const size_t width = line_index_width(index, lineno);
+    if (columns < width)
+      columns = width;
+
+    if (n_windows > 0) {
+      window_t *w = &windows[n_windows - 1];
+      if (lineno - w->top < 999) {
+        w->rows = lineno - w->top + 1;
+        continue;
+      }
+    }
+
+    windows[n_windows].top = lineno;
+    windows[n_windows].rows = 1;
+    ++n_windows;
+  }
+
+  DEBUG("rendering %zu lines of %s in %zu windows of %zu columns", unique,
+        filename, n_windows, columns);
+
+  filter_t f = {
+      .linenos = sorted, .n = unique, .callback = callback, .state = state};
+  rc = read_session(1, &filename, n_windows, windows, columns, NULL, filter,
+                    &f);
+
+done:
+  line_index_close(&index);
+  free(windows);
+  free(sorted);
+
+  return rc;
+}
@@ -0,0 +1,409 @@
+#include "buffer.h"
+#include "debug.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vimcat/read.h>
+
+/// a contiguous run of windows, rendered by a single Vim
+typedef struct {
+  size_t first;   ///< index of the first window in this task
+  size_t count;   ///< number of windows in this task
+  buffer_t lines; ///< rendered lines, each NUL terminated
+
+  /// The files this task’s windows come from, so its Vim need not load any
+  /// others. `windows` is a copy of this task’s windows with file indices
+  /// relative to `file_first`.
+  size_t file_first;
+  size_t n_files;
+  window_t *windows;
+
+  bool done;      ///< has a worker finished with this task?
+  int rc;         ///< result of rendering this task
+} task_t;
+
+/// state shared between the caller and its workers
+typedef struct {
+  const char *const *filenames;
+  size_t columns;
+  const render_opts_t *opts;
+  FILE *const *debug_sink; ///< where the caller’s debug messages go
+
+  size_t n_tasks;
+  task_t *tasks;
+
+  pthread_mutex_t lock;     ///< protects all following members
+  pthread_cond_t completed; ///< signalled when a task is done
+  size_t next;              ///< index of the next task to be claimed
+  bool cancelled;           ///< should workers stop claiming tasks?
+} pool_t;
+
+/// save a rendered line for the caller to retrieve later
+static int stash(void *state, size_t window, unsigned long lineno,
+                 char *line) {
+
+  assert(state != NULL);
+  assert(line != NULL);
+
+  (void)window;
+  (void)lineno;
+
+  buffer_t *lines = state;
+
+  if (ERROR(fputs(line, lines->f) < 0))
+    return errno;
+  if (ERROR(fputc('\0', lines->f) == EOF))
+    return errno;
+
+  return 0;
+}
+
+/// how many tasks to divide the windows of several files into, per worker
+///
+/// Files vary in size, so giving each worker a single run of windows can leave
+/// some idle while others finish large runs. Smaller tasks let idle workers
+/// claim the remaining work, at the cost of starting more Vims.
+enum { TASKS_PER_JOB = 4 };
+
+/// how many runs to divide the windows of any one file into, at most
+///
+/// A run beginning partway through a file has its Vim first parse every line
+/// before its start, at around half the cost of drawing them. So even the last
+/// run of a file takes about half as long as rendering the whole file, and
+/// beyond a few runs each further one adds more parsing than it saves time.
+enum { RUNS_PER_FILE = 4 };
+
+/// bytes of Vim’s argument list taken up by a filename
+static size_t arg_cost(const char *filename) {
+  assert(filename != NULL);
+  return strlen(filename) + 1 + sizeof(filename);
+}
+
+/** divide windows into contiguous runs of roughly equal numbers of rows
+ *
+ * No file is divided into more than `RUNS_PER_FILE` runs. Runs are divided
+ * further where needed so the files each covers fit in a single Vim’s argument
+ * list.
+ *
+ * \param filenames Files the windows refer to
+ * \param n_windows Number of entries in \p windows
+ * \param windows Windows to divide
+ * \param limit Number of runs to divide rows among, at most \p n_windows
+ * \param budget Bytes of filenames a single Vim can be given
+ * \param tasks [out] Array of \p n_windows tasks to fill in
+ * \return Number of tasks created
+ */
+static size_t divide(const char *const *filenames, size_t n_windows,
+                     const window_t *windows, size_t limit, size_t budget,
+                     task_t *tasks) {
+  assert(filenames != NULL);
+  assert(windows != NULL);
+  assert(limit > 0);
+  assert(limit <= n_windows);
+  assert(tasks != NULL);
+
+  size_t total = 0;
+  for (size_t i = 0; i < n_windows; ++i)
+    total += windows[i].rows;
+
+  // Assign each file to the share of rows its first window’s midpoint falls
+  // within, and divide each file evenly into as many runs as it spans shares.
+  // Begin a new run early if the current one could not take on another file.
+  size_t n_tasks = 0;
+  size_t previous = 0;
+  size_t rows = 0;
+  size_t cost = 0;
+  size_t height = 0; // rows in the current file
+  size_t parts = 1;  // runs to divide the current file into
+  size_t part = 0;   // which of these the current run is
+  size_t offset = 0; // rows of the current file before this window
+  for (size_t i = 0; i < n_windows; ++i) {
+    const size_t share = (2 * rows + windows[i].rows) * limit / (2 * total);
+    const bool new_file = i == 0 || windows[i - 1].file != windows[i].file;
+    const size_t c = new_file ? arg_cost(filenames[windows[i].file]) : 0;
+    if (new_file) {
+      height = 0;
+      for (size_t j = i; j < n_windows && windows[j].file == windows[i].file;
+           ++j)
+        height += windows[j].rows;
+      parts = (2 * height * limit + total) / (2 * total);
+      if (parts < 1)
+        parts = 1;
+      if (parts > RUNS_PER_FILE)
+        parts = RUNS_PER_FILE;
+      part = 0;
+      offset = 0;
+    }
+    const size_t p = (2 * offset + windows[i].rows) * parts / (2 * height);
+    const bool split =
+        new_file ? share != previous || cost + c > budget : p != part;
+    if (n_tasks == 0 || split) {
+      assert(n_tasks < n_windows);
+      tasks[n_tasks].first = i;
+      ++n_tasks;
+      previous = share;
+      cost = arg_cost(filenames[windows[i].file]);
+    } else {
+      cost += c;
+    }
+    ++tasks[n_tasks - 1].count;
+    part = p;
+    rows += windows[i].rows;
+    offset += windows[i].rows;
+  }
+
+  return n_tasks;
+}
+
+/// give a task its own copy of its windows, relative to the files they cover
+static int localise(task_t *task, const window_t *windows) {
+  assert(task != NULL);
+  assert(task->count > 0);
+  assert(windows != NULL);
+
+  const window_t *w = &windows[task->first];
+  task->file_first = w[0].file;
+  task->n_files = w[task->count - 1].file - task->file_first + 1;
+
+  task->windows = calloc(task->count, sizeof(task->windows[0]));
+  if (ERROR(task->windows == NULL))
+    return ENOMEM;
+  for (size_t i = 0; i < task->count; ++i) {
+    assert(w[i].file >= task->file_first);
+    task->windows[i] = w[i];
+    task->windows[i].file -= task->file_first;
+  }
+
+  // if this task begins partway through a file, its Vim will not have seen the
+  // preceding windows, so needs to parse the file from its start
+  if (task->first > 0 && windows[task->first - 1].file == w[0].file)
+    task->windows[0].sync = true;
+
+  return 0;
+}
+
+/// does every file’s first window begin at the file’s first line?
+static bool from_start(size_t n_windows, const window_t *windows) {
+  assert(windows != NULL);
+
+  for (size_t i = 0; i < n_windows; ++i) {
+    if (i > 0 && windows[i - 1].file == windows[i].file)
+      continue;
+    if (windows[i].top != 1)
+      return false;
+  }
+  return true;
+}
+
+static void *work(void *arg) {
+
+  assert(arg != NULL);
+
+  pool_t *pool = arg;
+
+  // log wherever the thread that started us does
+  debug_sink = pool->debug_sink;
+
+  while (true) {
+
+    // claim the next task
+    (void)pthread_mutex_lock(&pool->lock);
+    if (pool->cancelled || pool->next == pool->n_tasks) {
+      (void)pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    task_t *task = &pool->tasks[pool->next];
+    ++pool->next;
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    DEBUG("rendering windows %zu–%zu", task->first,
+          task->first + task->count - 1);
+
+    int rc = read_session(task->n_files, &pool->filenames[task->file_first],
+                          task->count, task->windows, pool->columns,
+                          pool->opts, stash, &task->lines);
+
+    // publish the result
+    (void)pthread_mutex_lock(&pool->lock);
+    task->rc = rc;
+    task->done = true;
+    (void)pthread_cond_broadcast(&pool->completed);
+    (void)pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+int read_parallel(size_t n_files, const char *const *filenames,
+                  size_t n_windows, const window_t *windows, size_t columns,
+                  size_t jobs, const render_opts_t *opts,
+                  int (*callback)(void *state, size_t window,
+                                  unsigned long lineno, char *line),
+                  void *state) {
+
+  assert(n_files > 0);
+  assert(filenames != NULL);
+  assert(windows != NULL || n_windows == 0);
+  assert(callback != NULL);
+  assert(jobs > 0);
+  assert((opts == NULL || opts->spans == NULL || jobs == 1) &&
+         "spans cannot be stashed between threads");
+  assert((opts == NULL || opts->ctx == NULL || jobs == 1) &&
+         "a context cannot be shared between threads");
+
+  // can a single Vim be given every file?
+  const size_t budget = arg_budget();
+  size_t cost = 0;
+  for (size_t i = 0; i < n_files; ++i)
+    cost += arg_cost(filenames[i]);
+  const bool fits = cost <= budget;
+
+  // A run may only begin partway through a file whose render began at its
+  // start, as a Vim starting on a later window could not otherwise know the
+  // syntax state a single Vim would have reached there.
+  const bool splittable = from_start(n_windows, windows);
+
+  // if there is nothing to parallelise, render serially
+  if (n_windows <= 1 || (fits && (jobs == 1 || !splittable)))
+    return read_session(n_files, filenames, n_windows, windows, columns, opts,
+                        callback, state);
+
+  assert((opts == NULL || (opts->spans == NULL && opts->ctx == NULL)) &&
+         "only lines can be passed between threads");
+
+  // Divide the windows into one contiguous run per worker, though a file is
+  // not divided into more than `RUNS_PER_FILE` runs. The windows of a single
+  // file are all the same height but for the last, so this balances them.
+  // Windows of several files are divided more finely. Without several
+  // workers, or if files cannot be split, runs are only divided as needed to
+  // fit their files in Vim’s argument list.
+  size_t limit = n_files > 1 ? jobs * TASKS_PER_JOB : jobs;
+  if (jobs == 1 || !splittable)
+    limit = 1;
+  if (limit > n_windows)
+    limit = n_windows;
+  if (!fits)
+    DEBUG("files exceed Vim’s argument list; dividing them between Vims");
+
+  int rc = 0;
+  pthread_t *workers = NULL;
+  size_t n_workers = 0;
+
+  pool_t pool = {.filenames = filenames,
+                 .columns = columns,
+                 .opts = opts,
+                 .debug_sink = debug_sink};
+
+  if (ERROR((rc = pthread_mutex_init(&pool.lock, NULL))))
+    return rc;
+  if (ERROR((rc = pthread_cond_init(&pool.completed, NULL)))) {
+    (void)pthread_mutex_destroy(&pool.lock);
+    return rc;
+  }
+
+  pool.tasks = calloc(n_windows, sizeof(pool.tasks[0]));
+  if (ERROR(pool.tasks == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  const size_t n_tasks =
+      divide(filenames, n_windows, windows, limit, budget, pool.tasks);
+  pool.n_tasks = n_tasks;
+  for (size_t i = 0; i < n_tasks; ++i) {
+    if (ERROR((rc = localise(&pool.tasks[i], windows))))
+      goto done;
+    if (ERROR((rc = buffer_open(&pool.tasks[i].lines))))
+      goto done;
+  }
+
+  const size_t n_threads = n_tasks < jobs ? n_tasks : jobs;
+  workers = calloc(n_threads, sizeof(workers[0]));
+  if (ERROR(workers == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  // start the workers
+  for (; n_workers < n_threads; ++n_workers) {
+    if (ERROR((rc = pthread_create(&workers[n_workers], NULL, work, &pool))))
+      goto done;
+  }
+  DEBUG("started %zu workers", n_workers);
+
+  // pass lines back to the caller as each task completes, in order
+  for (size_t i = 0; i < n_tasks; ++i) {
+    task_t *task = &pool.tasks[i];
+
+    (void)pthread_mutex_lock(&pool.lock);
+    while (!task->done)
+      (void)pthread_cond_wait(&pool.completed, &pool.lock);
+    (void)pthread_mutex_unlock(&pool.lock);
+
+    if (ERROR((rc = task->rc)))
+      goto done;
+
+    buffer_sync(&task->lines);
+    char *line = task->lines.base;
+    for (size_t j = task->first; j < task->first + task->count; ++j) {
+      for (size_t y = 0; y < windows[j].rows; ++y) {
+        assert(line < task->lines.base + task->lines.size);
+        const size_t length = strlen(line);
+        if (UNLIKELY((rc = callback(state, j, windows[j].top + y, line))))
+          goto done;
+        line += length + 1;
+      }
+    }
+
+    // release this memory eagerly, as later tasks may be large
+    buffer_close(&task->lines);
+  }
+
+done:
+  // stop any workers that have not yet started on a task
+  (void)pthread_mutex_lock(&pool.lock);
+  pool.cancelled = true;
+  (void)pthread_mutex_unlock(&pool.lock);
+
+  for (size_t i = 0; i < n_workers; ++i)
+    (void)pthread_join(workers[i], NULL);
+  free(workers);
+
+  if (pool.tasks != NULL) {
+    for (size_t i = 0; i < pool.n_tasks; ++i) {
+      buffer_close(&pool.tasks[i].lines);
+      free(pool.tasks[i].windows);
+    }
+  }
+  free(pool.tasks);
+
+  (void)pthread_cond_destroy(&pool.completed);
+  (void)pthread_mutex_destroy(&pool.lock);
+
+  return rc;
+}
+
+int vimcat_read_parallel(const char *filename, size_t jobs,
+                         int (*callback)(void *state, char *line),
+                         void *state) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  // default to one worker per processor
+  if (jobs == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  return read_core(filename, 1, 0, jobs, NULL, callback, state);
+}
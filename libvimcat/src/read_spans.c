@@ -0,0 +1,73 @@
+#include "debug.h"
+#include "line_index.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vimcat/spans.h>
+
+/// state for translating session callbacks into caller callbacks
+typedef struct {
+  int (*callback)(void *state, char *text, const vimcat_span_t *spans,
+                  size_t n_spans);
+  void *state;
+} forward_t;
+
+static int forward(void *state, size_t window, unsigned long lineno,
+                   char *text, const vimcat_span_t *spans, size_t n_spans) {
+
+  assert(state != NULL);
+  assert(text != NULL);
+  assert(spans != NULL || n_spans == 0);
+
+  (void)window;
+  (void)lineno;
+
+  const forward_t *f = state;
+  return f->callback(f->state, text, spans, n_spans);
+}
+
+int vimcat_read_spans(const char *filename,
+                      int (*callback)(void *state, char *text,
+                                      const vimcat_span_t *spans,
+                                      size_t n_spans),
+                      void *state) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  int rc = 0;
+
+  size_t rows = 0;
+  size_t columns = 0;
+  if (ERROR((rc = line_index_extent(filename, &rows, &columns))))
+    return rc;
+
+  DEBUG("%s has %zu rows and %zu columns", filename, rows, columns);
+
+  // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
+  // page through the file in screens of 999 rows if it is taller than this
+  const size_t n_windows = (rows + 998) / 999;
+  window_t *windows = calloc(n_windows, sizeof(windows[0]));
+  if (ERROR(windows == NULL))
+    return ENOMEM;
+  for (size_t i = 0; i < n_windows; ++i) {
+    windows[i].top = 1 + i * 999;
+    windows[i].rows =
+        rows - windows[i].top + 1 > 999 ? 999 : rows - windows[i].top + 1;
+  }
+
+  // read spans straight from the terminal instead of forming ANSI strings
+  const render_opts_t opts = {.spans = forward};
+  forward_t f = {.callback = callback, .state = state};
+  rc = read_session(1, &filename, n_windows, windows, columns, &opts, NULL,
+                    &f);
+
+  free(windows);
+
+  return rc;
+}
@@ -0,0 +1,7 @@
+#include <stddef.h>
+#include <unistd.h>
+#include <vimcat/read.h>
+
+int vimcat_read_stdin(int (*callback)(void *state, char *line), void *state) {
+  return vimcat_read_fd(STDIN_FILENO, NULL, callback, state);
+}
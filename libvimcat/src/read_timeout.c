@@ -0,0 +1,35 @@
+#include "deadline.h"
+#include "debug.h"
+#include "read_core.h"
+#include <errno.h>
+#include <stddef.h>
+#include <vimcat/read.h>
+
+int vimcat_read_timeout(const char *filename, unsigned long first,
+                        unsigned long last, unsigned long timeout,
+                        int (*callback)(void *state, char *line), void *state,
+                        unsigned long *highlighted) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(first == 0))
+    return EINVAL;
+
+  if (ERROR(last != 0 && first > last))
+    return EINVAL;
+
+  if (ERROR(callback == NULL))
+    return EINVAL;
+
+  size_t count = 0;
+  const render_opts_t opts = {.deadline = deadline_after(timeout),
+                              .highlighted = &count};
+  const int rc = read_core(filename, (size_t)first, (size_t)last, 1, &opts,
+                           callback, state);
+
+  if (rc == 0 && highlighted != NULL)
+    *highlighted = (unsigned long)count;
+
+  return rc;
+}
@@ -0,0 +1,596 @@
+#include "compiler.h"
+#include "debug.h"
+#include "hash.h"
+#include "io.h"
+#include "line_index.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vimcat/session.h>
+
+/// How many rows beyond the changed text to render up front. Most changes only
+/// affect the highlighting of a few lines after them, so rendering a few extra
+/// rows in the first Vim is cheaper than needing to start a second.
+enum { MARGIN = 32 };
+
+/// How many consecutive rows past the changed text must render as they did
+/// previously before we conclude the change’s effect on highlighting has ended.
+/// More than one is needed because rows with no highlighted text (e.g. blank
+/// lines) look the same regardless of the syntax state around them.
+enum { SETTLE = 8 };
+
+struct vimcat_session {
+  char *filename;
+  line_index_t *index; ///< index of the version of the file last rendered
+  size_t rows;         ///< number of lines in the file and render
+  char **lines;        ///< highlighted lines
+  digest_t *digests;   ///< hash of the text of each line
+};
+
+/** hash the text of a range of lines
+ *
+ * \param filename File to read
+ * \param index Index of the file
+ * \param first 1-indexed first line to hash
+ * \param last Last line to hash
+ * \param digests [out] Hash of each line, the first of which is for \p first
+ * \return 0 on success, ESTALE if the file is shorter than its index says, or
+ *   another errno on failure
+ */
+static int hash_lines(const char *filename, const line_index_t *index,
+                      size_t first, size_t last, digest_t *digests) {
+  assert(filename != NULL);
+  assert(index != NULL);
+  assert(first > 0);
+  assert(last <= line_index_rows(index));
+  assert(digests != NULL || first > last);
+
+  if (first > last)
+    return 0;
+
+  int rc = 0;
+  char *block = NULL;
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+
+  // the last line of the file runs to EOF
+  uint64_t end = 0;
+  if (last < line_index_rows(index)) {
+    end = line_index_offset(index, last + 1);
+  } else {
+    struct stat st;
+    if (ERROR(fstat(fd, &st) < 0)) {
+      rc = errno;
+      goto done;
+    }
+    end = (uint64_t)st.st_size;
+  }
+
+  block = malloc(IO_BLOCK_SIZE);
+  if (ERROR(block == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  uint64_t offset = line_index_offset(index, first);
+  size_t lineno = first;
+  uint64_t line_end =
+      lineno < last ? line_index_offset(index, lineno + 1) : end;
+  hash_t h;
+  hash_init(&h);
+
+  while (offset < end) {
+    const size_t want = end - offset < IO_BLOCK_SIZE ? (size_t)(end - offset)
+                                                    : IO_BLOCK_SIZE;
+    const ssize_t r = pread(fd, block, want, (off_t)offset);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (ERROR(r < 0)) {
+      rc = errno;
+      goto done;
+    }
+    // the file has shrunk since it was indexed
+    if (ERROR(r == 0)) {
+      rc = ESTALE;
+      goto done;
+    }
+
+    // divide the block among the lines it spans
+    size_t used = 0;
+    while (used < (size_t)r) {
+      const uint64_t remaining = line_end - (offset + used);
+      const size_t take = remaining < (size_t)r - used ? (size_t)remaining
+                                                       : (size_t)r - used;
+      hash_feed(&h, &block[used], take);
+      used += take;
+      if (offset + used == line_end && lineno < last) {
+        digests[lineno - first] = hash_finish(&h);
+        hash_init(&h);
+        ++lineno;
+        line_end = lineno < last ? line_index_offset(index, lineno + 1) : end;
+      }
+    }
+    offset += (uint64_t)r;
+  }
+
+  assert(lineno == last);
+  digests[last - first] = hash_finish(&h);
+
+done:
+  free(block);
+  (void)close(fd);
+
+  return rc;
+}
+
+/// a run of freshly rendered lines
+typedef struct {
+  size_t first; ///< line number of `lines[0]`
+  size_t size;  ///< number of entries in `lines`
+  char **lines;
+} fresh_t;
+
+static void fresh_free(fresh_t *f) {
+  assert(f != NULL);
+
+  for (size_t i = 0; i < f->size; ++i)
+    free(f->lines[i]);
+  free(f->lines);
+  *f = (fresh_t){0};
+}
+
+static int accept_line(void *state, size_t window, unsigned long lineno,
+                       char *line) {
+
+  assert(state != NULL);
+  assert(line != NULL);
+
+  (void)window;
+
+  fresh_t *f = state;
+  assert(lineno >= f->first && lineno - f->first < f->size);
+  assert(f->lines[lineno - f->first] == NULL && "line rendered twice");
+
+  f->lines[lineno - f->first] = strdup(line);
+  if (ERROR(f->lines[lineno - f->first] == NULL))
+    return ENOMEM;
+
+  return 0;
+}
+
+/** render further lines, appending them to those rendered so far
+ *
+ * \param filename File to render
+ * \param index Index of the file
+ * \param f Rendered lines to extend
+ * \param last Last line to render
+ * \return 0 on success or an errno on failure
+ */
+static int render(const char *filename, const line_index_t *index, fresh_t *f,
+                  size_t last) {
+  assert(filename != NULL);
+  assert(index != NULL);
+  assert(f != NULL);
+  assert(f->first > 0);
+  assert(last <= line_index_rows(index));
+
+  const size_t from = f->first + f->size;
+  if (from > last)
+    return 0;
+
+  int rc = 0;
+
+  char **lines = realloc(f->lines, (last - f->first + 1) * sizeof(lines[0]));
+  if (ERROR(lines == NULL))
+    return ENOMEM;
+  f->lines = lines;
+  for (size_t i = f->size; i < last - f->first + 1; ++i)
+    f->lines[i] = NULL;
+  f->size = last - f->first + 1;
+
+  // Vim has a hard limit of 1000 rows, so subtract 1 for the statusline and
+  // move in chunks of 999 rows if we need more than this
+  const size_t n_windows = (last - from + 1 + 998) / 999;
+  window_t *windows = calloc(n_windows, sizeof(windows[0]));
+  if (ERROR(windows == NULL))
+    return ENOMEM;
+  for (size_t i = 0; i < n_windows; ++i) {
+    windows[i].top = from + i * 999;
+    windows[i].rows =
+        last - windows[i].top + 1 > 999 ? 999 : last - windows[i].top + 1;
+  }
+
+  size_t columns = 0;
+  for (size_t i = from; i <= last; ++i) {
+    const size_t width = line_index_width(index, i);
+    if (columns < width)
+      columns = width;
+  }
+
+  DEBUG("re-rendering lines [%zu, %zu] of %s", from, last, filename);
+  if ((rc = read_session(1, &filename, n_windows, windows, columns, NULL,
+                         accept_line, f)))
+    goto done;
+
+  for (size_t i = from; i <= last; ++i) {
+    if (ERROR(f->lines[i - f->first] == NULL)) {
+      rc = EIO;
+      goto done;
+    }
+  }
+
+done:
+  free(windows);
+
+  return rc;
+}
+
+/** re-render the part of a file affected by a change to its text
+ *
+ * \param s Session to update
+ * \param index Index of the new version of the file
+ * \param digests Hash of each line of the new version of the file, which is
+ *   taken ownership of on success
+ * \param prefix Number of lines at the start of the file whose text is
+ *   unchanged
+ * \param suffix Number of lines at the end of the file whose text is
+ *   unchanged
+ * \param change [out] Description of how the render changed
+ * \param callback Optional handler for changed lines
+ * \param state State to pass as first parameter to the callback
+ * \return 0 on success, an errno on failure, or the last non-zero return from
+ *   the caller’s callback if there was one
+ */
+static int reconcile(vimcat_session_t *s, line_index_t **index,
+                     digest_t *digests, size_t prefix, size_t suffix,
+                     vimcat_change_t *change,
+                     int (*callback)(void *state, unsigned long lineno,
+                                     char *line),
+                     void *state) {
+  assert(s != NULL);
+  assert(index != NULL && *index != NULL);
+  assert(digests != NULL);
+  assert(change != NULL);
+
+  const size_t rows = line_index_rows(*index);
+  assert(prefix + suffix <= rows);
+  assert(prefix + suffix <= s->rows);
+
+  int rc = 0;
+  char **lines = NULL;
+  fresh_t fresh = {0};
+
+  *change = (vimcat_change_t){0};
+
+  // if the text is unchanged, so is its highlighting
+  if (rows == s->rows && prefix + suffix == rows) {
+    DEBUG("no lines of %s have changed", s->filename);
+    goto commit;
+  }
+
+  // Render from the line preceding the change, in case it is highlighted
+  // differently because of what follows it (e.g. the start of a region whose
+  // end was removed). Lines after the changed text are numbered differently in
+  // the new and old versions of the file by the difference in their lengths.
+  fresh.first = prefix == 0 ? 1 : prefix;
+  const size_t changed_last = rows - suffix < fresh.first ? fresh.first
+                                                          : rows - suffix;
+  size_t last = changed_last + MARGIN > rows ? rows : changed_last + MARGIN;
+
+  while (true) {
+    if ((rc = render(s->filename, *index, &fresh, last)))
+      goto done;
+
+    if (last == rows)
+      break;
+
+    // has the highlighting after the changed text settled back into what it
+    // was before?
+    size_t settled = 0;
+    for (size_t i = last; i > changed_last; --i) {
+      const size_t old = i + s->rows - rows;
+      assert(old > 0 && old <= s->rows);
+      if (strcmp(fresh.lines[i - fresh.first], s->lines[old - 1]) != 0)
+        break;
+      ++settled;
+    }
+    if (settled >= SETTLE)
+      break;
+
+    DEBUG("highlighting of %s has not settled by line %zu", s->filename, last);
+    last = last + 999 > rows ? rows : last + 999;
+  }
+
+  // Lines [fresh.first, last] of the new render replace lines [fresh.first,
+  // last + s->rows - rows] of the old. Narrow this to only lines that differ.
+  size_t added = last - fresh.first + 1;
+  size_t removed = last + s->rows - rows - fresh.first + 1;
+  size_t first = fresh.first;
+  while (added > 0 && removed > 0 &&
+         strcmp(fresh.lines[first - fresh.first], s->lines[first - 1]) == 0) {
+    ++first;
+    --added;
+    --removed;
+  }
+  while (added > 0 && removed > 0 &&
+         strcmp(fresh.lines[first - fresh.first + added - 1],
+                s->lines[first + removed - 2]) == 0) {
+    --added;
+    --removed;
+  }
+
+  *change = (vimcat_change_t){
+      .first = first, .removed = removed, .added = added};
+  DEBUG("lines [%zu, %zu] of %s replaced by %zu line(s)", first,
+        first + removed - 1, s->filename, added);
+
+  // splice the changed lines into the render
+  lines = calloc(rows, sizeof(lines[0]));
+  if (ERROR(lines == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  for (size_t i = 1; i < first; ++i)
+    lines[i - 1] = s->lines[i - 1];
+  for (size_t i = 0; i < added; ++i) {
+    lines[first + i - 1] = fresh.lines[first - fresh.first + i];
+    fresh.lines[first - fresh.first + i] = NULL;
+  }
+  for (size_t i = first + added; i <= rows; ++i)
+    lines[i - 1] = s->lines[i + s->rows - rows - 1];
+  for (size_t i = 0; i < removed; ++i)
+    free(s->lines[first + i - 1]);
+
+  free(s->lines);
+  s->lines = lines;
+  lines = NULL;
+
+commit:
+  s->rows = rows;
+  free(s->digests);
+  s->digests = digests;
+  line_index_close(&s->index);
+  s->index = *index;
+  *index = NULL;
+
+  // deliver the changed lines, now that the session reflects them
+  if (callback != NULL) {
+    for (size_t i = 0; i < change->added; ++i) {
+      const size_t lineno = change->first + i;
+      if (UNLIKELY((rc = callback(state, lineno, s->lines[lineno - 1]))))
+        goto done;
+    }
+  }
+
+done:
+  free(lines);
+  fresh_free(&fresh);
+
+  return rc;
+}
+
+int vimcat_session_open(const char *filename,
+                        int (*callback)(void *state, unsigned long lineno,
+                                        char *line),
+                        void *state, vimcat_session_t **session) {
+
+  if (ERROR(filename == NULL))
+    return EINVAL;
+
+  if (ERROR(session == NULL))
+    return EINVAL;
+
+  int rc = 0;
+  fresh_t fresh = {.first = 1};
+
+  vimcat_session_t *s = calloc(1, sizeof(*s));
+  if (ERROR(s == NULL))
+    return ENOMEM;
+
+  s->filename = strdup(filename);
+  if (ERROR(s->filename == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  if (ERROR((rc = line_index_open(filename, true, &s->index))))
+    goto done;
+  const size_t rows = line_index_rows(s->index);
+
+  s->digests = calloc(rows, sizeof(s->digests[0]));
+  if (ERROR(s->digests == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  if (ERROR((rc = hash_lines(filename, s->index, 1, rows, s->digests))))
+    goto done;
+
+  if ((rc = render(filename, s->index, &fresh, rows)))
+    goto done;
+  s->rows = rows;
+  s->lines = fresh.lines;
+  fresh = (fresh_t){0};
+
+  if (callback != NULL) {
+    for (size_t i = 1; i <= s->rows; ++i) {
+      if (UNLIKELY((rc = callback(state, i, s->lines[i - 1]))))
+        goto done;
+    }
+  }
+
+  *session = s;
+  s = NULL;
+
+done:
+  fresh_free(&fresh);
+  vimcat_session_close(&s);
+
+  return rc;
+}
+
+int vimcat_session_update(vimcat_session_t *session, vimcat_change_t *change,
+                          int (*callback)(void *state, unsigned long lineno,
+                                          char *line),
+                          void *state) {
+
+  if (ERROR(session == NULL))
+    return EINVAL;
+
+  if (ERROR(change == NULL))
+    return EINVAL;
+
+  // if the file is as it was when last indexed, its text is unchanged and
+  // there is no need to read it
+  if (line_index_current(session->index, session->filename)) {
+    DEBUG("%s is unchanged since it was last rendered", session->filename);
+    *change = (vimcat_change_t){0};
+    return 0;
+  }
+
+  int rc = 0;
+  line_index_t *index = NULL;
+  digest_t *digests = NULL;
+
+  if (ERROR((rc = line_index_open(session->filename, true, &index))))
+    goto done;
+  const size_t rows = line_index_rows(index);
+
+  digests = calloc(rows, sizeof(digests[0]));
+  if (ERROR(digests == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  if (ERROR((rc = hash_lines(session->filename, index, 1, rows, digests))))
+    goto done;
+
+  // find the unchanged text at either end of the file
+  const size_t common = rows < session->rows ? rows : session->rows;
+  size_t prefix = 0;
+  while (prefix < common && memcmp(&digests[prefix], &session->digests[prefix],
+                                   sizeof(digests[0])) == 0)
+    ++prefix;
+  size_t suffix = 0;
+  while (prefix + suffix < common &&
+         memcmp(&digests[rows - suffix - 1],
+                &session->digests[session->rows - suffix - 1],
+                sizeof(digests[0])) == 0)
+    ++suffix;
+
+  rc = reconcile(session, &index, digests, prefix, suffix, change, callback,
+                 state);
+  if (index == NULL) // did `reconcile` take ownership?
+    digests = NULL;
+
+done:
+  free(digests);
+  line_index_close(&index);
+
+  return rc;
+}
+
+int vimcat_session_edit(vimcat_session_t *session, unsigned long first,
+                        unsigned long last, vimcat_change_t *change,
+                        int (*callback)(void *state, unsigned long lineno,
+                                        char *line),
+                        void *state) {
+
+  if (ERROR(session == NULL))
+    return EINVAL;
+
+  if (ERROR(first == 0))
+    return EINVAL;
+
+  if (ERROR(last + 1 < first))
+    return EINVAL;
+
+  if (ERROR(change == NULL))
+    return EINVAL;
+
+  int rc = 0;
+  line_index_t *index = NULL;
+  digest_t *digests = NULL;
+
+  if (ERROR((rc = line_index_open(session->filename, true, &index))))
+    goto done;
+  const size_t rows = line_index_rows(index);
+
+  // does the edit fit within both versions of the file?
+  const size_t prefix = first - 1;
+  if (ERROR(last > rows)) {
+    rc = EINVAL;
+    goto done;
+  }
+  const size_t suffix = rows - last;
+  if (ERROR(prefix + suffix > session->rows)) {
+    rc = EINVAL;
+    goto done;
+  }
+
+  // only the edited lines need hashing, as the others are unchanged
+  digests = calloc(rows, sizeof(digests[0]));
+  if (ERROR(digests == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  memcpy(digests, session->digests, prefix * sizeof(digests[0]));
+  memcpy(&digests[rows - suffix], &session->digests[session->rows - suffix],
+         suffix * sizeof(digests[0]));
+  if (ERROR((rc = hash_lines(session->filename, index, first, last,
+                             &digests[prefix]))))
+    goto done;
+
+  rc = reconcile(session, &index, digests, prefix, suffix, change, callback,
+                 state);
+  if (index == NULL) // did `reconcile` take ownership?
+    digests = NULL;
+
+done:
+  free(digests);
+  line_index_close(&index);
+
+  return rc;
+}
+
+unsigned long vimcat_session_rows(const vimcat_session_t *session) {
+  if (ERROR(session == NULL))
+    return 0;
+  return (unsigned long)session->rows;
+}
+
+const char *vimcat_session_line(const vimcat_session_t *session,
+                                unsigned long lineno) {
+  if (ERROR(session == NULL))
+    return NULL;
+  if (lineno == 0 || lineno > session->rows)
+    return NULL;
+  return session->lines[lineno - 1];
+}
+
+void vimcat_session_close(vimcat_session_t **session) {
+
+  if (session == NULL || *session == NULL)
+    return;
+
+  vimcat_session_t *s = *session;
+
+  for (size_t i = 0; s->lines != NULL && i < s->rows; ++i)
+    free(s->lines[i]);
+  free(s->lines);
+  free(s->digests);
+  line_index_close(&s->index);
+  free(s->filename);
+  free(s);
+
+  *session = NULL;
+}
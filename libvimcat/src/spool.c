@@ -0,0 +1,184 @@
+#include "spool.h"
+#include "debug.h"
+#include "extent.h"
+#include "hash.h"
+#include "io.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/// create an anonymous in-memory file, named through our own /proc entry
+static int open_memfd(spool_t *s) {
+  assert(s != NULL);
+
+#ifdef __linux__
+  const int fd = memfd_create("vimcat", MFD_CLOEXEC);
+  if (ERROR(fd < 0))
+    return errno;
+
+  // Vim cannot use “/proc/self/fd/…” because it would refer to Vim’s own
+  // descriptor table, so name the descriptor through our PID instead. This lets
+  // the descriptor stay close-on-exec.
+  char *path = NULL;
+  if (ERROR(asprintf(&path, "/proc/%ld/fd/%d", (long)getpid(), fd) < 0)) {
+    (void)close(fd);
+    return ENOMEM;
+  }
+
+  // check /proc is mounted
+  if (ERROR(access(path, R_OK) < 0)) {
+    const int err = errno;
+    free(path);
+    (void)close(fd);
+    return err;
+  }
+
+  s->fd = fd;
+  s->path = path;
+  return 0;
+#else
+  (void)s;
+  return ENOSYS;
+#endif
+}
+
+/// create a temporary file to hold the captured data
+static int open_tmp(spool_t *s) {
+  assert(s != NULL);
+
+  const char *tmpdir = getenv("TMPDIR");
+  if (tmpdir == NULL || access(tmpdir, R_OK | W_OK | X_OK) != 0)
+    tmpdir = "/tmp";
+
+  char *path = NULL;
+  if (ERROR(asprintf(&path, "%s/vimcat.XXXXXX", tmpdir) < 0))
+    return ENOMEM;
+
+  const int fd = mkostemp(path, O_CLOEXEC);
+  if (ERROR(fd < 0)) {
+    const int err = errno;
+    free(path);
+    return err;
+  }
+
+  s->fd = fd;
+  s->path = path;
+  s->tmp = path;
+  return 0;
+}
+
+/// create somewhere to store captured data
+static int create(spool_t *s) {
+  assert(s != NULL);
+
+  *s = (spool_t){.fd = -1};
+
+  if (open_memfd(s) != 0) {
+    DEBUG("memfd unavailable; falling back to a temporary file");
+    int rc = open_tmp(s);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  DEBUG("spooling input to %s", s->path);
+
+  return 0;
+}
+
+int spool_open(spool_t *s, int from, hash_t *hash) {
+  assert(s != NULL);
+  assert(from >= 0);
+
+  int rc = 0;
+  char *block = NULL;
+
+  if (ERROR((rc = create(s))))
+    return rc;
+
+  block = malloc(IO_BLOCK_SIZE);
+  if (ERROR(block == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  // measure the input as it passes through, so it only needs reading once
+  extent_t e;
+  extent_init(&e, 0);
+
+  while (true) {
+    const ssize_t r = read(from, block, IO_BLOCK_SIZE);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (ERROR(r < 0)) {
+      rc = errno;
+      goto done;
+    }
+    if (r == 0)
+      break;
+
+    (void)extent_feed(&e, block, (size_t)r);
+    if (hash != NULL)
+      hash_feed(hash, block, (size_t)r);
+    if (ERROR((rc = write_all(s->fd, block, (size_t)r))))
+      goto done;
+  }
+
+  extent_finish(&e, &s->rows, &s->columns);
+  DEBUG("spooled input has %zu rows and %zu columns", s->rows, s->columns);
+
+done:
+  free(block);
+  if (UNLIKELY(rc != 0))
+    spool_close(s);
+
+  return rc;
+}
+
+int spool_buffer(spool_t *s, const char *data, size_t length) {
+  assert(s != NULL);
+  assert(data != NULL || length == 0);
+
+  int rc = create(s);
+  if (ERROR(rc != 0))
+    return rc;
+
+  // the data is already in memory, so measure it directly
+  extent_t e;
+  extent_init(&e, 0);
+  (void)extent_feed(&e, data, length);
+  extent_finish(&e, &s->rows, &s->columns);
+
+  if (ERROR((rc = write_all(s->fd, data, length)))) {
+    spool_close(s);
+    return rc;
+  }
+
+  DEBUG("spooled buffer has %zu rows and %zu columns", s->rows, s->columns);
+
+  return 0;
+}
+
+void spool_close(spool_t *s) {
+
+  if (s == NULL)
+    return;
+
+  if (s->tmp != NULL)
+    (void)unlink(s->tmp);
+
+  if (s->fd >= 0)
+    (void)close(s->fd);
+
+  // `tmp`, if set, aliases `path`
+  free(s->path);
+
+  *s = (spool_t){.fd = -1};
+}
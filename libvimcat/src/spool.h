@@ -0,0 +1,50 @@
+/// \file
+/// \brief capturing a stream into a file Vim can open
+///
+/// Vim can only highlight something it can open by name, so input that arrives
+/// on a pipe or is held in the caller’s memory needs to be stored somewhere
+/// first. A spool is an anonymous in-memory file (a memfd) where the platform
+/// supports it, or an unlinked temporary file otherwise. The input is measured
+/// as it is captured, so it does not need to be scanned a second time to learn
+/// its extent.
+
+#pragma once
+
+#include "compiler.h"
+#include "hash.h"
+#include <stddef.h>
+
+/// captured input
+typedef struct {
+  int fd;         ///< descriptor of the captured data
+  char *path;     ///< a name by which Vim can open the captured data
+  char *tmp;      ///< temporary file to remove on close, if any
+  size_t rows;    ///< number of lines in the captured data
+  size_t columns; ///< width of the widest line in the captured data
+} spool_t;
+
+/** capture the remaining content of a file descriptor
+ *
+ * \p from is read until EOF but is not closed.
+ *
+ * \param s [out] Captured input on success
+ * \param from Descriptor to read
+ * \param hash Optional hash state to also feed the input into
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int spool_open(spool_t *s, int from, hash_t *hash);
+
+/** capture an in-memory buffer
+ *
+ * \param s [out] Captured input on success
+ * \param data Content to capture
+ * \param length Number of bytes in \p data
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int spool_buffer(spool_t *s, const char *data, size_t length);
+
+/** release captured input
+ *
+ * \param s Spool to release
+ */
+INTERNAL void spool_close(spool_t *s);
@@ -1,5 +1,5 @@
 #include "term.h"
-#include "buffer.h"
+#include "builder.h"
 #include "colour.h"
 #include "compiler.h"
 #include "debug.h"
@@ -12,6 +12,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#else
+#define HAVE_X86 0
+#endif
 
 // flip this to false to enable checks against untrusted input
 enum { TRUST_CALLER = true };
@@ -38,267 +47,812 @@ typedef struct {
 
 static style_t style_default(void) { return (style_t){0}; }
 
-static bool style_eq(style_t a, style_t b) {
+/// pack a style into an integer, such that equal styles have equal keys
+static uint64_t style_key(style_t style) {
+  uint64_t key = (uint64_t)style.custom_fg | (uint64_t)style.custom_bg << 1 |
+                 (uint64_t)style.bold << 2 | (uint64_t)style.underline << 3;
+  if (style.custom_fg)
+    key |= (uint64_t)style.fg.r << 8 | (uint64_t)style.fg.g << 16 |
+           (uint64_t)style.fg.b << 24;
+  if (style.custom_bg)
+    key |= (uint64_t)style.bg.r << 32 | (uint64_t)style.bg.g << 40 |
+           (uint64_t)style.bg.b << 48;
+  return key;
+}
 
-  if (a.custom_fg != b.custom_fg)
-    return false;
+/// write a number in decimal
+///
+/// \param dst [out] Destination for at least `sizeof("4294967295") - 1` bytes
+/// \param value Number to write
+/// \return Number of characters written
+static size_t uint_format(char *dst, unsigned value) {
+  assert(dst != NULL);
 
-  if (a.custom_bg != b.custom_bg)
-    return false;
+  char digits[sizeof("4294967295") - 1];
+  size_t n = 0;
+  do {
+    digits[sizeof(digits) - ++n] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  memcpy(dst, &digits[sizeof(digits) - n], n);
+  return n;
+}
 
-  if (a.bold != b.bold)
-    return false;
+/// The colours of a style, as SGR parameters selecting them. These are
+/// prepared when the style is interned, so writing a line does not involve
+/// formatting numbers or searching the palette.
+typedef struct {
+  char fg[sizeof("38;2;255;255;255") - 1]; ///< foreground, not NUL terminated
+  char bg[sizeof("48;2;255;255;255") - 1]; ///< background, not NUL terminated
+  uint8_t fg_length;                       ///< number of characters in `fg`
+  uint8_t bg_length;                       ///< number of characters in `bg`
+} sgr_t;
+
+/// write the parameters selecting a colour
+///
+/// \param dst [out] Destination the size of an `sgr_t`’s `fg` or `bg`
+/// \param custom Whether the colour is non-default
+/// \param colour The colour, if \p custom
+/// \param base 30 for a foreground colour or 40 for a background colour
+/// \return Number of characters written
+static uint8_t sgr_colour(char *dst, bool custom, colour_t colour,
+                          unsigned base) {
+  assert(dst != NULL);
+  assert(base == 30 || base == 40);
+
+  const unsigned colour8 = custom ? colour_24_to_8(colour) : 0;
+
+  if (!custom) // default?
+    return (uint8_t)uint_format(dst, base + 9);
+
+  if (colour8 <= 7) // can we do it as a 3-bit colour?
+    return (uint8_t)uint_format(dst, base + colour8);
+
+  if (colour8 <= 15) // can we do it as a 4-bit colour?
+    return (uint8_t)uint_format(dst, base + 60 + colour8 - 8);
+
+  size_t n = uint_format(dst, base + 8);
+
+  if (colour8 <= 255) { // can we do it as an 8-bit colour?
+    memcpy(&dst[n], ";5;", strlen(";5;"));
+    n += strlen(";5;");
+    n += uint_format(&dst[n], colour8);
+    return (uint8_t)n;
+  }
 
-  if (a.underline != b.underline)
-    return false;
+  // otherwise, 24-bit colour
+  memcpy(&dst[n], ";2;", strlen(";2;"));
+  n += strlen(";2;");
+  n += uint_format(&dst[n], colour.r);
+  dst[n++] = ';';
+  n += uint_format(&dst[n], colour.g);
+  dst[n++] = ';';
+  n += uint_format(&dst[n], colour.b);
+  return (uint8_t)n;
+}
 
-  if (a.custom_fg && !colour_eq(a.fg, b.fg))
-    return false;
+/// prepare the SGR parameters for a style’s colours
+static sgr_t sgr_new(style_t style) {
+  sgr_t sgr;
+  sgr.fg_length = sgr_colour(sgr.fg, style.custom_fg, style.fg, 30);
+  sgr.bg_length = sgr_colour(sgr.bg, style.custom_bg, style.bg, 40);
+  return sgr;
+}
 
-  if (a.custom_bg && !colour_eq(a.bg, b.bg))
-    return false;
+/// an SGR parameter, as a directive is assembled
+typedef struct {
+  const char *text; ///< parameter, not NUL terminated
+  size_t length;    ///< number of characters in `text`
+} param_t;
 
-  return true;
-}
+/// a UTF-8 character
+typedef struct {
+  char bytes[4];
+} utf8_t;
 
-/// write a directive for the given style
-static int style_put(style_t style, FILE *f) {
-  assert(f != NULL);
+/// A stretch of cells within a row that share a style. Source code is mostly
+/// long runs of like-styled text, so rows keep styling per run rather than per
+/// cell.
+typedef struct {
+  size_t end;     ///< 1-indexed column of the last cell in the run
+  uint16_t style; ///< index of the cells’ colour, format, etc
+  bool empty;     ///< are the cells blank, as opposed to holding spaces?
+} run_t;
+
+/// A line of the terminal. Storage is allocated as it is written, so a row
+/// costs memory in proportion to the text drawn in it and the number of style
+/// changes within it, rather than the width of the terminal.
+///
+/// Each cell holds a single UTF-8 character, which does not account for
+/// non-spacing combining marks, a weakness we accept for the sake of
+/// efficiency. Until a multi-byte character is written to it, a row’s text is
+/// the bytes of its cells, so reading a run of it is a single copy.
+///
+/// Vim pads the rows beyond the end of a file with spaces to the full width of
+/// the terminal. So these do not cost storage either, a run of like-styled
+/// spaces written after the last stored cell is only counted.
+typedef struct {
+  char *text;   ///< the cells’ characters, `unit` bytes each, NUL padded
+  size_t size;  ///< number of bytes allocated in `text`
+  size_t unit;  ///< bytes per cell, 1 or 4
+  size_t width; ///< number of leading cells that may be non-empty
+
+  /// styling of the first `width` cells, in order
+  run_t *runs;
+  size_t n_runs;
+  size_t runs_capacity;
+
+  size_t blank;   ///< number of spaces following the first `width` cells
+  uint16_t space; ///< index of the style of these `blank` spaces
+} row_t;
+
+/// states of the interpretation of terminal input
+typedef enum {
+  GROUND, ///< between characters and escape sequences
+  CR,     ///< after a carriage return that may begin a Windows line ending
+  UTF8,   ///< part way through a multi-byte UTF-8 character
+  ESC,    ///< after an escape
+  CSI,    ///< within a Control Sequence Introducer sequence
+  OSC,    ///< within an Operating System Command
+} state_t;
+
+/// maximum number of parameters, including sub-parameters, of a CSI sequence
+enum { CSI_PARAMS = 16 };
+
+/// a CSI sequence, as its parameters are parsed
+typedef struct {
+  uint32_t params[CSI_PARAMS]; ///< parameter values, 0 where omitted
+  bool given[CSI_PARAMS];      ///< did each parameter have any digits?
+  bool sub[CSI_PARAMS];        ///< was each parameter introduced by ':'?
+  size_t n_params;             ///< number of parameters, at least 1
 
-  if (ERROR(fputs("\033[", f) == EOF))
-    return errno;
+  bool is_private; ///< was a private marker ('<', '=', '>', or '?') seen?
+  bool ended;      ///< was a byte seen that ends the parameters?
+  bool overflow;   ///< were there more than `CSI_PARAMS` parameters?
 
-  // emit the foreground colour
-  do {
+  /// leading bytes of the sequence, for debug messages
+  char text[32];
+  size_t length; ///< number of bytes in the sequence so far
+} csi_t;
 
-    // default?
-    if (!style.custom_fg) {
-      if (ERROR(fputs("39;", f) == EOF))
-        return errno;
-      break;
-    }
+/// length of the longest Operating System Command payload we recognise
+enum { OSC_MAX = 32 };
 
-    unsigned colour8 = colour_24_to_8(style.fg);
+/// size of the blocks `term_send` reads input in
+enum { INPUT_BLOCK = 64 * 1024 };
 
-    // can we do it as a 3-bit colour?
-    if (colour8 <= 7) {
-      if (ERROR(fprintf(f, "%u;", 30 + colour8) < 0))
-        return errno;
-      break;
-    }
+/// number of entries in a terminal’s cache of recently interned styles
+enum { STYLE_CACHE = 64 };
 
-    // can we do it as a 4-bit colour?
-    if (colour8 <= 15) {
-      if (ERROR(fprintf(f, "%u;", 90 + colour8 - 8) < 0))
-        return errno;
-      break;
-    }
+struct term {
+  /// dimensions of the terminal
+  size_t columns;
+  size_t rows;
 
-    // can we do it as an 8-bit colour?
-    if (colour8 <= 255) {
-      if (ERROR(fprintf(f, "38;5;%um\033[", colour8) < 0))
-        return errno;
-      break;
-    }
+  /// number of rows allocated in `lines`, at least `rows`
+  size_t capacity;
 
-    // otherwise, 24-bit colour
-    if (ERROR(fprintf(f, "38;2;%u;%u;%um\033[", (unsigned)style.fg.r,
-                      (unsigned)style.fg.g, (unsigned)style.fg.b) < 0))
-      return errno;
+  /// number of leading rows that may be non-empty
+  size_t height;
 
-  } while (0);
+  /// cursor position
+  size_t x;
+  size_t y;
 
-  // emit the background colour
-  do {
+  /// currently active style, and its index in `styles`
+  style_t style;
+  uint16_t style_index;
 
-    // default?
-    if (!style.custom_bg) {
-      if (ERROR(fputs("49;", f) == EOF))
-        return errno;
-      break;
-    }
+  /// distinct styles used on the terminal, of which the first is the default
+  style_t *styles;
+  uint64_t *style_keys; ///< `style_key` of each of `styles`
+  sgr_t *sgrs;          ///< `sgr_new` of each of `styles`
+  size_t n_styles;
+  size_t styles_capacity;
 
-    unsigned colour8 = colour_24_to_8(style.bg);
+  /// recently interned styles, indexed by a hash of their key
+  uint16_t style_cache[STYLE_CACHE];
 
-    // can we do it as a 3-bit colour?
-    if (colour8 <= 7) {
-      if (ERROR(fprintf(f, "%u;", 40u + colour8) < 0))
-        return errno;
-      break;
-    }
+  /// scratch space for doing transient text manipulation
+  builder_t stage;
+
+  /// do lines read by `term_readline` continue in the style the last ended in?
+  bool carry;
+  style_t carried; ///< style the last line read ended in, if `carry`
+
+  /// number of leading columns of each row to read, or 0 for all of them
+  size_t width;
+
+  /// Interpretation state of input received by `term_send`, which may end
+  /// part way through a character or escape sequence. Partial characters and
+  /// sequences are held here rather than as input, so each input byte is only
+  /// examined once.
+  state_t state;
+  utf8_t pending;          ///< bytes of a partial UTF-8 character
+  size_t pending_length;   ///< number of bytes in `pending`
+  size_t pending_expected; ///< length of the character `pending` begins
+  csi_t csi;               ///< partial CSI sequence
+  char osc[OSC_MAX];       ///< leading bytes of a partial OSC payload
+  size_t osc_length;       ///< number of bytes in the OSC payload so far
+
+  /// block of input read by `term_send`, of which bytes from `input_offset` to
+  /// `input_size` follow a frame marker and are yet to be interpreted
+  char *input;
+  size_t input_offset;
+  size_t input_size;
+
+  /// scratch space for the styling of a line read by `term_readspans`
+  vimcat_span_t *spans;
+  size_t spans_capacity;
 
-    // can we do it as a 4-bit colour?
-    if (colour8 <= 15) {
-      if (ERROR(fprintf(f, "%u;", 100 + colour8 - 8) < 0))
-        return errno;
-      break;
-    }
+  /// data on the terminal
+  row_t *lines;
+};
 
-    // can we do it as an 8-bit colour?
-    if (ERROR(fprintf(f, "48;5;%um\033[", colour8) < 0))
-      return errno;
+int term_new(term_t **t, size_t columns, size_t rows) {
 
-    // otherwise, 24-bit colour
-    if (ERROR(fprintf(f, "48;2;%u;%u;%um\033[", (unsigned)style.bg.r,
-                      (unsigned)style.bg.g, (unsigned)style.bg.b) < 0))
-      return errno;
+  PRECONDITION(t != NULL);
+  PRECONDITION(columns > 0);
+  PRECONDITION(rows > 0);
 
-  } while (0);
+  term_t *term = calloc(1, sizeof(*term));
+  if (ERROR(term == NULL))
+    return ENOMEM;
 
-  if (style.bold) {
-    if (ERROR(fputs("1;", f) == EOF))
-      return errno;
-  } else {
-    if (ERROR(fputs("22;", f) == EOF))
-      return errno;
+  int rc = 0;
+
+  term->columns = columns;
+  term->rows = rows;
+
+  // allocate rows, but not their cells
+  term->lines = calloc(rows, sizeof(term->lines[0]));
+  if (ERROR(term->lines == NULL)) {
+    rc = ENOMEM;
+    goto done;
   }
+  for (size_t i = 0; i < rows; ++i)
+    term->lines[i].unit = 1;
+  term->capacity = rows;
 
-  if (style.underline) {
-    if (ERROR(fputs("4", f) == EOF))
-      return errno;
-  } else {
-    if (ERROR(fputs("24", f) == EOF))
-      return errno;
+  term->x = 1;
+  term->y = 1;
+
+  term->styles = malloc(sizeof(term->styles[0]) * 16);
+  term->style_keys = malloc(sizeof(term->style_keys[0]) * 16);
+  term->sgrs = malloc(sizeof(term->sgrs[0]) * 16);
+  if (ERROR(term->styles == NULL || term->style_keys == NULL ||
+            term->sgrs == NULL)) {
+    rc = ENOMEM;
+    goto done;
   }
+  term->styles[0] = style_default();
+  term->style_keys[0] = style_key(style_default());
+  term->sgrs[0] = sgr_new(style_default());
+  term->n_styles = 1;
+  term->styles_capacity = 16;
 
-  if (ERROR(fputc('m', f) == EOF))
-    return errno;
+  // success
+  *t = term;
 
-  return 0;
+done:
+  if (UNLIKELY(rc != 0))
+    term_free(&term);
+
+  return rc;
 }
 
-/// a UTF-8 character
-typedef struct {
-  char bytes[4];
-} utf8_t;
+int term_resize(term_t **t, size_t columns, size_t rows) {
+
+  PRECONDITION(t != NULL);
+  PRECONDITION(*t != NULL);
+  PRECONDITION(columns > 0);
+  PRECONDITION(rows > 0);
+
+  term_t *term = *t;
+
+  // only grow the allocation, so a terminal used for renders of varying sizes
+  // settles at the largest of them
+  if (rows > term->capacity) {
+    row_t *lines = realloc(term->lines, sizeof(lines[0]) * rows);
+    if (ERROR(lines == NULL))
+      return ENOMEM;
+    memset(&lines[term->capacity], 0,
+           sizeof(lines[0]) * (rows - term->capacity));
+    for (size_t i = term->capacity; i < rows; ++i)
+      lines[i].unit = 1;
+    term->lines = lines;
+    term->capacity = rows;
+  }
+
+  term->columns = columns;
+  term->rows = rows;
+  term->width = 0;
+  term_reset(term);
 
-static bool utf8eq(utf8_t u, const char *s) {
-  return strlen(s) <= sizeof(u.bytes) &&
-         strncmp(u.bytes, s, sizeof(u.bytes)) == 0;
+  return 0;
 }
 
-/// A grapheme, stored as a single UTF-8 character. Note that this
-/// representation does not account for non-spacing combining marks, a
-/// weakness we accept for the sake of efficiency.
-typedef struct {
-  utf8_t value;
-} grapheme_t;
+size_t term_rows(const term_t *t) {
+  assert(t != NULL);
+  return t->rows;
+}
 
-static bool grapheme_is_nul(const grapheme_t *g) {
-  assert(g != NULL);
-  return utf8eq(g->value, "");
+size_t term_columns(const term_t *t) {
+  assert(t != NULL);
+  return t->columns;
 }
 
-static int grapheme_put(const grapheme_t *g, FILE *f) {
-  assert(g != NULL);
-  assert(f != NULL);
+/// find the index of a style in the terminal’s table, adding it if necessary
+///
+/// \param t Terminal whose styles to search
+/// \param style Style to look up
+/// \param index [out] Index of \p style on success
+/// \return 0 on success or an errno on failure
+static int style_intern(term_t *t, style_t style, uint16_t *index) {
+  assert(t != NULL);
+  assert(index != NULL);
+  assert(t->n_styles > 0);
+
+  const uint64_t key = style_key(style);
+
+  // try the cache, whose entries may be stale, using the top 6 bits of a
+  // Fibonacci hash of the key
+  uint16_t *const cached =
+      &t->style_cache[(key * UINT64_C(0x9e3779b97f4a7c15)) >> 58];
+  if (*cached < t->n_styles && t->style_keys[*cached] == key) {
+    *index = *cached;
+    return 0;
+  }
+
+  for (size_t i = 0; i < t->n_styles; ++i) {
+    if (t->style_keys[i] == key) {
+      *index = *cached = (uint16_t)i;
+      return 0;
+    }
+  }
+
+  if (UNLIKELY(t->n_styles > UINT16_MAX)) {
+    DEBUG("more than %zu distinct styles", t->n_styles);
+    return EOVERFLOW;
+  }
+
+  if (t->n_styles == t->styles_capacity) {
+    const size_t c = t->styles_capacity * 2;
+    style_t *s = realloc(t->styles, c * sizeof(s[0]));
+    if (ERROR(s == NULL))
+      return ENOMEM;
+    t->styles = s;
+    uint64_t *k = realloc(t->style_keys, c * sizeof(k[0]));
+    if (ERROR(k == NULL))
+      return ENOMEM;
+    t->style_keys = k;
+    sgr_t *g = realloc(t->sgrs, c * sizeof(g[0]));
+    if (ERROR(g == NULL))
+      return ENOMEM;
+    t->sgrs = g;
+    t->styles_capacity = c;
+  }
 
-  if (ERROR(fprintf(f, "%.*s", (int)sizeof(g->value.bytes), g->value.bytes) <
-            0))
-    return errno;
+  t->styles[t->n_styles] = style;
+  t->style_keys[t->n_styles] = key;
+  t->sgrs[t->n_styles] = sgr_new(style);
+  *index = *cached = (uint16_t)t->n_styles;
+  ++t->n_styles;
 
   return 0;
 }
 
-static void grapheme_free(grapheme_t *g) {
-  assert(g != NULL);
-  *g = (grapheme_t){0};
+/// get the row at the given 1-indexed coordinate
+static row_t *get_row(term_t *t, size_t y) {
+  assert(t != NULL);
+  assert(y > 0);
+  assert(y <= t->rows);
+
+  return &t->lines[y - 1];
 }
 
-/// a 1-grapheme region of the terminal
-typedef struct {
-  grapheme_t grapheme;
-  style_t style; ///< colour, format, etc for this character
-} cell_t;
+/// restyle a range of a row’s cells
+///
+/// The range must begin within or immediately after the cells the row’s runs
+/// already cover.
+///
+/// \param row Row to update
+/// \param from 1-indexed column of the first cell to restyle
+/// \param to 1-indexed column of the last cell to restyle
+/// \param style Index of the style to give the cells
+/// \param empty Whether the cells are blank
+/// \return 0 on success or an errno on failure
+static int runs_set(row_t *row, size_t from, size_t to, uint16_t style,
+                    bool empty) {
+  assert(row != NULL);
+  assert(from > 0);
+  assert(from <= to);
+
+  const size_t n = row->n_runs;
+  run_t *runs = row->runs;
+  const size_t covered = n > 0 ? runs[n - 1].end : 0;
+  assert(from <= covered + 1);
+
+  // make room for the at most two runs we add
+  if (n + 2 > row->runs_capacity) {
+    const size_t c = row->runs_capacity < 8 ? 8 : row->runs_capacity * 2;
+    run_t *r = realloc(runs, sizeof(r[0]) * c);
+    if (ERROR(r == NULL))
+      return ENOMEM;
+    row->runs = runs = r;
+    row->runs_capacity = c;
+  }
+
+  // fast path for text written left to right
+  if (from == covered + 1) {
+    if (n > 0 && runs[n - 1].style == style && runs[n - 1].empty == empty) {
+      runs[n - 1].end = to;
+    } else {
+      runs[n] = (run_t){.end = to, .style = style, .empty = empty};
+      ++row->n_runs;
+    }
+    return 0;
+  }
+
+  // find the runs containing `from` and `to`
+  size_t lo = 0;
+  for (size_t hi = n; lo < hi;) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (runs[mid].end < from) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  size_t hi = lo;
+  while (hi < n && runs[hi].end < to)
+    ++hi;
+
+  // fast path for text redrawn as it was
+  if (hi == lo && runs[lo].style == style && runs[lo].empty == empty)
+    return 0;
+  if (hi == n && lo + 1 == n && runs[lo].style == style &&
+      runs[lo].empty == empty) {
+    runs[lo].end = to;
+    return 0;
+  }
+
+  // construct what replaces runs[lo] through runs[hi], keeping the parts of
+  // these that lie outside the range
+  run_t replacement[3];
+  size_t m = 0;
+  const size_t start = lo > 0 ? runs[lo - 1].end + 1 : 1;
+  if (start < from) {
+    replacement[m] = runs[lo];
+    replacement[m].end = from - 1;
+    ++m;
+  }
+  replacement[m++] = (run_t){.end = to, .style = style, .empty = empty};
+  if (hi < n && runs[hi].end > to)
+    replacement[m++] = runs[hi];
+  hi = hi < n ? hi + 1 : n;
+
+  // merge with like-styled neighbours
+  if (lo > 0 && runs[lo - 1].style == replacement[0].style &&
+      runs[lo - 1].empty == replacement[0].empty)
+    --lo;
+  if (hi < n && runs[hi].style == replacement[m - 1].style &&
+      runs[hi].empty == replacement[m - 1].empty) {
+    replacement[m - 1].end = runs[hi].end;
+    ++hi;
+  }
+  size_t k = 0;
+  for (size_t i = 0; i < m; ++i) {
+    if (k > 0 && replacement[k - 1].style == replacement[i].style &&
+        replacement[k - 1].empty == replacement[i].empty) {
+      replacement[k - 1].end = replacement[i].end;
+    } else {
+      replacement[k++] = replacement[i];
+    }
+  }
+
+  memmove(&runs[lo + k], &runs[hi], sizeof(runs[0]) * (n - hi));
+  memcpy(&runs[lo], replacement, sizeof(runs[0]) * k);
+  row->n_runs = n - (hi - lo) + k;
 
-static bool cell_is_empty(const cell_t *c) {
-  assert(c != NULL);
+  return 0;
+}
 
-  return grapheme_is_nul(&c->grapheme);
+/// get the text of a cell
+static char *row_at(const row_t *row, size_t x) {
+  assert(row != NULL);
+  assert(x > 0);
+  return &row->text[(x - 1) * row->unit];
 }
 
-static void cell_clear(cell_t *c) {
-  assert(c != NULL);
+/// write spaces into a row’s text, from column \p from to \p to inclusive
+static void row_fill(row_t *row, size_t from, size_t to) {
+  assert(row != NULL);
+
+  if (from > to)
+    return;
+
+  if (row->unit == 1) {
+    memset(row_at(row, from), ' ', to - from + 1);
+    return;
+  }
 
-  grapheme_free(&c->grapheme);
-  *c = (cell_t){0};
+  char *cell = row_at(row, from);
+  for (size_t x = from; x <= to; ++x, cell += 4) {
+    cell[0] = ' ';
+    cell[1] = cell[2] = cell[3] = '\0';
+  }
 }
 
-static int cell_put(const cell_t *c, FILE *f) {
-  assert(c != NULL);
-  assert(f != NULL);
+/// allow a row to store multi-byte characters
+static int row_widen(term_t *t, row_t *row) {
+  assert(t != NULL);
+  assert(row != NULL);
+
+  if (row->unit == 4)
+    return 0;
+
+  // Keep as many cells as the row has room for now, but no more than the
+  // terminal is wide. A row cleared after holding multi-byte characters
+  // retains its larger allocation, which may already be enough.
+  size_t cells = row->size / row->unit;
+  if (cells > t->columns)
+    cells = t->columns;
+  if (cells < row->width)
+    cells = row->width;
+  if (row->size < cells * 4) {
+    char *r = realloc(row->text, cells * 4);
+    if (ERROR(r == NULL))
+      return ENOMEM;
+    row->text = r;
+    row->size = cells * 4;
+  }
+
+  // spread each byte out to 4, working backwards so none is overwritten
+  for (size_t x = row->width; x > 0; --x) {
+    char *cell = &row->text[(x - 1) * 4];
+    cell[0] = row->text[x - 1];
+    cell[1] = cell[2] = cell[3] = '\0';
+  }
+  row->unit = 4;
 
-  return grapheme_put(&c->grapheme, f);
+  return 0;
 }
 
-struct term {
-  /// dimensions of the terminal
-  size_t columns;
-  size_t rows;
+/// prepare a row for its cells from \p from to \p to inclusive to be written
+///
+/// The caller is expected to fill and style these cells. Any others that come
+/// into storage, from the row’s `blank` spaces or the gap between its content
+/// and \p from, are given their own content.
+///
+/// \param t Terminal the row belongs to
+/// \param row Row to expand
+/// \param from 1-indexed column of the first cell to be written
+/// \param to 1-indexed column of the last cell to be written
+/// \return 0 on success or an errno on failure
+static int row_reserve(term_t *t, row_t *row, size_t from, size_t to) {
+  assert(t != NULL);
+  assert(row != NULL);
+  assert(from > 0);
+  assert(from <= to);
+  assert(to <= t->columns);
 
-  /// cursor position
-  size_t x;
-  size_t y;
+  if (to <= row->width)
+    return 0;
 
-  /// currently active style
-  style_t style;
+  if (to * row->unit > row->size) {
+    // grow geometrically, but no further than the terminal is wide
+    const size_t capacity = row->size / row->unit;
+    size_t c = capacity < 16 ? 16 : capacity * 2;
+    if (c < to)
+      c = to;
+    if (c > t->columns)
+      c = t->columns;
+    char *r = realloc(row->text, c * row->unit);
+    if (ERROR(r == NULL))
+      return ENOMEM;
+    row->text = r;
+    row->size = c * row->unit;
+  }
 
-  /// scratch space for doing transient text manipulation
-  buffer_t stage;
+  // turn any `blank` spaces before the written cells into stored ones
+  const size_t blank_end = row->width + row->blank;
+  {
+    const size_t end = blank_end < from - 1 ? blank_end : from - 1;
+    if (row->width < end) {
+      row_fill(row, row->width + 1, end);
+      const int rc = runs_set(row, row->width + 1, end, row->space, false);
+      if (ERROR(rc != 0))
+        return rc;
+    }
+  }
 
-  /// data on the terminal
-  cell_t screen[];
-};
+  // blank any gap between these and the written cells
+  {
+    const size_t start = (blank_end > row->width ? blank_end : row->width) + 1;
+    if (start < from) {
+      row_fill(row, start, from - 1);
+      const int rc = runs_set(row, start, from - 1, 0, true);
+      if (ERROR(rc != 0))
+        return rc;
+    }
+  }
 
-int term_new(term_t **t, size_t columns, size_t rows) {
+  row->blank = blank_end > to ? blank_end - to : 0;
+  row->width = to;
 
-  PRECONDITION(t != NULL);
-  PRECONDITION(columns > 0);
-  PRECONDITION(rows > 0);
+  return 0;
+}
 
-  term_t *term = calloc(1, sizeof(*term) + sizeof(cell_t) * columns * rows);
-  if (ERROR(term == NULL))
-    return ENOMEM;
+/// write single-byte characters into a row
+///
+/// \param t Terminal to write to
+/// \param x 1-indexed column of the first cell to write
+/// \param y 1-indexed row to write to
+/// \param text Characters to write, NULs among which leave cells blank, or
+///   `NULL` to write spaces
+/// \param n Number of cells to write, which must not go beyond the right edge
+/// \param style Index of the style to give the cells
+/// \return 0 on success or an errno on failure
+static int put_cells(term_t *t, size_t x, size_t y, const char *text, size_t n,
+                     uint16_t style) {
+  assert(t != NULL);
+  assert(x > 0);
+  assert(n > 0);
+  assert(x + n - 1 <= t->columns);
 
-  int rc = 0;
+  row_t *row = get_row(t, y);
 
-  term->columns = columns;
-  term->rows = rows;
+  {
+    const int rc = row_reserve(t, row, x, x + n - 1);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  if (y > t->height)
+    t->height = y;
+
+  for (size_t i = 0; i < n;) {
+
+    // find the extent of the following non-NUL or NUL characters
+    const bool empty = text != NULL && text[i] == '\0';
+    size_t j = n;
+    if (empty) {
+      for (j = i + 1; j < n && text[j] == '\0'; ++j)
+        ;
+    } else if (text != NULL) {
+      const char *nul = memchr(&text[i], '\0', n - i);
+      if (nul != NULL)
+        j = (size_t)(nul - text);
+    }
 
-  term->x = 1;
-  term->y = 1;
+    if (text == NULL || empty) {
+      row_fill(row, x + i, x + j - 1);
+    } else if (row->unit == 1) {
+      memcpy(row_at(row, x + i), &text[i], j - i);
+    } else {
+      char *cell = row_at(row, x + i);
+      for (size_t k = i; k < j; ++k, cell += 4) {
+        cell[0] = text[k];
+        cell[1] = cell[2] = cell[3] = '\0';
+      }
+    }
 
-  if (ERROR((rc = buffer_open(&term->stage))))
-    goto done;
+    const int rc = runs_set(row, x + i, x + j - 1, style, empty);
+    if (ERROR(rc != 0))
+      return rc;
 
-  // success
-  *t = term;
+    i = j;
+  }
 
-done:
-  if (UNLIKELY(rc != 0))
-    term_free(&term);
+  return 0;
+}
 
-  return rc;
+/// write a character into a row
+///
+/// \param t Terminal to write to
+/// \param x 1-indexed column of the cell to write
+/// \param y 1-indexed row to write to
+/// \param u Character to write
+/// \param style Index of the style to give the cell
+/// \return 0 on success or an errno on failure
+static int put_cell(term_t *t, size_t x, size_t y, utf8_t u, uint16_t style) {
+  assert(t != NULL);
+
+  if (u.bytes[1] == '\0')
+    return put_cells(t, x, y, u.bytes, 1, style);
+
+  row_t *row = get_row(t, y);
+
+  {
+    const int rc = row_widen(t, row);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  {
+    const int rc = row_reserve(t, row, x, x);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  if (y > t->height)
+    t->height = y;
+
+  memcpy(row_at(row, x), u.bytes, sizeof(u.bytes));
+
+  return runs_set(row, x, x, style, false);
 }
 
-/// get the cell at the given coordinates
-static cell_t *get_cell(term_t *t, size_t x, size_t y) {
+/// write spaces in the current style, without storing them if possible
+///
+/// \param t Terminal to write to
+/// \param x 1-indexed column of the first space
+/// \param y 1-indexed row to write to
+/// \param n Number of spaces, which must not go beyond the right edge
+/// \return 0 on success or an errno on failure
+static int put_blank(term_t *t, size_t x, size_t y, size_t n) {
   assert(t != NULL);
   assert(x > 0);
-  assert(x <= t->columns);
-  assert(y > 0);
-  assert(y <= t->rows);
+  assert(n > 0);
+  assert(x + n - 1 <= t->columns);
+
+  row_t *row = get_row(t, y);
 
-  // indexing is 1-based
-  size_t offset = t->columns * (y - 1) + x - 1;
-  return &t->screen[offset];
+  // spaces must be stored unless they extend the row’s run of like spaces
+  if (row->blank == 0)
+    row->space = t->style_index;
+  if (x <= row->width || x > row->width + row->blank + 1 ||
+      row->space != t->style_index)
+    return put_cells(t, x, y, NULL, n, t->style_index);
+
+  if (x + n - 1 > row->width + row->blank)
+    row->blank = x + n - 1 - row->width;
+  if (y > t->height)
+    t->height = y;
+
+  return 0;
 }
 
-/// get the cell we are currently pointing at
-static cell_t *get_current_cell(term_t *t) {
+/// blank the cells of a row from column \p from to column \p to, inclusive
+static int clear_cells(term_t *t, size_t y, size_t from, size_t to) {
   assert(t != NULL);
+  assert(from > 0);
+
+  row_t *row = get_row(t, y);
 
-  return get_cell(t, t->x, t->y);
+  // cells beyond `width` and `blank` are already empty
+  const size_t end = row->width + row->blank;
+  if (to > end)
+    to = end;
+  if (from > to)
+    return 0;
+
+  // if we are blanking the tail of the row, it just becomes shorter
+  if (to == end) {
+    if (from > row->width) {
+      row->blank = from - 1 - row->width;
+      return 0;
+    }
+    row->blank = 0;
+    row->width = from - 1;
+    while (row->n_runs > 0 && row->runs[row->n_runs - 1].end > row->width) {
+      const size_t start =
+          row->n_runs > 1 ? row->runs[row->n_runs - 2].end + 1 : 1;
+      if (start <= row->width) {
+        row->runs[row->n_runs - 1].end = row->width;
+        break;
+      }
+      --row->n_runs;
+    }
+    return 0;
+  }
+
+  // otherwise, the cells we keep after those we blank must all be stored
+  {
+    const int rc = row_reserve(t, row, from, to);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  row_fill(row, from, to);
+  return runs_set(row, from, to, 0, true);
 }
 
 static int process_A(term_t *t, size_t index, bool is_default, size_t entry) {
@@ -404,12 +958,16 @@ static void term_clear(term_t *t) {
   if (t == NULL)
     return;
 
-  for (size_t y = 1; y <= t->rows; ++y) {
-    for (size_t x = 1; x <= t->columns; ++x) {
-      cell_t *cell = get_cell(t, x, y);
-      cell_clear(cell);
-    }
+  // only rows that have been written to need blanking, which may include some
+  // beyond `rows` if the terminal has been resized
+  for (size_t y = 0; y < t->height; ++y) {
+    row_t *row = &t->lines[y];
+    row->unit = 1;
+    row->width = 0;
+    row->n_runs = 0;
+    row->blank = 0;
   }
+  t->height = 0;
 }
 
 static int process_J(term_t *t, size_t index, bool is_default, size_t entry) {
@@ -425,11 +983,10 @@ static int process_J(term_t *t, size_t index, bool is_default, size_t entry) {
 
   case 0: { // clear to end of screen
     size_t offset = t->x;
-    for (size_t y = t->y; y <= t->rows; ++y) {
-      for (size_t x = offset; x <= t->columns; ++x) {
-        cell_t *cell = get_cell(t, x, y);
-        cell_clear(cell);
-      }
+    for (size_t y = t->y; y <= t->rows && y <= t->height; ++y) {
+      const int rc = clear_cells(t, y, offset, t->columns);
+      if (ERROR(rc != 0))
+        return rc;
       offset = 1;
     }
     break;
@@ -438,10 +995,9 @@ static int process_J(term_t *t, size_t index, bool is_default, size_t entry) {
   case 1: { // clear to beginning of screen
     size_t offset = t->x;
     for (size_t y = t->y; y > 0; --y) {
-      for (size_t x = offset; x > 0; --x) {
-        cell_t *cell = get_cell(t, x, y);
-        cell_clear(cell);
-      }
+      const int rc = clear_cells(t, y, 1, offset);
+      if (ERROR(rc != 0))
+        return rc;
       offset = t->columns;
     }
     break;
@@ -584,45 +1140,104 @@ static int process_m(term_t *t, size_t index, bool is_default, size_t entry) {
   return 0;
 }
 
-/// parse and apply the effect of an ANSI CSI sequence
-static int process_csi(term_t *t, const char *csi) {
-
+/// handle an extended colour, `38;…` or `48;…`, within an SGR sequence
+///
+/// Both the ';' separated form Vim emits and the ':' separated form of ITU
+/// T.416 are recognised, the latter with or without a colour space identifier.
+///
+/// \param t Terminal to update
+/// \param csi Parsed sequence
+/// \param i Index of the parameter that is 38 or 48
+/// \param consumed [out] Number of parameters the colour spans, or 0 if they
+///   do not form an extended colour
+/// \return 0 on success or an errno on failure
+static int process_extended(term_t *t, const csi_t *csi, size_t i,
+                            size_t *consumed) {
   assert(t != NULL);
   assert(csi != NULL);
-  assert(strlen(csi) > 0);
+  assert(i < csi->n_params);
+  assert(csi->params[i] == 38 || csi->params[i] == 48);
+  assert(consumed != NULL);
 
-  char final = csi[strlen(csi) - 1];
+  *consumed = 0;
 
-  // if this is a private sequence, ignore it
-  if (strchr(csi, '<') || strchr(csi, '=') || strchr(csi, '>') ||
-      strchr(csi, '?') || (final >= 0x70 && final <= 0x7e)) {
-    DEBUG("ignoring private sequence <esc>[%s", csi);
+  const size_t n = csi->n_params;
+  if (i + 2 >= n || csi->ended || !csi->given[i + 1])
     return 0;
-  }
 
-  // if this is Set Mode, ignore it
-  if (final == 'h') {
-    DEBUG("ignoring set mode <esc>[%s", csi);
+  // how many of the following parameters form the colour?
+  const bool colon = csi->sub[i + 1];
+  size_t length = 0;
+  if (colon) {
+    while (i + 1 + length < n && csi->sub[i + 1 + length])
+      ++length;
+  } else if (csi->params[i + 1] == 5) {
+    length = 2;
+  } else if (csi->params[i + 1] == 2) {
+    length = 4;
+  }
+  if (length == 0 || i + length >= n)
     return 0;
+  for (size_t j = i + 2; !colon && j <= i + length; ++j) {
+    if (csi->sub[j])
+      return 0;
   }
 
-  // <esc>[H is shorthand for move to origin
-  if (strcmp(csi, "H") == 0) {
-    t->x = 1;
-    t->y = 1;
-    return 0;
+  const bool fg = csi->params[i] == 38;
+  const uint32_t *p = &csi->params[i + 1];
+
+  if (p[0] == 5 && length == 2) {
+    *consumed = 1 + length;
+    return fg ? process_38_5_m(t, p[1]) : process_48_5_m(t, p[1]);
   }
 
-#ifdef __APPLE__
-  // Vim on macOS when `t_Co=2` can emit unusual sequences like `<esc>[311m`
+  if (p[0] == 2 && (length == 4 || (colon && length == 5))) {
+    const uint32_t *rgb = &p[length - 3];
+    *consumed = 1 + length;
+    return fg ? process_38_2_m(t, rgb[0], rgb[1], rgb[2])
+              : process_48_2_m(t, rgb[0], rgb[1], rgb[2]);
+  }
+
+  return 0;
+}
+
+/// apply the effect of the CSI sequence that has just been parsed
+static int process_csi(term_t *t, char final) {
+  assert(t != NULL);
+
+  const csi_t *csi = &t->csi;
+  const int length = csi->length < sizeof(csi->text) ? (int)csi->length
+                                                     : (int)sizeof(csi->text);
+
+  // if this is a private sequence, ignore it
+  if (csi->is_private || (final >= 0x70 && final <= 0x7e)) {
+    DEBUG("ignoring private sequence <esc>[%.*s%c", length, csi->text, final);
+    return 0;
+  }
+
+  // if this is Set Mode, ignore it
+  if (final == 'h') {
+    DEBUG("ignoring set mode <esc>[%.*s%c", length, csi->text, final);
+    return 0;
+  }
+
+  // <esc>[H is shorthand for move to origin
+  if (final == 'H' && csi->length == 0) {
+    t->x = 1;
+    t->y = 1;
+    return 0;
+  }
+
+#ifdef __APPLE__
+  // Vim on macOS when `t_Co=2` can emit unusual sequences like `<esc>[311m`
   // that appear to have no defined meaning. This seems to result from an
   // incorrect call to `term_color` in Vim. I do not know if this is a Vim bug
   // or a bug in some default configuration on macOS or simply violation of an
   // assumption that there are no monochrome macOS environments (reasonable).
   // Just ignore this sequence if we see it.
-  if (UNLIKELY(csi[0] == '3' && csi[1] == '1' && isdigit(csi[2]) &&
-               csi[3] == 'm')) {
-    DEBUG("ignoring <esc>[%s", csi);
+  if (UNLIKELY(final == 'm' && csi->length == 3 && csi->text[0] == '3' &&
+               csi->text[1] == '1' && isdigit(csi->text[2]))) {
+    DEBUG("ignoring <esc>[%.*s%c", length, csi->text, final);
     return 0;
   }
 #endif
@@ -662,334 +1277,834 @@ static int process_csi(term_t *t, const char *csi) {
     handler = process_m;
     break;
   default:
-    DEBUG("unrecognised CSI sequence <esc>[%s", csi);
+    DEBUG("unrecognised CSI sequence <esc>[%.*s%c", length, csi->text, final);
     return ENOTSUP;
   }
 
-  DEBUG("processing <esc>[%s", csi);
+  DEBUG("processing <esc>[%.*s%c", length, csi->text, final);
 
-  if (final == 'm') {
+  if (UNLIKELY(csi->overflow)) {
+    DEBUG("more than %d parameters in CSI sequence", (int)CSI_PARAMS);
+    return ENOTSUP;
+  }
 
-    // is this an 8-bit colour foreground switch?
-    bool is_8_fg = strncmp(csi, "38;5;", strlen("38;5;")) == 0;
-    if (is_8_fg) {
-      const char *idm = csi + strlen("38;5;");
-      size_t id = 0;
-      for (; isdigit(*idm); ++idm)
-        id = id * 10 + *idm - '0';
-      if (*idm == 'm')
-        return process_38_5_m(t, id);
-    }
+  // process ';' separated entries, stopping at any sub-parameters
+  for (size_t i = 0; i < csi->n_params && !csi->sub[i]; ++i) {
 
-    // is this an 8-bit colour background switch?
-    bool is_8_bg = strncmp(csi, "48;5;", strlen("48;5;")) == 0;
-    if (is_8_bg) {
-      const char *idm = csi + strlen("48;5;");
-      size_t id = 0;
-      for (; isdigit(*idm); ++idm)
-        id = id * 10 + *idm - '0';
-      if (*idm == 'm')
-        return process_48_5_m(t, id);
+    // is this an 8-bit or 24-bit colour switch?
+    if (final == 'm' && (csi->params[i] == 38 || csi->params[i] == 48)) {
+      size_t consumed = 0;
+      const int rc = process_extended(t, csi, i, &consumed);
+      if (UNLIKELY(rc != 0))
+        return rc;
+      if (consumed > 0) {
+        i += consumed - 1;
+        continue;
+      }
     }
 
-    // is this a 24-bit colour foreground switch?
-    bool is_24_fg = strncmp(csi, "38;2;", strlen("38;2;")) == 0;
-    if (is_24_fg) {
-      do {
-        const char *idm = csi + strlen("38;2");
-        size_t r = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          r = r * 10 + *idm - '0';
-        if (*idm != ';')
-          break;
-        size_t g = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          g = g * 10 + *idm - '0';
-        if (*idm != ';')
-          break;
-        size_t b = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          b = b * 10 + *idm - '0';
-        if (*idm == 'm')
-          return process_38_2_m(t, r, g, b);
-      } while (0);
-    }
+    const int rc = handler(t, i, !csi->given[i], csi->params[i]);
+    if (UNLIKELY(rc != 0))
+      return rc;
+  }
 
-    // is this a 24-bit colour background switch?
-    bool is_24_bg = strncmp(csi, "48;2;", strlen("48;2;")) == 0;
-    if (is_24_bg) {
-      do {
-        const char *idm = csi + strlen("48;2");
-        size_t r = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          r = r * 10 + *idm - '0';
-        if (*idm != ';')
-          break;
-        size_t g = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          g = g * 10 + *idm - '0';
-        if (*idm != ';')
-          break;
-        size_t b = 0;
-        for (++idm; isdigit(*idm); ++idm)
-          b = b * 10 + *idm - '0';
-        if (*idm == 'm')
-          return process_48_2_m(t, r, g, b);
-      } while (0);
+  // look up the style Select Graphic Rendition has left us with
+  if (final == 'm')
+    return style_intern(t, t->style, &t->style_index);
+
+  return 0;
+}
+
+/// classes of input bytes outside escape sequences
+enum {
+  TEXT,     ///< a character in itself
+  NEWLINE,  ///< '\n'
+  RETURN,   ///< '\r'
+  ESCAPE,   ///< '\033'
+  LEAD2,    ///< first byte of a 2-byte UTF-8 character
+  LEAD3,    ///< first byte of a 3-byte UTF-8 character
+  LEAD4,    ///< first byte of a 4-byte UTF-8 character
+  MALFORMED ///< a byte that cannot begin a UTF-8 character
+};
+
+static const uint8_t GROUND_CLASS[256] = {
+    [0x00 ... 0x09] = TEXT,      ['\n'] = NEWLINE,
+    [0x0b ... 0x0c] = TEXT,      ['\r'] = RETURN,
+    [0x0e ... 0x1a] = TEXT,      ['\033'] = ESCAPE,
+    [0x1c ... 0x7f] = TEXT,      [0x80 ... 0xbf] = MALFORMED,
+    [0xc0 ... 0xdf] = LEAD2,     [0xe0 ... 0xef] = LEAD3,
+    [0xf0 ... 0xf7] = LEAD4,     [0xf8 ... 0xff] = MALFORMED,
+};
+
+/// classes of bytes within a CSI sequence
+enum {
+  INTERMEDIATE, ///< a byte that ends the parameters
+  DIGIT,        ///< '0'–'9'
+  SEPARATOR,    ///< ';'
+  SUBSEPARATOR, ///< ':'
+  MARKER,       ///< a private marker, '<', '=', '>', or '?'
+  FINAL         ///< the byte that terminates the sequence
+};
+
+static const uint8_t CSI_CLASS[256] = {
+    [0x00 ... 0x2f] = INTERMEDIATE, ['0' ... '9'] = DIGIT,
+    [':'] = SUBSEPARATOR,           [';'] = SEPARATOR,
+    ['<' ... '?'] = MARKER,         [0x40 ... 0x7e] = FINAL,
+    [0x7f ... 0xff] = INTERMEDIATE,
+};
+
+/// character to emit for malformed UTF-8 data
+static const utf8_t REPLACEMENT = (utf8_t){.bytes = "�"};
+
+/// write a character at the cursor and advance it
+static int put(term_t *t, utf8_t u) {
+  assert(t != NULL);
+
+  {
+    const int rc = put_cell(t, t->x, t->y, u, t->style_index);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+
+  if (t->x == t->columns) {
+    if (t->y < t->rows) {
+      ++t->y;
+      t->x = 1;
     }
+  } else {
+    ++t->x;
   }
 
-  // process ';' separated entries
-  size_t index = 0;
-  bool is_default = true;
-  size_t entry = 0;
-  for (size_t i = 0;; ++i) {
+  return 0;
+}
 
-    if (isdigit(csi[i])) {
-      entry = entry * 10 + csi[i] - '0';
-      is_default = false;
+/// clear the cell at the cursor and move to the start of the next line
+static int newline(term_t *t) {
+  assert(t != NULL);
 
-    } else { // end of an entry
+  {
+    const int rc = clear_cells(t, t->y, t->x, t->x);
+    if (ERROR(rc != 0))
+      return rc;
+  }
 
-      int rc = handler(t, index, is_default, entry);
-      if (UNLIKELY(rc != 0))
-        return rc;
+  if (t->y < t->rows) {
+    ++t->y;
+    t->x = 1;
+  }
 
-      // are we done?
-      if (csi[i] != ';')
-        break;
+  return 0;
+}
 
-      ++index;
-      is_default = true;
-      entry = 0;
+/// write a run of single-byte characters at the cursor, advancing it
+///
+/// This has the same effect as `put` of each character in turn, but fills
+/// consecutive cells of a row at once.
+static int put_run(term_t *t, const char *text, size_t length) {
+  assert(t != NULL);
+  assert(text != NULL || length == 0);
+
+  while (length > 0) {
+
+    // once the cursor is in the last cell of the screen, it no longer moves so
+    // each character overwrites the one before
+    if (t->x == t->columns && t->y == t->rows) {
+      text += length - 1;
+      length = 1;
+    }
+
+    const size_t room = t->columns - t->x + 1;
+    const size_t n = length < room ? length : room;
+
+    // trailing spaces may not need storing
+    size_t spaces = 0;
+    while (spaces < n && text[n - spaces - 1] == ' ')
+      ++spaces;
+
+    if (spaces < n) {
+      const int rc =
+          put_cells(t, t->x, t->y, text, n - spaces, t->style_index);
+      if (ERROR(rc != 0))
+        return rc;
+    }
+    if (spaces > 0) {
+      const int rc = put_blank(t, t->x + n - spaces, t->y, spaces);
+      if (ERROR(rc != 0))
+        return rc;
+    }
+    text += n;
+    length -= n;
+
+    if (n < room) {
+      t->x += n;
+    } else if (t->y < t->rows) {
+      ++t->y;
+      t->x = 1;
+    } else {
+      t->x = t->columns;
     }
   }
 
   return 0;
 }
 
-/// consume a character and advance if it matches the expected
-static bool eat_if(FILE *f, char expected) {
-  assert(f != NULL);
-  int c = getc(f);
-  if (c == expected)
-    return true;
-  if (c != EOF)
-    ungetc(c, f);
-  return false;
-}
-
-/// read a UTF-8 character from the given stream
-static utf8_t get_utf8(FILE *f) {
-  assert(f != NULL);
-
-  // character to emit for malformed UTF-8 data
-  static const utf8_t REPLACEMENT = (utf8_t){.bytes = "�"};
-
-  int c = getc(f);
-  if (c == EOF)
-    return (utf8_t){{0}};
-
-  utf8_t u = {{c}};
-
-  // recognise Windows line endings and treat them as a single character
-  if (c == '\r' && eat_if(f, '\n')) {
-    u.bytes[1] = '\n';
-    return u;
-  }
-
-  // From the UTF-8 RFC (3629):
-  //
-  //   Char. number range  |        UTF-8 octet sequence
-  //      (hexadecimal)    |              (binary)
-  //   --------------------+---------------------------------------------
-  //   0000 0000-0000 007F | 0xxxxxxx
-  //   0000 0080-0000 07FF | 110xxxxx 10xxxxxx
-  //   0000 0800-0000 FFFF | 1110xxxx 10xxxxxx 10xxxxxx
-  //   0001 0000-0010 FFFF | 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-  //
-  // So we can determine the length of the current character by the bits set in
-  // the first byte.
-
-  size_t length = 1;
-  // is this a 1-byte character? Assume this is the common case, given we are
-  // parsing programming source code.
-  if (LIKELY(((uint8_t)c >> 7) == 0)) {
-    return u;
-  } else if (((uint8_t)c >> 5) == 6) {
-    length = 2;
-  } else if (((uint8_t)c >> 4) == 14) {
-    length = 3;
-  } else if (((uint8_t)c >> 3) == 30) {
-    length = 4;
-  } else {
-    // malformed first byte
-    return REPLACEMENT;
+/// length of the prefix of some input that `put_run` can write
+///
+/// That is, the number of leading bytes that are not '\n', '\r', '\033', or
+/// part of a multi-byte UTF-8 character.
+static size_t run_scalar(const char *data, size_t size) {
+  assert(data != NULL || size == 0);
+
+  size_t i = 0;
+  for (; i < size; ++i) {
+    const uint8_t c = (uint8_t)data[i];
+    if (c == '\n' || c == '\r' || c == '\033' || c >= 0x80)
+      break;
   }
+  return i;
+}
 
-  assert(length >= 2 && length <= 4);
+#if HAVE_X86
+
+#ifdef __SSE2__
+static size_t run_sse2(const char *data, size_t size) {
+  assert(data != NULL || size == 0);
+
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i esc = _mm_set1_epi8('\033');
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i v = _mm_loadu_si128((const void *)&data[i]);
+    // bytes ≥ 0x80 are caught by their own top bit
+    const __m128i stop = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, esc), v));
+    const unsigned mask = (unsigned)_mm_movemask_epi8(stop);
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+
+  return i + run_scalar(&data[i], size - i);
+}
+#endif
 
-  // read byte 2
-  c = getc(f);
-  if (c == EOF || ((uint8_t)c >> 6) != 2) {
-    DEBUG("malformed byte 0x%x seen", (unsigned)c);
-    if (c != EOF)
-      ungetc(c, f);
-    return REPLACEMENT;
+__attribute__((target("avx2"))) static size_t run_avx2(const char *data,
+                                                       size_t size) {
+  assert(data != NULL || size == 0);
+
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i esc = _mm256_set1_epi8('\033');
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const void *)&data[i]);
+    // bytes ≥ 0x80 are caught by their own top bit
+    const __m256i stop = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, esc), v));
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(stop);
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
   }
-  u.bytes[1] = c;
 
-  if (length == 2)
-    return u;
+  return i + run_scalar(&data[i], size - i);
+}
+
+#endif
+
+/// implementation selected by `term_use`
+static term_impl_t selected = TERM_AUTO;
 
-  // read byte 3
-  c = getc(f);
-  if (c == EOF || ((uint8_t)c >> 6) != 2) {
-    DEBUG("malformed byte 0x%x seen", (unsigned)c);
-    if (c != EOF)
-      ungetc(c, f);
-    return REPLACEMENT;
+bool term_use(term_impl_t impl) {
+  switch (impl) {
+  case TERM_AUTO:
+  case TERM_SCALAR:
+    break;
+  case TERM_SSE2:
+#if HAVE_X86 && defined(__SSE2__)
+    break;
+#else
+    return false;
+#endif
+  case TERM_AVX2:
+#if HAVE_X86
+    if (!__builtin_cpu_supports("avx2"))
+      return false;
+    break;
+#else
+    return false;
+#endif
   }
-  u.bytes[2] = c;
+  selected = impl;
+  return true;
+}
 
-  if (length == 3)
-    return u;
+/// dispatch to the selected implementation
+static size_t run(const char *data, size_t size) {
+  assert(data != NULL || size == 0);
 
-  // read byte 4
-  c = getc(f);
-  if (c == EOF || ((uint8_t)c >> 6) != 2) {
-    DEBUG("malformed byte 0x%x seen", (unsigned)c);
-    if (c != EOF)
-      ungetc(c, f);
-    return REPLACEMENT;
+  switch (selected) {
+  case TERM_AUTO:
+#if HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+      return run_avx2(data, size);
+#endif
+#if HAVE_X86 && defined(__SSE2__)
+    return run_sse2(data, size);
+#else
+    return run_scalar(data, size);
+#endif
+  case TERM_SCALAR:
+    return run_scalar(data, size);
+#if HAVE_X86 && defined(__SSE2__)
+  case TERM_SSE2:
+    return run_sse2(data, size);
+#endif
+#if HAVE_X86
+  case TERM_AVX2:
+    return run_avx2(data, size);
+#endif
+  default:
+    UNREACHABLE();
   }
-  u.bytes[3] = c;
 
-  return u;
+  return run_scalar(data, size);
 }
 
-int term_send(term_t *t, FILE *from) {
+/// check a whole multi-byte UTF-8 character at once
+///
+/// Rather than moving through the `UTF8` state a byte at a time, the
+/// continuation bytes of a character whose lead byte is at `data[0]` are all
+/// checked with a single masked comparison of the four bytes from there.
+///
+/// \param data Input, of which at least 4 bytes must be readable
+/// \param length Length of the character the lead byte begins, 2–4
+/// \return True if the character is well formed
+static bool utf8_whole(const char *data, size_t length) {
+  assert(data != NULL);
+  assert(length >= 2 && length <= 4);
 
-  PRECONDITION(t != NULL);
-  PRECONDITION(from != NULL);
+  static const uint8_t MASK[][4] = {{0, 0xc0, 0, 0},
+                                    {0, 0xc0, 0xc0, 0},
+                                    {0, 0xc0, 0xc0, 0xc0}};
+  static const uint8_t EXPECTED[][4] = {{0, 0x80, 0, 0},
+                                        {0, 0x80, 0x80, 0},
+                                        {0, 0x80, 0x80, 0x80}};
+
+  // load through `memcpy` so the comparison is independent of endianness and
+  // alignment
+  uint32_t word, mask, expected;
+  memcpy(&word, data, sizeof(word));
+  memcpy(&mask, MASK[length - 2], sizeof(mask));
+  memcpy(&expected, EXPECTED[length - 2], sizeof(expected));
+
+  return (word & mask) == expected;
+}
+
+/// begin a CSI sequence
+static void csi_start(csi_t *csi) {
+  assert(csi != NULL);
+
+  csi->params[0] = 0;
+  csi->given[0] = false;
+  csi->sub[0] = false;
+  csi->n_params = 1;
+  csi->is_private = false;
+  csi->ended = false;
+  csi->overflow = false;
+  csi->length = 0;
+}
+
+/// take the next byte of a CSI sequence’s parameters
+static void csi_feed(csi_t *csi, uint8_t c) {
+  assert(csi != NULL);
+
+  if (csi->length < sizeof(csi->text))
+    csi->text[csi->length] = (char)c;
+  ++csi->length;
+
+  switch (CSI_CLASS[c]) {
 
-  while (true) {
+  case DIGIT:
+    if (!csi->ended) {
+      uint32_t *p = &csi->params[csi->n_params - 1];
+      const uint32_t digit = c - '0';
+      *p = *p > (UINT32_MAX - digit) / 10 ? UINT32_MAX : *p * 10 + digit;
+      csi->given[csi->n_params - 1] = true;
+    }
+    break;
 
-    utf8_t u = get_utf8(from);
-    if (utf8eq(u, "")) // EOF
+  case SEPARATOR:
+  case SUBSEPARATOR:
+    if (csi->ended)
       break;
+    if (UNLIKELY(csi->n_params == CSI_PARAMS)) {
+      csi->overflow = true;
+      csi->ended = true;
+      break;
+    }
+    csi->params[csi->n_params] = 0;
+    csi->given[csi->n_params] = false;
+    csi->sub[csi->n_params] = CSI_CLASS[c] == SUBSEPARATOR;
+    ++csi->n_params;
+    break;
 
-    // is this an escape sequence?
-    if (utf8eq(u, "\033")) {
+  case MARKER:
+    csi->is_private = true;
+    csi->ended = true;
+    break;
 
-      // is this a Control Sequence Introducer (CSI)?
-      if (eat_if(from, '[')) {
+  default:
+    csi->ended = true;
+    break;
+  }
+}
 
-        // clear our temporary buffer to stage the sequence
-        buffer_clear(&t->stage);
+/// apply the effect of the Operating System Command that has just been parsed
+///
+/// \param t Terminal the command was sent to
+/// \param framed [out] Set if the command was a frame marker
+/// \return 0 on success or an errno on failure
+static int process_osc(term_t *t, bool *framed) {
+  assert(t != NULL);
+  assert(framed != NULL);
+
+  const int length =
+      t->osc_length < OSC_MAX ? (int)t->osc_length : (int)OSC_MAX;
+
+  // is this the end of a frame?
+  if (t->osc_length == strlen(TERM_FRAME) &&
+      memcmp(t->osc, TERM_FRAME, strlen(TERM_FRAME)) == 0) {
+    DEBUG("end of frame");
+    *framed = true;
+    return 0;
+  }
 
-        // drain to the terminator of the CSI sequence
-        while (true) {
+  // ignore changes to the Icon Name or Window Title
+  if (t->osc_length >= 2 && t->osc[0] >= '0' && t->osc[0] <= '2' &&
+      t->osc[1] == ';') {
+    DEBUG("ignoring OSC sequence <esc>]%.*s", length, t->osc);
+    return 0;
+  }
+
+  DEBUG("unsupported OSC sequence <esc>]%.*s", length, t->osc);
+  return ENOTSUP;
+}
+
+/// interpret a block of input
+///
+/// This is a state machine that takes each byte once, so it can stop at any
+/// point in the input and resume when more arrives.
+///
+/// \param t Terminal to write to
+/// \param data Input to interpret
+/// \param size Number of bytes in \p data
+/// \param consumed [out] Number of bytes of \p data interpreted, which is less
+///   than \p size only if a frame marker was seen
+/// \param framed [out] True if interpretation stopped at a frame marker
+/// \return 0 on success or an errno on failure
+static int feed(term_t *t, const char *data, size_t size, size_t *consumed,
+                bool *framed) {
+  assert(t != NULL);
+  assert(data != NULL || size == 0);
+  assert(consumed != NULL);
+  assert(framed != NULL);
+
+  int rc = 0;
+  size_t i = 0;
 
-          int c = getc(from);
-          if (c == EOF) {
-            // malformed sequence, as we have not yet seen the terminator
-            return EBADMSG;
-          }
+  while (i < size) {
+    const uint8_t c = (uint8_t)data[i];
 
-          // stage this character
-          if (ERROR(fputc(c, t->stage.f) == EOF))
-            return errno;
+    switch (t->state) {
 
-          // was this the CSI sequence terminator?
-          if (c >= 0x40 && c <= 0x7e)
-            break;
+    case GROUND:
+      switch (GROUND_CLASS[c]) {
+      case TEXT: {
+        const size_t n = run(&data[i], size - i);
+        assert(n > 0);
+        if (ERROR((rc = put_run(t, &data[i], n))))
+          goto done;
+        i += n;
+        break;
+      }
+      case NEWLINE:
+        if (ERROR((rc = newline(t))))
+          goto done;
+        ++i;
+        break;
+      case RETURN:
+        t->state = CR;
+        ++i;
+        break;
+      case ESCAPE:
+        t->state = ESC;
+        ++i;
+        break;
+      case LEAD2:
+      case LEAD3:
+      case LEAD4: {
+        const size_t length = GROUND_CLASS[c] - LEAD2 + 2;
+        // if the whole character is here, take it in one step
+        if (i + sizeof(uint32_t) <= size && utf8_whole(&data[i], length)) {
+          utf8_t u = {0};
+          memcpy(u.bytes, &data[i], length);
+          if (ERROR((rc = put(t, u))))
+            goto done;
+          i += length;
+          break;
         }
-        buffer_sync(&t->stage);
+        t->pending = (utf8_t){{(char)c}};
+        t->pending_length = 1;
+        t->pending_expected = length;
+        t->state = UTF8;
+        ++i;
+        break;
+      }
+      default:
+        if (ERROR((rc = put(t, REPLACEMENT))))
+          goto done;
+        ++i;
+        break;
+      }
+      break;
 
-        // apply the effects of this sequence
-        int rc = process_csi(t, t->stage.base);
-        if (ERROR(rc != 0))
-          return rc;
+    case CR:
+      // recognise Windows line endings and treat them as a single character
+      t->state = GROUND;
+      if (c == '\n') {
+        if (ERROR((rc = newline(t))))
+          goto done;
+        ++i;
+      } else {
+        if (ERROR((rc = put(t, (utf8_t){{'\r'}}))))
+          goto done;
+      }
+      break;
 
-        continue;
+    case UTF8:
+      // a byte that does not continue the character is interpreted afresh
+      if ((c >> 6) != 2) {
+        DEBUG("malformed byte 0x%x seen", (unsigned)c);
+        if (ERROR((rc = put(t, REPLACEMENT))))
+          goto done;
+        t->state = GROUND;
+        break;
+      }
+      t->pending.bytes[t->pending_length] = (char)c;
+      ++t->pending_length;
+      ++i;
+      if (t->pending_length == t->pending_expected) {
+        if (ERROR((rc = put(t, t->pending))))
+          goto done;
+        t->state = GROUND;
       }
+      break;
 
-      // is this the Application Keypad sequence?
-      if (eat_if(from, '=')) {
-        // ignore
-        continue;
+    case ESC:
+      ++i;
+      switch (c) {
+      case '[': // Control Sequence Introducer
+        csi_start(&t->csi);
+        t->state = CSI;
+        break;
+      case '=': // Application Keypad
+      case '>': // Normal Keypad
+        t->state = GROUND;
+        break;
+      case ']': // Operating System Command
+        t->osc_length = 0;
+        t->state = OSC;
+        break;
+      default:
+        DEBUG("unsupported escape sequence");
+        rc = ENOTSUP;
+        goto done;
       }
+      break;
 
-      // is this the Normal Keypad sequence?
-      if (eat_if(from, '>')) {
-        // ignore
-        continue;
+    case CSI:
+      ++i;
+      if (CSI_CLASS[c] != FINAL) {
+        csi_feed(&t->csi, c);
+        break;
       }
+      t->state = GROUND;
+      if (ERROR((rc = process_csi(t, (char)c))))
+        goto done;
+      break;
 
-      // is this an Operating System Command?
-      if (eat_if(from, ']')) {
+    case OSC:
+      ++i;
+      if (c != 0x7 && c != 0x9c) {
+        if (t->osc_length < OSC_MAX)
+          t->osc[t->osc_length] = (char)c;
+        ++t->osc_length;
+        break;
+      }
+      t->state = GROUND;
+      if (ERROR((rc = process_osc(t, framed))))
+        goto done;
+      if (*framed)
+        goto done;
+      break;
+    }
+  }
 
-        // clear our temporary buffer to stage the sequence
-        buffer_clear(&t->stage);
+done:
+  *consumed = i;
+  return rc;
+}
 
-        // drain to the terminator of the OSC sequence
-        while (true) {
+/// complete interpretation of input that has reached EOF
+static int finish(term_t *t) {
+  assert(t != NULL);
 
-          int c = getc(from);
-          if (c == EOF) {
-            // malformed sequence, as we have not yet seen the terminator
-            return EBADMSG;
-          }
+  const state_t state = t->state;
+  t->state = GROUND;
 
-          // was this the OSC sequence terminator
-          if (c == 0x7 || c == 0x9c)
-            break;
+  switch (state) {
+  case GROUND:
+    return 0;
 
-          // stage this character
-          if (ERROR(fputc(c, t->stage.f) == EOF))
-            return errno;
-        }
-        buffer_sync(&t->stage);
+  case CR:
+    return put(t, (utf8_t){{'\r'}});
 
-        // ignore changes to the Icon Name or Window Title
-        const char *osc = t->stage.base;
-        if (osc[0] >= '0' && osc[0] <= '2' && osc[1] == ';') {
-          DEBUG("ignoring OSC sequence <esc>]%s", osc);
-          continue;
-        }
+  case UTF8:
+    DEBUG("truncated UTF-8 character seen");
+    return put(t, REPLACEMENT);
 
-        DEBUG("unsupported OSC sequence <esc>]%s", osc);
-        return ENOTSUP;
-      }
+  case ESC:
+    DEBUG("unsupported escape sequence");
+    return ENOTSUP;
 
-      DEBUG("unsupported escape sequence");
-      return ENOTSUP;
-    }
+  case CSI:
+  case OSC:
+    // malformed sequence, as we have not yet seen the terminator
+    return EBADMSG;
+  }
+
+  UNREACHABLE();
+}
+
+int term_send(term_t *t, int from, bool *framed) {
 
-    // what cell are we pointing at?
-    cell_t *cell = get_current_cell(t);
+  PRECONDITION(t != NULL);
+  PRECONDITION(from >= 0);
+  PRECONDITION(framed != NULL);
+
+  *framed = false;
 
-    cell_clear(cell);
+  if (t->input == NULL) {
+    t->input = malloc(INPUT_BLOCK);
+    if (ERROR(t->input == NULL))
+      return ENOMEM;
+  }
 
-    // for a newline, just leave the cell clear
-    if (!utf8eq(u, "\n") && !utf8eq(u, "\r\n")) {
+  for (;;) {
 
-      cell->style = t->style;
-      cell->grapheme.value = u;
+    // interpret whatever remains of the last block read
+    if (t->input_offset < t->input_size) {
+      size_t consumed = 0;
+      const int rc = feed(t, t->input + t->input_offset,
+                          t->input_size - t->input_offset, &consumed, framed);
+      t->input_offset += consumed;
+      if (ERROR(rc != 0))
+        return rc;
+      if (*framed)
+        return 0;
     }
 
-    // advance our cell position
-    if (utf8eq(u, "\n") || utf8eq(u, "\r\n") || t->x == t->columns) {
-      if (t->y < t->rows) {
-        ++t->y;
-        t->x = 1;
-      }
-    } else {
-      ++t->x;
+    const ssize_t r = read(from, t->input, INPUT_BLOCK);
+    if (r < 0 && errno == EINTR)
+      continue;
+    // if the stream is non-blocking and has nothing for us yet, the caller can
+    // call us again when it does
+    if (r < 0 && errno == EAGAIN)
+      return EAGAIN;
+    if (ERROR(r < 0))
+      return errno;
+    if (r == 0) {
+      const int rc = finish(t);
+      if (ERROR(rc != 0))
+        return rc;
+      return 0;
     }
+    t->input_offset = 0;
+    t->input_size = (size_t)r;
+  }
+}
+
+/** number of a row’s runs to read, and the spaces to follow them
+ *
+ * Runs beginning beyond the terminal’s read width are left out, as are
+ * trailing blank cells that no spaces follow.
+ *
+ * \param t Terminal the row belongs to
+ * \param row Row to read
+ * \param blank [out] Number of spaces to follow the runs
+ * \return Number of leading runs to read
+ */
+static size_t row_runs(const term_t *t, const row_t *row, size_t *blank) {
+  assert(t != NULL);
+  assert(row != NULL);
+  assert(blank != NULL);
+
+  const size_t limit = t->width == 0 ? SIZE_MAX : t->width;
+
+  size_t n = row->n_runs;
+  while (n > 1 && row->runs[n - 2].end >= limit)
+    --n;
+
+  *blank = 0;
+  if (row->width < limit)
+    *blank = row->blank < limit - row->width ? row->blank : limit - row->width;
+
+  if (*blank == 0) {
+    while (n > 0 && row->runs[n - 1].empty)
+      --n;
+  }
+  return n;
+}
+
+/// 1-indexed column of the last cell of a row’s run to read
+static size_t run_end(const term_t *t, const row_t *row, size_t run) {
+  assert(t != NULL);
+  assert(row != NULL);
+  assert(run < row->n_runs);
+
+  const size_t end = row->runs[run].end;
+  return t->width > 0 && end > t->width ? t->width : end;
+}
+
+/// write the text of a row’s cells from column \p from to \p to inclusive
+///
+/// \param row Row to read from
+/// \param from 1-indexed column of the first cell to write
+/// \param to 1-indexed column of the last cell to write
+/// \param b Builder to write to
+/// \param written [out] Number of bytes written on success, if non-NULL
+/// \return 0 on success or an errno on failure
+static int row_copy(const row_t *row, size_t from, size_t to, builder_t *b,
+                    size_t *written) {
+  assert(row != NULL);
+  assert(from > 0);
+  assert(from <= to);
+  assert(to <= row->width);
+  assert(b != NULL);
+
+  const size_t n = to - from + 1;
+  if (row->unit == 1) {
+    const int rc = builder_append(b, row_at(row, from), n);
+    if (ERROR(rc != 0))
+      return rc;
+    if (written != NULL)
+      *written = n;
+    return 0;
   }
 
+  // copy each cell whole, but only advance past the bytes of its character
+  const int rc = builder_reserve(b, n * 4);
+  if (ERROR(rc != 0))
+    return rc;
+  const char *c = row_at(row, from);
+  char *const start = &b->base[b->size];
+  char *out = start;
+  for (size_t i = 0; i < n; ++i, c += 4) {
+    memcpy(out, c, 4);
+    out += c[1] == '\0' ? 1 : c[2] == '\0' ? 2 : c[3] == '\0' ? 3 : 4;
+  }
+  b->size += (size_t)(out - start);
+
+  if (written != NULL)
+    *written = (size_t)(out - start);
+  return 0;
+}
+
+/// write a directive changing from one style to another
+///
+/// Only the attributes that differ are changed, unless resetting to the
+/// default and setting the attributes of \p to from there is shorter. Nothing
+/// is written if the styles are the same.
+///
+/// \param t Terminal whose styles to use
+/// \param from Style in effect
+/// \param to Index of the style to change to
+/// \param b Builder to write to
+/// \return 0 on success or an errno on failure
+static int style_put(const term_t *t, style_t from, uint16_t to,
+                     builder_t *b) {
+  assert(t != NULL);
+  assert(to < t->n_styles);
+  assert(b != NULL);
+
+  if (style_key(from) == t->style_keys[to])
+    return 0;
+
+  const style_t s = t->styles[to];
+  const sgr_t *sgr = &t->sgrs[to];
+  const param_t fg = {sgr->fg, sgr->fg_length};
+  const param_t bg = {sgr->bg, sgr->bg_length};
+
+  // change each attribute that differs
+  param_t change[4];
+  size_t n_change = 0;
+  if (from.custom_fg != s.custom_fg ||
+      (s.custom_fg && !colour_eq(from.fg, s.fg)))
+    change[n_change++] = fg;
+  if (from.custom_bg != s.custom_bg ||
+      (s.custom_bg && !colour_eq(from.bg, s.bg)))
+    change[n_change++] = bg;
+  if (from.bold != s.bold)
+    change[n_change++] = s.bold ? (param_t){"1", 1} : (param_t){"22", 2};
+  if (from.underline != s.underline)
+    change[n_change++] = s.underline ? (param_t){"4", 1} : (param_t){"24", 2};
+
+  // or reset, then set any non-default attributes
+  param_t reset[5];
+  size_t n_reset = 0;
+  if (s.custom_fg || s.custom_bg || s.bold || s.underline)
+    reset[n_reset++] = (param_t){"0", 1};
+  if (s.custom_fg)
+    reset[n_reset++] = fg;
+  if (s.custom_bg)
+    reset[n_reset++] = bg;
+  if (s.bold)
+    reset[n_reset++] = (param_t){"1", 1};
+  if (s.underline)
+    reset[n_reset++] = (param_t){"4", 1};
+
+  // how long is each, including separators?
+  size_t change_length = n_change > 0 ? n_change - 1 : 0;
+  for (size_t i = 0; i < n_change; ++i)
+    change_length += change[i].length;
+  size_t reset_length = n_reset > 0 ? n_reset - 1 : 0;
+  for (size_t i = 0; i < n_reset; ++i)
+    reset_length += reset[i].length;
+
+  const bool use_reset = reset_length < change_length;
+  const param_t *params = use_reset ? reset : change;
+  const size_t n_params = use_reset ? n_reset : n_change;
+  const size_t length = use_reset ? reset_length : change_length;
+
+  const int rc = builder_reserve(b, strlen("\033[m") + length);
+  if (ERROR(rc != 0))
+    return rc;
+  char *out = &b->base[b->size];
+  *out++ = '\033';
+  *out++ = '[';
+  for (size_t i = 0; i < n_params; ++i) {
+    if (i > 0)
+      *out++ = ';';
+    memcpy(out, params[i].text, params[i].length);
+    out += params[i].length;
+  }
+  *out++ = 'm';
+  b->size += strlen("\033[m") + length;
+
   return 0;
 }
 
@@ -1001,55 +2116,223 @@ int term_readline(term_t *t, size_t row, char **line) {
   PRECONDITION(line != NULL);
 
   // reset our staging buffer to prepare for reuse
-  buffer_clear(&t->stage);
-  FILE *f = t->stage.f;
+  builder_clear(&t->stage);
 
-  // assume we are beginning with a default style
-  style_t style = style_default();
+  const row_t *r = get_row(t, row);
 
-  // pre-calculate the length of this line, stripping trailing cells
-  size_t limit = t->columns;
-  while (limit > 0) {
-    const cell_t *cell = get_cell(t, limit, row);
-    if (!cell_is_empty(cell))
-      break;
-    --limit;
+  // begin in the default style, or that the last line ended in
+  style_t style = t->carry ? t->carried : style_default();
+
+  size_t blank = 0;
+  for (size_t i = 0, n = row_runs(t, r, &blank); i < n; ++i) {
+
+    // update style for this run, if necessary
+    int rc = style_put(t, style, r->runs[i].style, &t->stage);
+    if (ERROR(rc != 0))
+      return rc;
+    style = t->styles[r->runs[i].style];
+
+    // write the run’s text, in which blank cells are spaces
+    const size_t start = i > 0 ? r->runs[i - 1].end + 1 : 1;
+    rc = row_copy(r, start, run_end(t, r, i), &t->stage, NULL);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+
+  // write any spaces the row ends with that are not stored
+  if (blank > 0) {
+    int rc = style_put(t, style, r->space, &t->stage);
+    if (ERROR(rc != 0))
+      return rc;
+    style = t->styles[r->space];
+    rc = builder_fill(&t->stage, ' ', blank);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+
+  // reset the style to simplify the caller’s life, unless it is to carry over
+  if (t->carry) {
+    t->carried = style;
+  } else {
+    int rc = style_put(t, style, 0, &t->stage);
+    if (ERROR(rc != 0))
+      return rc;
   }
 
-  for (size_t i = 0; i < limit; ++i) {
+  // success; NUL terminate the buffer and make it available to the caller
+  return builder_str(&t->stage, line);
+}
+
+void term_set_carry(term_t *t, bool carry) {
+  assert(t != NULL);
+
+  t->carry = carry;
+  t->carried = style_default();
+}
+
+void term_set_width(term_t *t, size_t columns) {
+  assert(t != NULL);
+
+  t->width = columns;
+}
 
-    const cell_t *cell = get_cell(t, i + 1, row);
+int term_readline_end(term_t *t, char **line) {
 
-    // update style for this grapheme, if necessary
-    if (!style_eq(style, cell->style)) {
-      int rc = style_put(cell->style, f);
+  PRECONDITION(t != NULL);
+  PRECONDITION(line != NULL);
+
+  builder_clear(&t->stage);
+
+  const int rc = style_put(t, t->carried, 0, &t->stage);
+  if (ERROR(rc != 0))
+    return rc;
+  t->carried = style_default();
+
+  return builder_str(&t->stage, line);
+}
+
+/// translate a span’s styling into our own representation
+static style_t span_to_style(const vimcat_span_t *span) {
+  assert(span != NULL);
+
+  style_t style = {.bold = span->bold, .underline = span->underline};
+  if (span->fg != VIMCAT_COLOUR_DEFAULT) {
+    style.custom_fg = true;
+    style.fg = (colour_t){.r = (uint8_t)(span->fg >> 16),
+                          .g = (uint8_t)(span->fg >> 8),
+                          .b = (uint8_t)span->fg};
+  }
+  if (span->bg != VIMCAT_COLOUR_DEFAULT) {
+    style.custom_bg = true;
+    style.bg = (colour_t){.r = (uint8_t)(span->bg >> 16),
+                          .g = (uint8_t)(span->bg >> 8),
+                          .b = (uint8_t)span->bg};
+  }
+  return style;
+}
+
+int term_write(term_t *t, size_t row, size_t *column, const char *text,
+               size_t length, const vimcat_span_t *style) {
+
+  PRECONDITION(t != NULL);
+  PRECONDITION(row > 0 && row <= t->rows);
+  PRECONDITION(column != NULL && *column > 0);
+  PRECONDITION(text != NULL || length == 0);
+  PRECONDITION(style != NULL);
+
+  uint16_t s = 0;
+  {
+    const int rc = style_intern(t, span_to_style(style), &s);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+
+  for (size_t i = 0; i < length;) {
+
+    // how long is this UTF-8 character? Treat malformed data as single bytes.
+    const unsigned char lead = (unsigned char)text[i];
+    size_t width = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+    if (width > length - i)
+      width = 1;
+
+    if (*column <= t->columns) {
+      utf8_t u = {{0}};
+      memcpy(u.bytes, &text[i], width);
+      const int rc = put_cell(t, *column, row, u, s);
       if (ERROR(rc != 0))
         return rc;
-      style = cell->style;
     }
 
-    // if this cell is empty, write a space to mimic its effect
-    if (cell_is_empty(cell)) {
-      if (ERROR(fputc(' ', f) == EOF))
-        return errno;
+    ++*column;
+    i += width;
+  }
+
+  return 0;
+}
+
+/// describe a style as a span
+static vimcat_span_t style_to_span(style_t style) {
+  vimcat_span_t span = {.fg = VIMCAT_COLOUR_DEFAULT,
+                        .bg = VIMCAT_COLOUR_DEFAULT,
+                        .bold = style.bold,
+                        .underline = style.underline};
+  if (style.custom_fg)
+    span.fg = (long)style.fg.r << 16 | (long)style.fg.g << 8 | style.fg.b;
+  if (style.custom_bg)
+    span.bg = (long)style.bg.r << 16 | (long)style.bg.g << 8 | style.bg.b;
+  return span;
+}
 
-      // otherwise write the character itself
+int term_readspans(term_t *t, size_t row, char **text,
+                   const vimcat_span_t **spans, size_t *n_spans) {
+
+  PRECONDITION(t != NULL);
+  PRECONDITION(row > 0);
+  PRECONDITION(row <= t->rows);
+  PRECONDITION(text != NULL);
+  PRECONDITION(spans != NULL);
+  PRECONDITION(n_spans != NULL);
+
+  // reset our staging buffer to prepare for reuse
+  builder_clear(&t->stage);
+
+  const row_t *r = get_row(t, row);
+
+  size_t n = 0;
+  size_t offset = 0;
+  uint16_t style = 0;
+
+  // each run, and then any `blank` spaces, as a span
+  size_t blank = 0;
+  const size_t n_runs = row_runs(t, r, &blank);
+  for (size_t i = 0; i < n_runs + (blank > 0 ? 1 : 0); ++i) {
+
+    const uint16_t s = i < n_runs ? r->runs[i].style : r->space;
+
+    // start a new span if the style changes
+    if (n == 0 || style != s) {
+      if (n == t->spans_capacity) {
+        const size_t c = t->spans_capacity == 0 ? 16 : t->spans_capacity * 2;
+        vimcat_span_t *sp = realloc(t->spans, c * sizeof(sp[0]));
+        if (ERROR(sp == NULL))
+          return ENOMEM;
+        t->spans = sp;
+        t->spans_capacity = c;
+      }
+      if (n > 0)
+        t->spans[n - 1].length = offset - t->spans[n - 1].offset;
+      t->spans[n] = style_to_span(t->styles[s]);
+      t->spans[n].offset = offset;
+      ++n;
+      style = s;
+    }
+
+    if (i < n_runs) {
+      const size_t start = i > 0 ? r->runs[i - 1].end + 1 : 1;
+      size_t length = 0;
+      const int rc = row_copy(r, start, run_end(t, r, i), &t->stage, &length);
+      if (ERROR(rc != 0))
+        return rc;
+      offset += length;
     } else {
-      int rc = cell_put(cell, f);
+      const int rc = builder_fill(&t->stage, ' ', blank);
       if (ERROR(rc != 0))
         return rc;
+      offset += blank;
     }
   }
 
-  // reset the style to simplify the caller’s life
-  if (!style_eq(style, style_default())) {
-    if (ERROR(fputs("\033[0m", f) == EOF))
-      return errno;
-  }
+  if (n > 0)
+    t->spans[n - 1].length = offset - t->spans[n - 1].offset;
 
   // success; NUL terminate the buffer and make it available to the caller
-  buffer_sync(&t->stage);
-  *line = t->stage.base;
+  {
+    const int rc = builder_str(&t->stage, text);
+    if (ERROR(rc != 0))
+      return rc;
+  }
+  *spans = t->spans;
+  *n_spans = n;
 
   return 0;
 }
@@ -1065,8 +2348,15 @@ void term_reset(term_t *t) {
   t->x = 1;
   t->y = 1;
 
-  // reset current style
+  // reset current style, and forget those no longer on screen
   t->style = style_default();
+  t->style_index = 0;
+  t->n_styles = 1;
+
+  // discard any partially received input
+  t->state = GROUND;
+  t->input_offset = 0;
+  t->input_size = 0;
 }
 
 void term_free(term_t **t) {
@@ -1077,9 +2367,18 @@ void term_free(term_t **t) {
   if (*t == NULL)
     return;
 
-  term_clear(*t);
-
-  buffer_close(&(*t)->stage);
+  for (size_t i = 0; i < (*t)->capacity; ++i) {
+    free((*t)->lines[i].text);
+    free((*t)->lines[i].runs);
+  }
+  free((*t)->lines);
+
+  builder_free(&(*t)->stage);
+  free((*t)->input);
+  free((*t)->spans);
+  free((*t)->styles);
+  free((*t)->style_keys);
+  free((*t)->sgrs);
 
   free(*t);
 
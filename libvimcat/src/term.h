@@ -19,8 +19,13 @@
 #pragma once
 
 #include "compiler.h"
+#include <stdbool.h>
 #include <stddef.h>
-#include <stdio.h>
+#include <vimcat/spans.h>
+
+/// payload of the Operating System Command that delimits one screen render from
+/// the next, `<esc>]vimcat;frame<bel>`
+#define TERM_FRAME "vimcat;frame"
 
 /// a virtual (in-memory) terminal
 typedef struct term term_t;
@@ -34,16 +39,62 @@ typedef struct term term_t;
  */
 INTERNAL int term_new(term_t **t, size_t columns, size_t rows);
 
+/** change the dimensions of a terminal
+ *
+ * The terminal is reset as by `term_reset`. Its memory is reused if it is large
+ * enough for the new dimensions.
+ *
+ * \param t [inout] Terminal to resize, which may be moved on success
+ * \param columns New width of the terminal
+ * \param rows New height of the terminal
+ * \return 0 on success or an errno on failure, in which case \p t is unchanged
+ */
+INTERNAL int term_resize(term_t **t, size_t columns, size_t rows);
+
+/// height of a terminal
+INTERNAL size_t term_rows(const term_t *t);
+
+/// width of a terminal
+INTERNAL size_t term_columns(const term_t *t);
+
 /** write data to the terminal
  *
- * This function reads the given file until EOF. The read data can contain UTF-8
- * characters and/or ANSI escape sequences.
+ * This function reads the given file descriptor until EOF or until it sees a
+ * frame marker (an OSC sequence carrying `TERM_FRAME`). The read data can
+ * contain UTF-8 characters and/or ANSI escape sequences. When a frame marker is
+ * seen, the terminal contents reflect everything up to the marker and a further
+ * call can be made to continue reading from the same stream.
+ *
+ * If \p from is non-blocking, this returns EAGAIN when no more data is
+ * available yet. Data read so far, including any character or escape sequence
+ * it ends part way through, is retained by the terminal and a further call
+ * resumes where this one left off.
  *
  * \param t Terminal to write to
  * \param from Source to read data from
- * \return 0 on success or an errno on failure
+ * \param framed [out] True if reading stopped at a frame marker, false if it
+ *   stopped at EOF
+ * \return 0 on success, EAGAIN if \p from has no data available, or another
+ *   errno on failure
+ */
+INTERNAL int term_send(term_t *t, int from, bool *framed);
+
+/// implementations of the scan for runs of plain text within `term_send`
+typedef enum {
+  TERM_AUTO,   ///< the fastest this machine supports
+  TERM_SCALAR, ///< byte-at-a-time
+  TERM_SSE2,   ///< 16 bytes at a time using SSE2
+  TERM_AVX2,   ///< 32 bytes at a time using AVX2
+} term_impl_t;
+
+/** select which implementation `term_send` uses to find runs of plain text
+ *
+ * This is only intended for testing and benchmarking. It is not thread-safe.
+ *
+ * \param impl Implementation to use
+ * \return True if the implementation is supported on this machine
  */
-INTERNAL int term_send(term_t *t, FILE *from);
+INTERNAL bool term_use(term_impl_t impl);
 
 /** read a line of data from the terminal
  *
@@ -57,10 +108,84 @@ INTERNAL int term_send(term_t *t, FILE *from);
  */
 INTERNAL int term_readline(term_t *t, size_t row, char **line);
 
+/** choose whether lines read from the terminal carry style between them
+ *
+ * By default, each line `term_readline` returns begins in the default style
+ * and returns to it at its end, so lines can be displayed independently. With
+ * carrying on, a line instead begins in the style the previous line read ended
+ * in and does not reset at its end. This saves re-establishing the style of
+ * text that continues from one line to the next (e.g. a multi-line comment),
+ * but lines must then be displayed in the order they were read, followed by
+ * `term_readline_end`. This setting persists across `term_reset`.
+ *
+ * \param t Terminal to configure
+ * \param carry Whether to carry style from one line to the next
+ */
+INTERNAL void term_set_carry(term_t *t, bool carry);
+
+/** limit the columns of lines read from the terminal
+ *
+ * Lines `term_readline` and `term_readspans` return are cut short after the
+ * given number of columns, as though the terminal were only this wide. This
+ * setting persists across `term_reset`, but not `term_resize`.
+ *
+ * \param t Terminal to configure
+ * \param columns Number of leading columns to read, or 0 for all of them
+ */
+INTERNAL void term_set_width(term_t *t, size_t columns);
+
+/** finish a series of lines read with carrying on
+ *
+ * This returns the directive to display after the last line to restore the
+ * default style, which may be empty. Subsequent lines begin from the default
+ * style. The returned \p line has the same lifetime as for `term_readline`.
+ *
+ * \param t Terminal that was read from
+ * \param line [out] Directive to display on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int term_readline_end(term_t *t, char **line);
+
+/** write text directly into the terminal
+ *
+ * This bypasses escape sequence processing, placing each UTF-8 character of
+ * \p text into its own cell with the given style. Text beyond the right edge of
+ * the terminal is discarded.
+ *
+ * \param t Terminal to write to
+ * \param row 1-indexed row to write to
+ * \param column [inout] 1-indexed column of the first cell to write to, which
+ *   is updated to the column following the text
+ * \param text Text to write
+ * \param length Number of bytes in \p text
+ * \param style Style to give the text, of which only the colours and
+ *   attributes are used
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int term_write(term_t *t, size_t row, size_t *column,
+                        const char *text, size_t length,
+                        const vimcat_span_t *style);
+
+/** read a line of data from the terminal as text and style spans
+ *
+ * This is an alternative to `term_readline` for callers who want the styling of
+ * the line described structurally rather than with escape sequences. The same
+ * lifetime rules apply to \p text and \p spans.
+ *
+ * \param t Terminal to read from
+ * \param row 1-indexed row to read from
+ * \param text [out] Text of the line on success
+ * \param spans [out] Styling of \p text on success
+ * \param n_spans [out] Number of entries in \p spans on success
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int term_readspans(term_t *t, size_t row, char **text,
+                            const vimcat_span_t **spans, size_t *n_spans);
+
 /** wipe any data previously rendered to this terminal
  *
  * This also resets the cursor position to the origin, (1, 1) and the style to
- * its default.
+ * its default, and discards any input `term_send` has retained.
  *
  * \param t Terminal to blank
  */
@@ -0,0 +1,510 @@
+#include "vim.h"
+#include "cache.h"
+#include "debug.h"
+#include "get_environ.h"
+#include "hash.h"
+#include "io.h"
+#include "read_core.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct vim {
+  struct vim *next; ///< next executable we have looked up
+
+  char *name;   ///< name we were asked to find
+  char *search; ///< `$PATH` at the time, or `NULL` if `name` is a path
+  char *path;   ///< absolute path of the executable
+
+  // identity of the executable, to tell when it has been replaced
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  // what `--version` told us, protected by `lock`
+  bool probed;
+  int probe_rc;
+  unsigned version;
+  unsigned long patch;
+
+  /// has Vim’s version, or a render, shown it lacks `echoraw`? Protected by
+  /// `lock`.
+  bool no_echoraw;
+};
+
+/// protects all state below
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// executables found so far, most recent first
+static struct vim *known;
+
+/// do two optional strings match?
+static bool str_eq(const char *a, const char *b) {
+  if (a == NULL || b == NULL)
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+/// is this path an executable regular file?
+static bool is_executable(const char *path, struct stat *st) {
+  assert(path != NULL);
+  assert(st != NULL);
+
+  return access(path, X_OK) == 0 && stat(path, st) == 0 &&
+         S_ISREG(st->st_mode);
+}
+
+/// does this executable still match the one we found?
+static bool unchanged(const struct vim *v) {
+  assert(v != NULL);
+
+  struct stat st;
+  return is_executable(v->path, &st) && st.st_dev == v->dev &&
+         st.st_ino == v->ino && st.st_size == v->size &&
+         st.st_mtime == v->mtime;
+}
+
+/// make a path absolute, relative to the current directory
+static char *absolute(const char *path) {
+  assert(path != NULL);
+
+  if (path[0] == '/')
+    return strdup(path);
+
+  char cwd[PATH_MAX];
+  if (ERROR(getcwd(cwd, sizeof(cwd)) == NULL))
+    return NULL;
+
+  char *abs = NULL;
+  if (ERROR(asprintf(&abs, "%s/%s", cwd, path) < 0))
+    return NULL;
+  return abs;
+}
+
+/** locate an executable
+ *
+ * \param name Name to search \p search for, or a path to use as-is
+ * \param search Colon-separated directories, or `NULL` if \p name is a path
+ * \param path [out] Absolute path of the executable on success
+ * \param st [out] Status of the executable on success
+ * \return 0 on success, ENOENT if there is no such executable, or another
+ *   errno on failure
+ */
+static int locate(const char *name, const char *search, char **path,
+                  struct stat *st) {
+  assert(name != NULL);
+  assert(path != NULL);
+  assert(st != NULL);
+
+  if (search == NULL) {
+    if (!is_executable(name, st))
+      return ENOENT;
+    *path = absolute(name);
+    return *path == NULL ? ENOMEM : 0;
+  }
+
+  for (const char *p = search;;) {
+    const char *end = strchr(p, ':');
+    const size_t len = end == NULL ? strlen(p) : (size_t)(end - p);
+
+    // an empty entry means the current directory
+    char *candidate = NULL;
+    if (ERROR(asprintf(&candidate, "%.*s/%s", (int)len, len == 0 ? "." : p,
+                       name) < 0))
+      return ENOMEM;
+
+    if (is_executable(candidate, st)) {
+      *path = absolute(candidate);
+      free(candidate);
+      return *path == NULL ? ENOMEM : 0;
+    }
+    free(candidate);
+
+    if (end == NULL)
+      break;
+    p = end + 1;
+  }
+
+  return ENOENT;
+}
+
+int vim_find(const char *name, const vim_t **vim) {
+  assert(name != NULL);
+  assert(vim != NULL);
+
+  int rc = 0;
+  struct vim *v = NULL;
+
+  // a name containing a slash is a path, as for `execvp`
+  const char *search = NULL;
+  if (strchr(name, '/') == NULL) {
+    search = getenv("PATH");
+    if (search == NULL)
+      search = "/usr/bin:/bin";
+  }
+
+  (void)pthread_mutex_lock(&lock);
+
+  for (struct vim *k = known; k != NULL; k = k->next) {
+    if (strcmp(k->name, name) == 0 && str_eq(k->search, search) &&
+        unchanged(k)) {
+      *vim = k;
+      goto done;
+    }
+  }
+
+  v = calloc(1, sizeof(*v));
+  if (ERROR(v == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+
+  struct stat st;
+  if ((rc = locate(name, search, &v->path, &st))) {
+    DEBUG("%s not found: %s", name, strerror(rc));
+    goto done;
+  }
+  v->dev = st.st_dev;
+  v->ino = st.st_ino;
+  v->size = st.st_size;
+  v->mtime = st.st_mtime;
+
+  v->name = strdup(name);
+  if (ERROR(v->name == NULL)) {
+    rc = ENOMEM;
+    goto done;
+  }
+  if (search != NULL) {
+    v->search = strdup(search);
+    if (ERROR(v->search == NULL)) {
+      rc = ENOMEM;
+      goto done;
+    }
+  }
+
+  DEBUG("found %s at %s", name, v->path);
+
+  // Remember this for the rest of the process. An entry for an executable that
+  // has since changed is left in place, as a caller may still be using it.
+  v->next = known;
+  known = v;
+  *vim = v;
+  v = NULL;
+
+done:
+  (void)pthread_mutex_unlock(&lock);
+
+  if (v != NULL) {
+    free(v->search);
+    free(v->name);
+    free(v->path);
+    free(v);
+  }
+
+  return rc;
+}
+
+const char *vim_path(const vim_t *vim) {
+  assert(vim != NULL);
+  return vim->path;
+}
+
+void vim_hash(hash_t *h, const vim_t *vim) {
+  assert(h != NULL);
+  assert(vim != NULL);
+
+  hash_str(h, vim->path);
+  hash_feed(h, &vim->dev, sizeof(vim->dev));
+  hash_feed(h, &vim->ino, sizeof(vim->ino));
+  hash_feed(h, &vim->size, sizeof(vim->size));
+  hash_feed(h, &vim->mtime, sizeof(vim->mtime));
+}
+
+/** parse the output of `vim --version`
+ *
+ * This begins with lines like:
+ *
+ *   VIM - Vi IMproved 9.0 (2022 Jun 28, compiled …)
+ *   Included patches: 1-1378, 1499
+ */
+static int parse_version(const char *text, unsigned *version,
+                         unsigned long *patch) {
+  assert(text != NULL);
+  assert(version != NULL);
+  assert(patch != NULL);
+
+  unsigned major = 0;
+  unsigned minor = 0;
+  if (ERROR(sscanf(text, "VIM - Vi IMproved %u.%u", &major, &minor) != 2))
+    return EPROTO;
+  *version = major * 100 + minor;
+
+  // a release without patches does not list any
+  *patch = 0;
+  static const char PATCHES[] = "\nIncluded patches: 1";
+  const char *p = strstr(text, PATCHES);
+  if (p != NULL) {
+    p += strlen(PATCHES);
+    if (*p == '-') {
+      *patch = strtoul(p + 1, NULL, 10);
+    } else if (*p == ',' || *p == '\n') {
+      *patch = 1;
+    }
+  }
+
+  return 0;
+}
+
+/// run `vim --version` and parse its output
+static int probe(const char *path, unsigned *version, unsigned long *patch) {
+  assert(path != NULL);
+  assert(version != NULL);
+  assert(patch != NULL);
+
+  int rc = 0;
+  int fd[2] = {-1, -1};
+  int devnull = -1;
+  pid_t pid = 0;
+
+  posix_spawn_file_actions_t actions;
+  if (ERROR((rc = posix_spawn_file_actions_init(&actions))))
+    return rc;
+
+  if (ERROR((rc = pipe_(fd))))
+    goto done;
+  devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (ERROR(devnull < 0)) {
+    rc = errno;
+    goto done;
+  }
+  if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, devnull,
+                                                   STDIN_FILENO))))
+    goto done;
+  if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, fd[1],
+                                                   STDOUT_FILENO))))
+    goto done;
+  if (ERROR((rc = posix_spawn_file_actions_adddup2(&actions, devnull,
+                                                   STDERR_FILENO))))
+    goto done;
+
+  {
+    const char *argv[] = {"vim", "--version", NULL};
+    if (ERROR((rc = posix_spawn(&pid, path, &actions, NULL,
+                                (char *const *)argv, get_environ()))))
+      goto done;
+  }
+  (void)close(fd[1]);
+  fd[1] = -1;
+
+  // The lines we need are at the start, so keep only the first block and
+  // discard the rest.
+  char text[4096];
+  size_t size = 0;
+  while (true) {
+    char discard[4096];
+    char *buffer = size < sizeof(text) - 1 ? &text[size] : discard;
+    const size_t space =
+        size < sizeof(text) - 1 ? sizeof(text) - 1 - size : sizeof(discard);
+    const ssize_t r = read(fd[0], buffer, space);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    if (buffer == &text[size])
+      size += (size_t)r;
+  }
+  text[size] = '\0';
+
+  if (ERROR((rc = wait_vim(pid))))
+    goto done;
+  pid = 0;
+
+  rc = parse_version(text, version, patch);
+
+done:
+  if (pid > 0)
+    (void)wait_vim(pid);
+  if (devnull >= 0)
+    (void)close(devnull);
+  if (fd[0] >= 0)
+    (void)close(fd[0]);
+  if (fd[1] >= 0)
+    (void)close(fd[1]);
+  (void)posix_spawn_file_actions_destroy(&actions);
+
+  return rc;
+}
+
+/// header of a saved version, identifying its format
+#define SAVED_HEADER "vimcat-vim 2"
+
+/// path at which the version of an executable is saved, if anywhere
+static char *saved_path(const struct vim *v) {
+  assert(v != NULL);
+
+  hash_t h;
+  hash_init(&h);
+  vim_hash(&h, v);
+  const digest_t d = hash_finish(&h);
+
+  char name[sizeof(d.bytes) * 2 + sizeof(".vim")];
+  for (size_t i = 0; i < sizeof(d.bytes); ++i)
+    (void)snprintf(&name[i * 2], 3, "%02x", (unsigned)d.bytes[i]);
+  (void)strcpy(&name[sizeof(d.bytes) * 2], ".vim");
+
+  return cache_path(name);
+}
+
+/// load a version, and what Vim was found to lack, saved by a previous process
+static bool load(const struct vim *v, unsigned *version, unsigned long *patch,
+                 bool *no_echoraw) {
+  assert(v != NULL);
+  assert(no_echoraw != NULL);
+
+  char *path = saved_path(v);
+  if (path == NULL)
+    return false;
+
+  bool loaded = false;
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  FILE *f = fd < 0 ? NULL : fdopen(fd, "r");
+  if (f != NULL) {
+    int lacks = 0;
+    loaded = fscanf(f, SAVED_HEADER " %u %lu %d", version, patch, &lacks) == 3;
+    if (loaded)
+      *no_echoraw = lacks != 0;
+    (void)fclose(f);
+  } else if (fd >= 0) {
+    (void)close(fd);
+  }
+  if (loaded)
+    DEBUG("loaded version of %s from %s", v->path, path);
+
+  free(path);
+
+  return loaded;
+}
+
+/// save a version, and what Vim has been found to lack, for future processes
+static void save(const struct vim *v) {
+  assert(v != NULL);
+
+  char *path = saved_path(v);
+  if (path == NULL)
+    return;
+
+  // write to a temporary file and then move it into place, so concurrent
+  // readers never see a partial file
+  char *tmp = NULL;
+  if (ERROR(asprintf(&tmp, "%s.XXXXXX", path) < 0)) {
+    free(path);
+    return;
+  }
+  const int fd = mkostemp(tmp, O_CLOEXEC);
+  if (ERROR(fd < 0))
+    goto done;
+
+  char text[sizeof(SAVED_HEADER) + 64];
+  const int len = snprintf(text, sizeof(text), SAVED_HEADER " %u %lu %d\n",
+                           v->version, v->patch, v->no_echoraw ? 1 : 0);
+  const bool written = len > 0 && write_all(fd, text, (size_t)len) == 0;
+  if (ERROR(close(fd) != 0) || ERROR(!written) ||
+      ERROR(rename(tmp, path) != 0)) {
+    (void)unlink(tmp);
+    goto done;
+  }
+
+  DEBUG("saved version of %s to %s", v->path, path);
+
+done:
+  free(tmp);
+  free(path);
+}
+
+int vim_version(const vim_t *vim, unsigned *version, unsigned long *patch) {
+  assert(vim != NULL);
+  assert(version != NULL);
+  assert(patch != NULL);
+
+  // the only mutable members of a `vim_t` are those protected by `lock`
+  struct vim *v = (struct vim *)vim;
+
+  // Probe while holding the lock, so concurrent renders do not each run Vim.
+  // This only happens once per executable.
+  (void)pthread_mutex_lock(&lock);
+  if (!v->probed) {
+    bool no_echoraw = false;
+    if (load(v, &v->version, &v->patch, &no_echoraw)) {
+      if (no_echoraw)
+        v->no_echoraw = true;
+    } else {
+      v->probe_rc = probe(v->path, &v->version, &v->patch);
+      if (v->probe_rc == 0) {
+        if (v->version < 802 || (v->version == 802 && v->patch < 65))
+          v->no_echoraw = true;
+        save(v);
+      }
+    }
+    if (v->probe_rc == 0)
+      DEBUG("%s is Vim %u.%u.%04lu", v->path, v->version / 100,
+            v->version % 100, v->patch);
+    v->probed = true;
+  }
+  const int rc = v->probe_rc;
+  *version = v->version;
+  *patch = v->patch;
+  (void)pthread_mutex_unlock(&lock);
+
+  return rc;
+}
+
+bool vim_has_echoraw(const vim_t *vim) {
+  assert(vim != NULL);
+
+  struct vim *v = (struct vim *)vim;
+
+  // Without a render cache to keep the answer in, learning Vim’s version would
+  // cost a run of Vim in every process, which is no cheaper than the in-band
+  // check the caller falls back on. So only ask when the answer is, or will
+  // be, saved for later processes. Either way, take the word of any render
+  // that has already found out.
+  if (cache_enabled()) {
+    unsigned version = 0;
+    unsigned long patch = 0;
+    (void)vim_version(vim, &version, &patch);
+  }
+
+  (void)pthread_mutex_lock(&lock);
+  const bool has = !v->no_echoraw;
+  (void)pthread_mutex_unlock(&lock);
+
+  return has;
+}
+
+void vim_lacks_echoraw(const vim_t *vim) {
+  assert(vim != NULL);
+
+  struct vim *v = (struct vim *)vim;
+
+  (void)pthread_mutex_lock(&lock);
+  if (!v->no_echoraw) {
+    DEBUG("%s lacks echoraw", v->path);
+    v->no_echoraw = true;
+    if (v->probed && v->probe_rc == 0)
+      save(v);
+  }
+  (void)pthread_mutex_unlock(&lock);
+}
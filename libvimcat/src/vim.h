@@ -0,0 +1,71 @@
+/// \file
+/// \brief locating and identifying the Vim executable
+///
+/// Vim is found by searching `$PATH` within this process, rather than by the
+/// shell or `posix_spawnp`, and then always started by absolute path. Each
+/// lookup is remembered for the life of the process, so later renders only
+/// need to `stat` the executable to confirm it has not changed. What Vim
+/// reports about itself is also remembered, and kept alongside the render cache
+/// when one is configured so later processes need not ask again.
+
+#pragma once
+
+#include "compiler.h"
+#include "hash.h"
+#include <stdbool.h>
+
+/// a Vim executable
+typedef struct vim vim_t;
+
+/** find a Vim executable
+ *
+ * \param name Name to search `$PATH` for, or a path (containing '/') to use
+ *   as-is
+ * \param vim [out] The executable on success, which remains valid for the
+ *   life of the process
+ * \return 0 on success, ENOENT if no such executable exists, or another errno
+ *   on failure
+ */
+INTERNAL int vim_find(const char *name, const vim_t **vim);
+
+/// absolute path to a Vim executable
+INTERNAL const char *vim_path(const vim_t *vim);
+
+/// hash the identity of a Vim executable, so a change to it can be detected
+INTERNAL void vim_hash(hash_t *h, const vim_t *vim);
+
+/** learn the version of a Vim executable
+ *
+ * The first time this is asked of an executable, it is run with `--version`,
+ * unless a previous process has saved the answer in the render cache.
+ *
+ * \param vim Executable to query
+ * \param version [out] Vim’s `v:version` on success, e.g. 900 for Vim 9.0
+ * \param patch [out] Highest patch number on success, such that all patches
+ *   from 1 up to it are included
+ * \return 0 on success or an errno on failure
+ */
+INTERNAL int vim_version(const vim_t *vim, unsigned *version,
+                         unsigned long *patch);
+
+/** does this Vim have `echoraw`?
+ *
+ * This is needed to render several windows within a single Vim. Vim’s version
+ * is only consulted when there is a render cache to save it in, so without one
+ * this never runs Vim. Vim is assumed to have `echoraw` unless its version is
+ * older than 8.2.0065 or a render has reported it lacking through
+ * `vim_lacks_echoraw`.
+ *
+ * \param vim Executable to query
+ * \return False if Vim is known to lack `echoraw`
+ */
+INTERNAL bool vim_has_echoraw(const vim_t *vim);
+
+/** record that a render found a Vim lacks `echoraw`
+ *
+ * Later renders by this process then skip straight to their fallback, as do
+ * those of later processes if the answer can be saved in the render cache.
+ *
+ * \param vim Executable that lacks `echoraw`
+ */
+INTERNAL void vim_lacks_echoraw(const vim_t *vim);
@@ -0,0 +1,153 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+  size_t limit; ///< number of lines after which to stop, or 0 for no limit
+  int stop;     ///< value to stop with, or 0 for ECANCELED
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  if (l->size != l->limit)
+    return 0;
+  return l->stop == 0 ? ECANCELED : l->stop;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+/// run a render to completion, waiting on its descriptor between steps
+static int run(vimcat_async_t *a) {
+  int rc;
+  while ((rc = vimcat_async_step(a)) == EAGAIN) {
+    struct pollfd p = {.fd = vimcat_async_fd(a), .events = POLLIN};
+    assert(p.fd >= 0);
+    assert(poll(&p, 1, -1) == 1);
+  }
+  assert(vimcat_async_fd(a) == -1);
+  return rc;
+}
+
+/// are there no children left unreaped?
+static bool no_children(void) {
+  return waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_async FILE");
+  const char *filename = argv[1];
+
+  // a C file taller than a single Vim screen
+  {
+    FILE *f = fopen(filename, "w");
+    assert(f != NULL);
+    for (size_t i = 0; i < 2500; ++i)
+      assert(fprintf(f, "int x%zu = %zu; /* line %zu */\n", i, i, i) >= 0);
+    assert(fclose(f) == 0);
+  }
+
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+  assert(reference.size == 2500);
+
+  // an asynchronous render should match a synchronous one
+  {
+    lines_t lines = {0};
+    vimcat_async_t *a = NULL;
+    assert(vimcat_async_start(filename, append, &lines, &a) == 0);
+    assert(vimcat_async_fd(a) >= 0);
+    assert(run(a) == 0);
+
+    // stepping a finished render should repeat its result
+    assert(vimcat_async_step(a) == 0);
+
+    vimcat_async_close(&a);
+    assert(a == NULL);
+    assert(no_children());
+
+    assert(lines.size == reference.size);
+    for (size_t i = 0; i < reference.size; ++i)
+      assert(strcmp(lines.lines[i], reference.lines[i]) == 0);
+    clear(&lines);
+  }
+
+  // cancelling before any output should kill and reap Vim
+  {
+    lines_t lines = {0};
+    vimcat_async_t *a = NULL;
+    assert(vimcat_async_start(filename, append, &lines, &a) == 0);
+    vimcat_async_close(&a);
+    assert(a == NULL);
+    assert(no_children());
+    assert(lines.size == 0);
+  }
+
+  // a callback returning non-zero should stop the render
+  {
+    lines_t lines = {.limit = 10};
+    vimcat_async_t *a = NULL;
+    assert(vimcat_async_start(filename, append, &lines, &a) == 0);
+    assert(run(a) == ECANCELED);
+    assert(no_children());
+    assert(lines.size == 10);
+    vimcat_async_close(&a);
+    clear(&lines);
+  }
+
+  // a callback returning EAGAIN should also stop the render, not be mistaken
+  // for the render still being in progress
+  {
+    lines_t lines = {.limit = 10, .stop = EAGAIN};
+    vimcat_async_t *a = NULL;
+    assert(vimcat_async_start(filename, append, &lines, &a) == 0);
+    int rc;
+    while ((rc = vimcat_async_step(a)) == EAGAIN && vimcat_async_fd(a) >= 0) {
+      struct pollfd p = {.fd = vimcat_async_fd(a), .events = POLLIN};
+      assert(poll(&p, 1, -1) == 1);
+    }
+    assert(rc == EAGAIN);
+    assert(vimcat_async_fd(a) == -1);
+    assert(no_children());
+    assert(lines.size == 10);
+
+    // stepping again should pass on no further lines
+    assert(vimcat_async_step(a) == EAGAIN);
+    assert(lines.size == 10);
+
+    vimcat_async_close(&a);
+    clear(&lines);
+  }
+
+  clear(&reference);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "builder.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void) {
+
+  builder_t b = {0};
+
+  // an empty builder should yield an empty string
+  {
+    char *str = NULL;
+    assert(builder_str(&b, &str) == 0);
+    assert(strcmp(str, "") == 0);
+    assert(b.size == 0);
+  }
+
+  // build strings of increasing length, so the builder grows repeatedly, and
+  // check each against the same built with the standard library
+  char reference[10000] = {0};
+  for (size_t length = 0; length < sizeof(reference); length += 97) {
+
+    builder_clear(&b);
+    memset(reference, 0, sizeof(reference));
+
+    size_t n = 0;
+    for (size_t i = 0; n < length; ++i) {
+      const size_t chunk = i % 3 == 0 ? 1 : i % 3 == 1 ? 5 : 70;
+      const size_t remaining = length - n;
+      const size_t k = chunk < remaining ? chunk : remaining;
+      if (i % 2 == 0) {
+        assert(builder_fill(&b, (char)('a' + i % 26), k) == 0);
+        memset(&reference[n], 'a' + (int)(i % 26), k);
+      } else {
+        assert(builder_append(&b, "0123456789abcdefghijklmnopqrstuvwxyz"
+                                  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+                                  "!@#$%^&*()",
+                              k) == 0);
+        memcpy(&reference[n],
+               "0123456789abcdefghijklmnopqrstuvwxyz"
+               "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+               "!@#$%^&*()",
+               k);
+      }
+      n += k;
+    }
+
+    assert(b.size == length);
+    assert(b.capacity >= length);
+
+    char *str = NULL;
+    assert(builder_str(&b, &str) == 0);
+    assert(strcmp(str, reference) == 0);
+
+    // terminating should not prevent further appending
+    assert(builder_append(&b, "!", 1) == 0);
+    assert(builder_str(&b, &str) == 0);
+    assert(strlen(str) == length + 1);
+    assert(str[length] == '!');
+  }
+
+  // clearing should retain the allocation
+  {
+    const size_t capacity = b.capacity;
+    char *const base = b.base;
+    builder_clear(&b);
+    assert(b.size == 0);
+    assert(builder_append(&b, "hello", strlen("hello")) == 0);
+    assert(b.capacity == capacity);
+    assert(b.base == base);
+    char *str = NULL;
+    assert(builder_str(&b, &str) == 0);
+    assert(strcmp(str, "hello") == 0);
+  }
+
+  // reserved space should be writable directly
+  {
+    builder_clear(&b);
+    assert(builder_reserve(&b, 3) == 0);
+    memcpy(&b.base[b.size], "xyz", 3);
+    b.size += 3;
+    char *str = NULL;
+    assert(builder_str(&b, &str) == 0);
+    assert(strcmp(str, "xyz") == 0);
+  }
+
+  builder_free(&b);
+  assert(b.base == NULL);
+  assert(b.size == 0);
+  assert(b.capacity == 0);
+
+  // freeing again should be harmless
+  builder_free(&b);
+  builder_free(NULL);
+
+  return EXIT_SUCCESS;
+}
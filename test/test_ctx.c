@@ -0,0 +1,210 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+static bool equal(const lines_t *a, const lines_t *b) {
+  if (a->size != b->size)
+    return false;
+  for (size_t i = 0; i < a->size; ++i) {
+    if (strcmp(a->lines[i], b->lines[i]) != 0)
+      return false;
+  }
+  return true;
+}
+
+/// how many bytes have been written to a stream?
+static long written(FILE *f) {
+  assert(fflush(f) == 0);
+  return ftell(f);
+}
+
+/// a thread rendering files through its own context
+typedef struct {
+  vimcat_ctx_t *ctx;
+  const char *const *filenames;
+  size_t n_filenames;
+  const lines_t *references;
+  size_t rounds;
+} worker_t;
+
+static void *work(void *arg) {
+  const worker_t *w = arg;
+
+  for (size_t i = 0; i < w->rounds; ++i) {
+    for (size_t j = 0; j < w->n_filenames; ++j) {
+      lines_t lines = {0};
+      assert(vimcat_ctx_read(w->ctx, w->filenames[j], append, &lines) == 0);
+      assert(equal(&lines, &w->references[j]));
+      clear(&lines);
+    }
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 3 && "usage: test_ctx FILE FILE");
+  const char *filenames[] = {argv[1], argv[2]};
+
+  // a C file taller than a single Vim screen, and a short, wide one, so a
+  // context’s terminal must change shape between them
+  {
+    FILE *f = fopen(filenames[0], "w");
+    assert(f != NULL);
+    for (size_t i = 0; i < 1500; ++i)
+      assert(fprintf(f, "int x%zu = %zu; /* line %zu */\n", i, i, i) >= 0);
+    assert(fclose(f) == 0);
+
+    f = fopen(filenames[1], "w");
+    assert(f != NULL);
+    for (size_t i = 0; i < 3; ++i) {
+      assert(fprintf(f, "static const char *s%zu = \"", i) >= 0);
+      for (size_t j = 0; j < 300; ++j)
+        assert(fputc('a' + (int)(j % 26), f) != EOF);
+      assert(fputs("\";\n", f) >= 0);
+    }
+    assert(fclose(f) == 0);
+  }
+
+  lines_t references[2] = {{0}};
+  for (size_t i = 0; i < 2; ++i)
+    assert(vimcat_read(filenames[i], append, &references[i]) == 0);
+  assert(references[0].size == 1500);
+  assert(references[1].size == 3);
+
+  // the process-wide debug stream should hear nothing from contexts
+  FILE *global = tmpfile();
+  assert(global != NULL);
+  (void)vimcat_set_debug(global);
+
+  // two contexts used concurrently, each logging to its own stream
+  {
+    vimcat_ctx_t *ctxs[2] = {NULL};
+    FILE *logs[2] = {NULL};
+    for (size_t i = 0; i < 2; ++i) {
+      assert(vimcat_ctx_new(&ctxs[i]) == 0);
+      logs[i] = tmpfile();
+      assert(logs[i] != NULL);
+      vimcat_ctx_set_debug(ctxs[i], logs[i]);
+    }
+    assert(vimcat_ctx_set_filetype(ctxs[1], "c") == 0);
+
+    worker_t workers[2];
+    pthread_t threads[2];
+    for (size_t i = 0; i < 2; ++i) {
+      workers[i] = (worker_t){.ctx = ctxs[i],
+                              .filenames = filenames,
+                              .n_filenames = 2,
+                              .references = references,
+                              .rounds = 3};
+      assert(pthread_create(&threads[i], NULL, work, &workers[i]) == 0);
+    }
+    for (size_t i = 0; i < 2; ++i)
+      assert(pthread_join(threads[i], NULL) == 0);
+
+    for (size_t i = 0; i < 2; ++i) {
+      assert(written(logs[i]) > 0);
+      vimcat_ctx_free(&ctxs[i]);
+      assert(ctxs[i] == NULL);
+      assert(fclose(logs[i]) == 0);
+    }
+  }
+
+  assert(written(global) == 0);
+  vimcat_debug_off();
+  assert(fclose(global) == 0);
+
+  // a range should match the same lines of a full render
+  {
+    vimcat_ctx_t *ctx = NULL;
+    assert(vimcat_ctx_new(&ctx) == 0);
+    lines_t lines = {0};
+    assert(vimcat_ctx_read_range(ctx, filenames[0], 1001, 1010, append,
+                                 &lines) == 0);
+    assert(lines.size == 10);
+    for (size_t i = 0; i < lines.size; ++i)
+      assert(strcmp(lines.lines[i], references[0].lines[1000 + i]) == 0);
+    clear(&lines);
+    vimcat_ctx_free(&ctx);
+  }
+
+  // the headless backend should be selectable per context
+  {
+    vimcat_ctx_t *ctx = NULL;
+    assert(vimcat_ctx_new(&ctx) == 0);
+    assert(vimcat_ctx_set_backend(ctx, VIMCAT_BACKEND_HEADLESS) == 0);
+    for (size_t i = 0; i < 2; ++i) {
+      lines_t lines = {0};
+      assert(vimcat_ctx_read(ctx, filenames[i], append, &lines) == 0);
+      assert(equal(&lines, &references[i]));
+      clear(&lines);
+    }
+    vimcat_ctx_free(&ctx);
+  }
+
+  // invalid settings should be rejected, and a missing Vim should be an error
+  {
+    vimcat_ctx_t *ctx = NULL;
+    assert(vimcat_ctx_new(&ctx) == 0);
+    assert(vimcat_ctx_set_filetype(ctx, "c; !rm -rf /") == EINVAL);
+    assert(vimcat_ctx_set_backend(ctx, (vimcat_backend_t)42) == EINVAL);
+    assert(vimcat_ctx_set_vim(ctx, "") == EINVAL);
+    assert(vimcat_ctx_read_range(ctx, filenames[0], 0, 0, append, NULL) ==
+           EINVAL);
+
+    assert(vimcat_ctx_set_vim(ctx, "/nonexistent/vim") == 0);
+    lines_t lines = {0};
+    assert(vimcat_ctx_read(ctx, filenames[1], append, &lines) != 0);
+    assert(lines.size == 0);
+
+    // the context should recover once given a working Vim
+    assert(vimcat_ctx_set_vim(ctx, NULL) == 0);
+    assert(vimcat_ctx_read(ctx, filenames[1], append, &lines) == 0);
+    assert(equal(&lines, &references[1]));
+    clear(&lines);
+    vimcat_ctx_free(&ctx);
+  }
+
+  for (size_t i = 0; i < 2; ++i)
+    clear(&references[i]);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "extent.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// the original, byte-at-a-time, measurement algorithm
+static void reference(FILE *f, size_t limit, size_t *rows, size_t *columns) {
+
+  size_t lines = 1;
+  size_t width = 0;
+  size_t max_width = 0;
+  int last = EOF;
+
+  while (true) {
+
+    if (limit != 0 && lines > limit)
+      break;
+
+    int c = getc(f);
+    if (c == EOF)
+      break;
+    last = c;
+
+    if (c == '\n') {
+      ++lines;
+      if (max_width < width)
+        max_width = width;
+      width = 0;
+      continue;
+    }
+
+    if (c == '\r') {
+      int n = getc(f);
+      if (n == '\n') {
+        ++lines;
+        if (max_width < width)
+          max_width = width;
+        width = 0;
+        continue;
+      }
+
+      if (n != EOF)
+        (void)ungetc(n, f);
+    }
+
+    if (c == '\t') {
+      width += 8;
+      continue;
+    }
+
+    ++width;
+  }
+
+  if (max_width < width)
+    max_width = width;
+
+  if (last == '\n')
+    --lines;
+
+  *rows = lines;
+  *columns = max_width;
+}
+
+/// width of the widest line in [first, last] of some text
+static size_t range_width(const char *text, size_t length, size_t first,
+                          size_t last) {
+  size_t lineno = 1;
+  size_t width = 0;
+  size_t max_width = 0;
+  for (size_t i = 0; i <= length; ++i) {
+    if (i == length || text[i] == '\n') {
+      const bool cr = i > 0 && i < length && text[i - 1] == '\r';
+      if (lineno >= first && (last == 0 || lineno <= last) &&
+          max_width < width - cr)
+        max_width = width - cr;
+      ++lineno;
+      width = 0;
+      continue;
+    }
+    width += text[i] == '\t' ? 8 : 1;
+  }
+  return max_width;
+}
+
+/// check all ways of measuring some text agree
+static void check(const char *path, const char *text, size_t length) {
+
+  // write the text to a file
+  {
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+    assert(fwrite(text, 1, length, f) == length);
+    assert(fclose(f) == 0);
+  }
+
+  for (size_t limit = 0; limit < 6; ++limit) {
+
+    size_t ref_rows = 0;
+    size_t ref_columns = 0;
+    {
+      FILE *f = fopen(path, "rb");
+      assert(f != NULL);
+      reference(f, limit, &ref_rows, &ref_columns);
+      (void)fclose(f);
+    }
+
+    // measuring from the file should give the same result
+    {
+      size_t rows = 0;
+      size_t columns = 0;
+      assert(get_extent(path, limit, &rows, &columns) == 0);
+      assert(rows == ref_rows);
+      assert(columns == ref_columns);
+    }
+
+    // measuring a range should count the same rows, but only the widths of
+    // lines within the range
+    for (size_t first = 1; first < 5; ++first) {
+      if (limit != 0 && first > limit)
+        break;
+      size_t rows = 0;
+      size_t columns = 0;
+      assert(get_extent_range(path, first, limit, &rows, &columns) == 0);
+      assert(rows == ref_rows);
+      assert(columns == range_width(text, length, first, limit));
+    }
+
+    // measuring the text in arbitrary pieces should give the same result
+    {
+      extent_t e;
+      extent_init(&e, limit);
+      for (size_t offset = 0; offset < length;) {
+        const size_t piece = (size_t)rand() % (length - offset) + 1;
+        const size_t consumed = extent_feed(&e, &text[offset], piece);
+        assert(consumed <= piece);
+        assert(consumed == piece || e.done);
+        offset += piece;
+      }
+      size_t rows = 0;
+      size_t columns = 0;
+      extent_finish(&e, &rows, &columns);
+      assert(rows == ref_rows);
+      assert(columns == ref_columns);
+    }
+  }
+}
+
+int main(void) {
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  char path[4096];
+  (void)snprintf(path, sizeof(path), "%s/test_extent.XXXXXX", TMPDIR);
+  {
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    (void)close(fd);
+  }
+
+  static const char ALPHABET[] = {'a', ' ', '\t', '\r', '\n', '\xc3', '\xa9'};
+
+  static const extent_impl_t IMPLS[] = {EXTENT_AUTO, EXTENT_SCALAR,
+                                        EXTENT_SSE2, EXTENT_AVX2};
+
+  for (size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); ++i) {
+
+    if (!extent_use(IMPLS[i])) {
+      printf("skipping unsupported implementation %d\n", (int)IMPLS[i]);
+      continue;
+    }
+
+    // some hand-written edge cases
+    static const char *const CASES[] = {
+        "",         "\n",       "\r",       "\r\n",      "\n\n",
+        "a\r\n",    "a\r\r\n",  "a\rb",     "\t\r\n\t",  "a\nb",
+        "a\r\nb\n", "\n\r\n\r", "\r\r\r\n", "abc\r\n\n",
+    };
+    for (size_t j = 0; j < sizeof(CASES) / sizeof(CASES[0]); ++j)
+      check(path, CASES[j], strlen(CASES[j]));
+
+    // random text, including lengths that do not divide into whole blocks and
+    // lines that span blocks
+    srand(42);
+    for (size_t j = 0; j < 2000; ++j) {
+      char text[300];
+      const size_t length = (size_t)rand() % sizeof(text);
+      for (size_t k = 0; k < length; ++k) {
+        // bias towards long lines so some blocks contain no newline
+        const size_t choice = (size_t)rand() % (j % 2 ? 40 : 7);
+        text[k] = choice < sizeof(ALPHABET) ? ALPHABET[choice] : 'x';
+      }
+      check(path, text, length);
+    }
+  }
+
+  (void)unlink(path);
+
+  return 0;
+}
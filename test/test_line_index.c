@@ -0,0 +1,197 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "extent.h"
+#include "line_index.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vimcat/index.h>
+
+static void write_file(const char *path, const char *text, size_t length) {
+  FILE *f = fopen(path, "wb");
+  assert(f != NULL);
+  assert(fwrite(text, 1, length, f) == length);
+  assert(fclose(f) == 0);
+}
+
+/// change a file’s modification time without changing its content or size
+static void touch(const char *path, time_t mtime) {
+  const struct timespec times[] = {{.tv_sec = mtime}, {.tv_sec = mtime}};
+  assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+/// check an index describes some text
+static void check(const line_index_t *index, const char *path, const char *text,
+                  size_t length) {
+
+  // it should agree with measuring the file directly
+  {
+    size_t rows = 0;
+    size_t columns = 0;
+    assert(get_extent(path, 0, &rows, &columns) == 0);
+    assert(line_index_rows(index) == rows);
+    assert(line_index_columns(index) == columns);
+  }
+
+  // each line should be where and as wide as we expect
+  size_t lineno = 1;
+  size_t start = 0;
+  size_t width = 0;
+  for (size_t i = 0; i < length; ++i) {
+    if (text[i] == '\n') {
+      const bool cr = i > 0 && text[i - 1] == '\r';
+      assert(lineno <= line_index_rows(index));
+      assert(line_index_offset(index, lineno) == start);
+      assert(line_index_width(index, lineno) == width - cr);
+      ++lineno;
+      start = i + 1;
+      width = 0;
+      continue;
+    }
+    width += text[i] == '\t' ? 8 : 1;
+  }
+
+  // the final line only counts if something (other than a lone "\n") ends it
+  const bool bare_lf =
+      length > 0 && text[length - 1] == '\n' &&
+      (length == 1 || text[length - 2] != '\r');
+  if (!bare_lf) {
+    assert(line_index_rows(index) == lineno);
+    assert(line_index_offset(index, lineno) == start);
+    assert(line_index_width(index, lineno) == width);
+  } else {
+    assert(line_index_rows(index) == lineno - 1);
+  }
+}
+
+int main(void) {
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  char path[4096];
+  (void)snprintf(path, sizeof(path), "%s/test_line_index.XXXXXX", TMPDIR);
+  {
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    (void)close(fd);
+  }
+
+  // indices of random text should be accurate
+  {
+    static const char ALPHABET[] = {'a', ' ', '\t', '\r', '\n', '\xc3', '\xa9'};
+
+    srand(42);
+    for (size_t i = 0; i < 500; ++i) {
+      static char text[5000];
+      const size_t length = (size_t)rand() % sizeof(text);
+      for (size_t j = 0; j < length; ++j) {
+        const size_t choice = (size_t)rand() % (i % 2 ? 100 : 7);
+        text[j] = choice < sizeof(ALPHABET) ? ALPHABET[choice] : 'x';
+      }
+      write_file(path, text, length);
+
+      line_index_t *index = NULL;
+      assert(line_index_open(path, true, &index) == 0);
+      assert(index != NULL);
+      check(index, path, text, length);
+      line_index_close(&index);
+      assert(index == NULL);
+
+      line_index_flush();
+    }
+  }
+
+  // an index should be reused until the file changes
+  {
+    static const char TEXT[] = "hello\nworld\n";
+    write_file(path, TEXT, strlen(TEXT));
+    touch(path, 1000000);
+
+    // asking without building should find nothing
+    line_index_t *none = NULL;
+    assert(line_index_open(path, false, &none) == 0);
+    assert(none == NULL);
+
+    line_index_t *first = NULL;
+    assert(line_index_open(path, true, &first) == 0);
+    line_index_t *second = NULL;
+    assert(line_index_open(path, false, &second) == 0);
+    assert(second == first);
+    line_index_close(&second);
+
+    // a change of modification time should invalidate it
+    touch(path, 2000000);
+    assert(line_index_open(path, false, &second) == 0);
+    assert(second == NULL);
+
+    // the original should still be usable by its holder
+    check(first, path, TEXT, strlen(TEXT));
+    line_index_close(&first);
+
+    // a change of content should be noticed
+    static const char LONGER[] = "hello\nworld\nagain";
+    write_file(path, LONGER, strlen(LONGER));
+    assert(line_index_open(path, true, &first) == 0);
+    check(first, path, LONGER, strlen(LONGER));
+    line_index_close(&first);
+
+    line_index_flush();
+  }
+
+  // an index should be persisted if we have somewhere to put it
+  {
+    char dir[4096];
+    (void)snprintf(dir, sizeof(dir), "%s/test_line_index.XXXXXX", TMPDIR);
+    assert(mkdtemp(dir) != NULL);
+    assert(vimcat_set_index_dir(dir) == 0);
+
+    static const char TEXT[] = "a\tb\r\nc\n\nlonger line\n";
+    write_file(path, TEXT, strlen(TEXT));
+
+    line_index_t *index = NULL;
+    assert(line_index_open(path, true, &index) == 0);
+    line_index_close(&index);
+
+    // after forgetting it, we should be able to recover it from disk
+    line_index_flush();
+    assert(line_index_open(path, false, &index) == 0);
+    assert(index != NULL);
+    check(index, path, TEXT, strlen(TEXT));
+    line_index_close(&index);
+
+    // but not once the file has changed
+    line_index_flush();
+    touch(path, 3000000);
+    assert(line_index_open(path, false, &index) == 0);
+    assert(index == NULL);
+
+    // clean up the persisted index
+    {
+      struct stat st;
+      assert(stat(path, &st) == 0);
+      char sidecar[sizeof(dir) + 100];
+      (void)snprintf(sidecar, sizeof(sidecar), "%s/%jx-%jx.idx", dir,
+                     (uintmax_t)st.st_dev, (uintmax_t)st.st_ino);
+      assert(unlink(sidecar) == 0);
+    }
+    assert(vimcat_set_index_dir(NULL) == 0);
+    assert(rmdir(dir) == 0);
+  }
+
+  (void)unlink(path);
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+static void check_same(const lines_t *a, const lines_t *b) {
+  assert(a->size == b->size);
+  for (size_t i = 0; i < a->size; ++i)
+    assert(strcmp(a->lines[i], b->lines[i]) == 0);
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 3 && "usage: test_read_buffer FILE FILETYPE");
+  const char *filename = argv[1];
+  const char *filetype = argv[2];
+
+  // highlight the file itself as a reference
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+
+  // read the file into memory
+  char *data = NULL;
+  size_t length = 0;
+  {
+    FILE *f = fopen(filename, "r");
+    assert(f != NULL);
+    FILE *m = open_memstream(&data, &length);
+    assert(m != NULL);
+    for (int c; (c = getc(f)) != EOF;)
+      assert(putc(c, m) != EOF);
+    (void)fclose(m);
+    (void)fclose(f);
+  }
+
+  // highlighting the same content from memory should give the same result
+  {
+    lines_t lines = {0};
+    assert(vimcat_read_buffer(data, length, filetype, append, &lines) == 0);
+    check_same(&reference, &lines);
+    clear(&lines);
+  }
+
+  // as should highlighting it from a pipe
+  {
+    int fd[2];
+    assert(pipe(fd) == 0);
+    const pid_t writer = fork();
+    assert(writer >= 0);
+    if (writer == 0) {
+      (void)close(fd[0]);
+      for (size_t offset = 0; offset < length;) {
+        const ssize_t w = write(fd[1], &data[offset], length - offset);
+        if (w < 0)
+          _exit(EXIT_FAILURE);
+        offset += (size_t)w;
+      }
+      _exit(EXIT_SUCCESS);
+    }
+    (void)close(fd[1]);
+
+    lines_t lines = {0};
+    assert(vimcat_read_fd(fd[0], filetype, append, &lines) == 0);
+    (void)close(fd[0]);
+    check_same(&reference, &lines);
+    clear(&lines);
+  }
+
+  // an empty buffer should be a single empty line, as for an empty file
+  {
+    lines_t lines = {0};
+    assert(vimcat_read_buffer(NULL, 0, NULL, append, &lines) == 0);
+    assert(lines.size == 1);
+    assert(strcmp(lines.lines[0], "") == 0);
+    clear(&lines);
+  }
+
+  // filetypes that could smuggle in other Vim commands should be rejected
+  assert(vimcat_read_buffer(data, length, "c|q", append, &(lines_t){0}) ==
+         EINVAL);
+  assert(vimcat_read_buffer(data, length, "", append, &(lines_t){0}) == EINVAL);
+
+  free(data);
+  clear(&reference);
+
+  return 0;
+}
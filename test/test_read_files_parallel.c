@@ -0,0 +1,178 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines, each tagged with the file it came from
+typedef struct {
+  char **lines;
+  size_t *indices;
+  size_t size;
+
+  /// outcomes reported through the `finished` callback, in order
+  size_t reported[16];
+  int results[16];
+  size_t n_reported;
+
+  int stop; ///< value for `finished` to return on a failure
+} lines_t;
+
+static int append(void *state, size_t index, char *line) {
+  lines_t *l = state;
+
+  // lines should not arrive for a file after its outcome is reported
+  assert(l->n_reported == 0 || l->reported[l->n_reported - 1] < index);
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+  size_t *indices = realloc(l->indices, sizeof(l->indices[0]) * (l->size + 1));
+  assert(indices != NULL);
+  l->indices = indices;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  l->indices[l->size] = index;
+  ++l->size;
+
+  return 0;
+}
+
+static int finished(void *state, size_t index, int rc) {
+  lines_t *l = state;
+
+  assert(l->n_reported < sizeof(l->reported) / sizeof(l->reported[0]));
+  l->reported[l->n_reported] = index;
+  l->results[l->n_reported] = rc;
+  ++l->n_reported;
+
+  return rc == 0 ? 0 : l->stop;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  free(l->indices);
+  *l = (lines_t){0};
+}
+
+/// do two renders contain the same lines from the same files?
+static bool equal(const lines_t *a, const lines_t *b) {
+  if (a->size != b->size)
+    return false;
+  for (size_t i = 0; i < a->size; ++i) {
+    if (a->indices[i] != b->indices[i])
+      return false;
+    if (strcmp(a->lines[i], b->lines[i]) != 0)
+      return false;
+  }
+  return true;
+}
+
+/// write a C file of the given number of lines
+static char *make(const char *dir, const char *name, size_t lines) {
+  char *path = NULL;
+  assert(asprintf(&path, "%s/%s", dir, name) >= 0);
+  FILE *f = fopen(path, "w");
+  assert(f != NULL);
+  for (size_t i = 0; i < lines; ++i)
+    assert(fprintf(f, "int %c%zu = %zu; // line %zu\n", name[0], i, i, i) >= 0);
+  assert(fclose(f) == 0);
+  return path;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_read_files_parallel DIR");
+  const char *dir = argv[1];
+
+  // files of varying heights, some taller than a single Vim screen
+  char *paths[] = {make(dir, "a.c", 2500), make(dir, "b.c", 3),
+                   make(dir, "e.c", 0), make(dir, "a2.c", 1200),
+                   make(dir, "b2.c", 40)};
+  enum { N = sizeof(paths) / sizeof(paths[0]) };
+  const char *filenames[N];
+  for (size_t i = 0; i < N; ++i)
+    filenames[i] = paths[i];
+
+  lines_t reference = {0};
+  assert(vimcat_read_files(filenames, N, append, &reference) == 0);
+  // an empty file is displayed as a single empty line
+  assert(reference.size == 2500 + 3 + 1 + 1200 + 40);
+
+  // any number of jobs should produce the same lines, in the same order
+  for (size_t jobs = 0; jobs <= 4; ++jobs) {
+    lines_t lines = {0};
+    assert(vimcat_read_files_parallel(filenames, N, jobs, append, finished,
+                                      &lines) == 0);
+    assert(equal(&lines, &reference));
+    assert(lines.n_reported == N);
+    for (size_t i = 0; i < N; ++i) {
+      assert(lines.reported[i] == i);
+      assert(lines.results[i] == 0);
+    }
+    clear(&lines);
+  }
+
+  // a missing file should be reported in its place without stopping the others
+  {
+    char *missing = NULL;
+    assert(asprintf(&missing, "%s/missing.c", dir) >= 0);
+    const char *with_missing[] = {filenames[0], missing, filenames[1]};
+
+    lines_t expected = {0};
+    assert(vimcat_read_files((const char *[]){filenames[0], filenames[1]}, 2,
+                             append, &expected) == 0);
+
+    lines_t lines = {0};
+    assert(vimcat_read_files_parallel(with_missing, 3, 2, append, finished,
+                                      &lines) == 0);
+    assert(lines.n_reported == 3);
+    assert(lines.results[0] == 0);
+    assert(lines.results[1] == ENOENT);
+    assert(lines.results[2] == 0);
+    assert(lines.size == expected.size);
+    for (size_t i = 0; i < lines.size; ++i) {
+      assert(strcmp(lines.lines[i], expected.lines[i]) == 0);
+      assert(lines.indices[i] == (expected.indices[i] == 0 ? 0 : 2));
+    }
+    clear(&lines);
+
+    // a handler returning the failure should stop the render there
+    lines = (lines_t){.stop = ECANCELED};
+    assert(vimcat_read_files_parallel(with_missing, 3, 2, append, finished,
+                                      &lines) == ECANCELED);
+    assert(lines.n_reported == 2);
+    for (size_t i = 0; i < lines.size; ++i)
+      assert(lines.indices[i] == 0);
+    clear(&lines);
+
+    // without a handler, the failure should end the render as it does serially
+    lines_t serial = {0};
+    assert(vimcat_read_files(with_missing, 3, append, &serial) == ENOENT);
+    lines = (lines_t){0};
+    assert(vimcat_read_files_parallel(with_missing, 3, 2, append, NULL,
+                                      &lines) == ENOENT);
+    assert(equal(&lines, &serial));
+    clear(&lines);
+    clear(&serial);
+
+    clear(&expected);
+    free(missing);
+  }
+
+  clear(&reference);
+  for (size_t i = 0; i < N; ++i)
+    free(paths[i]);
+
+  return EXIT_SUCCESS;
+}
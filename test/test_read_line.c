@@ -0,0 +1,64 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_read_line FILE");
+  const char *filename = argv[1];
+
+  // highlight the whole file as a reference
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+
+  // highlighting each line individually should produce the same result, in any
+  // order
+  for (size_t i = 0; i < reference.size; ++i) {
+    const size_t lineno = i % 2 ? reference.size - i / 2 : i / 2 + 1;
+    char *line = NULL;
+    assert(vimcat_read_line(filename, (unsigned long)lineno, &line) == 0);
+    assert(strcmp(line, reference.lines[lineno - 1]) == 0);
+    free(line);
+  }
+
+  // lines beyond the end of the file should be rejected
+  {
+    char *line = NULL;
+    assert(vimcat_read_line(filename, (unsigned long)reference.size + 1,
+                            &line) == ERANGE);
+  }
+
+  for (size_t i = 0; i < reference.size; ++i)
+    free(reference.lines[i]);
+  free(reference.lines);
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_read_parallel FILE");
+  const char *filename = argv[1];
+
+  // highlight the file serially as a reference
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+
+  // parallel highlighting should produce the same lines in the same order
+  for (size_t jobs = 0; jobs <= 4; ++jobs) {
+    lines_t lines = {0};
+    assert(vimcat_read_parallel(filename, jobs, append, &lines) == 0);
+    assert(lines.size == reference.size);
+    for (size_t i = 0; i < lines.size; ++i)
+      assert(strcmp(lines.lines[i], reference.lines[i]) == 0);
+    clear(&lines);
+  }
+
+  clear(&reference);
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+/// state for checking spans against ANSI-highlighted lines
+typedef struct {
+  const lines_t *reference;
+  size_t index;  ///< index of the next line expected
+  bool coloured; ///< have we seen any non-default foreground?
+} check_t;
+
+static int check(void *state, char *text, const vimcat_span_t *spans,
+                 size_t n_spans) {
+  check_t *c = state;
+
+  assert(c->index < c->reference->size);
+  const char *line = c->reference->lines[c->index];
+  ++c->index;
+
+  // the spans should cover the text, in order, without gaps
+  size_t offset = 0;
+  for (size_t i = 0; i < n_spans; ++i) {
+    assert(spans[i].offset == offset);
+    assert(spans[i].length > 0);
+    offset += spans[i].length;
+    if (spans[i].fg != VIMCAT_COLOUR_DEFAULT)
+      c->coloured = true;
+  }
+  assert(offset == strlen(text));
+
+  // The text should be the ANSI line with its escapes removed, and the spans
+  // should begin wherever the ANSI line changed style. The ANSI line starts
+  // in the default style, so it only has an escape at the start if the first
+  // span is not default.
+  size_t span = 0;
+  size_t column = 0;
+  for (const char *p = line; *p != '\0';) {
+    if (*p == '\033') {
+      while (*p == '\033') {
+        const char *m = strchr(p, 'm');
+        assert(m != NULL);
+        p = m + 1;
+      }
+      // ignore the closing reset
+      if (*p == '\0')
+        break;
+      if (column > 0) {
+        ++span;
+        assert(span < n_spans);
+      }
+      assert(spans[span].offset == column);
+      continue;
+    }
+    assert(text[column] == *p);
+    ++column;
+    ++p;
+    // a span boundary must be marked by an escape
+    if (span + 1 < n_spans)
+      assert(column <= spans[span + 1].offset);
+  }
+  assert(column == strlen(text));
+  assert(span + 1 == n_spans || n_spans == 0);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_read_spans FILE");
+  const char *filename = argv[1];
+
+  // highlight the file as ANSI strings as a reference
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+
+  // the spans should describe the same highlighting
+  check_t c = {.reference = &reference};
+  assert(vimcat_read_spans(filename, check, &c) == 0);
+  assert(c.index == reference.size);
+  assert(c.coloured && "no highlighting seen");
+
+  for (size_t i = 0; i < reference.size; ++i)
+    free(reference.lines[i]);
+  free(reference.lines);
+
+  return EXIT_SUCCESS;
+}
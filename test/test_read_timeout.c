@@ -0,0 +1,142 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+  int stop; ///< value to return from the callback, to stop the render
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return l->stop;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+static double now(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// are there no children left unreaped?
+static bool no_children(void) {
+  return waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD;
+}
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_read_timeout DIR");
+  const char *dir = argv[1];
+
+  // a C file taller than a single Vim screen, which Vim renders promptly
+  char fast[4096];
+  (void)snprintf(fast, sizeof(fast), "%s/fast.c", dir);
+  {
+    FILE *f = fopen(fast, "w");
+    assert(f != NULL);
+    for (size_t i = 0; i < 2500; ++i)
+      assert(fprintf(f, "int x%zu = %zu; /* line %zu */\n", i, i, i) >= 0);
+    assert(fclose(f) == 0);
+  }
+
+  // a file the caller’s vimrc makes Vim stall on
+  char slow[4096];
+  (void)snprintf(slow, sizeof(slow), "%s/input.slow", dir);
+  {
+    FILE *f = fopen(slow, "w");
+    assert(f != NULL);
+    assert(fputs("first\n\tsecond\x01\n\nfourth", f) >= 0);
+    assert(fclose(f) == 0);
+  }
+
+  // a render within its time limit should be fully highlighted
+  {
+    lines_t reference = {0};
+    assert(vimcat_read_range(fast, 1, 0, append, &reference) == 0);
+    assert(reference.size == 2500);
+
+    lines_t lines = {0};
+    unsigned long highlighted = 0;
+    assert(vimcat_read_timeout(fast, 1, 0, 60000, append, &lines,
+                               &highlighted) == 0);
+    assert(highlighted == 2500);
+    assert(lines.size == reference.size);
+    for (size_t i = 0; i < reference.size; ++i)
+      assert(strcmp(lines.lines[i], reference.lines[i]) == 0);
+
+    clear(&lines);
+    clear(&reference);
+  }
+
+  // a render out of time should fall back to the file’s text
+  {
+    lines_t lines = {0};
+    unsigned long highlighted = 42;
+    const double start = now();
+    assert(vimcat_read_timeout(slow, 1, 0, 200, append, &lines,
+                               &highlighted) == 0);
+    assert(now() - start < 5 && "Vim was waited on beyond the deadline");
+    assert(no_children());
+
+    assert(highlighted == 0);
+    assert(lines.size == 4);
+    assert(strcmp(lines.lines[0], "first") == 0);
+    assert(strcmp(lines.lines[1], "        second^A") == 0);
+    assert(strcmp(lines.lines[2], "") == 0);
+    assert(strcmp(lines.lines[3], "fourth") == 0);
+    clear(&lines);
+  }
+
+  // the fallback should respect the requested range
+  {
+    lines_t lines = {0};
+    unsigned long highlighted = 42;
+    assert(vimcat_read_timeout(slow, 2, 3, 200, append, &lines,
+                               &highlighted) == 0);
+    assert(highlighted == 0);
+    assert(lines.size == 2);
+    assert(strcmp(lines.lines[0], "        second^A") == 0);
+    assert(strcmp(lines.lines[1], "") == 0);
+    clear(&lines);
+  }
+
+  // a callback returning ETIMEDOUT itself should not trigger the fallback
+  {
+    lines_t lines = {.stop = ETIMEDOUT};
+    assert(vimcat_read_timeout(fast, 1, 0, 60000, append, &lines, NULL) ==
+           ETIMEDOUT);
+    assert(lines.size == 1);
+    clear(&lines);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vimcat/vimcat.h>
+
+/// a growable list of lines
+typedef struct {
+  char **lines;
+  size_t size;
+} lines_t;
+
+static int append(void *state, char *line) {
+  lines_t *l = state;
+
+  char **lines = realloc(l->lines, sizeof(l->lines[0]) * (l->size + 1));
+  assert(lines != NULL);
+  l->lines = lines;
+
+  l->lines[l->size] = strdup(line);
+  assert(l->lines[l->size] != NULL);
+  ++l->size;
+
+  return 0;
+}
+
+static void clear(lines_t *l) {
+  for (size_t i = 0; i < l->size; ++i)
+    free(l->lines[i]);
+  free(l->lines);
+  *l = (lines_t){0};
+}
+
+static int count(void *state, unsigned long lineno, char *line) {
+  lines_t *l = state;
+  assert(lineno == l->size + 1);
+  return append(l, line);
+}
+
+/// state for checking lines delivered by a session update
+typedef struct {
+  const vimcat_session_t *session;
+  unsigned long next; ///< line number expected next
+  size_t count;       ///< number of lines received
+} received_t;
+
+static int receive(void *state, unsigned long lineno, char *line) {
+  received_t *r = state;
+
+  // lines should arrive in order, and match what the session holds
+  assert(r->next == 0 || lineno == r->next);
+  assert(strcmp(vimcat_session_line(r->session, lineno), line) == 0);
+  r->next = lineno + 1;
+  ++r->count;
+
+  return 0;
+}
+
+/// write a new version of the file
+///
+/// The file is replaced rather than overwritten, so it is seen as a new file
+/// even if its size and modification time do not change.
+static void write_file(const char *filename, const char *const *lines,
+                       size_t n) {
+  char *tmp = NULL;
+  assert(asprintf(&tmp, "%s.tmp", filename) >= 0);
+
+  FILE *f = fopen(tmp, "w");
+  assert(f != NULL);
+  for (size_t i = 0; i < n; ++i)
+    assert(fprintf(f, "%s\n", lines[i]) >= 0);
+  assert(fclose(f) == 0);
+
+  assert(rename(tmp, filename) == 0);
+  free(tmp);
+}
+
+/// check a session matches a from-scratch render of its file
+static void check_session(const vimcat_session_t *s, const char *filename) {
+  lines_t reference = {0};
+  assert(vimcat_read(filename, append, &reference) == 0);
+
+  assert(vimcat_session_rows(s) == reference.size);
+  for (size_t i = 0; i < reference.size; ++i)
+    assert(strcmp(vimcat_session_line(s, i + 1), reference.lines[i]) == 0);
+  assert(vimcat_session_line(s, reference.size + 1) == NULL);
+
+  clear(&reference);
+}
+
+enum { N = 120 };
+
+int main(int argc, char **argv) {
+
+  assert(argc == 2 && "usage: test_session FILE");
+  const char *filename = argv[1];
+
+  // a C file, with a comment near its end that an edit can extend
+  char *lines[N + 2] = {0};
+  for (size_t i = 0; i < N; ++i) {
+    if (i == 100) {
+      lines[i] = strdup("int end_of_comment; */");
+    } else {
+      assert(asprintf(&lines[i], "int x%zu = %zu; // line %zu", i, i, i) >= 0);
+    }
+    assert(lines[i] != NULL);
+  }
+  write_file(filename, (const char *const *)lines, N);
+
+  vimcat_session_t *s = NULL;
+  {
+    lines_t initial = {0};
+    assert(vimcat_session_open(filename, count, &initial, &s) == 0);
+    assert(initial.size == N);
+    clear(&initial);
+    check_session(s, filename);
+  }
+
+  // updating an unchanged file should change nothing
+  {
+    received_t r = {.session = s};
+    vimcat_change_t change;
+    assert(vimcat_session_update(s, &change, receive, &r) == 0);
+    assert(change.added == 0 && change.removed == 0);
+    assert(r.count == 0);
+  }
+
+  // changing a single line should only re-render that line
+  {
+    free(lines[50]);
+    lines[50] = strdup("char *changed = \"a string\";");
+    assert(lines[50] != NULL);
+    write_file(filename, (const char *const *)lines, N);
+
+    received_t r = {.session = s};
+    vimcat_change_t change;
+    assert(vimcat_session_update(s, &change, receive, &r) == 0);
+    assert(change.first == 51);
+    assert(change.removed == 1);
+    assert(change.added == 1);
+    assert(r.count == 1);
+    check_session(s, filename);
+  }
+
+  // opening a comment should re-render everything it encloses
+  {
+    free(lines[80]);
+    lines[80] = strdup("/* int x80 = 80;");
+    assert(lines[80] != NULL);
+    write_file(filename, (const char *const *)lines, N);
+
+    received_t r = {.session = s};
+    vimcat_change_t change;
+    assert(vimcat_session_update(s, &change, receive, &r) == 0);
+    assert(change.first == 81);
+    assert(change.removed == change.added);
+    assert(change.added >= 21 && "comment did not spread");
+    assert(r.count == change.added);
+    check_session(s, filename);
+  }
+
+  // inserting lines, described explicitly, should shift those after them
+  {
+    memmove(&lines[12], &lines[10], (N - 10) * sizeof(lines[0]));
+    lines[10] = strdup("// inserted");
+    lines[11] = strdup("#define INSERTED 1");
+    assert(lines[10] != NULL && lines[11] != NULL);
+    write_file(filename, (const char *const *)lines, N + 2);
+
+    received_t r = {.session = s};
+    vimcat_change_t change;
+    assert(vimcat_session_edit(s, 11, 12, &change, receive, &r) == 0);
+    assert(change.first == 11);
+    assert(change.removed == 0);
+    assert(change.added == 2);
+    assert(vimcat_session_rows(s) == N + 2);
+    check_session(s, filename);
+
+    // undo the insertion, described as a deletion
+    free(lines[10]);
+    free(lines[11]);
+    memmove(&lines[10], &lines[12], (N - 10) * sizeof(lines[0]));
+    lines[N] = lines[N + 1] = NULL;
+    write_file(filename, (const char *const *)lines, N);
+
+    r = (received_t){.session = s};
+    assert(vimcat_session_edit(s, 11, 10, &change, receive, &r) == 0);
+    assert(change.first == 11);
+    assert(change.removed == 2);
+    assert(change.added == 0);
+    assert(vimcat_session_rows(s) == N);
+    check_session(s, filename);
+  }
+
+  // an edit inconsistent with the file’s length should be rejected
+  {
+    vimcat_change_t change;
+    assert(vimcat_session_edit(s, 1, N + 1, &change, NULL, NULL) != 0);
+    check_session(s, filename);
+  }
+
+  vimcat_session_close(&s);
+  assert(s == NULL);
+
+  for (size_t i = 0; i < N; ++i)
+    free(lines[i]);
+
+  return EXIT_SUCCESS;
+}
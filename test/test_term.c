@@ -0,0 +1,254 @@
+// force assertions on
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "term.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// dimensions of the terminal under test
+enum { COLUMNS = 8, ROWS = 3 };
+
+/// interpret some input into a new terminal
+static term_t *interpret(const char *path, const char *input, size_t length,
+                         int *rc) {
+  assert(path != NULL);
+  assert(input != NULL || length == 0);
+  assert(rc != NULL);
+
+  FILE *f = fopen(path, "w");
+  assert(f != NULL);
+  assert(fwrite(input, 1, length, f) == length);
+  assert(fclose(f) == 0);
+
+  term_t *t = NULL;
+  assert(term_new(&t, COLUMNS, ROWS) == 0);
+
+  f = fopen(path, "r");
+  assert(f != NULL);
+  bool framed = false;
+  *rc = term_send(t, fileno(f), &framed);
+  (void)fclose(f);
+
+  return t;
+}
+
+/// interpret some input, returning the resulting screen as a string
+static char *render(const char *path, const char *input, size_t length) {
+  int rc = 0;
+  term_t *t = interpret(path, input, length, &rc);
+
+  char *screen = NULL;
+  size_t screen_size = 0;
+  FILE *s = open_memstream(&screen, &screen_size);
+  assert(s != NULL);
+  fprintf(s, "%d\n", rc);
+  for (size_t y = 1; rc == 0 && y <= ROWS; ++y) {
+    char *line = NULL;
+    assert(term_readline(t, y, &line) == 0);
+    fprintf(s, "%s\n", line);
+  }
+  assert(fclose(s) == 0);
+
+  term_free(&t);
+  return screen;
+}
+
+/// check the lines read from a terminal display as its screen
+///
+/// The lines are positioned on the rows they were read from and interpreted
+/// again, which should reproduce the original screen.
+static void check_reparse(const char *path, const char *input, size_t length,
+                          bool carry) {
+  int rc = 0;
+  term_t *t = interpret(path, input, length, &rc);
+  if (rc != 0) {
+    term_free(&t);
+    return;
+  }
+
+  char *lines = NULL;
+  size_t lines_size = 0;
+  FILE *s = open_memstream(&lines, &lines_size);
+  assert(s != NULL);
+  term_set_carry(t, carry);
+  for (size_t y = 1; y <= ROWS; ++y) {
+    char *line = NULL;
+    assert(term_readline(t, y, &line) == 0);
+    fprintf(s, "\033[%zu;1H%s", y, line);
+  }
+  if (carry) {
+    char *end = NULL;
+    assert(term_readline_end(t, &end) == 0);
+    fputs(end, s);
+  }
+  assert(fclose(s) == 0);
+  term_set_carry(t, false);
+
+  term_t *again = interpret(path, lines, lines_size, &rc);
+  assert(rc == 0);
+
+  for (size_t y = 1; y <= ROWS; ++y) {
+    char *expected = NULL;
+    assert(term_readline(t, y, &expected) == 0);
+    expected = strdup(expected);
+    assert(expected != NULL);
+    char *actual = NULL;
+    assert(term_readline(again, y, &actual) == 0);
+    if (strcmp(expected, actual) != 0) {
+      fprintf(stderr, "input %.*s\nrow %zu displayed as:\n%s\nnot:\n%s\n",
+              (int)length, input, y, actual, expected);
+      abort();
+    }
+    free(expected);
+  }
+
+  term_free(&again);
+  free(lines);
+  term_free(&t);
+}
+
+/// check the given input produces the given screen
+static void check(const char *path, const char *input, const char *expected) {
+  char *screen = render(path, input, strlen(input));
+  if (strcmp(screen, expected) != 0) {
+    fprintf(stderr, "input %s\nexpected:\n%s\nactual:\n%s\n", input, expected,
+            screen);
+    abort();
+  }
+  free(screen);
+}
+
+/// check the first row of the screen some input produces, read at a given width
+static void check_width(const char *path, const char *input, size_t width,
+                        const char *expected) {
+  int rc = 0;
+  term_t *t = interpret(path, input, strlen(input), &rc);
+  assert(rc == 0);
+
+  term_set_width(t, width);
+  char *line = NULL;
+  assert(term_readline(t, 1, &line) == 0);
+  if (strcmp(line, expected) != 0) {
+    fprintf(stderr, "input %s at width %zu\nexpected:\n%s\nactual:\n%s\n",
+            input, width, expected, line);
+    abort();
+  }
+
+  term_free(&t);
+}
+
+int main(void) {
+
+  // find temporary storage space
+  const char *TMPDIR = getenv("TMPDIR");
+  if (TMPDIR == NULL || access(TMPDIR, R_OK | W_OK | X_OK) != 0)
+    TMPDIR = "/tmp";
+
+  char path[4096];
+  (void)snprintf(path, sizeof(path), "%s/test_term.XXXXXX", TMPDIR);
+  {
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    (void)close(fd);
+  }
+
+  static const term_impl_t IMPLS[] = {TERM_AUTO, TERM_SCALAR, TERM_SSE2,
+                                      TERM_AVX2};
+
+  // fragments of input to compose random cases from
+  static const char *const FRAGMENTS[] = {
+      "a",         "xyz",          "0123456789abcdefghij", "\n",
+      "\r",        "\r\n",         "\t",                   "\033[",
+      "m",         "H",            ";",                    "1",
+      "38",        "5",            "J",                    "C",
+      "\033[0m",   "\033[1;31m",   "\033[38;5;196m",       "\033[2;3H",
+      "\033[?25l", "\xc3\xa9",     "\xe2\x88\x91",         "\xe2",
+      "\x80",      "\xff",         "\xf0\x9f\x98\x80",     "\033]0;t\a",
+  };
+
+  char *reference[500] = {0};
+
+  for (size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); ++i) {
+
+    if (!term_use(IMPLS[i])) {
+      printf("skipping unsupported implementation %d\n", (int)IMPLS[i]);
+      continue;
+    }
+
+    // some hand-written edge cases
+    check(path, "", "0\n\n\n\n");
+    check(path, "abc", "0\nabc\n\n\n");
+    check(path, "abc\r\ndef", "0\nabc\ndef\n\n");
+    check(path, "abcdefghij", "0\nabcdefgh\nij\n\n");
+    check(path, "a\rb", "0\na\rb\n\n\n");
+    check(path, "\033[2;7Habcd", "0\n\n      ab\ncd\n");
+    // the cursor sticks in the last cell, so each character overwrites it
+    check(path, "\033[3;7Habcdefghijklmnopqrstuvwxyz",
+          "0\n\n\n      az\n");
+    // only what changes in the style is emitted
+    check(path, "a\033[1mb\033[0mc", "0\na\033[1mb\033[mc\n\n\n");
+    check(path, "\033[31;4ma\033[1mb\033[24mc\033[32md",
+          "0\n\033[31;4ma\033[1mb\033[24mc\033[32md\033[m\n\n\n");
+    check(path, "\033[1;38;5;196;48;5;21ma\033[22mb",
+          "0\n\033[91;104;1ma\033[22mb\033[m\n\n\n");
+    check(path, "\033[1;4;31ma\033[0;32mb",
+          "0\n\033[31;1;4ma\033[0;32mb\033[m\n\n\n");
+    check(path, "\033[38;2;1;2;3ma\033[4;48;2;4;5;6mb",
+          "0\n\033[38;2;1;2;3ma\033[48;2;4;5;6;4mb\033[m\n\n\n");
+    check(path, "caf\xc3\xa9!", "0\ncaf\xc3\xa9!\n\n\n");
+    check(path, "a\xe2" "b", "0\na\xef\xbf\xbd" "b\n\n\n");
+    check(path, "a\xe2\x88", "0\na\xef\xbf\xbd\n\n\n");
+    // overwriting the middle of a row splits its styling
+    check(path, "\033[1mabcdef\033[0m\033[1;3Hx",
+          "0\n\033[1mab\033[mx\033[1mdef\033[m\n\n\n");
+    check(path, "abc\033[1;2H\xc3\xa9", "0\na\xc3\xa9" "c\n\n\n");
+    check(path, "abcdef\033[1;3H\033[1J", "0\n   def\n\n\n");
+    check(path, "abcdef\033[1;3H\033[0J", "0\nab\n\n\n");
+    // lines read at a narrower width are cut short, including trailing spaces
+    check_width(path, "ab\033[1mcd\033[0mef", 0, "ab\033[1mcd\033[mef");
+    check_width(path, "ab\033[1mcd\033[0mef", 3, "ab\033[1mc\033[m");
+    check_width(path, "ab\033[1mcd\033[0mef", 2, "ab");
+    check_width(path, "\033[94m~       ", 4, "\033[94m~   \033[m");
+    check_width(path, "\033[94m~       ", 1, "\033[94m~\033[m");
+    check_width(path, "\033[94m~       ", 20, "\033[94m~       \033[m");
+
+    // random input, each implementation of which should agree with the first
+    srand(42);
+    for (size_t j = 0; j < sizeof(reference) / sizeof(reference[0]); ++j) {
+      char input[800] = {0};
+      size_t length = 0;
+      for (size_t n = (size_t)rand() % 40; n > 0; --n) {
+        const size_t k =
+            (size_t)rand() % (sizeof(FRAGMENTS) / sizeof(FRAGMENTS[0]));
+        const char *fragment = FRAGMENTS[k];
+        memcpy(&input[length], fragment, strlen(fragment));
+        length += strlen(fragment);
+      }
+      char *screen = render(path, input, length);
+      if (IMPLS[i] == TERM_AUTO) {
+        check_reparse(path, input, length, false);
+        check_reparse(path, input, length, true);
+      }
+      if (reference[j] == NULL) {
+        reference[j] = screen;
+      } else {
+        assert(strcmp(screen, reference[j]) == 0);
+        free(screen);
+      }
+    }
+  }
+
+  for (size_t j = 0; j < sizeof(reference) / sizeof(reference[0]); ++j)
+    free(reference[j]);
+
+  (void)unlink(path);
+
+  return 0;
+}
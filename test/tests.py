@@ -6,8 +6,9 @@ import os
 import re
 import shutil
 import subprocess
+import time
 from pathlib import Path
-from typing import Dict, Optional
+from typing import Dict, List, Optional, Tuple
 
 import pytest
 
@@ -29,6 +30,236 @@ def set_home(home: Path) -> Dict[str, str]:
     return env
 
 
+def cache_stats(stderr: str) -> Tuple[int, int]:
+    """
+    extract the cache hits and misses from `vimcat --debug` output
+    """
+    m = re.search(r"\bcache: (\d+) hits, (\d+) misses\b", stderr)
+    assert m is not None, "no cache statistics in debug output"
+    return int(m.group(1)), int(m.group(2))
+
+
+def test_arg_max(tmp_path: Path):
+    """
+    files too many to pass to a single Vim should be divided between several
+    """
+
+    env = set_home(tmp_path)
+
+    sources = []
+    for i in range(100):
+        source = tmp_path / f"{'x' * 200}{i}.c"
+        source.write_text(f"int x{i} = {i};\n", encoding="utf-8")
+        sources.append(str(source))
+
+    expected = subprocess.check_output(["vimcat", "--"] + sources, env=env)
+
+    # pad the environment so vimcat can start, but Vim could not be given every
+    # file as well as vimcat’s own arguments
+    used = sum(len(s) + 1 + 8 for s in sources)
+    used += sum(len(k) + len(v) + 2 + 8 for k, v in env.items())
+    pad = os.sysconf("SC_ARG_MAX") - used - 8192
+    i = 0
+    while pad > 0:
+        n = min(pad, 64 * 1024)
+        env[f"VIMCAT_PAD{i}"] = "y" * n
+        pad -= n + len(f"VIMCAT_PAD{i}") + 2 + 8
+        i += 1
+
+    p = subprocess.run(
+        ["vimcat", "--debug", "--"] + sources, capture_output=True, check=True, env=env
+    )
+
+    assert "dividing them between Vims" in p.stderr.decode(), "files not divided"
+    assert p.stdout == expected, "incorrect output"
+
+
+def test_async(tmp_path: Path):
+    """
+    asynchronous rendering should match synchronous rendering and clean up Vim
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    subprocess.check_call(["test_async", tmp_path / "input.c"], env=env)
+
+
+@pytest.mark.parametrize("content", ("short", "tabs", "tall", "wide"))
+def test_backend(tmp_path: Path, content: str):
+    """
+    the headless backend should produce the same output as the terminal backend
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    sample = tmp_path / "input.c"
+    with open(sample, "wt", encoding="utf-8") as f:
+        if content == "short":
+            f.write('#include <stdio.h>\nint main(void) {\n  printf("hello");\n}\n')
+        elif content == "tabs":
+            f.write("int main(void) {\n\tint\tx = 1;\t// a\tcomment\n}\n")
+        elif content == "tall":
+            for i in range(VIM_LINE_LIMIT + 1):
+                f.write(f"int x{i} = {i}; /* line {i} */\n")
+        else:
+            f.write(f'char *s = "{"x" * 300}"; // {"y" * 300}\n')
+
+    terminal = subprocess.check_output(
+        ["vimcat", "--", sample], universal_newlines=True, env=env
+    )
+    headless = subprocess.check_output(
+        ["vimcat", "--backend=headless", "--", sample],
+        universal_newlines=True,
+        env=env,
+    )
+
+    assert headless == terminal, "headless backend output differs"
+
+
+def test_builder():
+    """
+    strings should be built correctly as their builder grows and is reused
+    """
+    subprocess.check_call(["test_builder"])
+
+
+@pytest.mark.parametrize("n_files", (1, 3))
+def test_cache(tmp_path: Path, n_files: int):
+    """
+    `--cache-dir` should reproduce earlier output without re-rendering
+    """
+
+    env = set_home(tmp_path)
+    cache = tmp_path / "cache"
+    cache.mkdir()
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    samples = []
+    for i in range(n_files):
+        sample = tmp_path / f"input{i}.c"
+        sample.write_text(f"int x = {i};\n// comment {i}\n", encoding="utf-8")
+        samples += [sample]
+
+    def run(*args) -> Tuple[str, Tuple[int, int]]:
+        p = subprocess.run(
+            ["vimcat", "--debug", f"--cache-dir={cache}", "--"] + list(args),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+            check=True,
+            env=env,
+        )
+        return p.stdout, cache_stats(p.stderr)
+
+    expected = subprocess.check_output(
+        ["vimcat", "--"] + samples, universal_newlines=True, env=env
+    )
+
+    # the first run should render everything
+    output, stats = run(*samples)
+    assert output == expected, "incorrect output when filling cache"
+    assert stats == (0, n_files), "unexpected cache hits"
+
+    # the second should render nothing
+    output, stats = run(*samples)
+    assert output == expected, "incorrect output from cache"
+    assert stats == (n_files, 0), "unexpected cache misses"
+
+    # changing a file should only re-render that file
+    samples[-1].write_text("int y;\n", encoding="utf-8")
+    expected = subprocess.check_output(
+        ["vimcat", "--"] + samples, universal_newlines=True, env=env
+    )
+    output, stats = run(*samples)
+    assert output == expected, "stale output from cache"
+    assert stats == (n_files - 1, 1), "modified file was not re-rendered"
+
+
+def test_cache_changed(tmp_path: Path):
+    """
+    a file that changes while being rendered should not be cached
+    """
+
+    env = set_home(tmp_path)
+    cache = tmp_path / "cache"
+    cache.mkdir()
+
+    # write a vimrc that modifies the file as Vim reads it
+    (tmp_path / ".vimrc").write_text(
+        "syntax on\nautocmd BufReadPost *.c call writefile(['int y;'], expand('%'))\n",
+        encoding="utf-8",
+    )
+
+    sample = tmp_path / "input.c"
+    sample.write_text("int x;\n", encoding="utf-8")
+
+    p = subprocess.run(
+        ["vimcat", "--debug", f"--cache-dir={cache}", "--", sample],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        universal_newlines=True,
+        check=True,
+        env=env,
+    )
+    assert "changed while being rendered" in p.stderr, "change was not detected"
+    assert not list(cache.glob("*.render")), "render of changed file was cached"
+
+
+def test_cache_sweep(tmp_path: Path):
+    """
+    the cache should track its size without rescanning, and remove abandoned
+    temporary files when it does scan
+    """
+
+    env = set_home(tmp_path)
+    cache = tmp_path / "cache"
+    cache.mkdir()
+
+    # an old temporary file, as if a writer died, and a recent one
+    stale = cache / f"{'0' * 64}.render.AbC123"
+    stale.write_text("partial", encoding="utf-8")
+    os.utime(stale, (0, 0))
+    fresh = cache / f"{'1' * 64}.render.dEf456"
+    fresh.write_text("partial", encoding="utf-8")
+
+    sample = tmp_path / "input.c"
+
+    def run() -> str:
+        p = subprocess.run(
+            ["vimcat", "--debug", f"--cache-dir={cache}", "--", sample],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+            check=True,
+            env=env,
+        )
+        return p.stderr
+
+    # the first insertion should scan, as the cache’s size is unknown
+    sample.write_text("int x;\n", encoding="utf-8")
+    assert "scanning cache directory" in run(), "unknown size did not cause scan"
+    assert not stale.exists(), "stale temporary file was not removed"
+    assert fresh.exists(), "recent temporary file was removed"
+
+    entries = sum(f.stat().st_size for f in cache.glob("*.render"))
+    assert (cache / "size").read_text(encoding="utf-8") == f"{entries}\n"
+
+    # the second should not
+    sample.write_text("int y;\n", encoding="utf-8")
+    assert "scanning cache directory" not in run(), "cache was rescanned"
+
+    entries = sum(f.stat().st_size for f in cache.glob("*.render"))
+    assert (cache / "size").read_text(encoding="utf-8") == f"{entries}\n"
+
+
 @pytest.mark.parametrize("colour", (None, "always", "auto", "never"))
 @pytest.mark.parametrize("no_color", (False, True))
 @pytest.mark.parametrize("t_Co", (2, 8, 16, 88, 256, 16777216))
@@ -153,6 +384,248 @@ def test_consent(tmp_path: Path, debug: bool):
     assert ret != 0, "vimcat ran successfully without ~/.vimcatrc"
 
 
+def test_ctx(tmp_path: Path):
+    """
+    contexts should render independently and concurrently
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    subprocess.check_call(
+        ["test_ctx", tmp_path / "tall.c", tmp_path / "wide.c"], env=env
+    )
+
+
+def test_extent():
+    """
+    measurement of text dimensions should be consistent across implementations
+    """
+    subprocess.check_call(["test_extent"])
+
+
+@pytest.mark.parametrize("n", (0, 1, 3, 10))
+def test_head(tmp_path: Path, n: int):
+    """
+    `--head` should display a prefix of the file
+    """
+
+    sample = tmp_path / "input.txt"
+    env = set_home(tmp_path)
+
+    sample.write_text("".join(f"line {i}\n" for i in range(5)), encoding="utf-8")
+
+    output = subprocess.check_output(
+        ["vimcat", "--head", str(n), sample], universal_newlines=True, env=env
+    )
+
+    assert output.splitlines() == [f"line {i}" for i in range(min(n, 5))]
+
+
+@pytest.mark.parametrize("backend", ("terminal", "headless"))
+@pytest.mark.parametrize("n_files", (1, 2))
+def test_jobs(tmp_path: Path, n_files: int, backend: str):
+    """
+    dividing a render among several Vims should not change its highlighting
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # A string spanning several of Vim’s screens, containing lines that Python’s
+    # syntax sync takes to be outside any string. A Vim starting partway through
+    # the file would misjudge which lines are within the string.
+    sources = []
+    for n in range(n_files):
+        source = tmp_path / f"input{n}.py"
+        with open(source, "wt", encoding="utf-8") as f:
+            f.write('x = 1\nS = """\n')
+            for i in range(3 * VIM_LINE_LIMIT):
+                f.write(f"def example{i}(x):\n" if i % 100 == 0 else f"{i}\n")
+            f.write('"""\ny = 2\n')
+        sources.append(source)
+
+    outputs = []
+    for jobs in (1, 4):
+        outputs.append(
+            subprocess.check_output(
+                ["vimcat", f"--backend={backend}", f"--jobs={jobs}", "--"]
+                + sources,
+                env=env,
+            )
+        )
+
+    assert outputs[0] == outputs[1], "parallel render differs from serial"
+
+
+def test_jobs_tall(tmp_path: Path):
+    """
+    dividing a file too large to parse within Vim’s default 'redrawtime' should
+    not change its highlighting
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting, leaving all else at defaults
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # A C file taking a Vim that starts on its second half long enough to parse
+    # up to there that, were the time limited, it would give up highlighting.
+    source = tmp_path / "input.c"
+    with open(source, "wt", encoding="utf-8") as f:
+        for i in range(60 * VIM_LINE_LIMIT // 17):
+            f.write(
+                f"/** handle case {i}\n"
+                " *\n"
+                f" * \\param t Terminal {i}\n"
+                " */\n"
+                f"static int process_{i}(term_t *t, size_t index, bool is_default) {{\n"
+                "  assert(t != NULL);\n"
+                f"  if (index > {i} && t->x <= t->columns) {{\n"
+                f'    DEBUG("unexpected %zu in case {i}: %s", index, "text");\n'
+                f"    return EBADMSG; // rejected {i}\n"
+                "  }\n"
+                f"  const size_t offset = (size_t)t->y * 0x{i:x}u + sizeof(row_t);\n"
+                "#ifdef __APPLE__\n"
+                "  t->x = offset >> 3 | 'c';\n"
+                "#endif\n"
+                "  return 0;\n"
+                "}\n"
+                "\n"
+            )
+
+    outputs = []
+    for jobs in (1, 2):
+        outputs.append(
+            subprocess.check_output(["vimcat", f"--jobs={jobs}", source], env=env)
+        )
+
+    assert outputs[0] == outputs[1], "parallel render differs from serial"
+
+
+def test_line_index():
+    """
+    line indices should be accurate and invalidated when their file changes
+    """
+    subprocess.check_call(["test_line_index"])
+
+
+def test_lines(tmp_path: Path):
+    """
+    `--lines` should highlight the requested lines of each file
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup two files, one taller than a Vim screen
+    samples = (tmp_path / "a.c", tmp_path / "b:c.py")
+    with open(samples[0], "wt", encoding="utf-8") as f:
+        for i in range(3 * VIM_LINE_LIMIT):
+            f.write(f"int x{i} = {i}; /* {'x' * (i % 97)} */\n")
+    samples[1].write_text("import os\n\nprint('hello')\n", encoding="utf-8")
+
+    # highlight each in its entirety as a reference
+    reference = [
+        subprocess.check_output(["vimcat", s], env=env, universal_newlines=True)
+        for s in samples
+    ]
+    reference = [r.splitlines() for r in reference]
+
+    # request lines out of order, with duplicates, and interleaving files
+    requests = [
+        (0, 2500),
+        (1, 3),
+        (0, 1),
+        (0, 999),
+        (0, 1000),
+        (1, 1),
+        (0, 1),
+        (0, 2999),
+    ]
+    stdin = "".join(f"{samples[f]}:{n}\n" for f, n in requests)
+    output = subprocess.check_output(
+        ["vimcat", "--lines"], env=env, input=stdin, universal_newlines=True
+    )
+
+    # we should get each line once, grouped by file in order of first appearance
+    expected = []
+    for f in (0, 1):
+        for n in sorted({n for g, n in requests if g == f}):
+            expected += [f"{samples[f]}:{n}:{reference[f][n - 1]}"]
+    assert output.splitlines() == expected
+
+    # a line beyond the end of a file should be rejected
+    p = subprocess.run(
+        ["vimcat", "--lines"],
+        env=env,
+        input=f"{samples[1]}:4\n",
+        stdout=subprocess.PIPE,
+        universal_newlines=True,
+        check=False,
+    )
+    assert p.returncode != 0
+    assert p.stdout == ""
+
+
+@pytest.mark.parametrize("jobs", (1, 3))
+@pytest.mark.parametrize("missing", (False, True))
+def test_multiple_files(tmp_path: Path, missing: bool, jobs: int):
+    """
+    highlighting several files at once should match highlighting each in turn
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # a file taller than Vim’s line limit
+    tall = tmp_path / "tall.c"
+    with open(tall, "wt", encoding="utf-8") as f:
+        for i in range(VIM_LINE_LIMIT + 10):
+            f.write(f"int x{i} = {i}; // line {i}\n")
+
+    # a file wider than the default terminal, and one Vim draws filler lines
+    # after, which should not be padded to the width of the former
+    wide = tmp_path / "wide.txt"
+    wide.write_text("x" * 150 + "\n", encoding="utf-8")
+    dos = tmp_path / "dos.txt"
+    dos.write_bytes(b"dos\r\nlines\r\n")
+
+    root = Path(__file__).parent
+    sources = [wide, dos, root / "test_version_le.c", tall, root / "newline1.txt"]
+    if missing:
+        sources.insert(2, tmp_path / "no-file.txt")
+
+    # highlight each file individually
+    reference = b""
+    for source in sources:
+        p = subprocess.run(
+            ["vimcat", source], capture_output=True, check=False, env=env
+        )
+        reference += p.stdout
+        if p.returncode != 0:
+            break
+
+    # highlight them all at once
+    p = subprocess.run(
+        ["vimcat", "--debug", f"--jobs={jobs}", "--"] + sources,
+        capture_output=True,
+        check=False,
+        env=env,
+    )
+
+    assert (p.returncode != 0) == missing, "incorrect exit status"
+    assert p.stdout == reference, "incorrect multi-file rendering"
+
+
 @pytest.mark.parametrize(
     "case",
     (
@@ -235,12 +708,180 @@ def test_no_vim(tmp_path: Path):
     ), "error message did not mention vim"
 
 
+def test_vim_version_cache(tmp_path: Path):
+    """
+    the result of probing Vim’s version should be kept in the cache directory
+    """
+    env = set_home(tmp_path)
+    cache = tmp_path / "cache"
+    cache.mkdir()
+
+    sample = tmp_path / "input.c"
+    sample.write_text("int x;\n", encoding="utf-8")
+
+    def run() -> str:
+        p = subprocess.run(
+            ["vimcat", "--debug", f"--cache-dir={cache}", "--", sample],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+            check=True,
+            env=env,
+        )
+        return p.stderr
+
+    # the first run should need to ask Vim
+    debug = run()
+    assert "saved version of" in debug, "Vim’s version was not saved"
+
+    # the second should not, even though a changed file needs re-rendering
+    sample.write_text("int y;\n", encoding="utf-8")
+    debug = run()
+    assert "loaded version of" in debug, "Vim’s version was not reused"
+    assert "saved version of" not in debug, "Vim’s version was probed again"
+
+
+def test_vim_echoraw_cache(tmp_path: Path):
+    """
+    a Vim found to lack `echoraw` should not be asked to run a session again
+    """
+    env = set_home(tmp_path)
+    cache = tmp_path / "cache"
+    cache.mkdir()
+
+    # a Vim that reports a recent version, but fails the check for `echoraw`
+    vim = shutil.which("vim")
+    assert vim is not None
+    bin = tmp_path / "bin"
+    bin.mkdir()
+    (bin / "vim").write_text(
+        "#!/bin/sh\n"
+        "for a; do\n"
+        "  shift\n"
+        "  case \"$a\" in\n"
+        "    \"+if !exists('*echoraw')\"*) set -- \"$@\" +cquit ;;\n"
+        "    *) set -- \"$@\" \"$a\" ;;\n"
+        "  esac\n"
+        "done\n"
+        f"exec {vim} \"$@\"\n",
+        encoding="utf-8",
+    )
+    (bin / "vim").chmod(0o755)
+    real = env.copy()
+    env["PATH"] = f"{bin}:{env['PATH']}"
+
+    sample = tmp_path / "input.c"
+    sample.write_text("int x;\n", encoding="utf-8")
+
+    def run() -> str:
+        expected = subprocess.check_output(
+            ["vimcat", "--", sample], universal_newlines=True, env=real
+        )
+        p = subprocess.run(
+            ["vimcat", "--debug", f"--cache-dir={cache}", "--", sample],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+            check=True,
+            env=env,
+        )
+        assert p.stdout == expected, "incorrect output from fallback"
+        return p.stderr
+
+    # the first run should learn `echoraw` is missing from the session failing
+    debug = run()
+    assert "no frames received" in debug, "Vim did not fail the session"
+    assert "lacks echoraw" in debug, "missing echoraw was not noted"
+
+    # the second should not try a session, even though the render is not cached
+    sample.write_text("int x;\n\n", encoding="utf-8")
+    debug = run()
+    assert "no frames received" not in debug, "missing echoraw was not saved"
+    assert "using a Vim per window" in debug, "Vim was not run per window"
+
+
 VIM_LINE_LIMIT = 1000
 """
 maximum number of terminal lines Vim will render
 """
 
 
+@pytest.mark.parametrize(
+    "spec",
+    ("1:1", "2:4", "1200:1260", "998:1002", "2999:3005", "5:", "3001:", "4000:4010"),
+)
+def test_range(tmp_path: Path, spec: str):
+    """
+    `--range` should display the same lines as the corresponding slice of the file
+    """
+
+    sample = tmp_path / "input.c"
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup a file taller than a Vim screen, with lines of varying widths
+    with open(sample, "wt", encoding="utf-8") as f:
+        for i in range(3 * VIM_LINE_LIMIT + 1):
+            f.write(f"int x{i} = {i}; /* {'x' * (i % 97)} */\n")
+
+    reference = subprocess.check_output(
+        ["vimcat", sample], universal_newlines=True, env=env
+    ).splitlines()
+
+    output = subprocess.check_output(
+        ["vimcat", "--range", spec, sample], universal_newlines=True, env=env
+    )
+
+    first, last = spec.split(":")
+    expected = reference[int(first) - 1 : int(last) if last else None]
+    assert output.splitlines() == expected
+
+
+def test_session(tmp_path: Path):
+    """
+    incrementally re-highlighting an edited file should match highlighting it
+    afresh
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    subprocess.check_call(["test_session", tmp_path / "input.c"], env=env)
+
+
+@pytest.mark.parametrize("args", ([], ["-"], ["--head", "1500", "-"]))
+def test_stdin(tmp_path: Path, args: List[str]):
+    """
+    input from stdin should be highlighted as the same content in a file would
+    """
+
+    sample = tmp_path / "input"
+    env = set_home(tmp_path)
+
+    # setup a file taller than a Vim screen
+    with open(sample, "wt", encoding="utf-8") as f:
+        for i in range(2 * VIM_LINE_LIMIT + 1):
+            f.write(f"line {i}\n")
+
+    reference = subprocess.check_output(
+        ["vimcat", sample], universal_newlines=True, env=env
+    )
+    if "--head" in args:
+        reference = "".join(reference.splitlines(keepends=True)[:1500])
+
+    # pipe the same content in
+    with open(sample, "rb") as f:
+        output = subprocess.check_output(
+            ["vimcat", "--debug"] + args, stdin=f, universal_newlines=True, env=env
+        )
+
+    assert output == reference, "incorrect stdin rendering"
+
+
 @pytest.mark.parametrize(
     "height",
     list(range(VIM_LINE_LIMIT - 2, VIM_LINE_LIMIT + 3))
@@ -272,6 +913,208 @@ def test_tall(tmp_path: Path, height: int):
     assert i == height, "incorrect total number of lines"
 
 
+def test_term():
+    """
+    terminal emulation should be consistent across implementations
+    """
+    subprocess.check_call(["test_term"])
+
+
+def test_timeout(tmp_path: Path):
+    """
+    `--timeout` should show files Vim is too slow on without highlighting
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting and stall on some files
+    (tmp_path / ".vimrc").write_text(
+        "syntax on\nset t_Co=256\nautocmd BufRead *.slow sleep 30\n",
+        encoding="utf-8",
+    )
+
+    fast = tmp_path / "input.c"
+    fast.write_text("int x;\n", encoding="utf-8")
+    slow = tmp_path / "input.slow"
+    slow.write_text("int y;\nint z;\n", encoding="utf-8")
+
+    expected = subprocess.check_output(
+        ["vimcat", "--", fast], universal_newlines=True, env=env
+    )
+
+    start = time.monotonic()
+    p = subprocess.run(
+        ["vimcat", "--timeout=500", "--", fast, slow],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        universal_newlines=True,
+        check=True,
+        env=env,
+        timeout=20,
+    )
+    assert time.monotonic() - start < 10, "Vim was waited on beyond the timeout"
+
+    assert p.stdout == expected + "int y;\nint z;\n", "incorrect output"
+    assert "timed out" in p.stderr, "no warning of unhighlighted output"
+    assert str(slow) in p.stderr, "warning did not name the file"
+
+
+@pytest.mark.parametrize(
+    "content",
+    (
+        "a\tb\n\tc\nxyz\td\n",
+        "héllo\tworld\n",
+        "dos\r\nlines\r\n",
+        "mixed\r\nlines\n",
+        "control\x01\tcharacters\x7f\n",
+    ),
+)
+def test_timeout_plain(tmp_path: Path, content: str):
+    """
+    lines shown without highlighting should otherwise appear as Vim shows them
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc that stalls on some files
+    (tmp_path / ".vimrc").write_text(
+        "autocmd BufRead *.slow sleep 30\n", encoding="utf-8"
+    )
+
+    fast = tmp_path / "input.txt"
+    fast.write_bytes(content.encode("utf-8"))
+    slow = tmp_path / "input.slow"
+    slow.write_bytes(content.encode("utf-8"))
+
+    expected = subprocess.check_output(["vimcat", "--", fast], env=env)
+
+    p = subprocess.run(
+        ["vimcat", "--timeout=500", "--", slow],
+        capture_output=True,
+        check=True,
+        env=env,
+        timeout=20,
+    )
+
+    # compare the text of each line, ignoring how Vim styled control characters
+    def text(output: bytes) -> List[bytes]:
+        lines = re.sub(rb"\033\[[0-9;]*m", b"", output).split(b"\n")
+        return lines[: content.count("\n")]
+
+    assert text(p.stdout) == text(expected), "incorrect output"
+
+
+@pytest.mark.parametrize("height", (1, VIM_LINE_LIMIT - 1, 3 * VIM_LINE_LIMIT + 7))
+def test_read_parallel(tmp_path: Path, height: int):
+    """
+    parallel highlighting API should produce the same output as serial
+    """
+
+    sample = tmp_path / "input.c"
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup a file with many lines
+    with open(sample, "wt", encoding="utf-8") as f:
+        for i in range(height):
+            f.write(f"int x{i} = {i}; // line {i}\n")
+
+    subprocess.check_call(["test_read_parallel", sample], env=env)
+
+
+def test_read_files_parallel(tmp_path: Path):
+    """
+    highlighting several files with several Vims should match doing so with one
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    subprocess.check_call(["test_read_files_parallel", tmp_path], env=env)
+
+
+def test_read_buffer(tmp_path: Path):
+    """
+    highlighting from memory or a pipe should match highlighting the file
+    """
+
+    sample = tmp_path / "input.c"
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup a C file whose content alone would be detected as a shell script, so
+    # we can tell if the filetype we pass is honoured
+    with open(sample, "wt", encoding="utf-8") as f:
+        f.write("#!/bin/sh\n")
+        for i in range(VIM_LINE_LIMIT + 10):
+            f.write(f"int x{i} = {i}; // line {i}\n")
+
+    subprocess.check_call(["test_read_buffer", sample, "c"], env=env)
+
+
+def test_read_spans(tmp_path: Path):
+    """
+    highlighting as style spans should match highlighting as ANSI strings
+    """
+
+    sample = tmp_path / "input.c"
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup a file with a mixture of highlighting, spanning multiple screens
+    with open(sample, "wt", encoding="utf-8") as f:
+        f.write("/* a comment\n * spanning\n * lines */\n\n")
+        for i in range(VIM_LINE_LIMIT + 10):
+            f.write(f'int x{i} = {i}; char *s{i} = "héllo"; // line {i}\n')
+
+    subprocess.check_call(["test_read_spans", sample], env=env)
+
+
+def test_read_line(tmp_path: Path):
+    """
+    highlighting a single line should match the same line of the whole file
+    """
+
+    sample = tmp_path / "input.c"
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting
+    (tmp_path / ".vimrc").write_text("syntax on\nset t_Co=256\n", encoding="utf-8")
+
+    # setup a file with lines of varying widths, including a multi-line comment
+    with open(sample, "wt", encoding="utf-8") as f:
+        f.write("/* a comment\n * spanning\n * lines */\n")
+        for i in range(40):
+            f.write(f"int x{i} = {i};{' ' * i * 7}\t// {'x' * i * 3}\n")
+        f.write("\n\tlast();\n")
+
+    subprocess.check_call(["test_read_line", sample], env=env)
+
+
+def test_read_timeout(tmp_path: Path):
+    """
+    a render that runs out of time should fall back to unhighlighted lines
+    """
+
+    env = set_home(tmp_path)
+
+    # write a vimrc to force syntax highlighting and stall on some files
+    (tmp_path / ".vimrc").write_text(
+        "syntax on\nset t_Co=256\nautocmd BufRead *.slow sleep 30\n",
+        encoding="utf-8",
+    )
+
+    subprocess.check_call(["test_read_timeout", tmp_path], env=env)
+
+
 @pytest.mark.parametrize(
     "case",
     (
@@ -306,6 +1149,26 @@ def test_utf8(tmp_path: Path, case: str):
     assert output.strip() == reference, "incorrect UTF-8 decoding"
 
 
+def test_utf8_tall(tmp_path: Path):
+    """
+    UTF-8 on every line of a file spanning many screens should not exhaust memory
+    """
+
+    env = set_home(tmp_path)
+
+    # each screen reuses the terminal’s rows, which should not grow each time
+    # they are cleared and refilled with multi-byte characters
+    height = 20 * VIM_LINE_LIMIT
+    sample = tmp_path / "input.txt"
+    sample.write_text("".join(f"é line {i}\n" for i in range(height)), encoding="utf-8")
+
+    output = subprocess.check_output(
+        ["vimcat", sample], universal_newlines=True, env=env
+    )
+
+    assert output.splitlines() == [f"é line {i}" for i in range(height)]
+
+
 def test_version_le():
     """
     version comparison API should behave as expected
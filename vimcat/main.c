@@ -43,6 +43,211 @@ static int print(void *ignored, char *line) {
   return 0;
 }
 
+static int print_file(void *ignored, size_t index, char *line) {
+  (void)index;
+  return print(ignored, line);
+}
+
+static int print_numbered(void *filename, unsigned long lineno, char *line) {
+  if (printf("%s:%lu:", (const char *)filename, lineno) < 0)
+    return errno;
+  return print(NULL, line);
+}
+
+static int print_counted(void *count, char *line) {
+  ++*(unsigned long *)count;
+  return print(NULL, line);
+}
+
+/** highlight a file within `--timeout`, warning if any lines were not
+ *
+ * \return 0 on success or an errno on failure
+ */
+static int print_timeout(const char *filename, unsigned long first,
+                         unsigned long last, unsigned long timeout) {
+  unsigned long count = 0;
+  unsigned long highlighted = 0;
+  const int rc = vimcat_read_timeout(filename, first, last, timeout,
+                                     print_counted, &count, &highlighted);
+  if (rc == 0 && highlighted < count)
+    fprintf(stderr, "%s: timed out; lines from %lu are not highlighted\n",
+            filename, first + highlighted);
+  return rc;
+}
+
+/// lines of stdin to display, for `--range` and `--head`
+typedef struct {
+  unsigned long lineno; ///< number of the next line to be received
+  unsigned long first;
+  unsigned long last; ///< last line to display, or 0 for the end of input
+} slice_t;
+
+/// a callback return value to stop highlighting once we are past a range
+enum { PAST_RANGE = -1 };
+
+static int print_slice(void *state, char *line) {
+  slice_t *s = state;
+
+  const unsigned long lineno = s->lineno++;
+  if (lineno < s->first)
+    return 0;
+  if (s->last != 0 && lineno > s->last)
+    return PAST_RANGE;
+  return print(NULL, line);
+}
+
+/// is this file operand a request to read stdin?
+static bool is_stdin(const char *filename) {
+  return strcmp(filename, "-") == 0;
+}
+
+static void print_cache_stats(void) {
+  unsigned long hits = 0;
+  unsigned long misses = 0;
+  vimcat_cache_stats(&hits, &misses);
+  fprintf(stderr, "[VIMCAT] cache: %lu hits, %lu misses\n", hits, misses);
+}
+
+/// a request to highlight a line, read from stdin
+typedef struct {
+  char *filename;
+  unsigned long lineno;
+  size_t seq; ///< position in the input
+} request_t;
+
+/// the requests for a single file
+typedef struct {
+  size_t start; ///< index of the first request for this file
+  size_t count; ///< number of requests for this file
+} group_t;
+
+static request_t *requests;
+
+static int cmp_request(const void *a, const void *b) {
+  const request_t *x = a;
+  const request_t *y = b;
+  const int c = strcmp(x->filename, y->filename);
+  if (c != 0)
+    return c;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int cmp_group(const void *a, const void *b) {
+  const group_t *x = a;
+  const group_t *y = b;
+  const size_t sx = requests[x->start].seq;
+  const size_t sy = requests[y->start].seq;
+  return sx < sy ? -1 : sx > sy;
+}
+
+/** highlight lines named by “FILE:LINE” entries on stdin
+ *
+ * Lines are grouped by file, with files in the order they first appear in the
+ * input, so each file only needs to be rendered once.
+ *
+ * \return An exit status
+ */
+static int highlight_lines(void) {
+
+  int rc = EXIT_SUCCESS;
+  size_t n_requests = 0;
+  group_t *groups = NULL;
+  size_t n_groups = 0;
+  unsigned long *linenos = NULL;
+  char *entry = NULL;
+  size_t entry_size = 0;
+
+  for (ssize_t len; (len = getline(&entry, &entry_size, stdin)) >= 0;) {
+
+    // strip the line ending
+    while (len > 0 && (entry[len - 1] == '\n' || entry[len - 1] == '\r'))
+      entry[--len] = '\0';
+    if (len == 0)
+      continue;
+
+    // split at the last ':', as the filename may itself contain ':'
+    char *colon = strrchr(entry, ':');
+    char *end = NULL;
+    unsigned long lineno = 0;
+    if (colon != NULL && colon != entry && colon[1] != '\0') {
+      errno = 0;
+      lineno = strtoul(colon + 1, &end, 10);
+      if (errno != 0 || *end != '\0' || colon[1] == '-')
+        lineno = 0;
+    }
+    if (lineno == 0) {
+      fprintf(stderr, "invalid input '%s'; expected FILE:LINE\n", entry);
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+    *colon = '\0';
+
+    request_t *r = realloc(requests, sizeof(requests[0]) * (n_requests + 1));
+    if (r == NULL) {
+      fprintf(stderr, "out of memory\n");
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+    requests = r;
+    requests[n_requests] = (request_t){
+        .filename = strdup(entry), .lineno = lineno, .seq = n_requests};
+    if (requests[n_requests].filename == NULL) {
+      fprintf(stderr, "out of memory\n");
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+    ++n_requests;
+  }
+
+  if (n_requests == 0)
+    goto done;
+
+  // group requests by file and then order the groups by first appearance
+  qsort(requests, n_requests, sizeof(requests[0]), cmp_request);
+  groups = calloc(n_requests, sizeof(groups[0]));
+  linenos = calloc(n_requests, sizeof(linenos[0]));
+  if (groups == NULL || linenos == NULL) {
+    fprintf(stderr, "out of memory\n");
+    rc = EXIT_FAILURE;
+    goto done;
+  }
+  for (size_t i = 0; i < n_requests; ++i) {
+    if (n_groups > 0 &&
+        strcmp(requests[groups[n_groups - 1].start].filename,
+               requests[i].filename) == 0) {
+      ++groups[n_groups - 1].count;
+      continue;
+    }
+    groups[n_groups++] = (group_t){.start = i, .count = 1};
+  }
+  qsort(groups, n_groups, sizeof(groups[0]), cmp_group);
+
+  for (size_t i = 0; i < n_groups; ++i) {
+    char *filename = requests[groups[i].start].filename;
+    for (size_t j = 0; j < groups[i].count; ++j)
+      linenos[j] = requests[groups[i].start + j].lineno;
+
+    int r = vimcat_read_lines(filename, linenos, groups[i].count,
+                              print_numbered, filename);
+    if (r != 0) {
+      fprintf(stderr, "failed: %s\n", strerror(r));
+      rc = EXIT_FAILURE;
+      goto done;
+    }
+  }
+
+done:
+  free(entry);
+  free(linenos);
+  free(groups);
+  for (size_t i = 0; i < n_requests; ++i)
+    free(requests[i].filename);
+  free(requests);
+  requests = NULL;
+
+  return rc;
+}
+
 /// scary text to be shown to users on first run
 static const char RIOT_ACT[] =
     "${HOME}/.vimcatrc not found; aborting\n"
@@ -83,25 +288,58 @@ static void check_consent(void) {
 int main(int argc, char **argv) {
 
   bool debug = false;
+  bool lines = false;
+  const char *cache_dir = NULL;
+  size_t jobs = 1;
+
+  // milliseconds to allow Vim per file, with 0 meaning no limit
+  unsigned long timeout = 0;
+
+  // range of lines to display, with `last` 0 meaning the end of the file
+  bool ranged = false;
+  unsigned long first = 1;
+  unsigned long last = 0;
 
   while (true) {
     static const struct option opts[] = {
+        {"backend", required_argument, 0, 'b'},
+        {"cache-dir", required_argument, 0, 'C'},
         {"color", required_argument, 0, 'c'},
         {"colour", required_argument, 0, 'c'},
         {"debug", no_argument, 0, 'd'},
+        {"head", required_argument, 0, 'n'},
         {"help", no_argument, 0, 'h'},
+        {"jobs", required_argument, 0, 'j'},
+        {"lines", no_argument, 0, 'l'},
+        {"range", required_argument, 0, 'r'},
+        {"timeout", required_argument, 0, 't'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0},
     };
 
     int index = 0;
-    int c = getopt_long(argc, argv, "c:dhv", opts, &index);
+    int c = getopt_long(argc, argv, "c:dhj:ln:r:v", opts, &index);
 
     if (c == -1)
       break;
 
     switch (c) {
 
+    case 'b': // --backend
+      if (strcmp(optarg, "terminal") == 0) {
+        (void)vimcat_set_backend(VIMCAT_BACKEND_TERMINAL);
+      } else if (strcmp(optarg, "headless") == 0) {
+        (void)vimcat_set_backend(VIMCAT_BACKEND_HEADLESS);
+      } else {
+        fprintf(stderr, "unrecognised option '%s' to --backend\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'C': // --cache-dir
+      cache_dir = optarg;
+      break;
+
     case 'c': // --colour
       if (strcmp(optarg, "always") == 0) {
         colour = ALWAYS;
@@ -123,6 +361,73 @@ int main(int argc, char **argv) {
       help();
       return EXIT_SUCCESS;
 
+    case 'j': { // --jobs
+      char *end = NULL;
+      errno = 0;
+      const unsigned long n = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || optarg[0] == '-') {
+        fprintf(stderr, "invalid argument '%s' to --jobs\n", optarg);
+        return EXIT_FAILURE;
+      }
+      jobs = (size_t)n;
+      break;
+    }
+
+    case 'l': // --lines
+      lines = true;
+      break;
+
+    case 'n': { // --head
+      char *end = NULL;
+      errno = 0;
+      const unsigned long n = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || optarg[0] == '-') {
+        fprintf(stderr, "invalid argument '%s' to --head\n", optarg);
+        return EXIT_FAILURE;
+      }
+      // there is nothing to display for `--head 0`
+      if (n == 0)
+        return EXIT_SUCCESS;
+      ranged = true;
+      first = 1;
+      last = n;
+      break;
+    }
+
+    case 'r': { // --range
+      char *end = NULL;
+      errno = 0;
+      first = strtoul(optarg, &end, 10);
+      if (errno == 0 && end != optarg && *end == ':' && optarg[0] != '-') {
+        const char *b = end + 1;
+        last = 0;
+        if (*b != '\0')
+          last = strtoul(b, &end, 10);
+        if (*b == '-' || (*b != '\0' && (end == b || *end != '\0')))
+          first = 0;
+      } else {
+        first = 0;
+      }
+      if (errno != 0 || first == 0 || (last != 0 && last < first)) {
+        fprintf(stderr, "invalid argument '%s' to --range\n", optarg);
+        return EXIT_FAILURE;
+      }
+      ranged = true;
+      break;
+    }
+
+    case 't': { // --timeout
+      char *end = NULL;
+      errno = 0;
+      timeout = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || optarg[0] == '-' ||
+          timeout == 0) {
+        fprintf(stderr, "invalid argument '%s' to --timeout\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    }
+
     case 'v': // --version
       printf("vimcat version %s\n", vimcat_version());
       return EXIT_SUCCESS;
@@ -148,13 +453,99 @@ int main(int argc, char **argv) {
   if (debug)
     vimcat_debug_on();
 
+  if (cache_dir != NULL) {
+    const int rc = vimcat_set_cache_dir(cache_dir, VIMCAT_CACHE_SIZE_DEFAULT);
+    if (rc != 0) {
+      fprintf(stderr, "cannot use cache directory %s: %s\n", cache_dir,
+              strerror(rc));
+      return EXIT_FAILURE;
+    }
+    if (debug)
+      (void)atexit(print_cache_stats);
+  }
+
   if (!vimcat_have_vim()) {
     fprintf(stderr, "vim not found\n");
     return EXIT_FAILURE;
   }
 
-  for (size_t i = optind; i < (size_t)argc; ++i) {
-    int rc = vimcat_read(argv[i], print, NULL);
+  if (lines) {
+    if (ranged) {
+      fprintf(stderr, "--lines cannot be combined with --head or --range\n");
+      return EXIT_FAILURE;
+    }
+    if (optind < argc) {
+      fprintf(stderr, "--lines reads from stdin and takes no files\n");
+      return EXIT_FAILURE;
+    }
+    return highlight_lines();
+  }
+
+  // with no files, read stdin
+  static const char *const STDIN_ONLY[] = {"-"};
+  const char *const *files = (const char *const *)&argv[optind];
+  size_t n_files = (size_t)(argc - optind);
+  if (n_files == 0) {
+    files = STDIN_ONLY;
+    n_files = 1;
+  }
+
+  if (ranged) {
+    for (size_t i = 0; i < n_files; ++i) {
+      int rc;
+      if (is_stdin(files[i])) {
+        // stdin cannot be measured without reading it all, so highlight it in
+        // its entirety and print only the requested lines
+        slice_t slice = {.lineno = 1, .first = first, .last = last};
+        rc = vimcat_read_stdin(print_slice, &slice);
+        if (rc == PAST_RANGE)
+          rc = 0;
+      } else if (timeout != 0) {
+        rc = print_timeout(files[i], first, last, timeout);
+      } else {
+        rc = vimcat_read_range(files[i], first, last, print, NULL);
+      }
+      // like `sed`, treat a range beginning past the end of a file as empty
+      if (rc == ERANGE)
+        continue;
+      if (rc != 0) {
+        fprintf(stderr, "failed: %s\n", strerror(rc));
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  bool any_stdin = false;
+  for (size_t i = 0; i < n_files; ++i)
+    any_stdin |= is_stdin(files[i]);
+
+  // If we have multiple files, render them all with a single Vim instance, or
+  // divide them among several. Stop at the first failure either way, so the
+  // output does not depend on the number of jobs. A timeout applies to each
+  // file, so they need rendering individually.
+  if (n_files > 1 && !any_stdin && timeout == 0) {
+    int rc = jobs == 1 ? vimcat_read_files(files, n_files, print_file, NULL)
+                       : vimcat_read_files_parallel(files, n_files, jobs,
+                                                    print_file, NULL, NULL);
+    if (rc != 0) {
+      fprintf(stderr, "failed: %s\n", strerror(rc));
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  for (size_t i = 0; i < n_files; ++i) {
+    int rc;
+    if (is_stdin(files[i])) {
+      rc = vimcat_read_stdin(print, NULL);
+    } else if (timeout != 0) {
+      rc = print_timeout(files[i], 1, 0, timeout);
+    } else if (jobs == 1) {
+      rc = vimcat_read(files[i], print, NULL);
+    } else {
+      rc = vimcat_read_parallel(files[i], jobs, print, NULL);
+    }
     if (rc != 0) {
       fprintf(stderr, "failed: %s\n", strerror(rc));
       return EXIT_FAILURE;